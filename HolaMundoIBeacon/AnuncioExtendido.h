@@ -0,0 +1,126 @@
+
+/**
+ * @file AnuncioExtendido.h
+ * @brief Declaración de la clase AnuncioExtendido.
+ *
+ * Un anuncio clásico lleva 31 bytes como mucho, y la carga libre del iBeacon 21. Con los anuncios
+ * extendidos de BLE 5 (ver EmisoraBLE::emitirAnuncioExtendido()) caben hasta 255 bytes, así que un
+ * lote entero de muestras del búfer sale en un solo evento de anuncio en lugar de en una ráfaga de
+ * anuncios clásicos.
+ *
+ * Datos del anuncio:
+ *
+ *   02 01 06 | L ff 4c 00 03 N | N bytes de carga
+ *
+ *  - banderas (el anuncio es conectable, como el clásico);
+ *  - datos de fabricante de Apple, como los de emitirAnuncioIBeaconLibre(), con el tipo 03 en
+ *    lugar del 02 de los iBeacon (un lector de iBeacon los salta) y N, la longitud de la carga;
+ *  - la carga: en Publicador::anunciarLote(), una TramaMediciones de VERSION_BLOQUE_LARGO.
+ */
+
+#ifndef ANUNCIO_EXTENDIDO_H_INCLUIDO
+#define ANUNCIO_EXTENDIDO_H_INCLUIDO
+
+/**
+ * @class AnuncioExtendido
+ * @brief Anuncio extendido con una carga de longitud variable, en doble búfer.
+ *
+ * Como en AnuncioPrecalculado, la carga nueva se escribe en el búfer que la SoftDevice no está
+ * emitiendo y se pasa a él con confirmar(). La cabecera se escribe una vez en preparar(); cada
+ * carga nueva sólo cambia sus dos bytes de longitud.
+ */
+class AnuncioExtendido {
+
+public:
+
+  /// Datos que admite la SoftDevice en un anuncio extendido conectable (no se puede encadenar: va en un solo AUX_ADV_IND).
+  static const uint8_t TAMANYO_MAXIMO = 238;
+
+  /// Banderas, cabecera de los datos de fabricante y prefijo 4c 00 03 N.
+  static const uint8_t TAMANYO_CABECERA = 3 + 2 + 4;
+
+  /// Bytes de carga que caben.
+  static const uint8_t CAPACIDAD_CARGA = TAMANYO_MAXIMO - TAMANYO_CABECERA;
+
+  /// Tipo de los datos de fabricante (tras 4c 00): 02 es iBeacon, 03 una carga de longitud variable.
+  static const uint8_t TIPO_CARGA = 0x03;
+
+private:
+
+  static const uint8_t POS_LONGITUD_AD = 3;
+  static const uint8_t POS_LONGITUD_CARGA = 8;
+
+  uint8_t datos[2][TAMANYO_MAXIMO];
+  uint8_t longitudDatos[2] = { 0, 0 };
+  uint8_t activo = 0;                   ///< Búfer que se entregó la última vez.
+
+public:
+
+  /**
+   * @brief Constructor de la clase AnuncioExtendido (anuncio vacío).
+   */
+  AnuncioExtendido( ) {
+  }
+
+  /**
+   * @brief Escribe la cabecera en los dos búferes, con la carga vacía.
+   *
+   * @param fabricanteID ID del fabricante.
+   */
+  void preparar( uint16_t fabricanteID ) {
+	const uint8_t cabecera[TAMANYO_CABECERA] = {
+	  2, BLE_GAP_AD_TYPE_FLAGS, BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE,
+	  5, BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA, (uint8_t) ( fabricanteID & 0xff ), (uint8_t) ( fabricanteID >> 8 ),
+	  TIPO_CARGA, 0
+	};
+	for( uint8_t b = 0; b < 2; b++ ) {
+	  memcpy( datos[b], cabecera, TAMANYO_CABECERA );
+	  longitudDatos[b] = TAMANYO_CABECERA;
+	}
+	activo = 0;
+  }
+
+  /**
+   * @brief Sitio de la carga en el búfer libre: se escriben ahí hasta CAPACIDAD_CARGA bytes y
+   * después se llama a fijarCarga().
+   */
+  uint8_t * cargaLibre() {
+	return &datos[1 - activo][TAMANYO_CABECERA];
+  }
+
+  /**
+   * @brief Pone la longitud de la carga escrita en cargaLibre().
+   *
+   * Los cambios no se ven hasta llamar a confirmar().
+   *
+   * @return false si no cabe.
+   */
+  bool fijarCarga( uint8_t tamanyo ) {
+	if( tamanyo > CAPACIDAD_CARGA ) {
+	  return false;
+	}
+	uint8_t * p = datos[1 - activo];
+	p[POS_LONGITUD_AD] = (uint8_t) ( 1 + 4 + tamanyo );
+	p[POS_LONGITUD_CARGA] = tamanyo;
+	longitudDatos[1 - activo] = (uint8_t) ( TAMANYO_CABECERA + tamanyo );
+	return true;
+  }
+
+  /**
+   * @brief Hace visible la carga fijada: el búfer libre pasa a ser el activo.
+   */
+  void confirmar() {
+	activo = 1 - activo;
+  }
+
+  /// Datos de anuncio vigentes.
+  uint8_t * datosAnuncio() { return datos[activo]; }
+  uint8_t longitudAnuncio() const { return longitudDatos[activo]; }
+
+  /// Carga vigente (tras el prefijo) y su longitud.
+  const uint8_t * carga() const { return &datos[activo][TAMANYO_CABECERA]; }
+  uint8_t longitudCarga() const { return datos[activo][POS_LONGITUD_CARGA]; }
+
+};
+
+#endif
@@ -0,0 +1,209 @@
+
+/**
+ * @file AnuncioPrecalculado.h
+ * @brief Declaración de la clase AnuncioPrecalculado.
+ *
+ * Un AnuncioPrecalculado guarda ya codificados los bytes de un anuncio (datos de anuncio y
+ * respuesta al escaneo) para que publicar una medición nueva consista sólo en parchear unos
+ * pocos bytes y entregárselos a la radio, sin reconstruir el anuncio ni pararlo y arrancarlo.
+ */
+
+#ifndef ANUNCIO_PRECALCULADO_H_INCLUIDO
+#define ANUNCIO_PRECALCULADO_H_INCLUIDO
+
+/**
+ * @class AnuncioPrecalculado
+ * @brief Anuncio BLE codificado una vez y actualizado en el sitio.
+ *
+ * Los bytes se guardan por duplicado: mientras la SoftDevice emite desde un búfer, los cambios
+ * se escriben en el otro y después se intercambian de una vez, así que nunca se emite un
+ * anuncio a medio escribir.
+ */
+class AnuncioPrecalculado {
+
+public:
+
+  /// Tamaño máximo de un anuncio BLE clásico.
+  static const uint8_t TAMANYO_MAXIMO = 31;
+
+  /// Bytes de carga libre que caben tras el prefijo 0x4c 0x00 0x02 21.
+  static const uint8_t TAMANYO_CARGA_LIBRE = 21;
+
+private:
+
+  uint8_t datos[2][TAMANYO_MAXIMO];      ///< Datos de anuncio (doble búfer).
+  uint8_t respuesta[2][TAMANYO_MAXIMO];  ///< Respuesta al escaneo (doble búfer).
+  uint8_t longitudDatos = 0;
+  uint8_t longitudRespuesta = 0;
+  uint8_t activo = 0;                    ///< Búfer que se entregó la última vez.
+  bool hayCambios = false;               ///< El búfer libre tiene cambios sin confirmar.
+
+  uint8_t posicionMajor = 0;             ///< Posición del major en los datos (0: no es iBeacon).
+  uint8_t posicionCarga = 0;             ///< Posición de la carga libre (0: no es libre).
+
+  /// Añade una estructura AD (longitud, tipo, datos) al final de un búfer.
+  static uint8_t anyadirEstructura( uint8_t * p, uint8_t usados, uint8_t tipo, const void * dato, uint8_t len ) {
+	if( usados + len + 2 > TAMANYO_MAXIMO ) {
+	  return usados;
+	}
+	p[usados] = len + 1;
+	p[usados + 1] = tipo;
+	memcpy( &p[usados + 2], dato, len );
+	return usados + len + 2;
+  }
+
+  /// Prepara la respuesta al escaneo con el nombre (completo si cabe).
+  void prepararRespuesta( const char * nombre ) {
+	uint8_t len = (uint8_t) strlen( nombre );
+	uint8_t tipo = BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME;
+	if( len > TAMANYO_MAXIMO - 2 ) {
+	  len = TAMANYO_MAXIMO - 2;
+	  tipo = BLE_GAP_AD_TYPE_SHORT_LOCAL_NAME;
+	}
+	longitudRespuesta = anyadirEstructura( respuesta[0], 0, tipo, nombre, len );
+	memcpy( respuesta[1], respuesta[0], longitudRespuesta );
+  }
+
+  /// Búfer libre, con el contenido del activo más los cambios pendientes.
+  uint8_t * siguiente() {
+	uint8_t libre = 1 - activo;
+	if( !hayCambios ) {
+	  memcpy( datos[libre], datos[activo], longitudDatos );
+	  hayCambios = true;
+	}
+	return datos[libre];
+  }
+
+public:
+
+  /**
+   * @brief Constructor de la clase AnuncioPrecalculado (anuncio vacío).
+   */
+  AnuncioPrecalculado( ) {
+  }
+
+  /**
+   * @brief Codifica un anuncio iBeacon completo.
+   *
+   * @param fabricanteID ID del fabricante.
+   * @param beaconUUID UUID del beacon (16 bytes).
+   * @param major Valor major inicial.
+   * @param minor Valor minor inicial.
+   * @param rssi RSSI a 1 m.
+   * @param nombre Nombre de la emisora para la respuesta al escaneo.
+   */
+  void prepararIBeacon( uint16_t fabricanteID, const uint8_t * beaconUUID,
+						uint16_t major, uint16_t minor, int8_t rssi, const char * nombre ) {
+	uint8_t carga[25];
+	carga[0] = (uint8_t) ( fabricanteID & 0xff );
+	carga[1] = (uint8_t) ( fabricanteID >> 8 );
+	carga[2] = 0x02;
+	carga[3] = 0x15;
+	memcpy( &carga[4], beaconUUID, 16 );
+	carga[20] = (uint8_t) ( major >> 8 );
+	carga[21] = (uint8_t) ( major & 0xff );
+	carga[22] = (uint8_t) ( minor >> 8 );
+	carga[23] = (uint8_t) ( minor & 0xff );
+	carga[24] = (uint8_t) rssi;
+
+	uint8_t flags = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+	uint8_t n = anyadirEstructura( datos[0], 0, BLE_GAP_AD_TYPE_FLAGS, &flags, 1 );
+	posicionMajor = n + 2 + 20;
+	posicionCarga = 0;
+	longitudDatos = anyadirEstructura( datos[0], n, BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA, carga, sizeof( carga ) );
+	memcpy( datos[1], datos[0], longitudDatos );
+	activo = 0;
+	hayCambios = false;
+
+	prepararRespuesta( nombre );
+  }
+
+  /**
+   * @brief Codifica un anuncio con carga libre de 21 bytes (el de emitirAnuncioIBeaconLibre()).
+   *
+   * @param carga Datos iniciales de la carga (puede ser nula).
+   * @param tamanyoCarga Tamaño de la carga (se recorta a 21 bytes y se rellena con '-').
+   * @param nombre Nombre de la emisora para la respuesta al escaneo.
+   */
+  void prepararLibre( const uint8_t * carga, uint8_t tamanyoCarga, const char * nombre ) {
+	uint8_t restoPrefijoYCarga[4 + TAMANYO_CARGA_LIBRE] = { 0x4c, 0x00, 0x02, TAMANYO_CARGA_LIBRE };
+	memset( &restoPrefijoYCarga[4], '-', TAMANYO_CARGA_LIBRE );
+	if( carga != nullptr ) {
+	  memcpy( &restoPrefijoYCarga[4], carga, ( tamanyoCarga > TAMANYO_CARGA_LIBRE ? TAMANYO_CARGA_LIBRE : tamanyoCarga ) );
+	}
+
+	uint8_t flags = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+	uint8_t n = anyadirEstructura( datos[0], 0, BLE_GAP_AD_TYPE_FLAGS, &flags, 1 );
+	posicionMajor = 0;
+	posicionCarga = n + 2 + 4;
+	longitudDatos = anyadirEstructura( datos[0], n, BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA,
+									   restoPrefijoYCarga, sizeof( restoPrefijoYCarga ) );
+	memcpy( datos[1], datos[0], longitudDatos );
+	activo = 0;
+	hayCambios = false;
+
+	prepararRespuesta( nombre );
+  }
+
+  /**
+   * @brief Cambia el major y el minor de un anuncio iBeacon.
+   *
+   * Los cambios quedan en el búfer libre y no se ven hasta llamar a confirmar().
+   *
+   * @return false si el anuncio no es un iBeacon.
+   */
+  bool cambiarMajorMinor( uint16_t major, uint16_t minor ) {
+	if( posicionMajor == 0 ) {
+	  return false;
+	}
+	uint8_t * p = siguiente();
+	p[posicionMajor] = (uint8_t) ( major >> 8 );
+	p[posicionMajor + 1] = (uint8_t) ( major & 0xff );
+	p[posicionMajor + 2] = (uint8_t) ( minor >> 8 );
+	p[posicionMajor + 3] = (uint8_t) ( minor & 0xff );
+	return true;
+  }
+
+  /**
+   * @brief Cambia bytes de la carga libre.
+   *
+   * Los cambios quedan en el búfer libre y no se ven hasta llamar a confirmar().
+   *
+   * @param desde Primer byte de la carga a cambiar.
+   * @param carga Bytes nuevos.
+   * @param tamanyo Cuántos bytes (se recorta al final de la carga).
+   * @return false si el anuncio no tiene carga libre.
+   */
+  bool cambiarCarga( uint8_t desde, const uint8_t * carga, uint8_t tamanyo ) {
+	if( posicionCarga == 0 || desde >= TAMANYO_CARGA_LIBRE ) {
+	  return false;
+	}
+	if( desde + tamanyo > TAMANYO_CARGA_LIBRE ) {
+	  tamanyo = TAMANYO_CARGA_LIBRE - desde;
+	}
+	memcpy( &siguiente()[posicionCarga + desde], carga, tamanyo );
+	return true;
+  }
+
+  /**
+   * @brief Hace visibles los cambios: el búfer libre pasa a ser el activo.
+   */
+  void confirmar() {
+	if( !hayCambios ) {
+	  memcpy( datos[1 - activo], datos[activo], longitudDatos );
+	}
+	activo = 1 - activo;
+	hayCambios = false;
+  }
+
+  /// Datos de anuncio vigentes.
+  uint8_t * datosAnuncio() { return datos[activo]; }
+  uint8_t longitudAnuncio() const { return longitudDatos; }
+
+  /// Respuesta al escaneo vigente (la copia que corresponde al búfer de datos activo).
+  uint8_t * datosRespuesta() { return respuesta[activo]; }
+  uint8_t longitudRespuestaEscaneo() const { return longitudRespuesta; }
+
+};
+
+#endif
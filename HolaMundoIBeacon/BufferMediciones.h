@@ -0,0 +1,520 @@
+
+/**
+ * @file BufferMediciones.h
+ * @brief Declaración de las clases CodecMuestras y BufferMediciones.
+ *
+ * BufferMediciones guarda las mediciones con su instante en un búfer circular de bytes de
+ * tamaño fijo, comprimidas con deltas (zig-zag + varint), para poder medir a menudo y transmitir
+ * por lotes. Si nadie escucha durante un rato, las mediciones se acumulan y se envían después;
+ * sólo cuando el búfer se llena se pierden las más antiguas.
+ *
+ * Un bloque (lo que cabe en un anuncio o una notificación) tiene este formato:
+ *
+ *   bloque   := secuencia(uint16, big-endian) edad(varint) registro* [0x00]
+ *   registro := id(uint8, distinto de 0) dt(varint) zigzag(dv)(varint)
+ *
+ *  - edad: milisegundos entre la primera muestra del bloque y el momento de empaquetarlo; el
+ *    receptor la resta de la hora a la que recibe el bloque.
+ *  - dt: milisegundos desde la muestra anterior del bloque (0 en la primera).
+ *  - dv: diferencia con el valor anterior del mismo id en el bloque (con 0 si es el primero).
+ *  - un 0x00 donde iría un id marca el final (relleno).
+ */
+
+#ifndef BUFFER_MEDICIONES_H_INCLUIDO
+#define BUFFER_MEDICIONES_H_INCLUIDO
+
+/**
+ * @class CodecMuestras
+ * @brief Codificación varint / zig-zag y decodificación de bloques (no depende del tamaño del búfer).
+ */
+class CodecMuestras {
+
+public:
+
+  /**
+   * @struct Muestra
+   * @brief Una medición con su número de secuencia y su instante.
+   */
+  struct Muestra {
+	uint32_t secuencia;  ///< Posición de la muestra en la serie (crece de uno en uno).
+	uint32_t instante;   ///< millis() en que se tomó.
+	uint8_t id;          ///< Tipo de medición (ver Publicador::MedicionesID).
+	int16_t valor;       ///< Valor medido.
+  };
+
+  /// Bytes máximos de un registro: id + varint de 32 bits + varint de 17 bits.
+  static const uint8_t TAMANYO_MAXIMO_REGISTRO = 1 + 5 + 3;
+
+  /// Bytes de cabecera de bloque que se reservan: secuencia + edad de hasta 32 bits.
+  static const uint8_t TAMANYO_MAXIMO_CABECERA = 2 + 5;
+
+  static uint32_t zigzag( int32_t v ) {
+	return ( (uint32_t) v << 1 ) ^ (uint32_t) ( v >> 31 );
+  }
+
+  static int32_t deszigzag( uint32_t v ) {
+	return (int32_t) ( v >> 1 ) ^ - (int32_t) ( v & 1 );
+  }
+
+  /**
+   * @brief Escribe un varint (7 bits por byte, el bit alto indica que sigue otro byte).
+   * @return Bytes escritos.
+   */
+  static uint8_t escribirVarint( uint8_t * p, uint32_t v ) {
+	uint8_t n = 0;
+	while( v >= 0x80 ) {
+	  p[n++] = (uint8_t) ( v | 0x80 );
+	  v >>= 7;
+	}
+	p[n++] = (uint8_t) v;
+	return n;
+  }
+
+  /**
+   * @brief Lee un varint.
+   * @return Bytes leídos, o 0 si no cabe en `n` bytes o es demasiado largo.
+   */
+  static uint8_t leerVarint( const uint8_t * p, uint8_t n, uint32_t & v ) {
+	v = 0;
+	for( uint8_t i = 0; i < n && i < 5; i++ ) {
+	  v |= (uint32_t) ( p[i] & 0x7f ) << ( 7 * i );
+	  if( ( p[i] & 0x80 ) == 0 ) {
+		return i + 1;
+	  }
+	}
+	return 0;
+  }
+
+  /**
+   * @brief Codifica un registro.
+   * @return Bytes escritos (como mucho TAMANYO_MAXIMO_REGISTRO).
+   */
+  static uint8_t escribirRegistro( uint8_t * p, uint8_t id, uint32_t dt, int32_t dv ) {
+	uint8_t n = 0;
+	p[n++] = id;
+	n += escribirVarint( &p[n], dt );
+	n += escribirVarint( &p[n], zigzag( dv ) );
+	return n;
+  }
+
+  /**
+   * @brief Decodifica un bloque.
+   *
+   * @param p Bytes del bloque.
+   * @param n Número de bytes.
+   * @param muestras Donde dejar las muestras.
+   * @param max Tamaño de `muestras`.
+   * @param instanteRecepcion Hora del receptor a la que se recibió el bloque (misma unidad: ms).
+   * @return Número de muestras, o -1 si el bloque está mal formado.
+   */
+  static int decodificarBloque( const uint8_t * p, uint8_t n, Muestra * muestras, uint8_t max,
+								uint32_t instanteRecepcion ) {
+	if( n < 3 ) {
+	  return -1;
+	}
+	uint32_t secuencia = ( (uint32_t) p[0] << 8 ) | p[1];
+	uint32_t edad;
+	uint8_t i = 2;
+	uint8_t leidos = leerVarint( &p[i], n - i, edad );
+	if( leidos == 0 ) {
+	  return -1;
+	}
+	i += leidos;
+
+	uint32_t instante = instanteRecepcion - edad;
+	uint8_t ids[8];
+	int32_t ultimos[8];
+	uint8_t numIds = 0;
+	int cuantas = 0;
+
+	while( i < n && p[i] != 0 && cuantas < max ) {
+	  uint8_t id = p[i++];
+	  uint32_t dt, dv;
+	  if( ( leidos = leerVarint( &p[i], n - i, dt ) ) == 0 ) {
+		return -1;
+	  }
+	  i += leidos;
+	  if( ( leidos = leerVarint( &p[i], n - i, dv ) ) == 0 ) {
+		return -1;
+	  }
+	  i += leidos;
+
+	  uint8_t k = 0;
+	  while( k < numIds && ids[k] != id ) {
+		k++;
+	  }
+	  if( k == numIds ) {
+		if( numIds == sizeof( ids ) ) {
+		  return -1;
+		}
+		ids[numIds] = id;
+		ultimos[numIds++] = 0;
+	  }
+	  ultimos[k] += deszigzag( dv );
+	  instante += dt;
+
+	  muestras[cuantas].secuencia = secuencia + cuantas;
+	  muestras[cuantas].instante = instante;
+	  muestras[cuantas].id = id;
+	  muestras[cuantas].valor = (int16_t) ultimos[k];
+	  cuantas++;
+	}
+	return cuantas;
+  }
+
+};
+
+/**
+ * @class BufferMediciones
+ * @brief Búfer circular de muestras comprimidas, sin memoria dinámica.
+ *
+ * Cada muestra se guarda como un registro (id, dt, dv) respecto a la muestra anterior y al valor
+ * anterior del mismo id. Para poder descartar por el principio se guarda también el estado
+ * (instante y últimos valores) justo antes de la muestra más antigua.
+ *
+ * @tparam CAPACIDAD Bytes del búfer circular.
+ * @tparam MAX_IDS Tipos de medición distintos que se pueden guardar.
+ */
+template< uint16_t CAPACIDAD, uint8_t MAX_IDS = 4 >
+class BufferMediciones {
+
+public:
+
+  using Muestra = CodecMuestras::Muestra;
+
+private:
+
+  /**
+   * @brief Estado de la decodificación en un punto del búfer.
+   */
+  struct Estado {
+	uint32_t instante;
+	int16_t valores[MAX_IDS];
+  };
+
+public:
+
+  /**
+   * @struct Cursor
+   * @brief Punto de lectura de copiarBloque() para seguir donde se quedó sin recorrer el búfer
+   * desde la muestra más antigua (ver situar()).
+   */
+  struct Cursor {
+	uint32_t secuencia = 0;  ///< Siguiente muestra que se copiará.
+	uint16_t posicion = 0;   ///< Su primer byte en el búfer circular.
+	Estado estado;           ///< Estado de la decodificación justo antes de ella.
+  };
+
+private:
+
+  uint8_t bytes[CAPACIDAD];
+  uint16_t cola = 0;        ///< Posición del registro más antiguo.
+  uint16_t usados = 0;      ///< Bytes ocupados.
+  uint16_t cuantas = 0;     ///< Muestras guardadas.
+
+  uint8_t ids[MAX_IDS];     ///< Ids vistos, en orden de llegada.
+  uint8_t numIds = 0;
+
+  Estado base;              ///< Estado antes de la muestra más antigua.
+  Estado ultimo;            ///< Estado tras la muestra más reciente.
+  uint32_t secuenciaCola = 0;
+  uint32_t descartadas_ = 0;
+
+  uint8_t leerByte( uint16_t desplazamiento ) const {
+	return bytes[ ( cola + desplazamiento ) % CAPACIDAD ];
+  }
+
+  int8_t indiceId( uint8_t id ) const {
+	for( uint8_t k = 0; k < numIds; k++ ) {
+	  if( ids[k] == id ) {
+		return k;
+	  }
+	}
+	return -1;
+  }
+
+  /**
+   * @brief Decodifica el registro que empieza en `desplazamiento` (desde la cola).
+   * @return Bytes que ocupa.
+   */
+  uint8_t leerRegistro( uint16_t desplazamiento, Estado & estado, Muestra & m ) const {
+	uint8_t r[CodecMuestras::TAMANYO_MAXIMO_REGISTRO];
+	uint8_t n = CodecMuestras::TAMANYO_MAXIMO_REGISTRO;
+	if( n > usados - desplazamiento ) {
+	  n = usados - desplazamiento;
+	}
+	for( uint8_t i = 0; i < n; i++ ) {
+	  r[i] = leerByte( desplazamiento + i );
+	}
+	uint32_t dt = 0, dv = 0;
+	uint8_t i = 1;
+	i += CodecMuestras::leerVarint( &r[i], n - i, dt );
+	i += CodecMuestras::leerVarint( &r[i], n - i, dv );
+
+	int8_t k = indiceId( r[0] );
+	if( k < 0 ) {
+	  k = 0; // no pasa: sólo se guardan registros de ids conocidos
+	}
+	estado.instante += dt;
+	estado.valores[k] = (int16_t) ( estado.valores[k] + CodecMuestras::deszigzag( dv ) );
+	m.id = r[0];
+	m.instante = estado.instante;
+	m.valor = estado.valores[k];
+	return i;
+  }
+
+  /// Quita la muestra más antigua actualizando el estado base.
+  void quitarMasAntigua( Muestra & m ) {
+	m.secuencia = secuenciaCola;
+	uint8_t n = leerRegistro( 0, base, m );
+	cola = ( cola + n ) % CAPACIDAD;
+	usados -= n;
+	cuantas--;
+	secuenciaCola++;
+  }
+
+  /**
+   * @brief Empaqueta muestras en un bloque empezando en `desplazamiento`.
+   * @return Bytes del bloque; `desplazamiento`, `estado` y `empaquetadas` quedan tras la última muestra.
+   */
+  uint8_t empaquetar( uint16_t & desplazamiento, Estado & estado, uint32_t secuencia, uint16_t disponibles,
+					  uint8_t * destino, uint8_t max, uint32_t ahora, uint16_t & empaquetadas ) const {
+	empaquetadas = 0;
+	if( max < CodecMuestras::TAMANYO_MAXIMO_CABECERA || disponibles == 0 ) {
+	  return 0;
+	}
+
+	Estado trasBloque = estado;
+	Muestra m;
+	uint16_t d = desplazamiento;
+	leerRegistro( d, trasBloque, m );
+
+	uint8_t n = 0;
+	destino[n++] = (uint8_t) ( secuencia >> 8 );
+	destino[n++] = (uint8_t) ( secuencia & 0xff );
+	n += CodecMuestras::escribirVarint( &destino[n], ahora - m.instante );
+
+	int16_t valoresBloque[MAX_IDS] = { 0 };
+	uint32_t instanteAnterior = m.instante;
+
+	while( empaquetadas < disponibles ) {
+	  Estado siguiente = estado;
+	  uint8_t ocupa = leerRegistro( d, siguiente, m );
+	  int8_t k = indiceId( m.id );
+
+	  uint8_t r[CodecMuestras::TAMANYO_MAXIMO_REGISTRO];
+	  uint8_t nr = CodecMuestras::escribirRegistro( r, m.id, m.instante - instanteAnterior,
+													(int32_t) m.valor - valoresBloque[k] );
+	  if( n + nr > max ) {
+		break;
+	  }
+	  memcpy( &destino[n], r, nr );
+	  n += nr;
+	  valoresBloque[k] = m.valor;
+	  instanteAnterior = m.instante;
+	  estado = siguiente;
+	  d += ocupa;
+	  empaquetadas++;
+	}
+	if( n < max ) {
+	  destino[n++] = 0;
+	}
+	desplazamiento = d;
+	return n;
+  }
+
+public:
+
+  /**
+   * @brief Constructor de la clase BufferMediciones (búfer vacío).
+   */
+  BufferMediciones( ) {
+	memset( &base, 0, sizeof( base ) );
+	memset( &ultimo, 0, sizeof( ultimo ) );
+  }
+
+  /**
+   * @brief Guarda una muestra. Si no cabe, descarta las más antiguas.
+   *
+   * @param id Tipo de medición (distinto de 0).
+   * @param valor Valor medido.
+   * @param instante millis() de la medición (no decreciente).
+   * @return false si el id no es válido o ya hay MAX_IDS tipos distintos.
+   */
+  bool anyadir( uint8_t id, int16_t valor, uint32_t instante ) {
+	if( id == 0 ) {
+	  return false;
+	}
+	int8_t k = indiceId( id );
+	if( k < 0 ) {
+	  if( numIds >= MAX_IDS ) {
+		return false;
+	  }
+	  k = numIds;
+	  ids[numIds++] = id;
+	  base.valores[k] = 0;
+	  ultimo.valores[k] = 0;
+	}
+
+	if( cuantas == 0 ) {
+	  // sin muestras, la base es el estado tras la última muestra descartada o enviada
+	  base = ultimo;
+	}
+
+	uint8_t r[CodecMuestras::TAMANYO_MAXIMO_REGISTRO];
+	uint8_t n = CodecMuestras::escribirRegistro( r, id, instante - ultimo.instante,
+												 (int32_t) valor - ultimo.valores[k] );
+
+	Muestra descartada;
+	while( CAPACIDAD - usados < n ) {
+	  quitarMasAntigua( descartada );
+	  descartadas_++;
+	}
+
+	for( uint8_t i = 0; i < n; i++ ) {
+	  bytes[ ( cola + usados + i ) % CAPACIDAD ] = r[i];
+	}
+	usados += n;
+	cuantas++;
+	ultimo.instante = instante;
+	ultimo.valores[k] = valor;
+	return true;
+  }
+
+  /**
+   * @brief Saca la muestra más antigua.
+   * @return false si el búfer está vacío.
+   */
+  bool extraer( Muestra & m ) {
+	if( cuantas == 0 ) {
+	  return false;
+	}
+	quitarMasAntigua( m );
+	return true;
+  }
+
+  /**
+   * @brief Saca tantas muestras como quepan en un bloque de `max` bytes (modo volcado).
+   *
+   * @param destino Donde escribir el bloque.
+   * @param max Bytes disponibles (por ejemplo, 19 en un anuncio o MTU - 3 en una notificación).
+   * @param ahora millis() en el momento de empaquetar (para la edad del bloque).
+   * @return Bytes del bloque; 0 si no hay muestras o no cabe ninguna.
+   */
+  uint8_t extraerBloque( uint8_t * destino, uint8_t max, uint32_t ahora ) {
+	uint16_t desplazamiento = 0;
+	uint16_t empaquetadas;
+	Estado estado = base;
+	uint8_t n = empaquetar( desplazamiento, estado, secuenciaCola, cuantas, destino, max, ahora, empaquetadas );
+	cola = ( cola + desplazamiento ) % CAPACIDAD;
+	usados -= desplazamiento;
+	cuantas -= empaquetadas;
+	secuenciaCola += empaquetadas;
+	base = estado;
+	return empaquetadas > 0 ? n : 0;
+  }
+
+  /**
+   * @brief Copia en un bloque las muestras a partir de una secuencia, sin sacarlas.
+   *
+   * @param desde Primera secuencia que se quiere (si ya no está, se empieza por la más antigua).
+   * @param destino Donde escribir el bloque.
+   * @param max Bytes disponibles.
+   * @param ahora millis() en el momento de empaquetar.
+   * @param siguiente Secuencia de la primera muestra que no ha cabido.
+   * @return Bytes del bloque; 0 si no hay muestras desde `desde`.
+   */
+  uint8_t copiarBloque( uint32_t desde, uint8_t * destino, uint8_t max, uint32_t ahora, uint32_t & siguiente ) const {
+	Cursor cursor;
+	situar( cursor, desde );
+	uint8_t n = copiarBloque( cursor, destino, max, ahora );
+	siguiente = cursor.secuencia;
+	return n;
+  }
+
+  /**
+   * @brief Pone un cursor en una secuencia (si ya no está, en la más antigua; si aún no existe,
+   * al final). Recorre el búfer desde el principio: es lo que se ahorran las copias siguientes.
+   */
+  void situar( Cursor & cursor, uint32_t desde ) const {
+	if( (int32_t) ( desde - secuenciaCola ) < 0 ) {
+	  desde = secuenciaCola;
+	}
+	if( (int32_t) ( desde - ( secuenciaCola + cuantas ) ) > 0 ) {
+	  desde = secuenciaCola + cuantas;
+	}
+	cursor.estado = base;
+	uint16_t desplazamiento = 0;
+	Muestra m;
+	for( uint32_t s = secuenciaCola; s != desde; s++ ) {
+	  desplazamiento += leerRegistro( desplazamiento, cursor.estado, m );
+	}
+	cursor.secuencia = desde;
+	cursor.posicion = ( cola + desplazamiento ) % CAPACIDAD;
+  }
+
+  /**
+   * @brief Copia en un bloque las muestras desde un cursor, sin sacarlas, y lo avanza.
+   *
+   * Cada llamada cuesta lo que ocupa el bloque, no lo que hay antes en el búfer. Si las muestras
+   * del cursor se han descartado por falta de sitio, sigue por la más antigua.
+   *
+   * @return Bytes del bloque; 0 si no quedan muestras desde el cursor.
+   */
+  uint8_t copiarBloque( Cursor & cursor, uint8_t * destino, uint8_t max, uint32_t ahora ) const {
+	if( (int32_t) ( cursor.secuencia - secuenciaCola ) < 0 ) {
+	  situar( cursor, secuenciaCola );
+	}
+	if( (int32_t) ( cursor.secuencia - ( secuenciaCola + cuantas ) ) >= 0 ) {
+	  return 0;
+	}
+
+	uint16_t desplazamiento = (uint16_t) ( ( cursor.posicion + CAPACIDAD - cola ) % CAPACIDAD );
+	uint16_t empaquetadas;
+	uint16_t quedan = (uint16_t) ( secuenciaCola + cuantas - cursor.secuencia );
+	uint8_t n = empaquetar( desplazamiento, cursor.estado, cursor.secuencia, quedan, destino, max, ahora, empaquetadas );
+	cursor.secuencia += empaquetadas;
+	cursor.posicion = ( cola + desplazamiento ) % CAPACIDAD;
+	return empaquetadas > 0 ? n : 0;
+  }
+
+  /**
+   * @brief Saca las muestras anteriores al cursor, p. ej. las de un bloque de copiarBloque() que
+   * ya se ha enviado, sin volver a recorrerlas.
+   *
+   * El cursor tiene que estar al día (sin muestras descartadas desde que se movió); si no está en
+   * el búfer, no se saca nada.
+   */
+  void quitarHasta( const Cursor & cursor ) {
+	uint32_t n = cursor.secuencia - secuenciaCola;
+	if( n == 0 || n > cuantas ) {
+	  return;
+	}
+	// con el búfer lleno hasta el último byte, el cursor del final vuelve a estar en la cola
+	usados = n == cuantas ? 0 : (uint16_t) ( usados - ( cursor.posicion + CAPACIDAD - cola ) % CAPACIDAD );
+	cola = cursor.posicion;
+	cuantas -= (uint16_t) n;
+	secuenciaCola = cursor.secuencia;
+	base = cursor.estado;
+  }
+
+  /// Número de muestras guardadas.
+  uint16_t numeroMuestras() const { return cuantas; }
+
+  /// Bytes ocupados por las muestras guardadas.
+  uint16_t bytesUsados() const { return usados; }
+
+  /// Secuencia de la muestra más antigua guardada.
+  uint32_t secuenciaMasAntigua() const { return secuenciaCola; }
+
+  /// Secuencia que llevará la próxima muestra.
+  uint32_t secuenciaSiguiente() const { return secuenciaCola + cuantas; }
+
+  /// Muestras perdidas por falta de sitio.
+  uint32_t descartadas() const { return descartadas_; }
+
+  bool estaVacio() const { return cuantas == 0; }
+
+};
+
+#endif
@@ -0,0 +1,236 @@
+
+/**
+ * @file ColaNotificaciones.h
+ * @brief Declaración de las clases CreditosNotificacion y ColaNotificaciones.
+ *
+ * Notificar registros pequeños de uno en uno gasta una notificación (y un hueco de la cola de la
+ * SoftDevice) por cada pocos bytes, y cuando la cola está llena `notify()` bloquea al llamante.
+ * ColaNotificaciones guarda los registros y los junta en notificaciones de hasta MTU - 3 bytes,
+ * que envía sólo cuando la SoftDevice tiene sitio; si la cola se llena, se lo dice al productor
+ * en lugar de bloquearlo o perder datos sin avisar.
+ */
+
+#ifndef COLA_NOTIFICACIONES_H_INCLUIDO
+#define COLA_NOTIFICACIONES_H_INCLUIDO
+
+/**
+ * @class CreditosNotificacion
+ * @brief Cuenta los huecos libres en la cola de notificaciones de la SoftDevice (créditos).
+ *
+ * Al conectarse hay tantos créditos como notificaciones admite la cola (hvn_qsize de
+ * configPrphConn()); cada notificación gasta uno y el evento BLE_GATTS_EVT_HVN_TX_COMPLETE los
+ * devuelve. Es una sola cuenta para toda la conexión, compartida por todas las colas.
+ *
+ * Sólo es exacta si todas las notificaciones de la conexión salen por una ColaNotificaciones.
+ *
+ * Los créditos libres son la diferencia de dos contadores con un solo escritor cada uno: la tarea
+ * BLE suma los concedidos y loop() los gastados, así que ninguna de las dos pisa a la otra.
+ */
+class CreditosNotificacion {
+
+private:
+
+  struct Estado {
+	uint8_t capacidad = BLE_GATTS_HVN_TX_QUEUE_SIZE_DEFAULT;
+	/// Créditos dados desde el arranque. Sólo los escribe la tarea BLE (procesarEvento()).
+	volatile uint32_t concedidos = 0;
+	/// Créditos gastados desde el arranque. Sólo los escribe loop() (gastar()).
+	volatile uint32_t gastados = 0;
+	volatile uint16_t conexion = BLE_CONN_HANDLE_INVALID;
+  };
+
+  static Estado & estado() {
+	static Estado elEstado;
+	return elEstado;
+  }
+
+public:
+
+  /**
+   * @brief Fija el tamaño de la cola de la SoftDevice (el mismo que se le pasa a configPrphConn()).
+   */
+  static void configurar( uint8_t capacidad ) {
+	estado().capacidad = capacidad;
+  }
+
+  /**
+   * @brief Callback para Bluefruit.setEventCallback(): sigue conexiones y notificaciones enviadas.
+   */
+  static void procesarEvento( ble_evt_t * evento ) {
+	Estado & e = estado();
+	switch( evento->header.evt_id ) {
+	case BLE_GAP_EVT_CONNECTED:
+	  e.concedidos = e.gastados + e.capacidad;
+	  e.conexion = evento->evt.gap_evt.conn_handle;
+	  break;
+	case BLE_GAP_EVT_DISCONNECTED:
+	  if( evento->evt.gap_evt.conn_handle == e.conexion ) {
+		e.conexion = BLE_CONN_HANDLE_INVALID;
+		e.concedidos = e.gastados;
+	  }
+	  break;
+	case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+	  if( evento->evt.gatts_evt.conn_handle == e.conexion ) {
+		// nunca más de capacidad por delante de lo gastado
+		uint32_t tope = e.gastados + e.capacidad;
+		uint32_t n = e.concedidos + evento->evt.gatts_evt.params.hvn_tx_complete.count;
+		e.concedidos = (int32_t) ( n - tope ) > 0 ? tope : n;
+	  }
+	  break;
+	}
+  }
+
+  /// Créditos libres en la conexión `conexion` (0 si no es la conexión actual).
+  static uint8_t disponibles( uint16_t conexion ) {
+	Estado & e = estado();
+	if( conexion != e.conexion ) {
+	  return 0;
+	}
+	// la tarea BLE puede haber leído `gastados` justo antes de un gastar(): entonces va uno por detrás
+	int32_t libres = (int32_t) ( e.concedidos - e.gastados );
+	return (uint8_t) ( libres < 0 ? 0 : ( libres > e.capacidad ? e.capacidad : libres ) );
+  }
+
+  /// Tamaño de la cola de la SoftDevice (créditos al conectarse).
+  static uint8_t capacidad() {
+	return estado().capacidad;
+  }
+
+  /// Gasta un crédito. Sólo desde loop().
+  static void gastar() {
+	if( disponibles( estado().conexion ) > 0 ) {
+	  estado().gastados = estado().gastados + 1;
+	}
+  }
+
+};
+
+/**
+ * @class ColaNotificaciones
+ * @brief Cola de registros de una característica que se notifican juntos.
+ *
+ * Los registros se guardan en un búfer circular, cada uno precedido de su longitud, y nunca se
+ * parten entre dos notificaciones. Para que siempre quepan en una, miden como mucho
+ * TAMANYO_MAXIMO_REGISTRO bytes (lo que deja el MTU mínimo).
+ *
+ * Necesita que la emisora se haya configurado con EmisoraBLE::configurarNotificaciones() y que
+ * la característica admita al menos TAMANYO_MAXIMO_REGISTRO bytes.
+ *
+ * @tparam CAPACIDAD Bytes del búfer (registros más un byte de longitud por registro).
+ */
+template< uint16_t CAPACIDAD >
+class ColaNotificaciones {
+
+public:
+
+  /// Bytes máximos de un registro: los que caben en una notificación con el MTU mínimo.
+  static const uint8_t TAMANYO_MAXIMO_REGISTRO = BLE_GATT_ATT_MTU_DEFAULT - 3;
+
+private:
+
+  ServicioEnEmisora::Caracteristica & laCaracteristica;
+
+  uint8_t bytes[CAPACIDAD];
+  uint16_t cabeza = 0;          ///< Posición del registro más antiguo.
+  uint16_t usados = 0;
+  uint32_t rechazados = 0;      ///< Registros que no cupieron.
+  uint32_t notificaciones = 0;  ///< Notificaciones enviadas.
+
+  uint8_t leerByte( uint16_t desplazamiento ) const {
+	return bytes[ ( cabeza + desplazamiento ) % CAPACIDAD ];
+  }
+
+public:
+
+  /**
+   * @brief Constructor de la clase ColaNotificaciones.
+   *
+   * @param caracteristica Característica por la que se notifica.
+   */
+  ColaNotificaciones( ServicioEnEmisora::Caracteristica & caracteristica )
+	: laCaracteristica( caracteristica ) {
+  }
+
+  /**
+   * @brief Encola un registro.
+   *
+   * @param datos Bytes del registro.
+   * @param tam Número de bytes (de 1 a TAMANYO_MAXIMO_REGISTRO).
+   * @return false si no cabe (contrapresión: el productor decide si lo guarda, lo descarta o
+   * espera a que enviar() haga sitio).
+   */
+  bool encolar( const void * datos, uint8_t tam ) {
+	if( tam == 0 || tam > TAMANYO_MAXIMO_REGISTRO || usados + tam + 1 > CAPACIDAD ) {
+	  rechazados++;
+	  return false;
+	}
+	const uint8_t * p = (const uint8_t *) datos;
+	uint16_t fin = ( cabeza + usados ) % CAPACIDAD;
+	bytes[fin] = tam;
+	for( uint8_t i = 0; i < tam; i++ ) {
+	  bytes[ ( fin + 1 + i ) % CAPACIDAD ] = p[i];
+	}
+	usados += tam + 1;
+	return true;
+  }
+
+  /**
+   * @brief Envía lo que se pueda sin bloquear: tantas notificaciones como créditos haya, cada
+   * una con tantos registros enteros como quepan en MTU - 3 bytes.
+   *
+   * @return Bytes de registros enviados.
+   */
+  uint16_t enviar() {
+	uint16_t conexion = Bluefruit.connHandle();
+	BLEConnection * laConexion = Bluefruit.Connection( conexion );
+	if( laConexion == nullptr ) {
+	  return 0;
+	}
+	uint16_t maximo = laConexion->getMtu() - 3;
+	if( maximo > laCaracteristica.tamanyoMaximoDatos() ) {
+	  maximo = laCaracteristica.tamanyoMaximoDatos();
+	}
+	if( maximo > BLEGATT_ATT_MTU_MAX - 3 ) {
+	  maximo = BLEGATT_ATT_MTU_MAX - 3;
+	}
+
+	uint8_t paquete[BLEGATT_ATT_MTU_MAX - 3];
+	uint16_t enviados = 0;
+
+	while( usados > 0 && CreditosNotificacion::disponibles( conexion ) > 0 ) {
+	  // juntar registros enteros sin sacarlos todavía
+	  uint16_t n = 0;
+	  uint16_t consumidos = 0;
+	  while( consumidos < usados && n + leerByte( consumidos ) <= maximo ) {
+		uint8_t tam = leerByte( consumidos );
+		for( uint8_t i = 0; i < tam; i++ ) {
+		  paquete[n++] = leerByte( consumidos + 1 + i );
+		}
+		consumidos += tam + 1;
+	  }
+	  if( n == 0 || !laCaracteristica.notificarDatos( paquete, n ) ) {
+		break;
+	  }
+	  CreditosNotificacion::gastar();
+	  cabeza = ( cabeza + consumidos ) % CAPACIDAD;
+	  usados -= consumidos;
+	  enviados += n;
+	  notificaciones++;
+	}
+	return enviados;
+  }
+
+  /// Bytes libres (un registro de tam bytes ocupa tam + 1).
+  uint16_t libres() const { return CAPACIDAD - usados; }
+
+  bool estaVacia() const { return usados == 0; }
+
+  /// Registros rechazados por falta de sitio desde que se creó la cola.
+  uint32_t registrosRechazados() const { return rechazados; }
+
+  /// Notificaciones enviadas desde que se creó la cola.
+  uint32_t notificacionesEnviadas() const { return notificaciones; }
+
+};
+
+#endif
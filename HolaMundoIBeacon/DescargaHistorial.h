@@ -0,0 +1,243 @@
+
+/**
+ * @file DescargaHistorial.h
+ * @brief Declaración de la clase DescargaHistorial.
+ *
+ * Descarga por GATT de las muestras guardadas en un BufferMediciones. Un cliente conectado
+ * escribe una orden en la característica de órdenes y la placa le devuelve las muestras por la
+ * característica de datos en ráfaga: tantas notificaciones seguidas como huecos tenga la cola de
+ * la SoftDevice (la ventana), cada una con un bloque de CodecMuestras de hasta MTU - 3 bytes.
+ * Con MTU 247 es una hora de muestras en pocos segundos, frente a los minutos que tarda en salir
+ * por los anuncios a 19 bytes por bloque.
+ *
+ * Órdenes (el primer byte es el código):
+ *  - DESCARGAR (0x01) + secuencia de 32 bits en little-endian: desde esa muestra (si ya no está,
+ *    desde la más antigua);
+ *  - REANUDAR (0x02): sigue una descarga interrumpida desde la última muestra confirmada;
+ *  - DETENER (0x03).
+ *
+ * Al acabar se notifica un bloque sin muestras (3 bytes: la secuencia siguiente y edad 0), que
+ * es también la secuencia con la que pedir más adelante sólo lo nuevo.
+ */
+
+#ifndef DESCARGA_HISTORIAL_H_INCLUIDO
+#define DESCARGA_HISTORIAL_H_INCLUIDO
+
+/**
+ * @class DescargaHistorial
+ * @brief Envía el contenido de un BufferMediciones en notificaciones con control de flujo.
+ *
+ * Las muestras no se sacan del búfer: la descarga lleva un BufferMediciones::Cursor, así que
+ * cada bloque cuesta lo que ocupa y el búfer sigue sirviendo para otras descargas. El cursor
+ * sólo avanza si la notificación entra en la cola de la SoftDevice.
+ *
+ * Una muestra está confirmada cuando la SoftDevice ha terminado de enviar su notificación
+ * (BLE_GATTS_EVT_HVN_TX_COMPLETE, contado por CreditosNotificacion). Si la conexión se corta,
+ * REANUDAR vuelve a la primera muestra sin confirmar: se pueden repetir muestras, pero no se
+ * salta ninguna. La cuenta sólo es exacta si la característica de datos es la única que notifica
+ * en la conexión.
+ *
+ * Las órdenes llegan por un DespachadorOrdenes a descargar(), reanudar() y detener(), como
+ * órdenes INMEDIATA (en el contexto de la pila BLE): sólo anotan la orden, y el trabajo lo hace
+ * enviar(), desde una tarea del Planificador.
+ *
+ * @tparam Buffer Tipo del BufferMediciones.
+ */
+template< typename Buffer >
+class DescargaHistorial {
+
+public:
+
+  /// Códigos de las órdenes.
+  enum Orden : uint8_t {
+	NINGUNA = 0x00,
+	DESCARGAR = 0x01,
+	REANUDAR = 0x02,
+	DETENER = 0x03
+  };
+
+  /// Notificaciones en vuelo que se siguen: la ventana no pasa de aquí aunque haya más créditos.
+  static const uint8_t MAX_EN_VUELO = 32;
+
+private:
+
+  const Buffer & elBuffer;
+  ServicioEnEmisora::Caracteristica & losDatos;
+
+  /// La escriben las órdenes INMEDIATA (pila BLE) y la vacía enviar() (loop()) de una vez, con un intercambio atómico.
+  volatile uint8_t ordenPendiente = NINGUNA;
+  volatile uint32_t desdePendiente = 0;
+
+  typename Buffer::Cursor cursor;
+  bool descargando = false;
+  uint16_t conexion = BLE_CONN_HANDLE_INVALID;
+
+  uint32_t inicioEnVuelo[MAX_EN_VUELO]; ///< Primera secuencia de cada notificación en vuelo.
+  uint8_t primeraEnVuelo = 0;
+  uint8_t numEnVuelo = 0;
+  uint32_t confirmada = 0;              ///< Primera muestra sin confirmar.
+
+  uint32_t notificaciones = 0;
+  uint32_t bytesEnviados = 0;
+  uint32_t muestrasEnviadas = 0;
+
+  /// Da por confirmadas las notificaciones cuyo crédito ha vuelto.
+  void confirmar() {
+	uint8_t ocupados = CreditosNotificacion::capacidad() - CreditosNotificacion::disponibles( conexion );
+	while( numEnVuelo > ocupados ) {
+	  primeraEnVuelo = ( primeraEnVuelo + 1 ) % MAX_EN_VUELO;
+	  numEnVuelo--;
+	}
+	(*this).confirmada = numEnVuelo > 0 ? inicioEnVuelo[primeraEnVuelo] : cursor.secuencia;
+  }
+
+  void empezar( uint32_t desde ) {
+	elBuffer.situar( (*this).cursor, desde );
+	(*this).confirmada = cursor.secuencia;
+	(*this).numEnVuelo = 0;
+	(*this).descargando = true;
+  }
+
+  bool notificar( const uint8_t * datos, uint8_t n ) {
+	if( !losDatos.notificarDatos( datos, n ) ) {
+	  return false;
+	}
+	CreditosNotificacion::gastar();
+	notificaciones++;
+	bytesEnviados += n;
+	return true;
+  }
+
+public:
+
+  /**
+   * @brief Constructor de la clase DescargaHistorial.
+   *
+   * @param buffer Búfer cuyas muestras se descargan.
+   * @param datos Característica (con NOTIFY) por la que salen los bloques.
+   */
+  DescargaHistorial( const Buffer & buffer, ServicioEnEmisora::Caracteristica & datos )
+	: elBuffer( buffer ), losDatos( datos ) {
+  }
+
+  /// Bytes de cada orden, con el código (para darlas de alta en el DespachadorOrdenes).
+  static const uint8_t TAMANYO_DESCARGAR = 5;
+  static const uint8_t TAMANYO_REANUDAR = 1;
+  static const uint8_t TAMANYO_DETENER = 1;
+
+  /**
+   * @brief Anota DESCARGAR + secuencia (manejador de DespachadorOrdenes).
+   */
+  bool descargar( const OrdenEscrita & orden ) {
+	(*this).desdePendiente = orden.u32( 1 );
+	(*this).ordenPendiente = DESCARGAR;
+	return true;
+  }
+
+  /**
+   * @brief Anota REANUDAR (manejador de DespachadorOrdenes).
+   */
+  bool reanudar( const OrdenEscrita & orden ) {
+	(*this).ordenPendiente = REANUDAR;
+	return true;
+  }
+
+  /**
+   * @brief Anota DETENER (manejador de DespachadorOrdenes).
+   */
+  bool detener( const OrdenEscrita & orden ) {
+	(*this).ordenPendiente = DETENER;
+	return true;
+  }
+
+  /**
+   * @brief Atiende la orden pendiente y envía bloques mientras haya créditos.
+   *
+   * No bloquea nunca: sin créditos vuelve enseguida y hay que llamarla otra vez más tarde.
+   * Sin conexión, la descarga se detiene (REANUDAR la sigue).
+   *
+   * @param ahora millis() (para la edad de cada bloque).
+   * @return true si queda algo por hacer (hay que volver a llamarla).
+   */
+  bool enviar( uint32_t ahora ) {
+	// leer y vaciar a la vez: una orden que llegue entre medias no se pierde
+	uint8_t orden = __atomic_exchange_n( &(*this).ordenPendiente, (uint8_t) NINGUNA, __ATOMIC_SEQ_CST );
+	uint16_t conexionActual = Bluefruit.connHandle();
+
+	if( orden == DESCARGAR ) {
+	  (*this).conexion = conexionActual;
+	  empezar( desdePendiente );
+	} else if( orden == REANUDAR ) {
+	  (*this).conexion = conexionActual;
+	  empezar( confirmada );
+	} else if( orden == DETENER ) {
+	  (*this).descargando = false;
+	}
+	if( !descargando ) {
+	  return false;
+	}
+
+	BLEConnection * laConexion = Bluefruit.Connection( conexion );
+	if( laConexion == nullptr ) {
+	  // se ha cortado: se conserva la última confirmada para REANUDAR
+	  (*this).descargando = false;
+	  return false;
+	}
+	confirmar();
+
+	uint16_t maximo = laConexion->getMtu() - 3;
+	if( maximo > losDatos.tamanyoMaximoDatos() ) {
+	  maximo = losDatos.tamanyoMaximoDatos();
+	}
+	if( maximo > BLEGATT_ATT_MTU_MAX - 3 ) {
+	  maximo = BLEGATT_ATT_MTU_MAX - 3;
+	}
+
+	uint8_t bloque[BLEGATT_ATT_MTU_MAX - 3];
+	while( CreditosNotificacion::disponibles( conexion ) > 0 && numEnVuelo < MAX_EN_VUELO ) {
+	  typename Buffer::Cursor siguiente = cursor;
+	  uint8_t n = elBuffer.copiarBloque( siguiente, bloque, (uint8_t) maximo, ahora );
+	  if( n == 0 ) {
+		// fin: bloque vacío con la secuencia siguiente
+		bloque[0] = (uint8_t) ( cursor.secuencia >> 8 );
+		bloque[1] = (uint8_t) ( cursor.secuencia & 0xff );
+		bloque[2] = 0;
+		if( notificar( bloque, 3 ) ) {
+		  (*this).descargando = false;
+		}
+		break;
+	  }
+	  if( !notificar( bloque, n ) ) {
+		break;
+	  }
+	  inicioEnVuelo[ ( primeraEnVuelo + numEnVuelo ) % MAX_EN_VUELO ] = cursor.secuencia;
+	  numEnVuelo++;
+	  muestrasEnviadas += siguiente.secuencia - cursor.secuencia;
+	  (*this).cursor = siguiente;
+	}
+	return descargando;
+  }
+
+  /// Hay una orden escrita que enviar() aún no ha atendido.
+  bool hayOrden() const { return ordenPendiente != NINGUNA; }
+
+  bool estaDescargando() const { return descargando; }
+
+  /// Primera muestra cuya notificación no consta como enviada (desde donde sigue REANUDAR).
+  uint32_t secuenciaConfirmada() const { return confirmada; }
+
+  /// Siguiente muestra que se enviará.
+  uint32_t secuenciaSiguiente() const { return cursor.secuencia; }
+
+  /// Notificaciones enviadas desde que se creó.
+  uint32_t notificacionesEnviadas() const { return notificaciones; }
+
+  /// Bytes notificados desde que se creó.
+  uint32_t bytesNotificados() const { return bytesEnviados; }
+
+  /// Muestras enviadas desde que se creó (con las repetidas al reanudar).
+  uint32_t muestrasNotificadas() const { return muestrasEnviadas; }
+
+};
+
+#endif
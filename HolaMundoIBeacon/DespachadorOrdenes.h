@@ -0,0 +1,285 @@
+/**
+ * @file DespachadorOrdenes.h
+ * @brief Declaración de las clases OrdenEscrita y DespachadorOrdenes.
+ *
+ * Las órdenes que un cliente escribe en una característica llegan al callback de escritura, en el
+ * contexto de la pila BLE, como bytes sueltos. DespachadorOrdenes las reparte por su primer byte
+ * (el código) entre manejadores con su objeto, comprobando la longitud de cada una, y las lee en
+ * el sitio con OrdenEscrita, sin copiarlas.
+ *
+ * Lo que tarda (escribir en la flash, recorrer el historial...) no se puede hacer en el callback:
+ * retrasaría los eventos de conexión y, en la placa, la flash espera a un evento de la SoftDevice
+ * que se atiende en ese mismo contexto. Esas órdenes se dan de alta como DIFERIDA: el callback
+ * sólo las deja en una cola y loop() las ejecuta con ejecutarDiferidas().
+ *
+ * Formato de una orden: `código [argumentos]`, los argumentos en little-endian.
+ */
+
+#ifndef DESPACHADOR_ORDENES_H_INCLUIDO
+#define DESPACHADOR_ORDENES_H_INCLUIDO
+
+/**
+ * @class OrdenEscrita
+ * @brief Vista de una orden escrita: apunta a sus bytes y los lee en el sitio.
+ *
+ * Los bytes son los del callback (orden INMEDIATA) o los de la cola del despachador (DIFERIDA);
+ * la vista sólo vale mientras dura la llamada al manejador. La longitud ya está comprobada con la
+ * del alta de la orden, así que los manejadores leen sus argumentos sin más comprobaciones.
+ */
+class OrdenEscrita {
+
+private:
+
+  const uint8_t * datos;
+  uint8_t tam;
+  uint16_t laConexion;
+
+public:
+
+  OrdenEscrita( uint16_t conexion_, const uint8_t * datos_, uint8_t tam_ )
+	: datos( datos_ ), tam( tam_ ), laConexion( conexion_ ) {
+  }
+
+  /// Código de la orden (primer byte).
+  uint8_t codigo() const { return datos[0]; }
+
+  /// Bytes de la orden, con el código.
+  uint8_t tamanyo() const { return tam; }
+
+  /// Conexión por la que ha llegado.
+  uint16_t conexion() const { return laConexion; }
+
+  /// Byte `i` de la orden (el 0 es el código).
+  uint8_t u8( uint8_t i ) const { return datos[i]; }
+
+  uint16_t u16( uint8_t i ) const {
+	return (uint16_t) ( datos[i] | ( datos[i + 1] << 8 ) );
+  }
+
+  uint32_t u32( uint8_t i ) const {
+	return (uint32_t) datos[i] | ( (uint32_t) datos[i + 1] << 8 ) | ( (uint32_t) datos[i + 2] << 16 )
+	  | ( (uint32_t) datos[i + 3] << 24 );
+  }
+
+  int16_t i16( uint8_t i ) const { return (int16_t) u16( i ); }
+
+};
+
+/**
+ * @class DespachadorOrdenes
+ * @brief Reparte las órdenes escritas en una característica entre sus manejadores.
+ *
+ * Cada orden se da de alta con su código, su longitud mínima y máxima, un método de un objeto
+ * (o una función con contexto) y si se ejecuta en el callback (INMEDIATA: anotar algo, como hace
+ * DescargaHistorial) o en loop() (DIFERIDA). Una orden con código desconocido o una longitud que
+ * no toca se rechaza sin llegar al manejador.
+ *
+ * La cola de las diferidas tiene un solo productor (los callbacks de escritura, que la pila BLE
+ * llama de uno en uno) y un solo consumidor (loop()), así que no necesita cerrojos; si está llena,
+ * la orden se pierde y se cuenta.
+ *
+ * @tparam MAX_ORDENES Órdenes distintas que se pueden dar de alta.
+ * @tparam TAMANYO_COLA Órdenes diferidas que pueden esperar a loop() a la vez.
+ */
+template< uint8_t MAX_ORDENES, uint8_t TAMANYO_COLA = 4 >
+class DespachadorOrdenes {
+
+  static_assert( TAMANYO_COLA > 0 && TAMANYO_COLA < 255, "la cola va con índices de 8 bits" );
+
+public:
+
+  /**
+   * @brief Manejador de una orden.
+   *
+   * @return false si la orden no se puede atender (se cuenta como rechazada).
+   */
+  using Manejador = bool ( void * contexto, const OrdenEscrita & orden );
+
+  enum Modo : uint8_t {
+	INMEDIATA,   ///< En el callback de escritura: tiene que ser corta.
+	DIFERIDA     ///< En ejecutarDiferidas(), desde loop().
+  };
+
+  /// Bytes que se guardan de una orden diferida (código incluido): es lo más largo que se puede dar de alta como DIFERIDA.
+  static const uint8_t MAX_TAMANYO_DIFERIDA = 12;
+
+  static const uint8_t CAPACIDAD_COLA = TAMANYO_COLA;
+
+private:
+
+  struct Alta {
+	uint8_t codigo;
+	uint8_t tamMinimo;
+	uint8_t tamMaximo;
+	Modo modo;
+	Manejador * manejador;
+	void * contexto;
+  };
+
+  struct Diferida {
+	const Alta * alta;
+	uint16_t conexion;
+	uint8_t tam;
+	uint8_t datos[MAX_TAMANYO_DIFERIDA];
+  };
+
+  Alta lasAltas[MAX_ORDENES];
+  uint8_t numeroAltas = 0;
+
+  /// Un hueco más que TAMANYO_COLA: así llena (siguiente justo antes de primera) y vacía no se confunden.
+  Diferida laCola[TAMANYO_COLA + 1];
+  volatile uint8_t primera = 0;   ///< La pone sólo ejecutarDiferidas().
+  volatile uint8_t siguiente = 0; ///< La pone sólo recibir().
+
+  // cada cuenta la escribe un solo contexto: recibir() en la pila BLE, ejecutarDiferidas() en loop()
+  volatile uint32_t recibidas = 0;
+  volatile uint32_t rechazadas = 0;  ///< Por recibir().
+  volatile uint32_t perdidas = 0;
+  uint32_t ejecutadas = 0;
+  uint32_t fallidas = 0;             ///< Diferidas que el manejador no ha aceptado.
+
+  const Alta * buscar( uint8_t codigo ) const {
+	for( uint8_t i = 0; i < numeroAltas; i++ ) {
+	  if( lasAltas[i].codigo == codigo ) {
+		return &lasAltas[i];
+	  }
+	}
+	return nullptr;
+  }
+
+  template< typename T, bool ( T::*METODO )( const OrdenEscrita & ) >
+  static bool llamarMetodo( void * contexto, const OrdenEscrita & orden ) {
+	return ( static_cast< T * >( contexto )->*METODO )( orden );
+  }
+
+  static void recibirEscritura( void * contexto, uint16_t conexion, const uint8_t * datos, uint16_t tam ) {
+	static_cast< DespachadorOrdenes * >( contexto )->recibir( conexion, datos, tam );
+  }
+
+public:
+
+  /**
+   * @brief Da de alta una orden con una función y su contexto.
+   *
+   * @param codigo Primer byte de la orden.
+   * @param tamMinimo Bytes mínimos de la orden, con el código.
+   * @param tamMaximo Bytes máximos de la orden, con el código.
+   * @param modo INMEDIATA o DIFERIDA.
+   * @param manejador Función a la que se pasa la orden.
+   * @param contexto Primer argumento de `manejador`.
+   * @return false si no cabe, si el código ya estaba o si es DIFERIDA y más larga que MAX_TAMANYO_DIFERIDA.
+   */
+  bool anyadir( uint8_t codigo, uint8_t tamMinimo, uint8_t tamMaximo, Modo modo, Manejador * manejador,
+				void * contexto ) {
+	if( numeroAltas >= MAX_ORDENES || buscar( codigo ) != nullptr || tamMinimo == 0 || tamMinimo > tamMaximo
+		|| ( modo == DIFERIDA && tamMaximo > MAX_TAMANYO_DIFERIDA ) ) {
+	  return false;
+	}
+	Alta & a = lasAltas[ numeroAltas++ ];
+	a.codigo = codigo;
+	a.tamMinimo = tamMinimo;
+	a.tamMaximo = tamMaximo;
+	a.modo = modo;
+	a.manejador = manejador;
+	a.contexto = contexto;
+	return true;
+  }
+
+  /**
+   * @brief Da de alta una orden atendida por un método de `objeto`.
+   *
+   * p. ej. `anyadir< Descarga, &Descarga::reanudar >( Descarga::REANUDAR, 1, 1, INMEDIATA, laDescarga )`.
+   */
+  template< typename T, bool ( T::*METODO )( const OrdenEscrita & ) >
+  bool anyadir( uint8_t codigo, uint8_t tamMinimo, uint8_t tamMaximo, Modo modo, T & objeto ) {
+	return anyadir( codigo, tamMinimo, tamMaximo, modo, llamarMetodo< T, METODO >, &objeto );
+  }
+
+  /**
+   * @brief Pasa al despachador las escrituras de `caracteristica`.
+   *
+   * @return false si la característica no admite más receptores.
+   */
+  bool instalarEn( ServicioEnEmisora::Caracteristica & caracteristica ) {
+	return caracteristica.instalarReceptorEscritura( recibirEscritura, this );
+  }
+
+  /**
+   * @brief Reparte una escritura (la llama el receptor de la característica, en el contexto de la pila BLE).
+   *
+   * @return false si la orden se ha rechazado o, si es DIFERIDA, no cabe en la cola.
+   */
+  bool recibir( uint16_t conexion, const uint8_t * datos, uint16_t tam ) {
+	recibidas++;
+	const Alta * a = tam > 0 ? buscar( datos[0] ) : nullptr;
+	if( a == nullptr || tam < a->tamMinimo || tam > a->tamMaximo ) {
+	  rechazadas++;
+	  return false;
+	}
+	if( a->modo == INMEDIATA ) {
+	  if( !a->manejador( a->contexto, OrdenEscrita( conexion, datos, (uint8_t) tam ) ) ) {
+		rechazadas++;
+		return false;
+	  }
+	  return true;
+	}
+	uint8_t s = siguiente;
+	uint8_t despues = (uint8_t) ( ( s + 1 ) % ( TAMANYO_COLA + 1 ) );
+	if( despues == primera ) {
+	  perdidas++;
+	  return false;
+	}
+	Diferida & d = laCola[s];
+	d.alta = a;
+	d.conexion = conexion;
+	d.tam = (uint8_t) tam;
+	memcpy( d.datos, datos, tam );
+	// el compilador no puede dejar la copia para después: la orden queda a la vista de loop()
+	// cuando ya está entera (un solo núcleo: no hace falta barrera del procesador)
+	__asm__ volatile( "" ::: "memory" );
+	siguiente = despues;
+	return true;
+  }
+
+  /// Hay órdenes diferidas esperando a ejecutarDiferidas().
+  bool hayDiferidas() const { return primera != siguiente; }
+
+  /**
+   * @brief Ejecuta las órdenes diferidas (desde loop(), nunca desde un callback).
+   *
+   * @return Órdenes ejecutadas.
+   */
+  uint8_t ejecutarDiferidas() {
+	uint8_t n = 0;
+	while( primera != siguiente ) {
+	  // el hueco se lee después de haber visto `siguiente`, no antes
+	  __asm__ volatile( "" ::: "memory" );
+	  uint8_t p = primera;
+	  const Diferida & d = laCola[p];
+	  if( !d.alta->manejador( d.alta->contexto, OrdenEscrita( d.conexion, d.datos, d.tam ) ) ) {
+		fallidas++;
+	  }
+	  // y se suelta cuando ya no se lee, para que recibir() no lo pise antes
+	  __asm__ volatile( "" ::: "memory" );
+	  primera = (uint8_t) ( ( p + 1 ) % ( TAMANYO_COLA + 1 ) );
+	  ejecutadas++;
+	  n++;
+	}
+	return n;
+  }
+
+  uint8_t numeroDeOrdenes() const { return numeroAltas; }
+
+  uint32_t ordenesRecibidas() const { return recibidas; }
+
+  /// Con código desconocido, longitud que no toca o que el manejador no ha aceptado.
+  uint32_t ordenesRechazadas() const { return rechazadas + fallidas; }
+
+  /// Diferidas que no cupieron en la cola.
+  uint32_t ordenesPerdidas() const { return perdidas; }
+
+  uint32_t ordenesEjecutadasDiferidas() const { return ejecutadas; }
+
+};
+
+#endif
@@ -0,0 +1,332 @@
+/**
+ * @file DiarioMediciones.h
+ * @brief Declaración de la clase DiarioMediciones.
+ *
+ * Diario de mediciones en la flash interna (InternalFS, LittleFS): las muestras de un
+ * BufferMediciones se copian de vez en cuando a ficheros que sólo crecen por el final, así que
+ * sobreviven a los reinicios y se pueden sacar más tarde sin ningún escáner cerca. El formato
+ * está en FormatoDiario.h.
+ *
+ * El diario son NUM_SEGMENTOS ficheros (/diario0.bin, /diario1.bin...) de hasta
+ * TAMANYO_SEGMENTO bytes que se llenan por turno: cuando el actual no tiene sitio se borra el más
+ * antiguo y se empieza otro. Así el espacio está acotado, las muestras viejas se pierden de
+ * segmento en segmento y el desgaste se reparte por toda la partición (LittleFS reparte además
+ * los bloques de cada fichero). Guardar cada pocos minutos en lugar de en cada medición junta
+ * las muestras en pocas escrituras grandes: menos borrados de bloque y mejor compresión.
+ */
+
+#ifndef DIARIO_MEDICIONES_H_INCLUIDO
+#define DIARIO_MEDICIONES_H_INCLUIDO
+
+#include "FormatoDiario.h"
+
+/**
+ * @class DiarioMediciones
+ * @brief Guarda en la flash las muestras nuevas de un BufferMediciones y recupera el diario al arrancar.
+ *
+ * Las muestras se leen del búfer con un BufferMediciones::Cursor, sin sacarlas. Si el búfer
+ * descarta muestras antes de que se guarden, se cuentan como perdidas.
+ *
+ * @tparam Buffer Tipo del BufferMediciones.
+ * @tparam NUM_SEGMENTOS Ficheros del diario.
+ * @tparam TAMANYO_SEGMENTO Bytes máximos de cada fichero.
+ */
+template< typename Buffer, uint8_t NUM_SEGMENTOS = 4, uint16_t TAMANYO_SEGMENTO = 4096 >
+class DiarioMediciones {
+
+public:
+
+  static_assert( NUM_SEGMENTOS >= 2 && NUM_SEGMENTOS <= 10, "de 2 a 10 segmentos (un dígito en el nombre)" );
+  static_assert( TAMANYO_SEGMENTO >= FormatoDiario::TAMANYO_CABECERA + FormatoDiario::MAX_ENTRADA,
+				 "en un segmento tiene que caber al menos una entrada" );
+
+  static const uint8_t NUMERO_DE_SEGMENTOS = NUM_SEGMENTOS;
+
+  /// Bloque máximo de cada entrada: con uno grande hay menos cabeceras y las deltas son más cortas.
+  static const uint8_t TAMANYO_BLOQUE = 240;
+
+private:
+
+  const Buffer & elBuffer;
+  Adafruit_LittleFS & laFlash;
+
+  typename Buffer::Cursor cursor;
+
+  bool abierto = false;
+  uint16_t arranque = 0;          ///< Arranque actual (el anterior + 1).
+  uint32_t numeroSegmento = 0;    ///< Número del segmento que se está llenando.
+  uint32_t ocupadoSegmento = 0;   ///< Sus bytes.
+
+  uint32_t entradas = 0;          ///< Entradas escritas desde el arranque.
+  uint32_t bytesEscritos = 0;
+  uint32_t muestrasGuardadas = 0;
+  uint32_t perdidas = 0;          ///< Descartadas del búfer antes de guardarse.
+  uint32_t bytesRecuperados = 0;  ///< Bytes de una entrada a medias cortados al abrir.
+  uint32_t fallos = 0;            ///< Escrituras que no se han podido hacer.
+
+  static void nombreSegmento( char * nombre, uint32_t numero ) {
+	memcpy( nombre, "/diario0.bin", 13 );
+	nombre[7] = (char) ( '0' + numero % NUM_SEGMENTOS );
+  }
+
+  /**
+   * @brief Recorre las entradas de un segmento abierto desde su cabecera.
+   *
+   * @param alLeer Se llama con cada entrada buena: alLeer( const FormatoDiario::Entrada & ).
+   * @return Bytes hasta el final de la última entrada buena.
+   */
+  template< typename Fichero, typename F >
+  static uint32_t recorrerSegmento( Fichero & f, F alLeer ) {
+	uint8_t entrada[FormatoDiario::MAX_ENTRADA];
+	uint32_t posicion = FormatoDiario::TAMANYO_CABECERA;
+	uint32_t tam = f.size();
+	f.seek( posicion );
+	while( posicion < tam ) {
+	  if( f.read( entrada, 1 ) != 1 ) {
+		break;
+	  }
+	  uint16_t total = FormatoDiario::tamanyoEntrada( entrada[0] );
+	  if( posicion + total > tam || f.read( &entrada[1], total - 1 ) != (int) total - 1 ) {
+		break;
+	  }
+	  FormatoDiario::Entrada e;
+	  if( FormatoDiario::leerEntrada( entrada, total, e ) == 0 ) {
+		break;
+	  }
+	  alLeer( e );
+	  posicion += total;
+	}
+	return posicion;
+  }
+
+  bool empezarSegmento( uint32_t numero ) {
+	char nombre[16];
+	nombreSegmento( nombre, numero );
+	laFlash.remove( nombre );
+	auto f = laFlash.open( nombre, Adafruit_LittleFS_Namespace::FILE_O_WRITE );
+	uint8_t cabecera[FormatoDiario::TAMANYO_CABECERA];
+	FormatoDiario::escribirCabecera( cabecera, numero, arranque );
+	if( !f || f.write( cabecera, sizeof( cabecera ) ) != sizeof( cabecera ) ) {
+	  return false;
+	}
+	f.close();
+	(*this).numeroSegmento = numero;
+	(*this).ocupadoSegmento = sizeof( cabecera );
+	return true;
+  }
+
+public:
+
+  /**
+   * @brief Constructor de la clase DiarioMediciones.
+   *
+   * @param buffer Búfer del que se guardan las muestras.
+   * @param flash Sistema de ficheros (InternalFS).
+   */
+  DiarioMediciones( const Buffer & buffer, Adafruit_LittleFS & flash )
+	: elBuffer( buffer ), laFlash( flash ) {
+  }
+
+  /**
+   * @brief Monta la flash, busca el segmento más reciente y lo deja listo para seguir escribiendo.
+   *
+   * Si la última entrada quedó a medias (un reinicio mientras se escribía), se corta el fichero
+   * tras la última entrada buena. Las muestras que ya tenga el búfer se guardarán en el
+   * siguiente guardar().
+   *
+   * @return false si no se puede montar la flash o crear el primer segmento.
+   */
+  bool abrir() {
+	if( !laFlash.begin() ) {
+	  return false;
+	}
+	elBuffer.situar( (*this).cursor, elBuffer.secuenciaMasAntigua() );
+
+	// el segmento de número más alto es el actual
+	bool hay = false;
+	uint16_t ultimoArranque = 0;
+	for( uint8_t k = 0; k < NUM_SEGMENTOS; k++ ) {
+	  char nombre[16];
+	  nombreSegmento( nombre, k );
+	  auto f = laFlash.open( nombre, Adafruit_LittleFS_Namespace::FILE_O_READ );
+	  uint8_t cabecera[FormatoDiario::TAMANYO_CABECERA];
+	  uint32_t numero;
+	  uint16_t arranqueSegmento;
+	  if( !f || f.read( cabecera, sizeof( cabecera ) ) != (int) sizeof( cabecera )
+		  || !FormatoDiario::leerCabecera( cabecera, sizeof( cabecera ), numero, arranqueSegmento )
+		  || numero % NUM_SEGMENTOS != k ) {
+		continue;
+	  }
+	  if( !hay || (int32_t) ( numero - numeroSegmento ) > 0 ) {
+		hay = true;
+		(*this).numeroSegmento = numero;
+		ultimoArranque = arranqueSegmento;
+	  }
+	}
+
+	if( !hay ) {
+	  (*this).arranque = 1;
+	  (*this).abierto = empezarSegmento( 0 );
+	  return abierto;
+	}
+
+	char nombre[16];
+	nombreSegmento( nombre, numeroSegmento );
+	auto f = laFlash.open( nombre, Adafruit_LittleFS_Namespace::FILE_O_WRITE );
+	if( !f ) {
+	  return false;
+	}
+	uint32_t tam = f.size();
+	uint32_t bueno = recorrerSegmento( f, [&] ( const FormatoDiario::Entrada & e ) {
+	  ultimoArranque = e.arranque;
+	} );
+	if( bueno < tam ) {
+	  f.truncate( bueno );
+	  (*this).bytesRecuperados = tam - bueno;
+	}
+	f.close();
+	(*this).arranque = (uint16_t) ( ultimoArranque + 1 );
+	(*this).ocupadoSegmento = bueno;
+	(*this).abierto = true;
+	return true;
+  }
+
+  /**
+   * @brief Escribe en la flash las muestras del búfer que aún no estén, en entradas de hasta
+   * TAMANYO_BLOQUE bytes, y cambia de segmento cuando el actual se llena.
+   *
+   * @param ahora millis().
+   * @return Entradas escritas.
+   */
+  uint16_t guardar( uint32_t ahora ) {
+	if( !abierto ) {
+	  return 0;
+	}
+	char nombre[16];
+	nombreSegmento( nombre, numeroSegmento );
+	auto f = laFlash.open( nombre, Adafruit_LittleFS_Namespace::FILE_O_WRITE );
+	uint8_t entrada[FormatoDiario::MAX_ENTRADA];
+	uint16_t escritas = 0;
+
+	while( f ) {
+	  typename Buffer::Cursor siguiente = cursor;
+	  uint8_t n = elBuffer.copiarBloque( siguiente, &entrada[FormatoDiario::TAMANYO_CABECERA_ENTRADA],
+										 TAMANYO_BLOQUE, ahora );
+	  if( n == 0 ) {
+		break;
+	  }
+	  // la primera muestra es la del cursor, salvo si el búfer ya la había descartado
+	  uint32_t primera = cursor.secuencia;
+	  if( (int32_t) ( primera - elBuffer.secuenciaMasAntigua() ) < 0 ) {
+		primera = elBuffer.secuenciaMasAntigua();
+	  }
+	  uint16_t tam = FormatoDiario::cerrarEntrada( entrada, n, arranque, primera, ahora );
+
+	  if( ocupadoSegmento + tam > TAMANYO_SEGMENTO ) {
+		f.close();
+		if( !empezarSegmento( numeroSegmento + 1 ) ) {
+		  (*this).fallos++;
+		  break;
+		}
+		nombreSegmento( nombre, numeroSegmento );
+		f = laFlash.open( nombre, Adafruit_LittleFS_Namespace::FILE_O_WRITE );
+		if( !f ) {
+		  (*this).fallos++;
+		  break;
+		}
+	  }
+
+	  if( f.write( entrada, tam ) != tam ) {
+		// puede haber quedado media entrada: se quita para no dejar basura en medio del segmento
+		f.truncate( ocupadoSegmento );
+		(*this).fallos++;
+		break;
+	  }
+	  (*this).ocupadoSegmento += tam;
+	  (*this).perdidas += primera - cursor.secuencia;
+	  (*this).muestrasGuardadas += siguiente.secuencia - primera;
+	  (*this).cursor = siguiente;
+	  (*this).entradas++;
+	  (*this).bytesEscritos += tam;
+	  escritas++;
+	}
+	f.close();
+	return escritas;
+  }
+
+  /**
+   * @brief Recorre las entradas de todo el diario, del segmento más antiguo al actual.
+   *
+   * @param alLeer Se llama con cada entrada: alLeer( const FormatoDiario::Entrada & ).
+   * @return Entradas leídas.
+   */
+  template< typename F >
+  uint32_t recorrer( F alLeer ) {
+	uint32_t n = 0;
+	for( uint8_t k = 0; k < NUM_SEGMENTOS; k++ ) {
+	  uint32_t numero = numeroSegmento - ( NUM_SEGMENTOS - 1 ) + k;
+	  if( (int32_t) numero < 0 ) {
+		continue;
+	  }
+	  char nombre[16];
+	  nombreSegmento( nombre, numero );
+	  auto f = laFlash.open( nombre, Adafruit_LittleFS_Namespace::FILE_O_READ );
+	  uint8_t cabecera[FormatoDiario::TAMANYO_CABECERA];
+	  uint32_t numeroLeido;
+	  uint16_t arranqueSegmento;
+	  if( !f || f.read( cabecera, sizeof( cabecera ) ) != (int) sizeof( cabecera )
+		  || !FormatoDiario::leerCabecera( cabecera, sizeof( cabecera ), numeroLeido, arranqueSegmento )
+		  || numeroLeido != numero ) {
+		continue;
+	  }
+	  recorrerSegmento( f, [&] ( const FormatoDiario::Entrada & e ) {
+		alLeer( e );
+		n++;
+	  } );
+	}
+	return n;
+  }
+
+  /**
+   * @brief Lee bytes crudos del diario para sacarlo (p. ej. por el puerto serie), segmento a
+   * segmento del más antiguo al actual.
+   *
+   * @param segmento Índice del segmento (0: el más antiguo; NUM_SEGMENTOS - 1: el actual).
+   * @param posicion Byte del segmento.
+   * @param destino Donde dejar los bytes.
+   * @param max Bytes como mucho.
+   * @return Bytes leídos (0 al final del segmento o si no existe).
+   */
+  uint16_t leerCrudo( uint8_t segmento, uint32_t posicion, uint8_t * destino, uint16_t max ) {
+	uint32_t numero = numeroSegmento - ( NUM_SEGMENTOS - 1 ) + segmento;
+	if( segmento >= NUM_SEGMENTOS || (int32_t) numero < 0 ) {
+	  return 0;
+	}
+	char nombre[16];
+	nombreSegmento( nombre, numero );
+	auto f = laFlash.open( nombre, Adafruit_LittleFS_Namespace::FILE_O_READ );
+	if( !f || !f.seek( posicion ) ) {
+	  return 0;
+	}
+	int n = f.read( destino, max );
+	return n > 0 ? (uint16_t) n : 0;
+  }
+
+  bool estaAbierto() const { return abierto; }
+
+  /// Número de arranque con el que se escriben las entradas.
+  uint16_t numeroArranque() const { return arranque; }
+
+  /// Número del segmento que se está llenando.
+  uint32_t segmentoActual() const { return numeroSegmento; }
+
+  uint32_t entradasEscritas() const { return entradas; }
+  uint32_t bytesEnFlash() const { return bytesEscritos; }
+  uint32_t muestrasEnFlash() const { return muestrasGuardadas; }
+  uint32_t muestrasPerdidas() const { return perdidas; }
+  uint32_t bytesCortadosAlAbrir() const { return bytesRecuperados; }
+  uint32_t escriturasFallidas() const { return fallos; }
+
+};
+
+#endif
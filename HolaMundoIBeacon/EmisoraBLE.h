@@ -2,6 +2,12 @@
 #define EMISORA_H_INCLUIDO
 
 #include "ServicioEnEmisora.h"
+#include "AnuncioPrecalculado.h"
+#include "AnuncioExtendido.h"
+#include "ColaNotificaciones.h"
+#include "NegociacionConexion.h"
+#include "Reposo.h"
+#include "Sondas.h"
 
 /**
  * @class EmisoraBLE
@@ -13,6 +19,88 @@ private:
   const uint16_t fabricanteID;  ///< ID del fabricante para identificar el beacon.
   const int8_t txPower;         ///< Potencia de transmisión del beacon.
 
+  /**
+   * Conjunto de anuncio de la SoftDevice. Sólo hay uno y lo crea Bluefruit.Advertising.start() la
+   * primera vez (la SoftDevice le da el 0): antes, el 0 es un manejador inválido. Bluefruit guarda
+   * su manejador aparte, así que el conjunto no se puede crear por fuera (Bluefruit ya no podría
+   * anunciar); ver crearConjuntoAnuncio().
+   */
+  static const uint8_t MANEJADOR_ANUNCIO = 0;
+  bool conjuntoCreado = false;
+
+  /// Intervalo de anuncio en unidades de 0,625 ms (100 = 62,5 ms).
+  uint16_t intervaloAnuncio = 100;
+
+  /// Anuncio extendido: lo admite la SoftDevice (ver configurarAnuncioExtendido()) y sus PHY.
+  bool extendidoAdmitido = false;
+  uint8_t phyPrimario = BLE_GAP_PHY_1MBPS;
+  uint8_t phySecundario = BLE_GAP_PHY_1MBPS;
+  AnuncioExtendido* anuncioExtendido = nullptr;   ///< El último emitido.
+
+  /**
+   * @brief Está en marcha el anuncio extendido.
+   * 
+   * La SoftDevice para el conjunto de anuncio por su cuenta cuando se conecta una central (el
+   * anuncio es conectable) o se acaba su duración, y entonces procesarEvento() lo pone a false.
+   * Se pone a true antes de arrancar el conjunto, para que el evento no pueda llegar antes.
+   */
+  static volatile bool& anunciandoExtendido() {
+    static volatile bool anunciando = false;
+    return anunciando;
+  }
+
+  /**
+   * @brief Hace que Bluefruit cree el conjunto de anuncio 0 si aún no lo ha hecho, arrancando y
+   * parando su anuncio (a lo sumo sale un evento de anuncio clásico).
+   * 
+   * @return false si Bluefruit no lo ha podido arrancar.
+   */
+  bool crearConjuntoAnuncio() {
+    if (conjuntoCreado || Bluefruit.Advertising.isRunning()) {
+      conjuntoCreado = true;
+      return true;
+    }
+    if (!Bluefruit.Advertising.start(0)) {
+      return false;
+    }
+    Bluefruit.Advertising.stop();
+    conjuntoCreado = true;
+    return true;
+  }
+
+  /// Parámetros del conjunto de anuncio para un anuncio extendido conectable.
+  ble_gap_adv_params_t parametrosExtendido() const {
+    ble_gap_adv_params_t p;
+    memset(&p, 0, sizeof(p));
+    p.properties.type = BLE_GAP_ADV_TYPE_EXTENDED_CONNECTABLE_NONSCANNABLE_UNDIRECTED;
+    p.interval = intervaloAnuncio;
+    p.duration = BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED;
+    p.filter_policy = BLE_GAP_ADV_FP_ANY;
+    p.primary_phy = phyPrimario;
+    p.secondary_phy = phySecundario;
+    return p;
+  }
+
+  /// Configura el conjunto de anuncio con los datos de `anuncio` y lo arranca.
+  bool arrancarAnuncioExtendido(AnuncioExtendido& anuncio) {
+    ble_gap_adv_data_t datosGap;
+    memset(&datosGap, 0, sizeof(datosGap));
+    datosGap.adv_data.p_data = anuncio.datosAnuncio();
+    datosGap.adv_data.len = anuncio.longitudAnuncio();
+    ble_gap_adv_params_t parametros = parametrosExtendido();
+    uint8_t manejador = MANEJADOR_ANUNCIO;
+    if (sd_ble_gap_adv_set_configure(&manejador, &datosGap, &parametros) != NRF_SUCCESS) {
+      return false;
+    }
+    anunciandoExtendido() = true;
+    if (sd_ble_gap_adv_start(MANEJADOR_ANUNCIO, CONN_CFG_PERIPHERAL) != NRF_SUCCESS) {
+      anunciandoExtendido() = false;
+      return false;
+    }
+    anuncioExtendido = &anuncio;
+    return true;
+  }
+
 public:
   /// Callback para gestionar la conexión establecida.
   using CallbackConexionEstablecida = void (uint16_t connHandle);
@@ -39,6 +127,71 @@ public:
     detenerAnuncio();
   }
 
+  /**
+   * @brief Prepara las conexiones para notificar deprisa (hay que llamarla antes de encenderEmisora()).
+   * 
+   * Permite negociar un MTU de hasta BLEGATT_ATT_MTU_MAX, fija cuántas notificaciones admite la
+   * cola de la SoftDevice e instala el callback de eventos que lleva la cuenta de créditos que
+   * usa ColaNotificaciones y sigue la negociación de la conexión.
+   * 
+   * @param colaNotificaciones Notificaciones que la SoftDevice acepta sin haberlas enviado aún.
+   * @param longitudEvento Tiempo de radio reservado en cada evento de conexión (unidades de
+   * 1,25 ms); para aprovechar un intervalo corto tiene que ser tan largo como él.
+   */
+  void configurarNotificaciones(uint8_t colaNotificaciones, uint16_t longitudEvento = BLE_GAP_EVENT_LENGTH_DEFAULT) {
+    Bluefruit.configPrphConn(BLEGATT_ATT_MTU_MAX, longitudEvento, colaNotificaciones,
+                             BLE_GATTC_WRITE_CMD_TX_QUEUE_SIZE_DEFAULT);
+    CreditosNotificacion::configurar(colaNotificaciones);
+    Bluefruit.setEventCallback(procesarEvento);
+  }
+
+  /**
+   * @brief Callback de eventos de la SoftDevice: créditos de notificación, negociación de la
+   * conexión y fin del anuncio extendido.
+   * 
+   * Despierta a loop() si está en Reposo::dormir(), para que atienda el evento ya.
+   */
+  static void procesarEvento(ble_evt_t* evento) {
+    CreditosNotificacion::procesarEvento(evento);
+    NegociacionConexion::procesarEvento(evento);
+    if (evento->header.evt_id == BLE_GAP_EVT_CONNECTED || evento->header.evt_id == BLE_GAP_EVT_ADV_SET_TERMINATED) {
+      anunciandoExtendido() = false;
+    }
+    Reposo::despertar();
+  }
+
+  /**
+   * @brief Pide a la central los parámetros de `perfil` (p. ej. desde el callback de conexión).
+   * 
+   * La negociación sigue en NegociacionConexion::atender(); necesita configurarNotificaciones().
+   * 
+   * @param connHandle Identificador de la conexión.
+   * @param perfil PerfilesConexion::RAPIDO, PerfilesConexion::AHORRO u otro.
+   */
+  void negociarConexion(uint16_t connHandle, const PerfilConexion& perfil) {
+    NegociacionConexion::pedirPerfil(connHandle, perfil);
+  }
+
+  /**
+   * @brief Parámetros con los que va la conexión ahora mismo.
+   * 
+   * @param connHandle Identificador de la conexión.
+   * @return Los parámetros (los de por defecto si no hay conexión).
+   */
+  ParametrosConexion parametrosConexion(uint16_t connHandle) {
+    ParametrosConexion r;
+    BLEConnection* c = Bluefruit.Connection(connHandle);
+    if (c != nullptr) {
+      r.phy = c->getPHY();
+      r.mtu = c->getMtu();
+      r.longitudDatos = c->getDataLength();
+      r.intervalo = c->getConnectionInterval();
+      r.latencia = c->getSlaveLatency();
+      r.supervision = c->getSupervisionTimeout();
+    }
+    return r;
+  }
+
   /**
    * @brief Enciende la emisora BLE y registra los callbacks para la conexión.
    * 
@@ -52,16 +205,52 @@ public:
   }
 
   /**
-   * @brief Detiene el anuncio si está en ejecución.
+   * @brief Detiene el anuncio (clásico o extendido) si está en ejecución.
    */
   void detenerAnuncio() {
+    if (anunciandoExtendido()) {
+      sd_ble_gap_adv_stop(MANEJADOR_ANUNCIO);
+      anunciandoExtendido() = false;
+    }
     if (estaAnunciando()) {
       Bluefruit.Advertising.stop();
     }
   }
 
   /**
-   * @brief Verifica si la emisora está anunciando.
+   * @brief Cambia el intervalo de anuncio.
+   * 
+   * Si se está anunciando, se para y se vuelve a arrancar con lo mismo que se estaba emitiendo:
+   * la SoftDevice no deja cambiar el intervalo de un anuncio en marcha. El primer evento con el
+   * intervalo nuevo sale al arrancar.
+   * 
+   * @param unidades Intervalo en unidades de 0,625 ms (de 32 a 16384).
+   */
+  void cambiarIntervaloAnuncio(uint16_t unidades) {
+    if (unidades == intervaloAnuncio) {
+      return;
+    }
+    intervaloAnuncio = unidades;
+    if (anunciandoExtendido()) {
+      Sondas::Ambito sonda(Sondas::ANUNCIAR);
+      sd_ble_gap_adv_stop(MANEJADOR_ANUNCIO);
+      anunciandoExtendido() = false;
+      arrancarAnuncioExtendido(*anuncioExtendido);
+    } else if (estaAnunciando()) {
+      Sondas::Ambito sonda(Sondas::ANUNCIAR);
+      Bluefruit.Advertising.stop();
+      Bluefruit.Advertising.setInterval(intervaloAnuncio, intervaloAnuncio);
+      Bluefruit.Advertising.start(0);
+    }
+  }
+
+  /// Intervalo de anuncio en unidades de 0,625 ms.
+  uint16_t intervaloDeAnuncio() const {
+    return intervaloAnuncio;
+  }
+
+  /**
+   * @brief Verifica si la emisora está anunciando con un anuncio clásico (de Bluefruit).
    * 
    * @return true si está anunciando, false en caso contrario.
    */
@@ -78,6 +267,7 @@ public:
    * @param rssi RSSI del beacon.
    */
   void emitirAnuncioIBeacon(uint8_t* beaconUUID, int16_t major, int16_t minor, uint8_t rssi) {
+    Sondas::Ambito sonda(Sondas::ANUNCIAR);
     detenerAnuncio();
     BLEBeacon elBeacon(beaconUUID, major, minor, rssi);
     elBeacon.setManufacturer(fabricanteID);
@@ -86,7 +276,7 @@ public:
     Bluefruit.ScanResponse.addName();
     Bluefruit.Advertising.setBeacon(elBeacon);
     Bluefruit.Advertising.restartOnDisconnect(true);
-    Bluefruit.Advertising.setInterval(100, 100);
+    Bluefruit.Advertising.setInterval(intervaloAnuncio, intervaloAnuncio);
     Bluefruit.Advertising.start(0);
   }
 
@@ -97,6 +287,7 @@ public:
    * @param tamanyoCarga Tamaño de la carga en bytes.
    */
   void emitirAnuncioIBeaconLibre(const char* carga, const uint8_t tamanyoCarga) {
+    Sondas::Ambito sonda(Sondas::ANUNCIAR);
     detenerAnuncio();
     Bluefruit.Advertising.clearData();
     Bluefruit.ScanResponse.clearData();
@@ -108,23 +299,179 @@ public:
     memcpy(&restoPrefijoYCarga[4], &carga[0], (tamanyoCarga > 21 ? 21 : tamanyoCarga));
     Bluefruit.Advertising.addData(BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA, &restoPrefijoYCarga[0], 4 + 21);
     Bluefruit.Advertising.restartOnDisconnect(true);
-    Bluefruit.Advertising.setInterval(100, 100);
+    Bluefruit.Advertising.setInterval(intervaloAnuncio, intervaloAnuncio);
     Bluefruit.Advertising.setFastTimeout(1);
     Bluefruit.Advertising.start(0);
-    Globales::elPuerto.escribir("emitiriBeacon libre Bluefruit.Advertising.start(0);\n");
+    Globales::elPuerto.trazar< Trazas::Id::ANUNCIO_LIBRE_START >();
+  }
+
+  /**
+   * @brief Codifica un anuncio iBeacon con los datos de esta emisora (fabricante y nombre).
+   * 
+   * @param anuncio Anuncio a preparar.
+   * @param beaconUUID UUID del beacon.
+   * @param major Valor major inicial.
+   * @param minor Valor minor inicial.
+   * @param rssi RSSI del beacon.
+   */
+  void prepararAnuncioIBeacon(AnuncioPrecalculado& anuncio, const uint8_t* beaconUUID, uint16_t major, uint16_t minor, int8_t rssi) {
+    anuncio.prepararIBeacon(fabricanteID, beaconUUID, major, minor, rssi, nombreEmisora);
+  }
+
+  /**
+   * @brief Codifica un anuncio con carga libre como el de emitirAnuncioIBeaconLibre().
+   * 
+   * @param anuncio Anuncio a preparar.
+   * @param carga Carga inicial (puede ser nula).
+   * @param tamanyoCarga Tamaño de la carga en bytes.
+   */
+  void prepararAnuncioLibre(AnuncioPrecalculado& anuncio, const char* carga, uint8_t tamanyoCarga) {
+    anuncio.prepararLibre((const uint8_t*) carga, tamanyoCarga, nombreEmisora);
+  }
+
+  /**
+   * @brief Escribe en un anuncio extendido la cabecera con el fabricante de esta emisora.
+   * 
+   * @param anuncio Anuncio a preparar.
+   */
+  void prepararAnuncioExtendido(AnuncioExtendido& anuncio) {
+    anuncio.preparar(fabricanteID);
+  }
+
+  /**
+   * @brief Emite un anuncio precalculado configurando la radio desde cero.
+   * 
+   * Es el camino lento (parar, configurar, arrancar); sólo hace falta la primera vez o cuando
+   * el anuncio estaba parado. Después basta con actualizarAnuncio().
+   * 
+   * @param anuncio Anuncio ya codificado.
+   */
+  void emitirAnuncioPrecalculado( AnuncioPrecalculado & anuncio ) {
+    detenerAnuncio();
+    Bluefruit.setTxPower(txPower);
+    Bluefruit.setName(nombreEmisora);
+    Bluefruit.Advertising.setData(anuncio.datosAnuncio(), anuncio.longitudAnuncio());
+    Bluefruit.ScanResponse.setData(anuncio.datosRespuesta(), anuncio.longitudRespuestaEscaneo());
+    Bluefruit.Advertising.restartOnDisconnect(true);
+    Bluefruit.Advertising.setInterval(intervaloAnuncio, intervaloAnuncio);
+    Bluefruit.Advertising.start(0);
+  }
+
+  /**
+   * @brief Pone en el aire los cambios de un anuncio precalculado sin parar la radio.
+   * 
+   * Confirma los cambios del anuncio y entrega el búfer nuevo a la SoftDevice, que lo empieza a
+   * usar en el siguiente evento de anuncio. Si no se estaba anunciando (o la SoftDevice rechaza
+   * el cambio), se recurre a emitirAnuncioPrecalculado().
+   * 
+   * @param anuncio Anuncio con los cambios pendientes.
+   * @return true si se pudo cambiar sin parar el anuncio.
+   */
+  bool actualizarAnuncio( AnuncioPrecalculado & anuncio ) {
+    Sondas::Ambito sonda(Sondas::ANUNCIAR);
+    anuncio.confirmar();
+    if (!estaAnunciando()) {
+      emitirAnuncioPrecalculado(anuncio);
+      return false;
+    }
+
+    ble_gap_adv_data_t datosGap;
+    datosGap.adv_data.p_data = anuncio.datosAnuncio();
+    datosGap.adv_data.len = anuncio.longitudAnuncio();
+    datosGap.scan_rsp_data.p_data = anuncio.datosRespuesta();
+    datosGap.scan_rsp_data.len = anuncio.longitudRespuestaEscaneo();
+
+    uint8_t manejador = MANEJADOR_ANUNCIO;
+    if (sd_ble_gap_adv_set_configure(&manejador, &datosGap, NULL) != NRF_SUCCESS) {
+      emitirAnuncioPrecalculado(anuncio);
+      return false;
+    }
+
+    // la copia de Bluefruit ya no está en uso: se actualiza para que restartOnDisconnect emita lo último
+    Bluefruit.Advertising.setData(anuncio.datosAnuncio(), anuncio.longitudAnuncio());
+    return true;
+  }
+
+  /**
+   * @brief Comprueba si la SoftDevice admite anuncios extendidos con estos PHY y los deja elegidos.
+   * 
+   * Configura el conjunto de anuncio (que es el mismo que usa Bluefruit.Advertising) sin datos,
+   * así que para lo que se esté anunciando; si Bluefruit aún no ha anunciado nada (justo tras
+   * encenderEmisora()), antes le hace crear el conjunto. Sin BLE 5 (o con un PHY que el controlador no tenga)
+   * la SoftDevice responde NRF_ERROR_NOT_SUPPORTED y hay que seguir con los anuncios clásicos.
+   * 
+   * @param phyPrimario_ PHY de los ADV_EXT_IND: BLE_GAP_PHY_1MBPS o BLE_GAP_PHY_CODED (más alcance).
+   * @param phySecundario_ PHY del paquete con los datos: BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS
+   * (menos tiempo en el aire) o BLE_GAP_PHY_CODED.
+   * @return true si se puede usar emitirAnuncioExtendido().
+   */
+  bool configurarAnuncioExtendido(uint8_t phyPrimario_, uint8_t phySecundario_) {
+    detenerAnuncio();
+    phyPrimario = phyPrimario_;
+    phySecundario = phySecundario_;
+    ble_gap_adv_params_t parametros = parametrosExtendido();
+    uint8_t manejador = MANEJADOR_ANUNCIO;
+    extendidoAdmitido = crearConjuntoAnuncio()
+      && sd_ble_gap_adv_set_configure(&manejador, NULL, &parametros) == NRF_SUCCESS;
+    return extendidoAdmitido;
+  }
+
+  /// La SoftDevice admite anuncios extendidos (tras configurarAnuncioExtendido()).
+  bool admiteAnuncioExtendido() const {
+    return extendidoAdmitido;
+  }
+
+  /// Está en marcha un anuncio extendido.
+  bool estaAnunciandoExtendido() const {
+    return anunciandoExtendido();
+  }
+
+  /**
+   * @brief Pone en el aire un anuncio extendido, en vez de lo que se estuviera anunciando.
+   * 
+   * Si ya se estaba anunciando uno, sólo se cambia de búfer (como actualizarAnuncio()); si no
+   * (tampoco si la SoftDevice lo ha parado al conectarse una central), se para el anuncio clásico
+   * y se configura el conjunto de anuncio desde cero. El anuncio es conectable y va en los PHY de
+   * configurarAnuncioExtendido().
+   * 
+   * @param anuncio Anuncio con la carga fijada (se confirma aquí).
+   * @return false si la SoftDevice no lo ha aceptado (p. ej. no admite anuncios extendidos):
+   * no se está anunciando nada y hay que recurrir a un anuncio clásico.
+   */
+  bool emitirAnuncioExtendido(AnuncioExtendido& anuncio) {
+    Sondas::Ambito sonda(Sondas::ANUNCIAR);
+    anuncio.confirmar();
+    if (!extendidoAdmitido) {
+      return false;
+    }
+    if (anunciandoExtendido()) {
+      ble_gap_adv_data_t datosGap;
+      memset(&datosGap, 0, sizeof(datosGap));
+      datosGap.adv_data.p_data = anuncio.datosAnuncio();
+      datosGap.adv_data.len = anuncio.longitudAnuncio();
+      uint8_t manejador = MANEJADOR_ANUNCIO;
+      // si la central se conecta mientras tanto, los datos se quedan en un conjunto parado
+      if (sd_ble_gap_adv_set_configure(&manejador, &datosGap, NULL) == NRF_SUCCESS && anunciandoExtendido()) {
+        anuncioExtendido = &anuncio;
+        return true;
+      }
+    }
+    detenerAnuncio();
+    return arrancarAnuncioExtendido(anuncio);
   }
 
   /**
    * @brief Añade un servicio a la emisora BLE.
    * 
-   * @param servicio Referencia a un servicio de la emisora.
+   * @param servicio Referencia a un servicio de la emisora (ServicioEnEmisora o ServicioEnEmisoraFijo).
    * @return true si el servicio fue añadido exitosamente, false en caso contrario.
    */
-  bool anyadirServicio(ServicioEnEmisora& servicio) {
-    Globales::elPuerto.escribir(" Bluefruit.Advertising.addService( servicio ); \n");
+  template <typename Servicio>
+  bool anyadirServicio(Servicio& servicio) {
+    Globales::elPuerto.trazar< Trazas::Id::ANYADIR_SERVICIO >();
     bool r = Bluefruit.Advertising.addService(servicio);
     if (!r) {
-      Serial.println(" SERVICIO NO AÑADIDO \n");
+      Globales::elPuerto.trazar< Trazas::Id::SERVICIO_NO_ANYADIDO >();
     }
     return r;
   }
@@ -153,15 +500,31 @@ public:
     return anyadirServicioConSusCaracteristicas(servicio, restoCaracteristicas...);
   }
 
+  /**
+   * @brief Añade un servicio de capacidad fija con sus características a la emisora BLE.
+   *
+   * No compila si se le pasan más características de las que caben en el servicio.
+   *
+   * @param servicio Servicio a añadir.
+   * @param caracteristicas Características del servicio.
+   * @return true si el servicio fue añadido con todas sus características, false en caso contrario.
+   */
+  template <uint8_t N, typename... T>
+  bool anyadirServicioConSusCaracteristicas(ServicioEnEmisoraFijo<N>& servicio, T&... caracteristicas) {
+    static_assert(sizeof...(T) <= N, "el servicio no tiene sitio para tantas características");
+    bool r = servicio.anyadirCaracteristicas(caracteristicas...);
+    return anyadirServicio(servicio) && r;
+  }
+
   /**
    * @brief Añade un servicio con varias características y lo activa.
    * 
-   * @param servicio Servicio a añadir.
+   * @param servicio Servicio a añadir (ServicioEnEmisora o ServicioEnEmisoraFijo).
    * @param restoCaracteristicas Características del servicio.
    * @return true si el servicio fue añadido y activado exitosamente, false en caso contrario.
    */
-  template <typename... T>
-  bool anyadirServicioConSusCaracteristicasYActivar(ServicioEnEmisora& servicio, T&... restoCaracteristicas) {
+  template <typename Servicio, typename... T>
+  bool anyadirServicioConSusCaracteristicasYActivar(Servicio& servicio, T&... restoCaracteristicas) {
     bool r = anyadirServicioConSusCaracteristicas(servicio, restoCaracteristicas...);
     servicio.activarServicio();
     return r;
@@ -0,0 +1,226 @@
+
+/**
+ * @file Filtros.h
+ * @brief Declaración de los filtros de enteros que usa el Medidor.
+ *
+ * Cada lectura del Medidor es el resultado de una cadena de filtros sobre varias muestras del
+ * sensor: sobremuestreo y diezmado (media de 2^n muestras), mediana móvil (quita picos sueltos) y
+ * media móvil exponencial (suaviza). Todo se hace con enteros en coma fija y memoria constante,
+ * sin coma flotante, que el nRF52832 no tiene en hardware para dobles y cuesta energía.
+ *
+ * Los bucles sobre bloques de muestras no tienen ramas ni dependencias entre iteraciones, para
+ * que el compilador del ordenador pueda vectorizarlos (ver host/bench_filtros.cpp).
+ */
+
+#ifndef FILTROS_H_INCLUIDO
+#define FILTROS_H_INCLUIDO
+
+namespace Filtros {
+
+  /**
+   * @brief Suma un bloque de muestras.
+   */
+  inline int32_t sumar( const int16_t * x, uint16_t n ) {
+	int32_t suma = 0;
+	for( uint16_t i = 0; i < n; i++ ) {
+	  suma += x[i];
+	}
+	return suma;
+  }
+
+  /**
+   * @brief Divide por 2^LOG2 redondeando al más cercano (también con negativos).
+   */
+  template< uint8_t LOG2 >
+  inline int32_t dividirRedondeando( int32_t v ) {
+	return LOG2 == 0 ? v : ( v + ( 1L << ( LOG2 - 1 ) ) ) >> LOG2;
+  }
+
+  /**
+   * @brief Media de 2^LOG2_N muestras (sobremuestreo de una lectura).
+   */
+  template< uint8_t LOG2_N >
+  inline int16_t promediar( const int16_t * x ) {
+	return (int16_t) dividirRedondeando< LOG2_N >( sumar( x, 1 << LOG2_N ) );
+  }
+
+  /**
+   * @brief Diezma un bloque: cada 2^LOG2_FACTOR muestras de entrada dan una de salida (su media).
+   *
+   * @param x Muestras de entrada.
+   * @param n Número de muestras de entrada (múltiplo de 2^LOG2_FACTOR).
+   * @param y Donde dejar las n / 2^LOG2_FACTOR muestras de salida.
+   */
+  template< uint8_t LOG2_FACTOR >
+  inline void diezmar( const int16_t * x, uint16_t n, int16_t * y ) {
+	const uint16_t FACTOR = 1 << LOG2_FACTOR;
+	for( uint16_t i = 0; i < n / FACTOR; i++ ) {
+	  y[i] = promediar< LOG2_FACTOR >( &x[i * FACTOR] );
+	}
+  }
+
+  /**
+   * @brief Mediana de n muestras (n impar) sin ordenarlas ni usar memoria extra.
+   *
+   * Para cada candidata cuenta cuántas muestras son menores y cuántas iguales; la mediana es
+   * la que deja la posición central dentro de su rango. O(n^2), pero sin ramas en el bucle
+   * interno y con ventanas de 3 a 9 muestras sale más barato que ordenar.
+   */
+  inline int16_t mediana( const int16_t * x, uint8_t n ) {
+	const uint8_t centro = n / 2;
+	for( uint8_t i = 0; i < n; i++ ) {
+	  uint8_t menores = 0;
+	  uint8_t iguales = 0;
+	  for( uint8_t j = 0; j < n; j++ ) {
+		menores += x[j] < x[i];
+		iguales += x[j] == x[i];
+	  }
+	  if( menores <= centro && centro < menores + iguales ) {
+		return x[i];
+	  }
+	}
+	return x[centro]; // no pasa
+  }
+
+  /**
+   * @class FiltroMediana
+   * @brief Mediana móvil de las últimas VENTANA muestras.
+   *
+   * Mientras no se han visto VENTANA muestras devuelve la mediana de las que haya.
+   * Con VENTANA = 1 no filtra.
+   *
+   * @tparam VENTANA Número de muestras de la ventana (impar).
+   */
+  template< uint8_t VENTANA >
+  class FiltroMediana {
+
+	static_assert( VENTANA % 2 == 1, "la ventana de la mediana tiene que ser impar" );
+
+  private:
+
+	int16_t ventana[VENTANA];
+	uint8_t posicion = 0;
+	uint8_t llenas = 0;
+
+  public:
+
+	/**
+	 * @brief Añade una muestra y devuelve la mediana de la ventana.
+	 */
+	int16_t filtrar( int16_t x ) {
+	  ventana[posicion] = x;
+	  posicion = ( posicion + 1 ) % VENTANA;
+	  if( llenas < VENTANA ) {
+		llenas++;
+		// con la ventana a medio llenar, la mediana de las que hay (de un número impar de ellas)
+		return mediana( ventana, llenas % 2 == 1 ? llenas : llenas - 1 );
+	  }
+	  return mediana( ventana, VENTANA );
+	}
+
+	/// Olvida las muestras vistas.
+	void reiniciar() {
+	  posicion = 0;
+	  llenas = 0;
+	}
+
+  };
+
+  /**
+   * @class FiltroEMA
+   * @brief Media móvil exponencial en coma fija: y += ( x - y ) / 2^ALFA_LOG2.
+   *
+   * El estado se guarda con ALFA_LOG2 bits de fracción para no perder resolución con
+   * escalones pequeños. La primera muestra inicializa el filtro. Con ALFA_LOG2 = 0 no filtra.
+   *
+   * @tparam ALFA_LOG2 Logaritmo en base 2 del inverso del peso de cada muestra nueva.
+   */
+  template< uint8_t ALFA_LOG2 >
+  class FiltroEMA {
+
+	static_assert( ALFA_LOG2 <= 15, "el estado de la EMA no cabe en 32 bits" );
+
+  private:
+
+	int32_t acumulado = 0;   ///< Salida multiplicada por 2^ALFA_LOG2.
+	bool iniciado = false;
+
+  public:
+
+	/**
+	 * @brief Añade una muestra y devuelve la salida filtrada.
+	 */
+	int16_t filtrar( int16_t x ) {
+	  if( !iniciado ) {
+		acumulado = (int32_t) x << ALFA_LOG2;
+		iniciado = true;
+	  } else {
+		acumulado += x - dividirRedondeando< ALFA_LOG2 >( acumulado );
+	  }
+	  return (int16_t) dividirRedondeando< ALFA_LOG2 >( acumulado );
+	}
+
+	/// Vuelve a empezar con la siguiente muestra.
+	void reiniciar() {
+	  iniciado = false;
+	}
+
+  };
+
+  /**
+   * @class Cadena
+   * @brief Sobremuestreo + mediana móvil + EMA: convierte 2^LOG2_SOBREMUESTREO muestras del
+   * sensor en una lectura.
+   *
+   * @tparam LOG2_SOBREMUESTREO Logaritmo en base 2 de las muestras por lectura (0: una muestra).
+   * @tparam VENTANA_MEDIANA Lecturas de la mediana móvil (1: sin mediana).
+   * @tparam ALFA_LOG2 Parámetro de la EMA (0: sin EMA).
+   */
+  template< uint8_t LOG2_SOBREMUESTREO, uint8_t VENTANA_MEDIANA, uint8_t ALFA_LOG2 >
+  class Cadena {
+
+  public:
+
+	/// Muestras del sensor que hacen falta por lectura.
+	static const uint16_t SOBREMUESTREO = 1 << LOG2_SOBREMUESTREO;
+
+  private:
+
+	FiltroMediana< VENTANA_MEDIANA > laMediana;
+	FiltroEMA< ALFA_LOG2 > laEMA;
+
+  public:
+
+	/**
+	 * @brief Filtra una lectura.
+	 *
+	 * @param muestras SOBREMUESTREO muestras seguidas del sensor.
+	 * @return La lectura filtrada.
+	 */
+	int16_t filtrar( const int16_t * muestras ) {
+	  return laEMA.filtrar( laMediana.filtrar( promediar< LOG2_SOBREMUESTREO >( muestras ) ) );
+	}
+
+	/**
+	 * @brief Toma SOBREMUESTREO muestras de una función de lectura y las filtra.
+	 */
+	template< typename Lector >
+	int16_t medir( Lector leer ) {
+	  int16_t muestras[SOBREMUESTREO];
+	  for( uint16_t i = 0; i < SOBREMUESTREO; i++ ) {
+		muestras[i] = leer();
+	  }
+	  return filtrar( muestras );
+	}
+
+	/// Olvida las lecturas anteriores.
+	void reiniciar() {
+	  laMediana.reiniciar();
+	  laEMA.reiniciar();
+	}
+
+  };
+
+} // namespace Filtros
+
+#endif
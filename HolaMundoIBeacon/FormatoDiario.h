@@ -0,0 +1,166 @@
+/**
+ * @file FormatoDiario.h
+ * @brief Declaración de la clase FormatoDiario.
+ *
+ * Formato de los ficheros del diario de mediciones en la flash (ver DiarioMediciones.h). El
+ * diario son varios segmentos (ficheros) que se llenan por turno; cada uno empieza con una
+ * cabecera y sigue con entradas que sólo se añaden al final (valores en little-endian):
+ *
+ *   segmento := 'D' 'M' versión(1) 0 número(uint32) arranque(uint16) entrada*
+ *   entrada  := longitud(uint8) arranque(uint16) secuencia(uint32) instante(uint32) bloque crc(uint16)
+ *
+ *  - número: crece con cada segmento nuevo; el de número más alto es el que se está llenando.
+ *  - arranque: cuenta de reinicios de la placa; millis() vuelve a 0 en cada uno.
+ *  - longitud: bytes de arranque + secuencia + instante + bloque.
+ *  - secuencia: de la primera muestra del bloque, con los 32 bits (el bloque sólo lleva 16).
+ *  - instante: millis() al escribir la entrada; es el «ahora» con el que se empaquetó el bloque,
+ *    así que decodificarBloque( bloque, ..., instante ) da el millis() de cada muestra.
+ *  - bloque: un bloque de CodecMuestras (ver BufferMediciones.h).
+ *  - crc: CRC-16/CCITT (0x1021, valor inicial 0xffff) de longitud .. bloque.
+ *
+ * Si la placa se reinicia mientras escribe, la última entrada queda cortada o con el CRC mal; al
+ * abrir el diario se recorre el segmento actual y se corta tras la última entrada buena.
+ */
+
+#ifndef FORMATO_DIARIO_H_INCLUIDO
+#define FORMATO_DIARIO_H_INCLUIDO
+
+/**
+ * @class FormatoDiario
+ * @brief Codificación y comprobación de las cabeceras y entradas del diario.
+ */
+class FormatoDiario {
+
+public:
+
+  static constexpr uint8_t VERSION = 1;
+  static constexpr uint8_t TAMANYO_CABECERA = 10;          ///< Cabecera del segmento.
+  static constexpr uint8_t TAMANYO_CABECERA_ENTRADA = 11;  ///< longitud + arranque + secuencia + instante.
+  static constexpr uint8_t TAMANYO_CRC = 2;
+  static constexpr uint8_t MAX_BLOQUE = 255 - ( TAMANYO_CABECERA_ENTRADA - 1 );
+  static constexpr uint16_t MAX_ENTRADA = TAMANYO_CABECERA_ENTRADA + MAX_BLOQUE + TAMANYO_CRC;
+
+  /**
+   * @struct Entrada
+   * @brief Una entrada leída (el bloque apunta dentro de los bytes leídos).
+   */
+  struct Entrada {
+	uint16_t arranque;
+	uint32_t secuencia;
+	uint32_t instante;
+	const uint8_t * bloque;
+	uint8_t tamanyoBloque;
+  };
+
+  /**
+   * @brief CRC-16/CCITT (polinomio 0x1021) de un bloque de bytes, continuando desde `crc`.
+   */
+  static uint16_t crc16( const uint8_t * p, uint16_t n, uint16_t crc = 0xffff ) {
+	for( uint16_t i = 0; i < n; i++ ) {
+	  crc ^= (uint16_t) p[i] << 8;
+	  for( uint8_t b = 0; b < 8; b++ ) {
+		crc = ( crc & 0x8000 ) ? (uint16_t) ( ( crc << 1 ) ^ 0x1021 ) : (uint16_t) ( crc << 1 );
+	  }
+	}
+	return crc;
+  }
+
+  static uint16_t leer16( const uint8_t * p ) {
+	return (uint16_t) ( p[0] | ( p[1] << 8 ) );
+  }
+
+  static uint32_t leer32( const uint8_t * p ) {
+	return (uint32_t) p[0] | ( (uint32_t) p[1] << 8 ) | ( (uint32_t) p[2] << 16 ) | ( (uint32_t) p[3] << 24 );
+  }
+
+  static void escribir16( uint8_t * p, uint16_t v ) {
+	p[0] = (uint8_t) v;
+	p[1] = (uint8_t) ( v >> 8 );
+  }
+
+  static void escribir32( uint8_t * p, uint32_t v ) {
+	for( uint8_t i = 0; i < 4; i++ ) {
+	  p[i] = (uint8_t) ( v >> ( 8 * i ) );
+	}
+  }
+
+  /**
+   * @brief Escribe la cabecera de un segmento (TAMANYO_CABECERA bytes).
+   */
+  static void escribirCabecera( uint8_t * p, uint32_t numero, uint16_t arranque ) {
+	p[0] = 'D';
+	p[1] = 'M';
+	p[2] = VERSION;
+	p[3] = 0;
+	escribir32( &p[4], numero );
+	escribir16( &p[8], arranque );
+  }
+
+  /**
+   * @brief Comprueba y lee la cabecera de un segmento.
+   * @return false si no es una cabecera del diario de esta versión.
+   */
+  static bool leerCabecera( const uint8_t * p, uint32_t n, uint32_t & numero, uint16_t & arranque ) {
+	if( n < TAMANYO_CABECERA || p[0] != 'D' || p[1] != 'M' || p[2] != VERSION ) {
+	  return false;
+	}
+	numero = leer32( &p[4] );
+	arranque = leer16( &p[8] );
+	return true;
+  }
+
+  /**
+   * @brief Completa una entrada cuyo bloque ya está en p[TAMANYO_CABECERA_ENTRADA...].
+   *
+   * @param p Donde va la entrada (al menos MAX_ENTRADA bytes).
+   * @param tamanyoBloque Bytes del bloque (hasta MAX_BLOQUE).
+   * @return Bytes de la entrada.
+   */
+  static uint16_t cerrarEntrada( uint8_t * p, uint8_t tamanyoBloque, uint16_t arranque, uint32_t secuencia,
+								 uint32_t instante ) {
+	p[0] = (uint8_t) ( TAMANYO_CABECERA_ENTRADA - 1 + tamanyoBloque );
+	escribir16( &p[1], arranque );
+	escribir32( &p[3], secuencia );
+	escribir32( &p[7], instante );
+	uint16_t n = TAMANYO_CABECERA_ENTRADA + tamanyoBloque;
+	escribir16( &p[n], crc16( p, n ) );
+	return n + TAMANYO_CRC;
+  }
+
+  /**
+   * @brief Bytes de una entrada a partir de su primer byte (longitud).
+   */
+  static uint16_t tamanyoEntrada( uint8_t longitud ) {
+	return 1 + longitud + TAMANYO_CRC;
+  }
+
+  /**
+   * @brief Comprueba y lee una entrada.
+   *
+   * @param p Bytes desde el principio de la entrada.
+   * @param n Bytes disponibles.
+   * @return Bytes de la entrada, o 0 si está cortada, mal formada o con el CRC mal.
+   */
+  static uint16_t leerEntrada( const uint8_t * p, uint32_t n, Entrada & e ) {
+	if( n < 1 || p[0] < TAMANYO_CABECERA_ENTRADA - 1 ) {
+	  return 0;
+	}
+	uint16_t total = tamanyoEntrada( p[0] );
+	if( n < total ) {
+	  return 0;
+	}
+	uint16_t sinCrc = total - TAMANYO_CRC;
+	if( crc16( p, sinCrc ) != leer16( &p[sinCrc] ) ) {
+	  return 0;
+	}
+	e.arranque = leer16( &p[1] );
+	e.secuencia = leer32( &p[3] );
+	e.instante = leer32( &p[7] );
+	e.bloque = &p[TAMANYO_CABECERA_ENTRADA];
+	e.tamanyoBloque = (uint8_t) ( sinCrc - TAMANYO_CABECERA_ENTRADA );
+	return total;
+  }
+
+};
+
+#endif
@@ -9,6 +9,7 @@
  */
 
 #include <bluefruit.h>
+#include <InternalFileSystem.h>
 
 #undef min 
 #undef max 
@@ -39,8 +40,19 @@ namespace Globales {
 };
 
 #include "EmisoraBLE.h"
+#include "DespachadorOrdenes.h"
+#include "TramaMediciones.h"
+#include "BufferMediciones.h"
+#include "IntervaloAdaptativo.h"
+#include "PoliticaPublicacion.h"
+#include "Sensores.h"
 #include "Publicador.h"
 #include "Medidor.h"
+#include "Planificador.h"
+#include "Reposo.h"
+#include "Sondas.h"
+#include "DescargaHistorial.h"
+#include "DiarioMediciones.h"
 
 
 namespace Globales {
@@ -59,6 +71,62 @@ namespace Globales {
    */
   Medidor elMedidor;
 
+
+
+  /**
+   * @brief Planificador de las tareas del bucle principal.
+   */
+  Planificador< 12 > elPlanificador;
+
+
+
+  /**
+   * @brief Búfer de las mediciones pendientes de publicar (comprimidas).
+   */
+  BufferMediciones< 512 > elBuffer;
+
+
+
+  /**
+   * @brief Historial de todas las mediciones (unos 4 bytes por muestra: una hora a 2,5 s), que se
+   * descarga por GATT.
+   */
+  using Historial = BufferMediciones< 12288 >;
+  Historial elHistorial;
+
+
+
+  /**
+   * @brief Servicio de descarga del historial: órdenes (escritura) y bloques de muestras (notificación).
+   */
+  constexpr UUID128 UUID_SERVICIO_HISTORIAL = UUID128::deNombre( "GTI-3A-HISTORIAL" );
+  constexpr UUID128 UUID_ORDENES_HISTORIAL = UUID128::deNombre( "HistorialOrdenes" );
+  constexpr UUID128 UUID_DATOS_HISTORIAL = UUID128::deNombre( "HistorialDatos" );
+
+  ServicioEnEmisoraFijo< 2 > elServicioHistorial( UUID_SERVICIO_HISTORIAL );
+  ServicioEnEmisora::Caracteristica lasOrdenesHistorial( UUID_ORDENES_HISTORIAL, CHR_PROPS_WRITE,
+														 SECMODE_NO_ACCESS, SECMODE_OPEN, 5 );
+  ServicioEnEmisora::Caracteristica losDatosHistorial( UUID_DATOS_HISTORIAL, CHR_PROPS_NOTIFY,
+													   SECMODE_OPEN, SECMODE_NO_ACCESS, BLEGATT_ATT_MTU_MAX - 3 );
+
+  DescargaHistorial< Historial > laDescarga( elHistorial, losDatosHistorial );
+
+
+
+  /**
+   * @brief Diario del historial en la flash interna: sobrevive a los reinicios.
+   */
+  using Diario = DiarioMediciones< Historial >;
+  Diario elDiario( elHistorial, InternalFS );
+
+
+
+  /**
+   * @brief Órdenes escritas en lasOrdenesHistorial: las de laDescarga y Loop::ORDEN_GUARDAR_DIARIO.
+   */
+  using Despachador = DespachadorOrdenes< 4 >;
+  Despachador elDespachador;
+
 };
 
 
@@ -72,136 +140,625 @@ namespace Globales {
  */
 void inicializarPlaquita () {
 
-  
+  Sondas::activar(); ///< Enciende el contador de ciclos de las sondas.
 
 } 
 
 
 
 /**
- * @brief Función de configuración (setup).
- * 
- * Esta función se ejecuta una sola vez al inicio del programa y prepara el puerto serie,
- * inicializa la emisora BLE y el medidor de CO2 y temperatura.
+ * @namespace Loop
+ * @brief Espacio de nombres que contiene las variables relacionadas con el bucle principal.
  */
-void setup() {
+namespace Loop {
 
-  Globales::elPuerto.esperarDisponible(); ///< Espera a que el puerto serie esté disponible.
 
-  inicializarPlaquita(); ///< Inicializa la placa.
+  /**
+   * @brief Contador del número de ciclos de publicación.
+   */
+  uint8_t cont = 0;
 
-  Globales::elPublicador.encenderEmisora(); ///< Enciende la emisora BLE.
 
-  
-  Globales::elMedidor.iniciarMedidor(); ///< Inicia el medidor de CO2 y temperatura.
 
-  esperar( 1000 ); ///< Espera 1 segundo.
+  /**
+   * @brief Milisegundos entre dos mediciones (se guardan en el búfer).
+   */
+  const uint32_t PERIODO_MUESTREO = 2500;
+
+
+
+  /**
+   * @brief Milisegundos entre el comienzo de dos ciclos de publicación.
+   */
+  const uint32_t PERIODO_CICLO = 7500;
+
+
+
+  /**
+   * @brief Milisegundos que se anuncia cada bloque de muestras durante el volcado del búfer.
+   */
+  const uint32_t TIEMPO_POR_BLOQUE = 500;
+
+
+
+  /**
+   * @brief Volcar el búfer en lotes con anuncios extendidos de BLE 5 (un lote son unos 200 bytes
+   * de muestras, una docena de bloques) en lugar de en bloques de anuncios clásicos.
+   *
+   * Sólo los reciben los escáneres con anuncios extendidos; si la SoftDevice no los admite se
+   * sigue con los bloques. El PHY secundario (el del paquete con los datos) a 2M pasa el lote en
+   * la mitad de tiempo que a 1M; con el codificado (S8) llega más lejos pero tarda ocho veces más.
+   */
+  const bool LOTES_EXTENDIDOS = false;
+  const uint8_t PHY_PRIMARIO_LOTES = BLE_GAP_PHY_1MBPS;
+  const uint8_t PHY_SECUNDARIO_LOTES = BLE_GAP_PHY_2MBPS;
 
-  Globales::elPuerto.escribir( "---- setup(): fin ---- \n " ); ///< Escribe un mensaje en el puerto serie indicando que el setup ha finalizado.
 
-} 
+
+  /**
+   * @brief Notificaciones que la SoftDevice acepta en cola: la ventana de la descarga del historial.
+   */
+  const uint8_t COLA_NOTIFICACIONES = 8;
+
+
+
+  /**
+   * @brief Milisegundos entre dos intentos de enviar del historial mientras no vuelven créditos.
+   */
+  const uint32_t MS_ENTRE_ENVIOS_HISTORIAL = 5;
+
+
+
+  /**
+   * @brief Longitud de los eventos de conexión (unidades de 1,25 ms): la del intervalo de
+   * PerfilesConexion::RAPIDO, para que la descarga use el evento entero.
+   */
+  const uint16_t LONGITUD_EVENTO = 6;
+
+
+
+  /**
+   * @brief Milisegundos sin descargar tras los que la conexión pasa a PerfilesConexion::AHORRO.
+   */
+  const uint32_t MS_HASTA_AHORRO = 10000;
+
+
+
+  /**
+   * @brief Milisegundos hasta volver a pedir un paso de la negociación que la SoftDevice no aceptó.
+   */
+  const uint32_t MS_REINTENTO_CONEXION = 50;
+
+
+  /**
+   * @brief Milisegundos que puede retrasarse una tarea para despertar una sola vez por ella y las
+   * que vencen poco antes (ver Planificador::msHastaSiguiente()).
+   *
+   * Cada despertar cuesta arrancar la CPU y el reloj rápido; los pasos del LED, el volcado y las
+   * mediciones caen a menudo a unos pocos ms unos de otros.
+   */
+  const uint32_t HOLGURA_DESPERTAR = 20;
+
+
+
+  /**
+   * @brief Orden (en la característica de órdenes del historial) que guarda ya el diario en la
+   * flash, p. ej. antes de desenchufar la placa. Va DIFERIDA: la flash no se toca en el callback.
+   */
+  const uint8_t ORDEN_GUARDAR_DIARIO = 0x10;
+
+
+
+  /**
+   * @brief Milisegundos entre dos escrituras del diario en la flash.
+   *
+   * Es lo que se puede perder si la placa se reinicia. Cada escritura cuesta al menos un borrado
+   * de bloque (LittleFS copia el último bloque del fichero), así que con la partición de 28 KB
+   * guardar cada minuto la gastaría en unos meses (ver build/bench_diario).
+   */
+  const uint32_t PERIODO_DIARIO = 600000;
+
+
+
+  /**
+   * @brief Bytes del diario en cada línea de la exportación por el puerto serie.
+   */
+  const uint8_t BYTES_POR_LINEA_DIARIO = 32;
+
+
+
+  /**
+   * @brief Por dónde va la exportación del diario (segmento y byte); sin exportar, fuera de rango.
+   */
+  uint8_t segmentoExportado = Globales::Diario::NUMERO_DE_SEGMENTOS;
+  uint32_t posicionExportada = 0;
+
+
+
+  /**
+   * @brief Duración de cada paso de la secuencia de parpadeo (encendido, apagado, encendido...).
+   */
+  const uint16_t PASOS_LUCECITAS[] = { 100, 400, 100, 400, 100, 400, 1000, 1000 };
+  uint8_t pasoLucecitas = 0;
+
+
+
+  /**
+   * @brief Línea del informe de las sondas que se escribe a continuación: etapa y cubeta
+   * (-1 es la línea de resumen de la etapa).
+   */
+  uint8_t etapaInforme = Sondas::NUMERO_DE_ETAPAS;
+  int8_t cubetaInforme = -1;
+};
 
 
 
 /**
- * @brief Controla la secuencia de parpadeo del LED.
+ * @namespace Tareas
+ * @brief Tareas del Planificador que forman el ciclo de medición y publicación.
  * 
- * Esta función activa y desactiva el LED con un brillo del 100% durante varios intervalos de tiempo.
+ * Ninguna tarea bloquea: cada una hace su trabajo y programa la siguiente. Las mediciones se
+ * guardan en el búfer a su ritmo y cada ciclo de publicación lo vacía en una ráfaga de anuncios,
+ * mientras el LED parpadea en paralelo.
  */
+namespace Tareas {
 
-inline void lucecitas() {
-  using namespace Globales;
+  void medir();
+  void publicar();
+  void volcar();
+  void lucecitas();
+  void informarSondas();
+  void descargarHistorial();
+  void guardarDiario();
+  void exportarDiario();
+  void negociarConexion();
+  void ahorrarConexion();
+  void ejecutarOrdenesDiferidas();
 
-  elLED.brillar( 100 ); ///< Enciende el LED al 100% de brillo.
-  esperar ( 400 ); ///< Espera 400 ms.
-  elLED.brillar( 100 ); 
-  esperar ( 400 ); 
-  Globales::elLED.brillar( 100 ); 
-  esperar ( 400 ); 
-  Globales::elLED.brillar( 1000 ); ///< Enciende el LED al 100% de brillo por un tiempo más largo.
-  esperar ( 1000 ); ///< Espera 1 segundo.
-}
-} 
 
 
-/**
- * @namespace Loop
- * @brief Espacio de nombres que contiene las variables relacionadas con el bucle principal.
- */
-namespace Loop {
+  /**
+   * @brief Visitante de Sensores::Todos para medir(): mide un sensor y guarda la lectura.
+   */
+  struct MedirSensor {
+	uint32_t ahora;
+
+	template< typename S >
+	void visitar() {
+	  using namespace Globales;
+
+	  int16_t valor = elMedidor.medir< S >(); ///< Mide el sensor.
+
+	  // sólo se guarda (y se publica) lo que sale de la banda muerta o toca de latido
+	  // el historial lo guarda todo
+	  elHistorial.anyadir( S::ID, valor, ahora );
+
+	  if( elPublicador.laPolitica.hayQuePublicar( S::ID, valor, ahora ) ) {
+		elBuffer.anyadir( S::ID, valor, ahora );
+	  }
+	}
+  };
+
 
 
   /**
-   * @brief Contador del número de iteraciones del bucle principal.
+   * @brief Toma las mediciones de todos los sensores y las guarda en el búfer.
    */
-  uint8_t cont = 0;
+  void medir() {
+	MedirSensor medirSensor = { (uint32_t) millis() };
+	Sensores::Todos::paraCada( medirSensor );
+  }
+
+
+
+  /**
+   * @brief Empieza un ciclo de publicación: vuelca el búfer y lanza el parpadeo.
+   */
+  void publicar() {
+	using namespace Loop;
+	using namespace Globales;
+
+	cont++; ///< Incrementa el contador de ciclos.
+
+	elPuerto.trazar< Trazas::Id::CICLO_EMPIEZA >( cont );
+
+	elPlanificador.programar( volcar, 0 );
+
+	pasoLucecitas = 0;
+	elPlanificador.programar( lucecitas, 0 );
+  }
+
+
+
+  /**
+   * @brief Anuncia el siguiente lote del búfer, o detiene el anuncio si ya está vacío.
+   * 
+   * Se reprograma cada TIEMPO_POR_BLOQUE hasta vaciar el búfer, de modo que todas las muestras
+   * acumuladas salen en una sola ráfaga (con Loop::LOTES_EXTENDIDOS, casi siempre en un anuncio).
+   */
+  void volcar() {
+	using namespace Globales;
+
+	if( elPublicador.anunciarLote( elBuffer ) ) {
+	  elPlanificador.programar( volcar, Loop::TIEMPO_POR_BLOQUE );
+	  return;
+	}
+
+	elPublicador.laEmisora.detenerAnuncio(); ///< Detiene el anuncio BLE.
+
+	elPuerto.trazar< Trazas::Id::CICLO_ACABA >( Loop::cont );
+  }
+
+
+
+  /**
+   * @brief Da un paso de la secuencia de parpadeo del LED y programa el siguiente.
+   * 
+   * Los pasos pares encienden el LED y los impares lo apagan, cada uno durante el tiempo
+   * indicado en Loop::PASOS_LUCECITAS.
+   */
+  void lucecitas() {
+	using namespace Loop;
+
+	const uint8_t NUM_PASOS = sizeof( PASOS_LUCECITAS ) / sizeof( PASOS_LUCECITAS[0] );
+
+	if( pasoLucecitas % 2 == 0 ) {
+	  Globales::elLED.encender();
+	} else {
+	  Globales::elLED.apagar();
+	}
+
+	uint16_t duracion = PASOS_LUCECITAS[ pasoLucecitas ];
+	pasoLucecitas++;
+	if( pasoLucecitas < NUM_PASOS ) {
+	  Globales::elPlanificador.programar( lucecitas, duracion );
+	}
+  }
+
+
+
+  /**
+   * @brief Escribe una línea del informe de las sondas y programa la siguiente.
+   * 
+   * Por cada etapa sale una línea de resumen y otra por cubeta no vacía del histograma. Van de
+   * una en una, dejando que se vacíe el puerto entre ellas, para no desbordar su cola.
+   */
+  void informarSondas() {
+	using namespace Loop;
+	using namespace Globales;
+
+	const Sondas::Estadistica & e = Sondas::estadistica( (Sondas::Etapa) etapaInforme );
+	if( cubetaInforme < 0 ) {
+	  elPuerto.trazar< Trazas::Id::SONDA_RESUMEN >( etapaInforme, e.veces, e.veces > 0 ? e.minimo : 0,
+													 e.media(), e.maximo );
+	} else {
+	  uint32_t desde = cubetaInforme == 0 ? 0 : 1UL << cubetaInforme;
+	  uint32_t hasta = cubetaInforme == Sondas::CUBETAS - 1 ? UINT32_MAX : 2UL << cubetaInforme;
+	  elPuerto.trazar< Trazas::Id::SONDA_CUBETA >( desde, hasta, e.histograma[cubetaInforme] );
+	}
+
+	// siguiente línea: la siguiente cubeta no vacía o el resumen de la siguiente etapa
+	do {
+	  cubetaInforme++;
+	} while( cubetaInforme < Sondas::CUBETAS && e.histograma[cubetaInforme] == 0 );
+	if( cubetaInforme == Sondas::CUBETAS ) {
+	  cubetaInforme = -1;
+	  etapaInforme++;
+	}
+	if( etapaInforme < Sondas::NUMERO_DE_ETAPAS ) {
+	  elPlanificador.programar( informarSondas, PuertoSerie::MS_ENTRE_VACIADOS );
+	}
+  }
+
+
+
+  /**
+   * @brief Envía bloques del historial mientras haya créditos y se reprograma hasta acabar.
+   * 
+   * Nunca espera a la SoftDevice: si la ventana está llena, vuelve a intentarlo al cabo de
+   * Loop::MS_ENTRE_ENVIOS_HISTORIAL.
+   */
+  void descargarHistorial() {
+	using namespace Globales;
+
+	if( laDescarga.enviar( millis() ) ) {
+	  elPlanificador.programar( descargarHistorial, Loop::MS_ENTRE_ENVIOS_HISTORIAL );
+	} else {
+	  elPlanificador.programar( ahorrarConexion, Loop::MS_HASTA_AHORRO );
+	}
+  }
+
+
+
+  /**
+   * @brief Ejecuta las órdenes BLE que el despachador ha dejado para loop().
+   */
+  void ejecutarOrdenesDiferidas() {
+	Globales::elDespachador.ejecutarDiferidas();
+  }
+
+
+
+  /**
+   * @brief Sigue con la negociación de la conexión y, al acabar, escribe lo que ha aceptado la central.
+   */
+  void negociarConexion() {
+	using namespace Globales;
+
+	NegociacionConexion::Resultado r = NegociacionConexion::atender( millis() );
+	if( r == NegociacionConexion::REINTENTAR ) {
+	  elPlanificador.programar( negociarConexion, Loop::MS_REINTENTO_CONEXION );
+	}
+	if( r == NegociacionConexion::ESPERANDO ) {
+	  // por si la central no contesta; si contesta antes, loop() la adelanta
+	  elPlanificador.programar( negociarConexion, NegociacionConexion::msHastaPlazo( millis() ) );
+	}
+	if( r != NegociacionConexion::TERMINADA ) {
+	  return;
+	}
+	const ParametrosConexion & p = NegociacionConexion::parametros();
+	elPuerto.trazar< Trazas::Id::CONEXION_NEGOCIADA >( p.phy, p.mtu, p.longitudDatos, p.intervalo, p.latencia,
+														NegociacionConexion::duracion(),
+														NegociacionConexion::rechazados() );
+	if( p.latencia == 0 && !laDescarga.estaDescargando() ) {
+	  elPlanificador.programar( ahorrarConexion, Loop::MS_HASTA_AHORRO );
+	}
+  }
+
+
+
+  /**
+   * @brief Pasa la conexión a PerfilesConexion::AHORRO si no se está descargando nada.
+   *
+   * Si se está negociando (p. ej. RAPIDO en una conexión nueva y ésta quedó programada en la
+   * anterior), no hace nada: al terminar, Tareas::negociarConexion() la vuelve a programar.
+   */
+  void ahorrarConexion() {
+	using namespace Globales;
+
+	if( Bluefruit.connected() && !NegociacionConexion::negociando() && !laDescarga.estaDescargando()
+		&& !laDescarga.hayOrden() ) {
+	  elPublicador.laEmisora.negociarConexion( Bluefruit.connHandle(), PerfilesConexion::AHORRO );
+	}
+  }
+
+
+
+  /**
+   * @brief Copia a la flash las muestras del historial que aún no estén en el diario.
+   */
+  void guardarDiario() {
+	Globales::elDiario.guardar( millis() );
+  }
+
+
+
+  /**
+   * @brief Escribe una línea del diario por el puerto serie y programa la siguiente.
+   * 
+   * Cada línea es `diario <segmento> <byte> <hexadecimal>` con BYTES_POR_LINEA_DIARIO bytes
+   * crudos de los ficheros, del segmento más antiguo al actual; build/leer_diario la lee en el
+   * ordenador. Si la cola del puerto no tiene sitio para la línea entera, espera a que se vacíe.
+   */
+  void exportarDiario() {
+	using namespace Loop;
+	using namespace Globales;
+
+	const uint16_t LONGITUD_LINEA = 24 + 2 * BYTES_POR_LINEA_DIARIO;
+	if( elPuerto.bytesPendientes() + LONGITUD_LINEA > PuertoSerie::TAMANYO_COLA ) {
+	  elPlanificador.programar( exportarDiario, PuertoSerie::MS_ENTRE_VACIADOS );
+	  return;
+	}
+
+	uint8_t bytes[BYTES_POR_LINEA_DIARIO];
+	uint16_t n = elDiario.leerCrudo( segmentoExportado, posicionExportada, bytes, sizeof( bytes ) );
+	if( n == 0 ) {
+	  segmentoExportado++;
+	  posicionExportada = 0;
+	  if( segmentoExportado < Diario::NUMERO_DE_SEGMENTOS ) {
+		elPlanificador.programar( exportarDiario, 0 );
+	  } else {
+		elPuerto.trazar< Trazas::Id::DIARIO_FIN_EXPORTAR >( elDiario.entradasEscritas(), elDiario.muestrasEnFlash() );
+	  }
+	  return;
+	}
+
+	const char HEX_DIGITOS[] = "0123456789abcdef";
+	char hex[2 * BYTES_POR_LINEA_DIARIO + 2];
+	for( uint16_t i = 0; i < n; i++ ) {
+	  hex[2 * i] = HEX_DIGITOS[bytes[i] >> 4];
+	  hex[2 * i + 1] = HEX_DIGITOS[bytes[i] & 0x0f];
+	}
+	hex[2 * n] = '\n';
+	hex[2 * n + 1] = 0;
+	elPuerto.escribir( "diario " );
+	elPuerto.escribir( segmentoExportado );
+	elPuerto.escribir( ' ' );
+	elPuerto.escribir( posicionExportada );
+	elPuerto.escribir( ' ' );
+	elPuerto.escribir( (const char *) hex );
+
+	posicionExportada += n;
+	elPlanificador.programar( exportarDiario, PuertoSerie::MS_ENTRE_VACIADOS );
+  }
+
 };
 
 
 
+/**
+ * @brief Callback de conexión: pide PerfilesConexion::RAPIDO, que la central acaba de conectarse y
+ * lo normal es que descubra los servicios y pida algo; si no, Tareas::ahorrarConexion() la pasa
+ * a AHORRO al cabo de Loop::MS_HASTA_AHORRO.
+ */
+void conexionEstablecida( uint16_t conn_handle ) {
+  Globales::elPublicador.laEmisora.negociarConexion( conn_handle, PerfilesConexion::RAPIDO );
+}
+
+
 
 /**
- * @brief Bucle principal del programa (loop).
- * 
- * Esta función se ejecuta continuamente y se encarga de realizar mediciones
- * de CO2 y temperatura, publicarlas mediante BLE, y manejar la secuencia de parpadeo del LED.
+ * @brief Manejador de Loop::ORDEN_GUARDAR_DIARIO (diferida: se ejecuta desde loop()).
+ *
+ * @return false si el diario no está abierto o alguna escritura ha fallado; sin nada que guardar
+ * es true.
  */
-void loop () {
+bool ordenGuardarDiario( void * contexto, const OrdenEscrita & orden ) {
+  uint32_t fallidas = Globales::elDiario.escriturasFallidas();
+  Globales::elDiario.guardar( millis() );
+  return Globales::elDiario.estaAbierto() && Globales::elDiario.escriturasFallidas() == fallidas;
+}
+
+
 
-  using namespace Loop;
+/**
+ * @brief Da de alta las órdenes de la característica de órdenes del historial.
+ *
+ * Las de la descarga son inmediatas (sólo anotan la orden, y loop() programa la descarga).
+ */
+void darDeAltaOrdenes() {
   using namespace Globales;
+  using D = DescargaHistorial< Historial >;
+
+  elDespachador.anyadir< D, &D::descargar >( D::DESCARGAR, D::TAMANYO_DESCARGAR, D::TAMANYO_DESCARGAR,
+											  Despachador::INMEDIATA, laDescarga );
+  elDespachador.anyadir< D, &D::reanudar >( D::REANUDAR, D::TAMANYO_REANUDAR, D::TAMANYO_REANUDAR,
+											 Despachador::INMEDIATA, laDescarga );
+  elDespachador.anyadir< D, &D::detener >( D::DETENER, D::TAMANYO_DETENER, D::TAMANYO_DETENER,
+											Despachador::INMEDIATA, laDescarga );
+  elDespachador.anyadir( Loop::ORDEN_GUARDAR_DIARIO, 1, 1, Despachador::DIFERIDA, ordenGuardarDiario, nullptr );
+  elDespachador.instalarEn( lasOrdenesHistorial );
+}
 
-  cont++; ///< Incrementa el contador de iteraciones del bucle.
 
-  elPuerto.escribir( "\n---- loop(): empieza " );
-  elPuerto.escribir( cont );
-  elPuerto.escribir( "\n" );
 
+/**
+ * @brief Función de configuración (setup).
+ * 
+ * Esta función se ejecuta una sola vez al inicio del programa y prepara el puerto serie,
+ * inicializa la emisora BLE y el medidor de CO2 y temperatura.
+ */
+void setup() {
 
-  lucecitas(); ///< Ejecuta la secuencia de parpadeo del LED.
+  Globales::elPuerto.esperarDisponible(); ///< Espera a que el puerto serie esté disponible.
 
-  
-  // Medición y publicación de CO2
-  int valorCO2 = elMedidor.medirCO2(); ///< Mide el valor del CO2.
-  
-  elPublicador.publicarCO2( valorCO2,
-							cont,
-							1000 
-							); ///< Publica el valor del CO2.
-  
-  
+  inicializarPlaquita(); ///< Inicializa la placa.
 
+  Globales::elPublicador.laEmisora.configurarNotificaciones( Loop::COLA_NOTIFICACIONES, Loop::LONGITUD_EVENTO ); ///< Antes de encenderla.
 
-  // Medición y publicación de temperatura
-  int valorTemperatura = elMedidor.medirTemperatura(); ///< Mide la temperatura.
-  
-  elPublicador.publicarTemperatura( valorTemperatura, 
-									cont,
-									1000 
-									); ///< Publica el valor de la temperatura.
+  Globales::elPublicador.encenderEmisora(); ///< Enciende la emisora BLE.
+
+  if( !Reposo::iniciar() ) { ///< Con la SoftDevice ya en marcha.
+	Globales::elPuerto.trazar< Trazas::Id::REPOSO_SIN_RADIO >();
+  }
+
+  if( Loop::LOTES_EXTENDIDOS ) {
+	bool admitidos = Globales::elPublicador.usarAnunciosExtendidos( Loop::PHY_PRIMARIO_LOTES, Loop::PHY_SECUNDARIO_LOTES );
+	Globales::elPuerto.trazar< Trazas::Id::LOTES_EXTENDIDOS >( admitidos, Loop::PHY_PRIMARIO_LOTES,
+															   Loop::PHY_SECUNDARIO_LOTES );
+  }
+
+  Globales::elPublicador.laEmisora.anyadirServicioConSusCaracteristicasYActivar( Globales::elServicioHistorial,
+																				 Globales::lasOrdenesHistorial,
+																				 Globales::losDatosHistorial );
+  darDeAltaOrdenes();
+  Globales::elPublicador.laEmisora.instalarCallbackConexionEstablecida( conexionEstablecida );
 
   
+  Globales::elMedidor.iniciarMedidor(); ///< Inicia el medidor de todos los sensores.
 
-  // Publicación de un anuncio iBeacon libre
-  char datos[21] = {
-	'H', 'o', 'l', 'a',
-	'H', 'o', 'l', 'a',
-	'H', 'o', 'l', 'a',
-	'H', 'o', 'l', 'a',
-	'H', 'o', 'l', 'a',
-	'H'
-  };
+  Globales::elPublicador.configurarPolitica();
 
-  elPublicador.laEmisora.emitirAnuncioIBeaconLibre ( &datos[0], 21 ); ///< Emite un anuncio iBeacon con los datos.
+  if( Globales::elDiario.abrir() ) {
+	Globales::elPuerto.trazar< Trazas::Id::DIARIO_ABIERTO >( Globales::elDiario.numeroArranque(),
+															  Globales::elDiario.segmentoActual(),
+															  Globales::elDiario.bytesCortadosAlAbrir() );
+	Globales::elPlanificador.programarPeriodica( Tareas::guardarDiario, Loop::PERIODO_DIARIO, Loop::PERIODO_DIARIO );
+  } else {
+	Globales::elPuerto.trazar< Trazas::Id::DIARIO_SIN_FLASH >();
+  }
 
-  esperar( 2000 ); ///< Espera 2 segundos.
+  Globales::elPlanificador.programarPeriodica( Tareas::medir, Loop::PERIODO_MUESTREO, 0 );
+  Globales::elPlanificador.programarPeriodica( Tareas::publicar, Loop::PERIODO_CICLO, 1000 ); ///< Primer ciclo tras 1 segundo.
 
-  elPublicador.laEmisora.detenerAnuncio(); ///< Detiene el anuncio BLE.
-  
+  Globales::elPuerto.trazar< Trazas::Id::SETUP_FIN >(); ///< Escribe un mensaje en el puerto serie indicando que el setup ha finalizado.
+
+} 
+
+
+
+/**
+ * @brief Lee las órdenes de una letra que llegan por el puerto serie.
+ * 
+ *  - 's': escribe el informe de las sondas (ver Sondas.h);
+ *  - 'e': escribe el tiempo en cada estado de Reposo y los despertares;
+ *  - 'r': pone a cero las estadísticas de las sondas y del reposo;
+ *  - 'd': guarda el diario y lo escribe entero (ver Tareas::exportarDiario()).
+ */
+void atenderOrdenes() {
+  while( Serial.available() > 0 ) {
+	int orden = Serial.read();
+	if( orden == 's' && Loop::etapaInforme >= Sondas::NUMERO_DE_ETAPAS ) {
+	  Loop::etapaInforme = 0;
+	  Loop::cubetaInforme = -1;
+	  Globales::elPlanificador.programar( Tareas::informarSondas, 0 );
+	} else if( orden == 'e' ) {
+	  Globales::elPuerto.trazar< Trazas::Id::RESIDENCIA >( Reposo::residenciaMs( Reposo::ACTIVO ),
+															Reposo::residenciaMs( Reposo::REPOSO ),
+															Reposo::residenciaMs( Reposo::RADIO ),
+															Reposo::despertares(), Reposo::anticipados() );
+	} else if( orden == 'r' ) {
+	  Sondas::reiniciar();
+	  Reposo::reiniciar();
+	} else if( orden == 'd' && Loop::segmentoExportado >= Globales::Diario::NUMERO_DE_SEGMENTOS ) {
+	  Globales::elDiario.guardar( millis() );
+	  Loop::segmentoExportado = 0;
+	  Loop::posicionExportada = 0;
+	  Globales::elPlanificador.programar( Tareas::exportarDiario, 0 );
+	}
+  }
+}
+
+
+
+/**
+ * @brief Bucle principal del programa (loop).
+ * 
+ * Ejecuta las tareas del Planificador que hayan vencido y duerme hasta el siguiente plazo (con
+ * Loop::HOLGURA_DESPERTAR) o hasta un evento de la SoftDevice (ver Reposo.h).
+ * Toda la espera del programa se concentra aquí, que es donde la placa duerme.
+ * En ese tiempo libre se vacía también la cola del puerto serie.
+ */
+void loop () {
+
+  atenderOrdenes();
+
+  if( Globales::laDescarga.hayOrden() && !Globales::elPlanificador.estaProgramada( Tareas::descargarHistorial ) ) {
+	Globales::elPlanificador.programar( Tareas::descargarHistorial, 0 );
+	// una descarga con la conexión en AHORRO: se vuelve a RAPIDO
+	uint16_t conexion = Bluefruit.connHandle();
+	if( Globales::elPublicador.laEmisora.parametrosConexion( conexion ).latencia != 0 ) {
+	  Globales::elPublicador.laEmisora.negociarConexion( conexion, PerfilesConexion::RAPIDO );
+	}
+  }
+
+  if( Globales::elDespachador.hayDiferidas()
+	  && !Globales::elPlanificador.estaProgramada( Tareas::ejecutarOrdenesDiferidas ) ) {
+	Globales::elPlanificador.programar( Tareas::ejecutarOrdenesDiferidas, 0 );
+  }
+
+  if( NegociacionConexion::hayTrabajo() ) {
+	Globales::elPlanificador.programar( Tareas::negociarConexion, 0 ); ///< Aunque esperase a MS_SIN_RESPUESTA.
+  }
+
+  uint32_t espera = Globales::elPlanificador.ejecutarPendientes( Loop::HOLGURA_DESPERTAR );
+
+  if( Globales::elPuerto.vaciar() && espera > PuertoSerie::MS_ENTRE_VACIADOS ) {
+	espera = PuertoSerie::MS_ENTRE_VACIADOS; ///< Vuelve pronto a seguir vaciando.
+  }
+
+  if( espera != Globales::elPlanificador.NADA_PROGRAMADO ) {
+	Reposo::dormir( espera ); ///< Duerme hasta el siguiente plazo o hasta un evento BLE.
+  }
 
-  
-  elPuerto.escribir( "---- loop(): acaba **** " );
-  elPuerto.escribir( cont );
-  elPuerto.escribir( "\n" );
-  
 } 
@@ -0,0 +1,103 @@
+
+/**
+ * @file IntervaloAdaptativo.h
+ * @brief Declaración de la clase IntervaloAdaptativo.
+ *
+ * Con un intervalo de anuncio fijo hay que elegir entre gastar radio (intervalo corto) o tardar
+ * en enseñar un valor nuevo (intervalo largo). IntervaloAdaptativo anuncia deprisa durante una
+ * ráfaga justo después de un cambio y, mientras las lecturas siguen estables, va multiplicando
+ * el intervalo hasta llegar al máximo:
+ *
+ *   cambio                                                         estable
+ *     | mínimo ... (rafaga_ms) | x factor (eventosPorEscalon) | x factor ... | máximo ...
+ */
+
+#ifndef INTERVALO_ADAPTATIVO_H_INCLUIDO
+#define INTERVALO_ADAPTATIVO_H_INCLUIDO
+
+/**
+ * @class IntervaloAdaptativo
+ * @brief Política del intervalo de anuncio: rápido tras un cambio y retroceso exponencial.
+ *
+ * Para configurarla se le asigna otra: `elIntervalo = IntervaloAdaptativo( 20, 5000 );`.
+ *
+ * Sólo lleva la cuenta; quien la usa aplica el intervalo (EmisoraBLE::cambiarIntervaloAnuncio())
+ * y vuelve a llamar a retroceder() pasados los milisegundos que le devuelve cada llamada (p. ej.
+ * con una tarea del Planificador).
+ */
+class IntervaloAdaptativo {
+
+public:
+
+  /// Límites del intervalo de anuncio en BLE, en ms (20 ms a 10,24 s).
+  static const uint16_t MINIMO_BLE_MS = 20;
+  static const uint16_t MAXIMO_BLE_MS = 10240;
+
+private:
+
+  uint16_t minimo_ms;
+  uint16_t maximo_ms;
+  uint16_t rafaga_ms;
+  uint8_t factor;
+  uint8_t eventosPorEscalon;
+
+  uint16_t intervalo_ms;
+
+  static uint16_t limitar( uint32_t ms ) {
+	return (uint16_t) ( ms < MINIMO_BLE_MS ? MINIMO_BLE_MS : ms > MAXIMO_BLE_MS ? MAXIMO_BLE_MS : ms );
+  }
+
+public:
+
+  /**
+   * @brief Constructor de la clase IntervaloAdaptativo. Empieza en el intervalo máximo.
+   *
+   * @param minimo_ms_ Intervalo durante la ráfaga que sigue a un cambio.
+   * @param maximo_ms_ Intervalo con las lecturas estables.
+   * @param rafaga_ms_ Duración de la ráfaga al intervalo mínimo.
+   * @param factor_ Multiplicador del intervalo en cada escalón del retroceso (2 o más).
+   * @param eventosPorEscalon_ Eventos de anuncio que dura cada escalón.
+   */
+  IntervaloAdaptativo( uint16_t minimo_ms_ = 20, uint16_t maximo_ms_ = 2000, uint16_t rafaga_ms_ = 300,
+					   uint8_t factor_ = 2, uint8_t eventosPorEscalon_ = 3 )
+	: minimo_ms( limitar( minimo_ms_ ) ), maximo_ms( limitar( maximo_ms_ < minimo_ms_ ? minimo_ms_ : maximo_ms_ ) ),
+	  rafaga_ms( rafaga_ms_ ), factor( factor_ < 2 ? 2 : factor_ ), eventosPorEscalon( eventosPorEscalon_ ),
+	  intervalo_ms( maximo_ms ) {
+  }
+
+  /**
+   * @brief Lo anunciado ha cambiado: vuelve al intervalo mínimo.
+   *
+   * @return Milisegundos hasta la siguiente llamada a retroceder().
+   */
+  uint32_t cambio() {
+	(*this).intervalo_ms = (*this).minimo_ms;
+	return (*this).rafaga_ms;
+  }
+
+  /**
+   * @brief Pasa al siguiente escalón del retroceso.
+   *
+   * @return Milisegundos hasta la siguiente llamada a retroceder(), o 0 si ya está en el máximo.
+   */
+  uint32_t retroceder() {
+	if( (*this).intervalo_ms >= (*this).maximo_ms ) {
+	  return 0;
+	}
+	uint32_t siguiente = (uint32_t) (*this).intervalo_ms * (*this).factor;
+	(*this).intervalo_ms = (uint16_t) ( siguiente > (*this).maximo_ms ? (*this).maximo_ms : siguiente );
+	return (*this).intervalo_ms >= (*this).maximo_ms ? 0 : (uint32_t) (*this).intervalo_ms * (*this).eventosPorEscalon;
+  }
+
+  /// Intervalo actual en ms.
+  uint16_t intervaloMs() const { return (*this).intervalo_ms; }
+
+  /// Intervalo actual en unidades de 0,625 ms (las de Bluefruit.Advertising.setInterval()).
+  uint16_t intervaloUnidades() const { return (uint16_t) ( (uint32_t) (*this).intervalo_ms * 1000 / 625 ); }
+
+  /// true si está en el intervalo máximo (no hace falta llamar más a retroceder()).
+  bool estaEnReposo() const { return (*this).intervalo_ms >= (*this).maximo_ms; }
+
+};
+
+#endif
@@ -4,25 +4,37 @@
  * @file Medidor.h
  * @brief Declaración de la clase Medidor.
  * 
- * Esta clase se encarga de gestionar las mediciones de CO2 y temperatura
- * de los sensores conectados a la placa.
+ * Esta clase se encarga de gestionar las mediciones de los sensores
+ * conectados a la placa (ver Sensores.h). Cada medición se obtiene de varias
+ * muestras del sensor filtradas (ver Filtros.h), para no publicar ruido.
  */
 
 #ifndef MEDIDOR_H_INCLUIDO
 #define MEDIDOR_H_INCLUIDO
 
+#include "Filtros.h"
+#include "Sondas.h"
+#include "Sensores.h"
 
 
 /**
  * @class Medidor
- * @brief Clase que representa el sensor de medición de CO2 y temperatura.
+ * @brief Clase que representa los sensores de la placa (ver Sensores::Todos).
  * 
- * La clase permite iniciar el sensor y obtener los valores medidos de CO2 y temperatura.
+ * La clase permite iniciar los sensores y obtener el valor medido de cada uno.
  */
 class Medidor {
 
+public:
+
+  /// Cadena de filtros de cada medición: 8 muestras por lectura, mediana de 3 lecturas, EMA 1/4.
+  using CadenaFiltros = Filtros::Cadena< /* log2 sobremuestreo = */ 3, /* ventana mediana = */ 3,
+										 /* alfa log2 = */ 2 >;
+
 private:
-  // No hay variables privadas en esta clase.
+
+  /// Un filtro por sensor, en el orden del registro.
+  CadenaFiltros losFiltros[ Sensores::Todos::NUMERO ];
 
 
 public:
@@ -38,35 +50,30 @@ public:
 
 
   /**
-   * @brief Inicia el medidor de CO2 y temperatura.
+   * @brief Inicia el medidor de todos los sensores.
    * 
-   * Esta función prepara el medidor para comenzar a tomar medidas de CO2 y temperatura.
+   * Esta función prepara el medidor para comenzar a tomar medidas.
    */
   void iniciarMedidor() {
+	for( CadenaFiltros & f : losFiltros ) {
+	  f.reiniciar();
+	}
   } 
 
 
   /**
-   * @brief Mide el nivel de CO2.
-   * 
-   * Esta función simula una medición de CO2 devolviendo un valor fijo.
-   * @return int El valor medido de CO2 (actualmente retorna 235 de forma fija).
-   */
-  int medirCO2() {
-	return 235; ///< Valor simulado de CO2.
-
-  } 
-
-
-
-  /**
-   * @brief Mide la temperatura.
+   * @brief Mide un sensor del registro.
    * 
-   * Esta función simula una medición de temperatura devolviendo un valor fijo.
-   * @return int El valor medido de la temperatura (actualmente retorna 12 de forma fija).
+   * Toma CadenaFiltros::SOBREMUESTREO muestras con S::leer(), las filtra y pasa la lectura a la
+   * escala y la codificación de S.
+   * @tparam S Descriptor del sensor (p. ej. Sensores::CO2).
+   * @return int16_t El valor medido (con los sensores simulados, el de S::leer()).
    */
-  int medirTemperatura() {
-	return 12; ///< Valor simulado de temperatura.
+  template< typename S >
+  int16_t medir() {
+	static_assert( Sensores::Todos::contiene< S >(), "el sensor no está en Sensores::Todos" );
+	Sondas::Ambito sonda( Sondas::MEDIR );
+	return Sensores::codificar< S >( losFiltros[ Sensores::Todos::indice< S >() ].medir( S::leer ) );
   } 
 	
 };
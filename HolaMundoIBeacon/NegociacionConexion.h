@@ -0,0 +1,329 @@
+/**
+ * @file NegociacionConexion.h
+ * @brief Declaración de PerfilConexion, ParametrosConexion y NegociacionConexion.
+ *
+ * Al conectarse manda la central: PHY de 1 Mbit/s, paquetes de enlace de 27 bytes y el intervalo
+ * que ella quiera (30 a 50 ms en los móviles). Para descargar el historial eso es lento (cada
+ * notificación de 244 bytes va en 10 paquetes) y, para una conexión que no hace nada, caro (la
+ * radio se enciende en cada evento). El periférico puede pedir otra cosa después de conectarse;
+ * NegociacionConexion lo pide paso a paso, porque la SoftDevice sólo lleva un procedimiento de
+ * enlace a la vez, y deja anotado lo que la central ha aceptado de verdad.
+ */
+
+#ifndef NEGOCIACION_CONEXION_H_INCLUIDO
+#define NEGOCIACION_CONEXION_H_INCLUIDO
+
+/**
+ * @struct PerfilConexion
+ * @brief Parámetros que se piden a la central; un 0 deja ese parámetro como esté.
+ */
+struct PerfilConexion {
+  uint8_t phy;              ///< BLE_GAP_PHY_1MBPS o BLE_GAP_PHY_2MBPS.
+  uint16_t mtu;             ///< ATT MTU (sólo se puede pedir una vez por conexión).
+  uint16_t longitudDatos;   ///< Bytes de datos por paquete de enlace (27 a 251).
+  uint16_t intervalo;       ///< Intervalo de conexión en unidades de 1,25 ms.
+  uint16_t latencia;        ///< Eventos que el periférico se puede saltar si no tiene nada que enviar.
+  uint16_t supervision;     ///< Tiempo sin recibir nada hasta dar la conexión por perdida (unidades de 10 ms).
+};
+
+namespace PerfilesConexion {
+
+  /// Descargas: 2M, MTU y paquetes de enlace máximos, 7,5 ms.
+  const PerfilConexion RAPIDO = { BLE_GAP_PHY_2MBPS, BLEGATT_ATT_MTU_MAX, BLE_GAP_DATA_LENGTH_MAX, 6, 0, 400 };
+
+  /// Conexión ociosa: 250 ms con latencia 7, la radio se enciende cada 2 s (el máximo de iOS).
+  const PerfilConexion AHORRO = { 0, 0, 0, 200, 7, 600 };
+
+} // namespace PerfilesConexion
+
+/**
+ * @struct ParametrosConexion
+ * @brief Parámetros con los que va de verdad una conexión.
+ */
+struct ParametrosConexion {
+  uint8_t phy = BLE_GAP_PHY_1MBPS;
+  uint16_t mtu = BLE_GATT_ATT_MTU_DEFAULT;
+  uint16_t longitudDatos = BLE_GAP_DATA_LENGTH_DEFAULT;
+  uint16_t intervalo = 0;
+  uint16_t latencia = 0;
+  uint16_t supervision = 0;
+};
+
+/**
+ * @class NegociacionConexion
+ * @brief Pide un PerfilConexion a la central un procedimiento tras otro.
+ *
+ * Como CreditosNotificacion, es un estado único para la conexión actual. Los eventos de la
+ * SoftDevice llegan por procesarEvento() en el contexto de la pila BLE y sólo se anotan; las
+ * peticiones salen de atender(), que loop() llama cuando hayTrabajo(). Si la SoftDevice no
+ * acepta una petición (lo normal es que la central tenga otro procedimiento en marcha), atender()
+ * pide que se la vuelva a llamar más tarde; tras MAX_REINTENTOS el paso se cuenta como rechazado
+ * y se sigue con el siguiente. Un paso pedido cuyo evento no llega en MS_SIN_RESPUESTA también se
+ * cuenta como rechazado: la central puede rechazar por L2CAP unos parámetros de conexión (iOS lo
+ * hace con 7,5 ms) y entonces la SoftDevice no manda BLE_GAP_EVT_CONN_PARAM_UPDATE.
+ *
+ * La desconexión también sólo se anota: el perfil y el paso en curso los usa loop() dentro de
+ * atender(), así que es atender() quien los borra cuando la ve.
+ */
+class NegociacionConexion {
+
+private:
+
+  /// Pasos en orden; el intervalo va primero si baja (los demás pasos van más rápido) y al final si sube.
+  enum Paso : uint8_t { INTERVALO_ANTES, MTU, PHY, LONGITUD_DATOS, INTERVALO_DESPUES, FIN };
+
+  enum Peticion : uint8_t { NO_HACE_FALTA, PEDIDA, FALLIDA };
+
+  /// Contador de `terminados` del evento que termina cada paso (los dos del intervalo comparten el suyo).
+  static uint8_t eventoPaso( uint8_t paso ) {
+	return paso == INTERVALO_DESPUES ? (uint8_t) INTERVALO_ANTES : paso;
+  }
+
+  struct Estado {
+	uint16_t conexion = BLE_CONN_HANDLE_INVALID;
+	const PerfilConexion * volatile pedido = nullptr;   ///< Perfil por empezar (lo pone pedirPerfil()).
+	const PerfilConexion * perfil = nullptr;            ///< Perfil que se está negociando.
+	uint8_t paso = FIN;
+	bool esperando = false;                             ///< El paso está pedido y falta su evento.
+	uint8_t reintentos = 0;
+	bool mtuPedido = false;                             ///< El MTU sólo se puede pedir una vez.
+	/// Eventos recibidos de cada paso (eventoPaso()): sólo los escribe procesarEvento(), en la tarea
+	/// de la pila BLE, así que loop() no tiene que borrar nada que la otra tarea pueda estar escribiendo.
+	volatile uint8_t terminados[FIN] = { 0, 0, 0, 0, 0 };
+	uint8_t vistos = 0;                                 ///< terminados[] del paso en curso al pedirlo.
+	volatile uint8_t desconexiones = 0;                 ///< Sólo lo escribe procesarEvento().
+	uint8_t desconexionesVistas = 0;                    ///< Sólo lo escribe atender().
+	uint32_t inicio = 0;
+	uint32_t inicioPaso = 0;                            ///< Cuándo se pidió el paso en curso.
+	uint32_t duracion = 0;
+	uint8_t rechazados = 0;
+	ParametrosConexion parametros;
+  };
+
+  static Estado & estado() {
+	static Estado elEstado;
+	return elEstado;
+  }
+
+  /**
+   * @brief Pide el paso `paso` si hace falta.
+   */
+  static Peticion pedir( BLEConnection * c, uint8_t paso ) {
+	const PerfilConexion & p = *estado().perfil;
+	bool pedido = false;
+	switch( paso ) {
+	case INTERVALO_ANTES:
+	case INTERVALO_DESPUES:
+	  if( p.intervalo == 0 || ( paso == INTERVALO_ANTES ) != ( p.intervalo < c->getConnectionInterval() )
+		  || ( p.intervalo == c->getConnectionInterval() && p.latencia == c->getSlaveLatency() ) ) {
+		return NO_HACE_FALTA;
+	  }
+	  pedido = c->requestConnectionParameter( p.intervalo, p.latencia, p.supervision );
+	  break;
+	case MTU:
+	  if( p.mtu == 0 || p.mtu <= c->getMtu() || estado().mtuPedido ) {
+		return NO_HACE_FALTA;
+	  }
+	  pedido = c->requestMtuExchange( p.mtu );
+	  estado().mtuPedido = pedido;
+	  break;
+	case PHY:
+	  if( p.phy == 0 || p.phy == c->getPHY() ) {
+		return NO_HACE_FALTA;
+	  }
+	  pedido = c->requestPHY( p.phy );
+	  break;
+	case LONGITUD_DATOS:
+	  if( p.longitudDatos == 0 || p.longitudDatos == c->getDataLength() ) {
+		return NO_HACE_FALTA;
+	  }
+	  {
+		ble_gap_data_length_params_t dl = { p.longitudDatos, p.longitudDatos, 0, 0 };
+		pedido = c->requestDataLengthUpdate( &dl );
+	  }
+	  break;
+	}
+	return pedido ? PEDIDA : FALLIDA;
+  }
+
+  /// Ha llegado el evento del paso en curso.
+  static bool pasoTerminado() {
+	const Estado & e = estado();
+	return e.terminados[eventoPaso( e.paso )] != e.vistos;
+  }
+
+  /// La conexión se ha cerrado y atender() aún no ha borrado la negociación.
+  static bool desconectado() {
+	const Estado & e = estado();
+	return e.desconexiones != e.desconexionesVistas;
+  }
+
+  static void leerParametros( BLEConnection * c ) {
+	ParametrosConexion & r = estado().parametros;
+	r.phy = c->getPHY();
+	r.mtu = c->getMtu();
+	r.longitudDatos = c->getDataLength();
+	r.intervalo = c->getConnectionInterval();
+	r.latencia = c->getSlaveLatency();
+	r.supervision = c->getSupervisionTimeout();
+  }
+
+public:
+
+  /**
+   * @brief Pide negociar `perfil` en la conexión (se puede llamar desde el callback de conexión).
+   *
+   * Si ya se estaba negociando otro, se deja tras el paso en curso.
+   */
+  static void pedirPerfil( uint16_t conexion, const PerfilConexion & perfil ) {
+	Estado & e = estado();
+	e.conexion = conexion;
+	e.pedido = &perfil;
+  }
+
+  /**
+   * @brief Para EmisoraBLE::procesarEvento(): anota los procedimientos terminados.
+   */
+  static void procesarEvento( ble_evt_t * evento ) {
+	Estado & e = estado();
+	switch( evento->header.evt_id ) {
+	case BLE_GAP_EVT_DISCONNECTED:
+	  if( evento->evt.gap_evt.conn_handle == e.conexion ) {
+		e.conexion = BLE_CONN_HANDLE_INVALID;
+		e.pedido = nullptr;
+		e.desconexiones++;   // el resto lo borra atender(), en loop()
+	  }
+	  break;
+	case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+	  e.terminados[INTERVALO_ANTES]++;
+	  break;
+	case BLE_GATTC_EVT_EXCHANGE_MTU_RSP:
+	  e.terminados[MTU]++;
+	  break;
+	case BLE_GAP_EVT_PHY_UPDATE:
+	  e.terminados[PHY]++;
+	  break;
+	case BLE_GAP_EVT_DATA_LENGTH_UPDATE:
+	  e.terminados[LONGITUD_DATOS]++;
+	  break;
+	}
+  }
+
+  /// Hay un paso que ha terminado, un perfil por empezar y ningún paso en curso, o una desconexión por atender.
+  static bool hayTrabajo() {
+	const Estado & e = estado();
+	if( desconectado() ) {
+	  return true;
+	}
+	return e.esperando ? pasoTerminado() : e.paso == FIN && e.pedido != nullptr;
+  }
+
+  /// Lo que devuelve atender().
+  enum Resultado : uint8_t {
+	SIGUE,         ///< Nada que hacer.
+	ESPERANDO,     ///< Paso pedido: si su evento no llega antes, hay que llamar otra vez en msHastaPlazo().
+	REINTENTAR,    ///< La SoftDevice no ha aceptado la petición: hay que llamar otra vez más tarde.
+	TERMINADA      ///< Acaba de terminar; los parámetros están en parametros().
+  };
+
+  static const uint8_t MAX_REINTENTOS = 5;
+
+  /// Milisegundos que se espera el evento de un paso: más que un procedimiento de enlace (unos 8
+  /// eventos) con el intervalo más largo de los perfiles, 250 ms.
+  static const uint32_t MS_SIN_RESPUESTA = 3000;
+
+  /**
+   * @brief Sigue con la negociación: empieza el perfil pedido o pide el siguiente paso.
+   *
+   * @param ahora millis().
+   */
+  static Resultado atender( uint32_t ahora ) {
+	Estado & e = estado();
+	if( desconectado() ) {
+	  e.desconexionesVistas = e.desconexiones;
+	  e.perfil = nullptr;
+	  e.paso = FIN;
+	  e.esperando = false;
+	  e.mtuPedido = false;
+	}
+	BLEConnection * c = Bluefruit.Connection( e.conexion );
+	if( c == nullptr ) {
+	  return SIGUE;
+	}
+	if( e.esperando ) {
+	  if( !pasoTerminado() ) {
+		if( ahora - e.inicioPaso < MS_SIN_RESPUESTA ) {
+		  return ESPERANDO;   // el paso en curso no ha terminado
+		}
+		e.rechazados++;       // la central no ha contestado: se sigue con el siguiente
+	  }
+	  e.esperando = false;
+	  e.paso++;
+	}
+	// se coge de una vez: la tarea BLE lo pone al conectarse y lo borra al desconectarse
+	const PerfilConexion * nuevo = __atomic_exchange_n( &e.pedido, (const PerfilConexion *) nullptr, __ATOMIC_SEQ_CST );
+	if( nuevo != nullptr ) {
+	  e.perfil = nuevo;
+	  e.paso = INTERVALO_ANTES;
+	  e.inicio = ahora;
+	  e.reintentos = 0;
+	  e.rechazados = 0;
+	}
+	if( e.perfil == nullptr ) {
+	  return SIGUE;
+	}
+	while( e.paso != FIN ) {
+	  e.vistos = e.terminados[eventoPaso( e.paso )];   // sin contar los que la central mandó por su cuenta
+	  Peticion r = pedir( c, e.paso );
+	  if( r == PEDIDA ) {
+		e.esperando = true;
+		e.inicioPaso = ahora;
+		e.reintentos = 0;
+		return ESPERANDO;
+	  }
+	  if( r == FALLIDA ) {
+		if( e.reintentos < MAX_REINTENTOS ) {
+		  e.reintentos++;
+		  return REINTENTAR;
+		}
+		e.reintentos = 0;
+		e.rechazados++;
+	  }
+	  e.paso++;
+	}
+	e.duracion = ahora - e.inicio;
+	e.perfil = nullptr;
+	leerParametros( c );
+	return TERMINADA;
+  }
+
+  /// Milisegundos hasta dar por rechazado el paso en curso (0 si no se espera ninguno).
+  static uint32_t msHastaPlazo( uint32_t ahora ) {
+	const Estado & e = estado();
+	uint32_t pasado = ahora - e.inicioPaso;
+	return !e.esperando || pasado >= MS_SIN_RESPUESTA ? 0 : MS_SIN_RESPUESTA - pasado;
+  }
+
+  /// Se está negociando un perfil.
+  static bool negociando() {
+	return ( estado().perfil != nullptr && !desconectado() ) || estado().pedido != nullptr;
+  }
+
+  /// Parámetros de la conexión al acabar la última negociación.
+  static const ParametrosConexion & parametros() {
+	return estado().parametros;
+  }
+
+  /// Milisegundos que tardó la última negociación.
+  static uint32_t duracion() {
+	return estado().duracion;
+  }
+
+  /// Pasos que la SoftDevice o la central rechazaron en la última negociación.
+  static uint8_t rechazados() {
+	return estado().rechazados;
+  }
+
+};
+
+#endif
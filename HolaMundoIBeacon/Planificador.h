@@ -0,0 +1,261 @@
+
+/**
+ * @file Planificador.h
+ * @brief Declaración de la clase Planificador.
+ *
+ * El Planificador ejecuta tareas cooperativas cuando vence su plazo en lugar de encadenar
+ * llamadas a `delay()`. Guarda los plazos en un montículo de mínimos de tamaño fijo (sin memoria
+ * dinámica), de modo que siempre sabe cuánto falta para la siguiente tarea y el bucle principal
+ * puede dormir hasta entonces.
+ */
+
+#ifndef PLANIFICADOR_H_INCLUIDO
+#define PLANIFICADOR_H_INCLUIDO
+
+/**
+ * @class Planificador
+ * @brief Planificador cooperativo de tareas por plazos (montículo de mínimos).
+ *
+ * Cada tarea es una función sin parámetros. Las tareas no deben bloquear: si necesitan esperar,
+ * programan otra tarea (o a sí mismas) para más adelante. Los instantes se comparan con
+ * aritmética modular, así que el desbordamiento de `millis()` (cada ~49 días) no afecta.
+ *
+ * @tparam CAPACIDAD Número máximo de tareas programadas a la vez.
+ */
+template< uint8_t CAPACIDAD >
+class Planificador {
+
+public:
+
+  /// Tipo de las tareas.
+  using Tarea = void ();
+
+private:
+
+  /**
+   * @brief Entrada del montículo: una tarea y su plazo.
+   */
+  struct Plazo {
+	uint32_t instante;  ///< millis() en que vence.
+	uint32_t periodo;   ///< 0 si la tarea se ejecuta una sola vez.
+	Tarea * tarea;
+  };
+
+  Plazo plazos[CAPACIDAD]; ///< Montículo de mínimos ordenado por instante.
+  uint8_t cuantos = 0;
+
+  uint32_t retrasoMaximo_ms = 0; ///< Mayor retraso observado entre el plazo y la ejecución.
+
+  static bool antes( uint32_t a, uint32_t b ) {
+	return (int32_t) ( a - b ) < 0;
+  }
+
+  void intercambiar( uint8_t i, uint8_t j ) {
+	Plazo aux = plazos[i];
+	plazos[i] = plazos[j];
+	plazos[j] = aux;
+  }
+
+  void subir( uint8_t i ) {
+	while( i > 0 ) {
+	  uint8_t padre = ( i - 1 ) / 2;
+	  if( !antes( plazos[i].instante, plazos[padre].instante ) ) {
+		break;
+	  }
+	  intercambiar( i, padre );
+	  i = padre;
+	}
+  }
+
+  void bajar( uint8_t i ) {
+	for( ;; ) {
+	  uint8_t menor = i;
+	  uint8_t izq = 2 * i + 1;
+	  uint8_t der = izq + 1;
+	  if( izq < cuantos && antes( plazos[izq].instante, plazos[menor].instante ) ) {
+		menor = izq;
+	  }
+	  if( der < cuantos && antes( plazos[der].instante, plazos[menor].instante ) ) {
+		menor = der;
+	  }
+	  if( menor == i ) {
+		break;
+	  }
+	  intercambiar( i, menor );
+	  i = menor;
+	}
+  }
+
+  void quitar( uint8_t i ) {
+	cuantos--;
+	if( i == cuantos ) {
+	  return;
+	}
+	plazos[i] = plazos[cuantos];
+	bajar( i );
+	subir( i );
+  }
+
+  bool insertar( Tarea * tarea, uint32_t instante, uint32_t periodo ) {
+	if( cuantos >= CAPACIDAD ) {
+	  return false;
+	}
+	plazos[cuantos].instante = instante;
+	plazos[cuantos].periodo = periodo;
+	plazos[cuantos].tarea = tarea;
+	cuantos++;
+	subir( cuantos - 1 );
+	return true;
+  }
+
+public:
+
+  /// Valor devuelto por msHastaSiguiente() cuando no hay nada programado.
+  static const uint32_t NADA_PROGRAMADO = 0xFFFFFFFF;
+
+  /**
+   * @brief Constructor de la clase Planificador.
+   */
+  Planificador( ) {
+  }
+
+  /**
+   * @brief Programa una tarea para que se ejecute una vez.
+   *
+   * Si la tarea ya estaba programada, se cambia su plazo.
+   *
+   * @param tarea Tarea a ejecutar.
+   * @param retardo Milisegundos desde ahora.
+   * @return false si no queda sitio en el planificador.
+   */
+  bool programar( Tarea * tarea, uint32_t retardo ) {
+	cancelar( tarea );
+	return insertar( tarea, millis() + retardo, 0 );
+  }
+
+  /**
+   * @brief Programa una tarea periódica.
+   *
+   * Los siguientes plazos se calculan a partir del plazo anterior y no del momento de ejecución,
+   * así que el periodo no deriva aunque alguna ejecución llegue tarde.
+   *
+   * @param tarea Tarea a ejecutar.
+   * @param periodo Milisegundos entre ejecuciones.
+   * @param retardo Milisegundos hasta la primera ejecución.
+   * @return false si no queda sitio en el planificador.
+   */
+  bool programarPeriodica( Tarea * tarea, uint32_t periodo, uint32_t retardo = 0 ) {
+	cancelar( tarea );
+	return insertar( tarea, millis() + retardo, periodo );
+  }
+
+  /**
+   * @brief Quita una tarea del planificador.
+   *
+   * @param tarea Tarea a quitar.
+   * @return true si estaba programada.
+   */
+  bool cancelar( Tarea * tarea ) {
+	for( uint8_t i = 0; i < cuantos; i++ ) {
+	  if( plazos[i].tarea == tarea ) {
+		quitar( i );
+		return true;
+	  }
+	}
+	return false;
+  }
+
+  /**
+   * @brief Indica si una tarea está programada.
+   */
+  bool estaProgramada( Tarea * tarea ) const {
+	for( uint8_t i = 0; i < cuantos; i++ ) {
+	  if( plazos[i].tarea == tarea ) {
+		return true;
+	  }
+	}
+	return false;
+  }
+
+  /**
+   * @brief Milisegundos que faltan para el siguiente plazo.
+   *
+   * Con `holgura`, los plazos que vencen hasta `holgura` ms después del siguiente se juntan con
+   * él: devuelve el último de ellos, de modo que un solo despertar los atiende todos (cada uno
+   * con hasta `holgura` ms de retraso).
+   *
+   * @param holgura Retraso que se admite en una tarea para no despertar sólo por ella.
+   * @return 0 si ya hay alguna tarea vencida, NADA_PROGRAMADO si no hay tareas.
+   */
+  uint32_t msHastaSiguiente( uint32_t holgura = 0 ) const {
+	if( cuantos == 0 ) {
+	  return NADA_PROGRAMADO;
+	}
+	uint32_t ahora = millis();
+	if( !antes( ahora, plazos[0].instante ) ) {
+	  return 0;
+	}
+	uint32_t despertar = plazos[0].instante;
+	if( holgura > 0 ) {
+	  // en el montículo no están ordenados: se miran todos (son pocos)
+	  uint32_t limite = plazos[0].instante + holgura;
+	  for( uint8_t i = 1; i < cuantos; i++ ) {
+		if( antes( despertar, plazos[i].instante ) && !antes( limite, plazos[i].instante ) ) {
+		  despertar = plazos[i].instante;
+		}
+	  }
+	}
+	return despertar - ahora;
+  }
+
+  /**
+   * @brief Ejecuta, en orden de plazo, todas las tareas vencidas.
+   *
+   * Una tarea puede programar otras (o a sí misma) desde dentro; si éstas vencen ya, se ejecutan
+   * en la misma llamada.
+   *
+   * @param holgura Ver msHastaSiguiente().
+   * @return Milisegundos hasta el siguiente plazo (ver msHastaSiguiente()).
+   */
+  uint32_t ejecutarPendientes( uint32_t holgura = 0 ) {
+	for( ;; ) {
+	  uint32_t ahora = millis();
+	  if( cuantos == 0 || antes( ahora, plazos[0].instante ) ) {
+		break;
+	  }
+
+	  Plazo p = plazos[0];
+	  if( ahora - p.instante > retrasoMaximo_ms ) {
+		retrasoMaximo_ms = ahora - p.instante;
+	  }
+
+	  if( p.periodo > 0 ) {
+		// se reprograma antes de ejecutarla para que la tarea pueda cancelarse a sí misma
+		plazos[0].instante = p.instante + p.periodo;
+		bajar( 0 );
+	  } else {
+		quitar( 0 );
+	  }
+
+	  (*p.tarea)();
+	}
+	return msHastaSiguiente( holgura );
+  }
+
+  /**
+   * @brief Mayor retraso (ms) con que se ha ejecutado una tarea respecto a su plazo.
+   */
+  uint32_t retrasoMaximo() const {
+	return retrasoMaximo_ms;
+  }
+
+  /**
+   * @brief Número de tareas programadas.
+   */
+  uint8_t tareasProgramadas() const {
+	return cuantos;
+  }
+
+};
+
+#endif
@@ -0,0 +1,136 @@
+
+/**
+ * @file PoliticaPublicacion.h
+ * @brief Declaración de la clase PoliticaPublicacion.
+ *
+ * Con datos ambientales casi siempre estables, publicar cada lectura gasta radio (y trabajo de
+ * los escáneres) en repetir lo mismo. PoliticaPublicacion decide, por tipo de medición, si una
+ * lectura merece publicarse:
+ *  - si se aleja del último valor publicado más que su banda muerta (absoluta, o relativa a ese
+ *    valor; vale la mayor de las dos);
+ *  - o si lleva sin publicar silencioMaximo_ms (latido, para que se sepa que la placa sigue viva).
+ * Las lecturas que no se publican se cuentan como suprimidas.
+ */
+
+#ifndef POLITICA_PUBLICACION_H_INCLUIDO
+#define POLITICA_PUBLICACION_H_INCLUIDO
+
+/**
+ * @class PoliticaPublicacion
+ * @brief Banda muerta y latido por tipo de medición.
+ *
+ * Los tipos sin regla configurada se publican siempre, como si no hubiera política.
+ *
+ * @tparam MAX_IDS Tipos de medición distintos que se pueden configurar.
+ */
+template< uint8_t MAX_IDS = 4 >
+class PoliticaPublicacion {
+
+private:
+
+  struct Regla {
+	uint8_t id;
+	uint16_t bandaAbsoluta;      ///< Mayor cambio que no se publica, en las unidades de la medición.
+	uint16_t bandaRelativa;      ///< Mayor cambio que no se publica, en milésimas del último valor publicado.
+	uint32_t silencioMaximo_ms;  ///< 0: sin latido.
+	bool publicada;              ///< Ya se ha publicado algún valor.
+	int16_t ultimoValor;
+	uint32_t ultimoInstante;
+	uint32_t suprimidas;
+  };
+
+  Regla reglas[MAX_IDS];
+  uint8_t numReglas = 0;
+
+  Regla * buscar( uint8_t id ) {
+	for( uint8_t k = 0; k < (*this).numReglas; k++ ) {
+	  if( (*this).reglas[k].id == id ) {
+		return &(*this).reglas[k];
+	  }
+	}
+	return nullptr;
+  }
+
+public:
+
+  /**
+   * @brief Fija (o cambia) la regla de un tipo de medición.
+   *
+   * @param id Tipo de medición (Publicador::MedicionesID).
+   * @param bandaAbsoluta Mayor cambio que no se publica, en unidades de la medición (0: se publica
+   * cualquier cambio, y sólo se suprime el mismo valor).
+   * @param bandaRelativa Mayor cambio que no se publica, en milésimas del último valor publicado
+   * (0: sin banda relativa).
+   * @param silencioMaximo_ms Tiempo máximo sin publicar (0: sin latido).
+   * @return false si ya hay MAX_IDS tipos configurados.
+   */
+  bool configurar( uint8_t id, uint16_t bandaAbsoluta, uint16_t bandaRelativa, uint32_t silencioMaximo_ms ) {
+	Regla * r = (*this).buscar( id );
+	if( r == nullptr ) {
+	  if( (*this).numReglas >= MAX_IDS ) {
+		return false;
+	  }
+	  r = &(*this).reglas[(*this).numReglas++];
+	  r->id = id;
+	  r->publicada = false;
+	  r->ultimoValor = 0;
+	  r->ultimoInstante = 0;
+	  r->suprimidas = 0;
+	}
+	r->bandaAbsoluta = bandaAbsoluta;
+	r->bandaRelativa = bandaRelativa;
+	r->silencioMaximo_ms = silencioMaximo_ms;
+	return true;
+  }
+
+  /**
+   * @brief Decide si se publica una lectura; si es que sí, la toma como la última publicada.
+   *
+   * @param id Tipo de medición.
+   * @param valor Valor leído.
+   * @param ahora millis() de la lectura.
+   * @return true si hay que publicarla.
+   */
+  bool hayQuePublicar( uint8_t id, int16_t valor, uint32_t ahora ) {
+	Regla * r = (*this).buscar( id );
+	if( r == nullptr ) {
+	  return true;
+	}
+	if( r->publicada ) {
+	  int32_t diferencia = (int32_t) valor - r->ultimoValor;
+	  uint32_t cambio = (uint32_t) ( diferencia < 0 ? -diferencia : diferencia );
+	  uint32_t magnitud = (uint32_t) ( r->ultimoValor < 0 ? - (int32_t) r->ultimoValor : r->ultimoValor );
+	  uint32_t banda = magnitud * r->bandaRelativa / 1000;
+	  if( banda < r->bandaAbsoluta ) {
+		banda = r->bandaAbsoluta;
+	  }
+	  bool latido = r->silencioMaximo_ms > 0 && ahora - r->ultimoInstante >= r->silencioMaximo_ms;
+	  if( cambio <= banda && !latido ) {
+		r->suprimidas++;
+		return false;
+	  }
+	}
+	r->publicada = true;
+	r->ultimoValor = valor;
+	r->ultimoInstante = ahora;
+	return true;
+  }
+
+  /// Lecturas suprimidas de un tipo de medición.
+  uint32_t suprimidas( uint8_t id ) {
+	Regla * r = (*this).buscar( id );
+	return r == nullptr ? 0 : r->suprimidas;
+  }
+
+  /// Lecturas suprimidas de todos los tipos.
+  uint32_t suprimidasEnTotal() const {
+	uint32_t total = 0;
+	for( uint8_t k = 0; k < (*this).numReglas; k++ ) {
+	  total += (*this).reglas[k].suprimidas;
+	}
+	return total;
+  }
+
+};
+
+#endif
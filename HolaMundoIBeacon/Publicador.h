@@ -3,7 +3,7 @@
  * @file Publicador.h
  * @brief Declaración de la clase Publicador.
  * 
- * Esta clase gestiona la publicación de los datos de CO2 y temperatura utilizando la emisora BLE.
+ * Esta clase gestiona la publicación de los datos de los sensores (ver Sensores.h) utilizando la emisora BLE.
  */
 
 #ifndef PUBLICADOR_H_INCLUIDO
@@ -14,10 +14,11 @@
 
 /**
  * @class Publicador
- * @brief Clase encargada de publicar mediciones de CO2 y temperatura usando BLE.
+ * @brief Clase encargada de publicar las mediciones de los sensores usando BLE.
  * 
  * La clase Publicador controla la emisora BLE y se encarga de enviar los datos de mediciones 
- * como CO2 y temperatura, encapsulándolos en anuncios iBeacon.
+ * como CO2 y temperatura, encapsulándolos en anuncios iBeacon. Cada medición se publica con
+ * publicar<S>(), siendo S el descriptor de su sensor en Sensores::Todos.
  */
 
 class Publicador {
@@ -28,13 +29,13 @@ private:
   /**
    * @brief UUID usado en los anuncios iBeacon.
    * 
-   * Este array de 16 bytes representa el UUID que se usa en los anuncios iBeacon emitidos por la emisora BLE.
+   * Los 16 bytes se calculan al compilar (ver UUID.h) y quedan en flash.
    */
 
-  uint8_t beaconUUID[16] = { 
-	'c', 'h', 'o', 'l', 'o', 's', 'i', 
-	'm', 'e', 'o', 'n', 'e', 'j','e','f','e'
-};
+  static const uint8_t * beaconUUID() {
+	static constexpr UUID128 uuid = UUID128::iBeaconDeNombre( "cholosimeonejefe" );
+	return uuid.bytes;
+  }
 
 
 
@@ -61,6 +62,52 @@ public:
   const int RSSI = -53; 
 
   
+private:
+
+  /**
+   * @brief Anuncios codificados en encenderEmisora(); publicar sólo parchea sus bytes.
+   */
+  AnuncioPrecalculado anuncioIBeacon;
+  AnuncioPrecalculado anuncioLibre;
+
+  /**
+   * @brief Anuncio de los lotes de anunciarLote(), si la emisora admite anuncios extendidos.
+   */
+  AnuncioExtendido anuncioLote;
+  bool lotesExtendidos = false;
+
+  /**
+   * @brief Visitante de Sensores::Todos para configurarPolitica().
+   */
+  struct ConfigurarRegla {
+	PoliticaPublicacion< Sensores::Todos::NUMERO > & laPolitica;
+
+	template< typename S >
+	void visitar() {
+	  laPolitica.configurar( S::ID, S::BANDA, S::BANDA_RELATIVA, S::LATIDO );
+	}
+  };
+
+
+public:
+
+  /**
+   * @brief Política del intervalo de anuncio para el modo adaptativo (ver acelerarAnuncio()).
+   */
+  IntervaloAdaptativo elIntervalo;
+
+
+
+  /**
+   * @brief Banda muerta y latido de cada tipo de medición (ver PoliticaPublicacion.h).
+   * 
+   * Sin configurar, todas las lecturas se publican; configurarPolitica() pone la de cada sensor.
+   * publicar<S>() la consulta; con el búfer de mediciones hay que consultarla antes de guardar la
+   * lectura.
+   */
+  PoliticaPublicacion< Sensores::Todos::NUMERO > laPolitica;
+
+  
 public:
 
   
@@ -71,9 +118,9 @@ public:
    * Estos valores se utilizan en los anuncios iBeacon para indicar el tipo de medición que se está enviando.
    */
   enum MedicionesID  {
-	CO2 = 11, ///< Identificador para la medición de CO2.
-	TEMPERATURA = 12, ///< Identificador para la medición de temperatura.
-	RUIDO = 13 ///< Identificador para la medición de ruido (no implementado en este código).
+	CO2 = Sensores::CO2::ID, ///< Identificador para la medición de CO2.
+	TEMPERATURA = Sensores::Temperatura::ID, ///< Identificador para la medición de temperatura.
+	RUIDO = Sensores::Ruido::ID ///< Identificador para la medición de ruido.
   };
 
   
@@ -96,68 +143,243 @@ public:
    */
   void encenderEmisora() {
 	(*this).laEmisora.encenderEmisora(); ///< Llama a la función para encender la emisora.
+
+	(*this).laEmisora.prepararAnuncioIBeacon( (*this).anuncioIBeacon, beaconUUID(), 0, 0, (*this).RSSI );
+	(*this).laEmisora.prepararAnuncioLibre( (*this).anuncioLibre, nullptr, 0 );
+	(*this).laEmisora.prepararAnuncioExtendido( (*this).anuncioLote );
   } 
 
 
 
+  /**
+   * @brief Pone en laPolitica la banda muerta y el latido de cada sensor del registro.
+   */
+  void configurarPolitica() {
+	ConfigurarRegla configurar = { (*this).laPolitica };
+	Sensores::Todos::paraCada( configurar );
+  }
+
+
+
+  /**
+   * @brief Pide que anunciarLote() use anuncios extendidos, si la emisora los admite.
+   * 
+   * Hay que llamarlo tras encenderEmisora() y con la radio sin anunciar (configura el conjunto
+   * de anuncio). Si la SoftDevice no admite anuncios extendidos o esos PHY, anunciarLote() sigue
+   * con los bloques de los anuncios clásicos.
+   * 
+   * @param phyPrimario BLE_GAP_PHY_1MBPS o BLE_GAP_PHY_CODED.
+   * @param phySecundario BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS o BLE_GAP_PHY_CODED.
+   * @return true si los lotes irán en anuncios extendidos.
+   */
+  bool usarAnunciosExtendidos( uint8_t phyPrimario, uint8_t phySecundario ) {
+	(*this).lotesExtendidos = (*this).laEmisora.configurarAnuncioExtendido( phyPrimario, phySecundario );
+	return (*this).lotesExtendidos;
+  }
+
+
+
+  /// anunciarLote() usa anuncios extendidos.
+  bool anunciaLotesExtendidos() const {
+	return (*this).lotesExtendidos;
+  }
+
+
+
 
   /**
-   * @brief Publica una medición de CO2.
+   * @brief Empieza a anunciar una medición del sensor S sin esperar.
    * 
-   * Esta función emite un anuncio iBeacon con los datos de CO2 y luego espera el tiempo especificado antes de detener la emisión.
+   * Parchea el major y el minor del anuncio iBeacon precalculado y lo pone en el aire: el anuncio
+   * sigue emitiéndose hasta que se llame a `laEmisora.detenerAnuncio()` o se publique otra cosa.
    * 
-   * @param valorCO2 Valor medido de CO2.
+   * @tparam S Descriptor del sensor (p. ej. Sensores::CO2).
+   * @param valor Valor medido (ya en la escala de S, ver Medidor::medir()).
    * @param contador Contador de iteraciones del bucle.
-   * @param tiempoEspera Tiempo en milisegundos que se espera antes de detener el anuncio.
    */
+  template< typename S >
+  void anunciar( int16_t valor, uint8_t contador ) {
+	static_assert( Sensores::Todos::contiene< S >(), "el sensor no está en Sensores::Todos" );
+
+	{
+	  Sondas::Ambito sonda( Sondas::CODIFICAR );
+	  uint16_t major = (S::ID << 8) + contador; ///< Crea el valor `major` usando el ID del sensor y el contador.
+	  (*this).anuncioIBeacon.cambiarMajorMinor( major, valor );
+	}
+	(*this).laEmisora.actualizarAnuncio( (*this).anuncioIBeacon );
+  }
 
-  void publicarCO2( int16_t valorCO2, uint8_t contador,
-					long tiempoEspera ) {
 
-	
-	
-	
 
-	uint16_t major = (MedicionesID::CO2 << 8) + contador; ///< Crea el valor `major` usando el ID de CO2 y el contador.
-	(*this).laEmisora.emitirAnuncioIBeacon( (*this).beaconUUID, 
-											major,
-											valorCO2, 
-											(*this).RSSI
-									);
+  /**
+   * @brief Empieza a anunciar una carga libre de hasta 21 bytes sin esperar.
+   * 
+   * Es el equivalente sin reconfiguración de `laEmisora.emitirAnuncioIBeaconLibre()`.
+   * 
+   * @param carga Bytes de la carga.
+   * @param tamanyoCarga Tamaño de la carga en bytes.
+   */
+  void anunciarLibre( const char * carga, uint8_t tamanyoCarga ) {
+	{
+	  Sondas::Ambito sonda( Sondas::CODIFICAR );
+	  (*this).anuncioLibre.cambiarCarga( 0, (const uint8_t *) carga, tamanyoCarga );
+	}
+	(*this).laEmisora.actualizarAnuncio( (*this).anuncioLibre );
+  }
 
-	
 
-	esperar( tiempoEspera ); ///< Espera el tiempo especificado antes de detener el anuncio.
 
-	
-	(*this).laEmisora.detenerAnuncio(); ///< Detiene el anuncio BLE.
+  /**
+   * @brief Empieza a anunciar varias mediciones a la vez en una TramaMediciones, sin esperar.
+   * 
+   * La trama va en la carga libre del anuncio, así que todas las mediciones de un ciclo salen
+   * en un único anuncio en lugar de uno por medición.
+   * 
+   * @param trama Trama con las mediciones añadidas (se cierra aquí).
+   */
+  void anunciarMediciones( TramaMediciones & trama ) {
+	static_assert( TramaMediciones::TAMANYO == AnuncioPrecalculado::TAMANYO_CARGA_LIBRE,
+				   "la trama tiene que ocupar la carga libre del anuncio" );
+
+	{
+	  Sondas::Ambito sonda( Sondas::CODIFICAR );
+	  (*this).anuncioLibre.cambiarCarga( 0, trama.cerrar(), TramaMediciones::TAMANYO );
+	}
+	(*this).laEmisora.actualizarAnuncio( (*this).anuncioLibre );
+  }
+
+
+
+  /**
+   * @brief Saca del búfer tantas muestras como quepan en un anuncio y empieza a anunciarlas.
+   * 
+   * Las muestras van comprimidas en una TramaMediciones de versión VERSION_BLOQUE. Llamándolo
+   * varias veces seguidas se vacía el búfer por ráfagas, un bloque por llamada.
+   * 
+   * @param buffer Búfer de mediciones (BufferMediciones).
+   * @return false si el búfer estaba vacío y no se ha anunciado nada.
+   */
+  template< typename Buffer >
+  bool anunciarBloque( Buffer & buffer ) {
+	{
+	  Sondas::Ambito sonda( Sondas::CODIFICAR );
+	  uint8_t trama[TramaMediciones::TAMANYO] = { 0 };
+	  if( buffer.extraerBloque( TramaMediciones::bloque( trama ), TramaMediciones::CAPACIDAD_BLOQUE, millis() ) == 0 ) {
+		return false;
+	  }
+	  TramaMediciones::cerrarBloque( trama );
+
+	  (*this).anuncioLibre.cambiarCarga( 0, trama, TramaMediciones::TAMANYO );
+	}
+	(*this).laEmisora.actualizarAnuncio( (*this).anuncioLibre );
+	return true;
   }
 
 
 
   /**
-   * @brief Publica una medición de temperatura.
+   * @brief Saca del búfer un lote de muestras y empieza a anunciarlo, sin esperar.
    * 
-   * Esta función emite un anuncio iBeacon con los datos de temperatura y luego espera el tiempo especificado antes de detener la emisión.
+   * Con anuncios extendidos (usarAnunciosExtendidos()) el lote va en una TramaMediciones de
+   * VERSION_BLOQUE_LARGO de hasta AnuncioExtendido::CAPACIDAD_CARGA bytes: una docena de bloques
+   * de anunciarBloque() en un solo anuncio. Si no, es anunciarBloque(). El lote se copia con un
+   * cursor, como en DescargaHistorial, y sólo se saca del búfer cuando la SoftDevice acepta el
+   * anuncio extendido; si lo rechaza, esas mismas muestras salen con anunciarBloque() y los lotes
+   * siguientes van por anuncios clásicos.
    * 
-   * @param valorTemperatura Valor medido de temperatura.
+   * @param buffer Búfer de mediciones (BufferMediciones).
+   * @return false si el búfer estaba vacío y no se ha anunciado nada.
+   */
+  template< typename Buffer >
+  bool anunciarLote( Buffer & buffer ) {
+	if( !(*this).lotesExtendidos ) {
+	  return (*this).anunciarBloque( buffer );
+	}
+	typename Buffer::Cursor cursor;
+	{
+	  Sondas::Ambito sonda( Sondas::CODIFICAR );
+	  uint8_t * trama = (*this).anuncioLote.cargaLibre();
+	  buffer.situar( cursor, buffer.secuenciaMasAntigua() );
+	  uint8_t n = buffer.copiarBloque( cursor, TramaMediciones::bloque( trama ),
+									   TramaMediciones::capacidadBloqueLargo( AnuncioExtendido::CAPACIDAD_CARGA ),
+									   millis() );
+	  if( n == 0 ) {
+		return false;
+	  }
+	  (*this).anuncioLote.fijarCarga( TramaMediciones::cerrarBloqueLargo( trama, n ) );
+	}
+	if( !(*this).laEmisora.emitirAnuncioExtendido( (*this).anuncioLote ) ) {
+	  (*this).lotesExtendidos = false;
+	  return (*this).anunciarBloque( buffer );
+	}
+	buffer.quitarHasta( cursor );
+	return true;
+  }
+
+
+
+  /**
+   * @brief Modo adaptativo: avisa de que lo anunciado ha cambiado y pasa al intervalo rápido.
+   * 
+   * Se llama justo después de anunciar un valor nuevo. Hay que volver a llamar a
+   * retrocederAnuncio() pasados los milisegundos devueltos, p. ej. con el Planificador:
+   * 
+   *   elPlanificador.programar( retroceder, elPublicador.acelerarAnuncio() );
+   *   ...
+   *   void retroceder() {
+   *     uint32_t ms = elPublicador.retrocederAnuncio();
+   *     if( ms > 0 ) elPlanificador.programar( retroceder, ms );
+   *   }
+   * 
+   * @return Milisegundos hasta la siguiente llamada a retrocederAnuncio().
+   */
+  uint32_t acelerarAnuncio() {
+	uint32_t ms = (*this).elIntervalo.cambio();
+	(*this).laEmisora.cambiarIntervaloAnuncio( (*this).elIntervalo.intervaloUnidades() );
+	return ms;
+  }
+
+
+
+  /**
+   * @brief Modo adaptativo: alarga el intervalo de anuncio un escalón.
+   * 
+   * @return Milisegundos hasta la siguiente llamada, o 0 si ya se ha llegado al intervalo máximo.
+   */
+  uint32_t retrocederAnuncio() {
+	uint32_t ms = (*this).elIntervalo.retroceder();
+	(*this).laEmisora.cambiarIntervaloAnuncio( (*this).elIntervalo.intervaloUnidades() );
+	return ms;
+  }
+
+
+
+  /**
+   * @brief Publica una medición del sensor S.
+   * 
+   * Esta función emite un anuncio iBeacon con la medición y luego espera el tiempo especificado antes de detener la emisión.
+   * Bloquea durante `tiempoEspera`; con el Planificador es mejor usar anunciar() y programar la parada.
+   * Si la lectura no sale de la banda muerta de laPolitica, no se publica ni se espera.
+   * 
+   * @tparam S Descriptor del sensor (p. ej. Sensores::CO2).
+   * @param valor Valor medido.
    * @param contador Contador de iteraciones del bucle.
    * @param tiempoEspera Tiempo en milisegundos que se espera antes de detener el anuncio.
+   * @return false si la lectura se ha suprimido.
    */
-  void publicarTemperatura( int16_t valorTemperatura,
-							uint8_t contador, long tiempoEspera ) {
+  template< typename S >
+  bool publicar( int16_t valor, uint8_t contador, long tiempoEspera ) {
 
+	if( !(*this).laPolitica.hayQuePublicar( S::ID, valor, millis() ) ) {
+	  return false;
+	}
 
-	uint16_t major = (MedicionesID::TEMPERATURA << 8) + contador; ///< Crea el valor `major` usando el ID de temperatura y el contador.
-	(*this).laEmisora.emitirAnuncioIBeacon( (*this).beaconUUID, 
-											major,
-											valorTemperatura, 
-											(*this).RSSI 
-									);
-	esperar( tiempoEspera ); ///< Espera el tiempo especificado antes de detener el anuncio.
+	(*this).anunciar< S >( valor, contador );
 
+	esperar( tiempoEspera ); ///< Espera el tiempo especificado antes de detener el anuncio.
 
 	(*this).laEmisora.detenerAnuncio(); ///< Detiene el anuncio BLE.
+	return true;
   } 
 	
 }; 
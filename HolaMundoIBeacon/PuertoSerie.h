@@ -1,67 +1,274 @@
-
 /**
  * @file PuertoSerie.h
  * @brief Declaración de la clase PuertoSerie.
- * 
+ *
  * La clase PuertoSerie se encarga de gestionar la comunicación serie a través de los puertos seriales.
+ *
+ * Lo que se escribe no sale en el momento: se guarda en una cola circular y sale por la UART
+ * cuando se llama a vaciar(), desde el tiempo libre del bucle principal. Así escribir nunca
+ * espera a la UART (a 115200 baudios cada byte tarda ~87 us) y no retrasa las publicaciones.
+ *
+ * Los mensajes de diagnóstico se escriben con error(), aviso(), info() o depuracion(); los de un
+ * nivel por encima de NIVEL_REGISTRO desaparecen al compilar. Para cambiarlo, definir
+ * NIVEL_REGISTRO antes de incluir este archivo (p. ej. `#define NIVEL_REGISTRO NIVEL_REGISTRO_AVISO`).
+ *
+ * Los mensajes fijos del firmware están en TablaTrazas.h y se escriben con trazar(); con
+ * TRAZAS_BINARIAS a 1 salen como registros binarios cortos en lugar de texto (ver Trazas.h).
  */
 
 #ifndef PUERTO_SERIE_H_INCLUIDO
 #define PUERTO_SERIE_H_INCLUIDO
 
+#define NIVEL_REGISTRO_NINGUNO    0
+#define NIVEL_REGISTRO_ERROR      1
+#define NIVEL_REGISTRO_AVISO      2
+#define NIVEL_REGISTRO_INFO       3
+#define NIVEL_REGISTRO_DEPURACION 4
+
+#ifndef NIVEL_REGISTRO
+#define NIVEL_REGISTRO NIVEL_REGISTRO_INFO
+#endif
+
+#include "Trazas.h"
+
 
 /**
  * @class PuertoSerie
  * @brief Clase para gestionar la comunicación a través de un puerto serie.
- * 
- * Proporciona métodos para inicializar el puerto serie, verificar su disponibilidad 
- * y enviar datos a través de él.
+ *
+ * Proporciona métodos para inicializar el puerto serie, verificar su disponibilidad
+ * y enviar datos a través de él sin bloquear.
  */
 
 class PuertoSerie  {
 
+public:
+
+  /// Bytes de la cola de salida.
+  static const uint16_t TAMANYO_COLA = 256;
+
+  /// Milisegundos que tarda la UART en vaciar su FIFO a 115200 baudios (con margen).
+  static const uint32_t MS_ENTRE_VACIADOS = 5;
+
+private:
+
+  uint8_t cola[TAMANYO_COLA];
+  uint16_t cabeza = 0;        ///< Siguiente byte a enviar.
+  uint16_t usados = 0;
+  uint32_t perdidos = 0;      ///< Bytes descartados por tener la cola llena.
+
+  void poner( const char * p, size_t n ) {
+	for( size_t i = 0; i < n; i++ ) {
+	  if( usados == TAMANYO_COLA ) {
+		perdidos += n - i;
+		return;
+	  }
+	  cola[ ( cabeza + usados ) % TAMANYO_COLA ] = (uint8_t) p[i];
+	  usados++;
+	}
+  }
+
+  void ponerEntero( unsigned long v, bool negativo ) {
+	char buf[12];
+	char * p = &buf[sizeof( buf )];
+	do {
+	  *--p = (char) ( '0' + v % 10 );
+	  v /= 10;
+	} while( v > 0 );
+	if( negativo ) {
+	  *--p = '-';
+	}
+	poner( p, &buf[sizeof( buf )] - p );
+  }
+
+  // formatos de escribir(), los mismos que Serial.print()
+  void formatear( const char * s ) { poner( s, strlen( s ) ); }
+  void formatear( char c ) { poner( &c, 1 ); }
+  void formatear( unsigned char v ) { ponerEntero( v, false ); }
+  void formatear( int v ) { formatear( (long) v ); }
+  void formatear( unsigned int v ) { ponerEntero( v, false ); }
+  void formatear( long v ) { ponerEntero( v < 0 ? 0UL - (unsigned long) v : (unsigned long) v, v < 0 ); }
+  void formatear( unsigned long v ) { ponerEntero( v, false ); }
+  void formatear( double v ) {
+	if( v < 0 ) {
+	  poner( "-", 1 );
+	  v = -v;
+	}
+	unsigned long entera = (unsigned long) v;
+	unsigned long centesimas = (unsigned long) ( ( v - entera ) * 100 + 0.5 );
+	if( centesimas >= 100 ) {
+	  entera++;
+	  centesimas -= 100;
+	}
+	ponerEntero( entera, false );
+	char decimales[3] = { '.', (char) ( '0' + centesimas / 10 ), (char) ( '0' + centesimas % 10 ) };
+	poner( decimales, 3 );
+  }
+
+  /// Pone los n bytes enteros o ninguno (un registro binario a medias descolocaría al decodificador).
+  void ponerCompleto( const uint8_t * p, uint16_t n ) {
+	if( TAMANYO_COLA - usados < n ) {
+	  perdidos += n;
+	  return;
+	}
+	poner( (const char *) p, n );
+  }
+
+  void escribirVarios( ) {
+  }
+
+  template<typename T, typename... R>
+  void escribirVarios( T primero, R... resto ) {
+	formatear( primero );
+	escribirVarios( resto... );
+  }
+
 public:
 
   /**
    * @brief Constructor de la clase PuertoSerie.
-   * 
+   *
    * Inicializa la comunicación serie con la velocidad en baudios especificada.
-   * 
+   *
    * @param baudios Velocidad en baudios para la comunicación serie (por ejemplo, 115200).
    */
 
 
   PuertoSerie (long baudios) {
 	Serial.begin( baudios ); ///< Inicia la comunicación serie.
-  } 
+  }
 
 
   /**
    * @brief Espera a que el puerto serie esté disponible.
-   * 
+   *
    * Realiza una breve espera para asegurar que el puerto serie esté listo antes de continuar.
    */
   void esperarDisponible() {
 
 	delay(10); ///< Pausa durante 10 milisegundos para dar tiempo a que el puerto serie esté disponible.
 
-  } 
+  }
 
 
   /**
    * @brief Escribe un mensaje en el puerto serie.
-   * 
-   * Esta función envía un mensaje a través del puerto serie utilizando la función `Serial.print`.
-   * 
+   *
+   * El mensaje se formatea como lo haría `Serial.print` y se deja en la cola; sale por la UART
+   * en el siguiente vaciar(). Si la cola está llena, lo que no cabe se pierde (ver bytesPerdidos()).
+   *
    * @tparam T El tipo de dato del mensaje que será enviado (puede ser texto, número, etc.).
    * @param mensaje El mensaje que será enviado por el puerto serie.
    */
 
   template<typename T>
   void escribir (T mensaje) {
-	Serial.print( mensaje ); ///< Envia el mensaje por el puerto serie.
-  } 
-  
-}; 
+	formatear( mensaje ); ///< Deja el mensaje en la cola.
+  }
+
+
+  /**
+   * @brief Pasa a la UART lo que quepa en su FIFO sin esperar.
+   *
+   * @return true si todavía quedan bytes en la cola.
+   */
+  bool vaciar() {
+	int sitio = Serial.availableForWrite();
+	while( usados > 0 && sitio > 0 ) {
+	  uint16_t seguidos = TAMANYO_COLA - cabeza;
+	  uint16_t n = usados < seguidos ? usados : seguidos;
+	  if( n > sitio ) {
+		n = (uint16_t) sitio;
+	  }
+	  Serial.write( &cola[cabeza], n );
+	  cabeza = ( cabeza + n ) % TAMANYO_COLA;
+	  usados -= n;
+	  sitio -= n;
+	}
+	return usados > 0;
+  }
+
+
+  /**
+   * @brief Espera a que salga todo lo escrito (bloquea; para antes de dormir o de reiniciar).
+   */
+  void vaciarDelTodo() {
+	while( vaciar() ) {
+	  delay( 1 );
+	}
+  }
+
+
+  /// Bytes pendientes de salir.
+  uint16_t bytesPendientes() const { return usados; }
+
+  /// Bytes perdidos por tener la cola llena.
+  uint32_t bytesPerdidos() const { return perdidos; }
+
+
+  /**
+   * @brief Mensajes de diagnóstico por niveles: escriben todos sus argumentos seguidos si su
+   * nivel está activado en NIVEL_REGISTRO y, si no, no generan código.
+   */
+  template<typename... T>
+  void error( T... partes ) {
+	if( NIVEL_REGISTRO >= NIVEL_REGISTRO_ERROR ) {
+	  escribirVarios( partes... );
+	}
+  }
+
+  template<typename... T>
+  void aviso( T... partes ) {
+	if( NIVEL_REGISTRO >= NIVEL_REGISTRO_AVISO ) {
+	  escribirVarios( partes... );
+	}
+  }
+
+  template<typename... T>
+  void info( T... partes ) {
+	if( NIVEL_REGISTRO >= NIVEL_REGISTRO_INFO ) {
+	  escribirVarios( partes... );
+	}
+  }
+
+  template<typename... T>
+  void depuracion( T... partes ) {
+	if( NIVEL_REGISTRO >= NIVEL_REGISTRO_DEPURACION ) {
+	  escribirVarios( partes... );
+	}
+  }
+
+
+  /**
+   * @brief Escribe la traza ID de TablaTrazas.h con sus valores, como texto o como registro
+   * binario según TRAZAS_BINARIAS. Si su nivel no está activado en NIVEL_REGISTRO, no genera código.
+   *
+   * @tparam ID Identificador de la traza.
+   * @param valores Enteros (o char), tantos como pida su formato.
+   */
+  template< Trazas::Id ID, typename... T >
+  void trazar( T... valores ) {
+	static_assert( Trazas::contarValores( Trazas::Info< ID >::formato() ) == sizeof...( T ),
+				   "la traza no tiene tantos valores como pide su formato" );
+	if( NIVEL_REGISTRO < Trazas::Info< ID >::NIVEL ) {
+	  return;
+	}
+	const int32_t v[] = { (int32_t) valores..., 0 };
+#if TRAZAS_BINARIAS
+	uint8_t registro[2 + Trazas::MAXIMO_BYTES_VALOR * sizeof...( T )];
+	uint16_t n = 0;
+	registro[n++] = Trazas::MARCA;
+	registro[n++] = (uint8_t) ID;
+	for( size_t i = 0; i < sizeof...( T ); i++ ) {
+	  n += Trazas::codificarValor( v[i], &registro[n] );
+	}
+	ponerCompleto( registro, n );
+#else
+	Trazas::expandir( Trazas::Info< ID >::formato(), v,
+					  [this] ( const char * p, size_t n ) { poner( p, n ); } );
+#endif
+  }
+
+};
 
 #endif
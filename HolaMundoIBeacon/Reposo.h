@@ -0,0 +1,249 @@
+
+/**
+ * @file Reposo.h
+ * @brief Declaración de la clase Reposo.
+ *
+ * loop() duerme entre dos plazos del Planificador con Reposo::dormir(): la tarea de loop() se
+ * bloquea en un semáforo y, mientras ninguna tarea tiene nada que hacer, FreeRTOS deja la CPU en
+ * reposo (el núcleo de Adafruit usa el modo sin tick: programa el RTC1 para el siguiente plazo y
+ * espera con sd_app_evt_wait() de la SoftDevice). Los eventos de la SoftDevice despiertan a loop()
+ * antes de tiempo (EmisoraBLE::procesarEvento() llama a despertar()), así que loop() no tiene que
+ * despertarse cada poco a mirar si ha pasado algo.
+ *
+ * Además lleva la cuenta del tiempo en cada estado (ver Reposo::Estado) y de los despertares, para
+ * saber a dónde se va la batería.
+ */
+
+#ifndef REPOSO_H_INCLUIDO
+#define REPOSO_H_INCLUIDO
+
+/**
+ * @class Reposo
+ * @brief Reposo de loop() hasta el siguiente plazo y contadores de residencia.
+ *
+ * El tiempo se mide con el RTC1 (32768 Hz, 24 bits), que sigue contando con la CPU parada; entre
+ * dos llamadas a dormir() no pueden pasar más de 512 s. El tiempo con la radio encendida lo dan
+ * las notificaciones de radio de la SoftDevice: una interrupción (SWI1) al encender y al apagar la
+ * radio en cada evento de anuncio o de conexión.
+ */
+class Reposo {
+
+public:
+
+  /**
+   * @brief Estados de los que se lleva el tiempo (suman el tiempo total).
+   */
+  enum Estado : uint8_t {
+	ACTIVO,      ///< La CPU despierta (loop(), sus tareas y la pila BLE), sin la radio.
+	REPOSO,      ///< loop() en dormir(), sin la radio.
+	RADIO,       ///< La radio encendida, esté la CPU dormida o no.
+	NUMERO_DE_ESTADOS
+  };
+
+  /// Prioridad de la interrupción de las notificaciones de radio (una de las que deja la SoftDevice).
+  static const uint8_t PRIORIDAD_NOTIFICACION_RADIO = 6;
+
+private:
+
+  static const uint32_t HZ_RTC = 32768;
+  static const uint32_t MASCARA_RTC = 0xFFFFFF;
+
+  struct Cuentas {
+	SemaphoreHandle_t despertador = nullptr;
+	bool notificacionRadio = false;
+	uint32_t ultimo = 0;        ///< RTC1 de la última vez que se sumó a total.
+	uint64_t total = 0;         ///< Ticks del RTC1 desde iniciar().
+	uint64_t reposo = 0;        ///< Ticks dentro de dormir().
+	uint32_t despertares = 0;
+	uint32_t anticipados = 0;   ///< Despertares por despertar() antes del plazo.
+
+	// los escribe la interrupción de las notificaciones de radio
+	volatile bool durmiendo = false;
+	volatile bool radioEncendida = false;
+	volatile uint32_t inicioRadio = 0;
+	volatile uint64_t radio = 0;
+	volatile uint64_t radioEnReposo = 0;   ///< La parte de `radio` que acabó dentro de dormir().
+
+	// lo que había al poner a cero (los de la radio no se tocan fuera de la interrupción)
+	uint64_t radioAlReiniciar = 0;
+	uint64_t radioEnReposoAlReiniciar = 0;
+  };
+
+  static Cuentas & cuentas() {
+	static Cuentas lasCuentas;
+	return lasCuentas;
+  }
+
+  static uint32_t rtc() {
+	return NRF_RTC1->COUNTER;
+  }
+
+  /// Ticks del RTC1 desde `antes` (vuelve a cero cada 2^24 ticks).
+  static uint32_t ticksDesde( uint32_t antes ) {
+	return ( rtc() - antes ) & MASCARA_RTC;
+  }
+
+  static void sumarTotal() {
+	Cuentas & c = cuentas();
+	uint32_t ahora = rtc();
+	c.total += ( ahora - c.ultimo ) & MASCARA_RTC;
+	c.ultimo = ahora;
+  }
+
+  /// Lee un contador que escribe la interrupción: si dos lecturas coinciden, no se ha partido.
+  static uint64_t leer( const volatile uint64_t & v ) {
+	uint64_t a;
+	uint64_t b;
+	do {
+	  a = v;
+	  b = v;
+	} while( a != b );
+	return a;
+  }
+
+  static uint32_t aMs( uint64_t ticks ) {
+	return (uint32_t) ( ticks * 1000 / HZ_RTC );
+  }
+
+public:
+
+  /**
+   * @brief Crea el semáforo de dormir() y activa las notificaciones de radio.
+   *
+   * Hay que llamarla después de encender la emisora (con la SoftDevice en marcha).
+   *
+   * @return false si no hay notificaciones de radio: se duerme igual, pero RADIO queda a cero.
+   */
+  static bool iniciar() {
+	Cuentas & c = cuentas();
+	if( c.despertador == nullptr ) {
+	  c.despertador = xSemaphoreCreateBinary();
+	}
+	c.ultimo = rtc();
+	if( sd_radio_notification_cfg_set( NRF_RADIO_NOTIFICATION_TYPE_INT_ON_BOTH,
+									   NRF_RADIO_NOTIFICATION_DISTANCE_NONE ) != NRF_SUCCESS
+		|| sd_nvic_ClearPendingIRQ( SWI1_EGU1_IRQn ) != NRF_SUCCESS
+		|| sd_nvic_SetPriority( SWI1_EGU1_IRQn, PRIORIDAD_NOTIFICACION_RADIO ) != NRF_SUCCESS
+		|| sd_nvic_EnableIRQ( SWI1_EGU1_IRQn ) != NRF_SUCCESS ) {
+	  return false;
+	}
+	c.notificacionRadio = true;
+	return true;
+  }
+
+  /**
+   * @brief Duerme hasta `ms` milisegundos o hasta que alguien llame a despertar().
+   *
+   * Si se llamó a despertar() mientras loop() estaba despierta, vuelve enseguida: ningún evento se
+   * queda sin atender hasta el siguiente plazo. Sin iniciar(), es un delay().
+   *
+   * @return true si la ha despertado despertar() antes del plazo.
+   */
+  static bool dormir( uint32_t ms ) {
+	Cuentas & c = cuentas();
+	if( c.despertador == nullptr ) {
+	  delay( ms );
+	  return false;
+	}
+	sumarTotal();
+	uint32_t inicio = c.ultimo;
+	c.durmiendo = true;
+	bool despertada = xSemaphoreTake( c.despertador, ms2tick( ms ) ) == pdTRUE;
+	c.durmiendo = false;
+	sumarTotal();
+	c.reposo += ( c.ultimo - inicio ) & MASCARA_RTC;
+	if( ms > 0 ) {
+	  c.despertares++;
+	  c.anticipados += despertada ? 1 : 0;
+	}
+	return despertada;
+  }
+
+  /**
+   * @brief Despierta a loop() si está en dormir() (desde una tarea, p. ej. la de la pila BLE).
+   */
+  static void despertar() {
+	SemaphoreHandle_t d = cuentas().despertador;
+	if( d != nullptr ) {
+	  xSemaphoreGive( d );
+	}
+  }
+
+  /**
+   * @brief Para la interrupción de las notificaciones de radio: la radio se enciende o se apaga.
+   *
+   * Cada uso de la radio cuenta en REPOSO o en ACTIVO según esté loop() al apagarse.
+   */
+  static void alCambiarRadio() {
+	Cuentas & c = cuentas();
+	if( !c.radioEncendida ) {
+	  c.inicioRadio = rtc();
+	  c.radioEncendida = true;
+	  return;
+	}
+	uint32_t duracion = ticksDesde( c.inicioRadio );
+	c.radio += duracion;
+	if( c.durmiendo ) {
+	  c.radioEnReposo += duracion;
+	}
+	c.radioEncendida = false;
+  }
+
+  /**
+   * @brief Milisegundos en el estado `e` desde iniciar() o reiniciar().
+   */
+  static uint32_t residenciaMs( Estado e ) {
+	Cuentas & c = cuentas();
+	sumarTotal();
+	uint64_t radio = leer( c.radio ) - c.radioAlReiniciar;
+	uint64_t radioEnReposo = leer( c.radioEnReposo ) - c.radioEnReposoAlReiniciar;
+	uint64_t reposo = c.reposo > radioEnReposo ? c.reposo - radioEnReposo : 0;
+	switch( e ) {
+	case RADIO:
+	  return aMs( radio );
+	case REPOSO:
+	  return aMs( reposo );
+	default:
+	  return aMs( c.total > reposo + radio ? c.total - reposo - radio : 0 );
+	}
+  }
+
+  /// Veces que ha vuelto de dormir() (sin contar las esperas de 0 ms).
+  static uint32_t despertares() {
+	return cuentas().despertares;
+  }
+
+  /// De ellas, las que fueron por despertar() antes del plazo.
+  static uint32_t anticipados() {
+	return cuentas().anticipados;
+  }
+
+  /// Las notificaciones de radio están activas (si no, RADIO no cuenta).
+  static bool cuentaRadio() {
+	return cuentas().notificacionRadio;
+  }
+
+  /**
+   * @brief Pone a cero los contadores.
+   */
+  static void reiniciar() {
+	Cuentas & c = cuentas();
+	sumarTotal();
+	c.total = 0;
+	c.reposo = 0;
+	c.despertares = 0;
+	c.anticipados = 0;
+	c.radioAlReiniciar = leer( c.radio );
+	c.radioEnReposoAlReiniciar = leer( c.radioEnReposo );
+  }
+
+};
+
+/**
+ * @brief Interrupción de las notificaciones de radio de la SoftDevice.
+ */
+extern "C" void SWI1_EGU1_IRQHandler() {
+  Reposo::alCambiarRadio();
+}
+
+#endif
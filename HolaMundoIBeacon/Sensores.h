@@ -0,0 +1,182 @@
+
+/**
+ * @file Sensores.h
+ * @brief Descriptores de los sensores de la placa y su registro.
+ *
+ * Cada tipo de medición se describe una vez, al compilar: su ID (el de Publicador::MedicionesID),
+ * cómo se lee una muestra, la escala y la codificación del valor publicado y su banda muerta (ver
+ * PoliticaPublicacion.h). El Medidor, el Publicador y las tareas del sketch recorren el registro
+ * (Sensores::Todos) con plantillas: cada sensor queda como código en línea, sin llamadas virtuales
+ * ni tablas que recorrer en el bucle.
+ *
+ * Añadir un sensor es escribir su descriptor (heredando de Sensor los valores por defecto) y
+ * ponerlo en Todos; Medidor::medir<S>() y Publicador::publicar<S>() no cambian.
+ */
+
+#ifndef SENSORES_H_INCLUIDO
+#define SENSORES_H_INCLUIDO
+
+namespace Sensores {
+
+  /**
+   * @brief Cómo se guarda el valor en los 16 bits del minor, de las tramas y del búfer.
+   */
+  enum class Codificacion : uint8_t {
+	CON_SIGNO,   ///< int16_t; satura en ±32767.
+	SIN_SIGNO    ///< Valores no negativos: una lectura negativa se publica como 0.
+  };
+
+  /**
+   * @struct Sensor
+   * @brief Valores por defecto de un descriptor: un descriptor hereda de Sensor<ID> y redefine
+   * lo que cambie.
+   *
+   * Un descriptor tiene:
+   *  - `ID`: tipo de medición;
+   *  - `ESCALA_MULTIPLICAR` / `ESCALA_DIVIDIR`: el valor publicado es la lectura filtrada por
+   *    ESCALA_MULTIPLICAR / ESCALA_DIVIDIR (redondeado);
+   *  - `CODIFICACION`;
+   *  - `BANDA`, `BANDA_RELATIVA` (milésimas) y `LATIDO` (ms): la regla de PoliticaPublicacion;
+   *  - `static int16_t leer()`: una muestra sin filtrar del sensor.
+   */
+  template< uint8_t ID_ >
+  struct Sensor {
+	static const uint8_t ID = ID_;
+	static const int16_t ESCALA_MULTIPLICAR = 1;
+	static const int16_t ESCALA_DIVIDIR = 1;
+	static const Codificacion CODIFICACION = Codificacion::CON_SIGNO;
+	static const uint16_t BANDA = 0;
+	static const uint16_t BANDA_RELATIVA = 0;
+	static const uint32_t LATIDO = 60000;
+  };
+
+  /**
+   * @brief Sensor de CO2 (ppm): se publica si cambia más de 10 ppm o del 2 % (lo que sea mayor).
+   */
+  struct CO2 : Sensor< 11 > {
+	static const Codificacion CODIFICACION = Codificacion::SIN_SIGNO;
+	static const uint16_t BANDA = 10;
+	static const uint16_t BANDA_RELATIVA = 20;
+
+	/// Muestra simulada (235 de forma fija).
+	static int16_t leer() {
+	  return 235;
+	}
+  };
+
+  /**
+   * @brief Sensor de temperatura (ºC): se publica con cualquier cambio.
+   */
+  struct Temperatura : Sensor< 12 > {
+
+	/// Muestra simulada (12 de forma fija).
+	static int16_t leer() {
+	  return 12;
+	}
+  };
+
+  /**
+   * @brief Sensor de ruido (dB): se publica si cambia más de 3 dB.
+   */
+  struct Ruido : Sensor< 13 > {
+	static const Codificacion CODIFICACION = Codificacion::SIN_SIGNO;
+	static const uint16_t BANDA = 3;
+
+	/// Muestra simulada (48 de forma fija).
+	static int16_t leer() {
+	  return 48;
+	}
+  };
+
+  /**
+   * @brief Pasa una lectura filtrada a la escala y la codificación del sensor S.
+   *
+   * Con la escala 1/1 y CON_SIGNO no queda nada: el compilador lo quita.
+   */
+  template< typename S >
+  inline int16_t codificar( int32_t lectura ) {
+	const int32_t dividir = S::ESCALA_DIVIDIR;
+	int32_t v = lectura * S::ESCALA_MULTIPLICAR;
+	if( dividir > 1 ) {
+	  v = ( v + ( v < 0 ? -dividir : dividir ) / 2 ) / dividir;
+	}
+	const int32_t minimo = S::CODIFICACION == Codificacion::SIN_SIGNO ? 0 : -32767;
+	return (int16_t) ( v < minimo ? minimo : v > 32767 ? 32767 : v );
+  }
+
+  /**
+   * @class Registro
+   * @brief Lista de descriptores que se recorre al compilar.
+   *
+   * paraCada( v ) llama a `v.template visitar< S >()` con cada descriptor, en orden: el bucle se
+   * desenrolla y cada llamada se puede poner en línea.
+   */
+  template< typename... S >
+  struct Registro;
+
+  template<>
+  struct Registro<> {
+
+	static const uint8_t NUMERO = 0;
+
+	template< typename T >
+	static constexpr uint8_t indice() { return 0; }
+
+	static constexpr bool tieneId( uint8_t id ) { return false; }
+
+	static constexpr bool idsDistintos() { return true; }
+
+	template< typename Visitante >
+	static void paraCada( Visitante & v ) {
+	}
+  };
+
+  template< typename Primero, typename... Resto >
+  struct Registro< Primero, Resto... > {
+
+	using Siguientes = Registro< Resto... >;
+
+	static const uint8_t NUMERO = 1 + sizeof...( Resto );
+
+	/// Posición de T en el registro (NUMERO si no está).
+	template< typename T >
+	static constexpr uint8_t indice() {
+	  return MismoTipo< T, Primero >::SI ? 0 : 1 + Siguientes::template indice< T >();
+	}
+
+	template< typename T >
+	static constexpr bool contiene() { return indice< T >() < NUMERO; }
+
+	static constexpr bool tieneId( uint8_t id ) {
+	  return Primero::ID == id || Siguientes::tieneId( id );
+	}
+
+	static constexpr bool idsDistintos() {
+	  return !Siguientes::tieneId( Primero::ID ) && Siguientes::idsDistintos();
+	}
+
+	template< typename Visitante >
+	static void paraCada( Visitante & v ) {
+	  v.template visitar< Primero >();
+	  Siguientes::paraCada( v );
+	}
+
+  private:
+
+	template< typename A, typename B >
+	struct MismoTipo { static const bool SI = false; };
+
+	template< typename A >
+	struct MismoTipo< A, A > { static const bool SI = true; };
+  };
+
+  /**
+   * @brief Sensores que mide y publica el sketch.
+   */
+  using Todos = Registro< CO2, Temperatura, Ruido >;
+
+  static_assert( Todos::idsDistintos(), "dos sensores con el mismo ID" );
+
+} // namespace Sensores
+
+#endif
@@ -6,6 +6,9 @@
  * Este archivo contiene la definición de la clase `ServicioEnEmisora`, que permite gestionar
  * servicios y características BLE (Bluetooth Low Energy) en una emisora. También incluye
  * funciones auxiliares para manipular datos en formato inverso.
+ *
+ * Los UUID se dan como constantes UUID128 (ver UUID.h), calculadas al compilar y guardadas en
+ * flash; el servicio y sus características sólo guardan un puntero a ellas.
  */
 
 #ifndef SERVICIO_EMISORA_H_INCLUIDO
@@ -13,6 +16,8 @@
 
 #include <vector>
 
+#include "UUID.h"
+
 /**
  * @brief Invierte los elementos de un arreglo.
  * 
@@ -40,26 +45,69 @@ T *  alReves( T * p, int n ) {
 
 
 /**
- * @brief Convierte una cadena a un arreglo de bytes y lo invierte.
- * 
- * Copia los caracteres de una cadena a un arreglo de tipo `uint8_t` y los coloca en orden inverso.
- * 
- * @param pString Puntero a la cadena original.
- * @param pUint Puntero al arreglo de destino de tipo `uint8_t`.
- * @param tamMax Tamaño máximo del arreglo de destino.
- * @return Puntero al arreglo `pUint` con los valores invertidos.
+ * @class BaseServicioEnEmisora
+ * @brief Lo común a ServicioEnEmisora y ServicioEnEmisoraFijo: el UUID, el servicio BLE y cómo se
+ * activa; cada uno guarda sus características a su manera.
  */
+class BaseServicioEnEmisora {
 
-uint8_t * stringAUint8AlReves( const char * pString, uint8_t * pUint, int tamMax ) {
+private:
 
-	int longitudString =  strlen( pString );
-	int longitudCopiar = ( longitudString > tamMax ? tamMax : longitudString );
-	for( int i=0; i<=longitudCopiar-1; i++ ) {
-	  pUint[ tamMax-i-1 ] = pString[ i ];
-	} 
+  const UUID128 & uuidServicio; ///< UUID del servicio (en flash).
 
-	return pUint;
-} 
+  BLEService elServicio; ///< Servicio BLE asociado.
+
+protected:
+
+  BaseServicioEnEmisora( const UUID128 & uuidServicio_ )
+	:
+	uuidServicio( uuidServicio_ ),
+	elServicio( uuidServicio_.bytes )
+  {
+  }
+
+  /**
+   * @brief Activa el servicio BLE y las características de [primera, ultima).
+   *
+   * Llama a `begin` para iniciar el servicio y activar sus características.
+   *
+   * @param primera, ultima Punteros (o iteradores) a punteros a las características.
+   */
+  template< typename Iterador >
+  void activarConCaracteristicas( Iterador primera, Iterador ultima ) {
+
+	err_t error = (*this).elServicio.begin();
+	Globales::elPuerto.trazar< Trazas::Id::SERVICIO_BEGIN >( error );
+
+	for( ; primera != ultima; ++primera ) {
+	  (*primera)->activar();
+	}
+
+  }
+
+public:
+
+  /**
+   * @brief Escribe el UUID del servicio en el puerto serie.
+   */
+  void escribeUUID() {
+	Globales::elPuerto.escribir ( "**********\n" );
+	for (int i=0; i<= 15; i++) {
+	  Globales::elPuerto.escribir( (char) uuidServicio.bytes[i] );
+	}
+	Globales::elPuerto.escribir ( "\n**********\n" );
+  }
+
+  /**
+   * @brief Sobrecarga del operador para devolver el servicio BLE.
+   *
+   * @return Referencia al servicio BLE.
+   */
+  operator BLEService&() {
+	return elServicio;
+  }
+
+};
 
 
 
@@ -70,7 +118,7 @@ uint8_t * stringAUint8AlReves( const char * pString, uint8_t * pUint, int tamMax
  * 
  * Esta clase permite definir un servicio BLE, agregarle características y activarlo para que funcione en una emisora.
  */
-class ServicioEnEmisora {
+class ServicioEnEmisora : public BaseServicioEnEmisora {
 
 public:
 
@@ -87,6 +135,19 @@ public:
   using CallbackCaracteristicaEscrita = void ( uint16_t conn_handle,
 											   BLECharacteristic * chr,
 											   uint8_t * data, uint16_t len); 
+
+  /**
+   * @brief Receptor de escrituras con contexto (ver Caracteristica::instalarReceptorEscritura()).
+   *
+   * @param contexto El puntero que se dio al instalarlo (p. ej. un DespachadorOrdenes).
+   * @param conn_handle Identificador de la conexión BLE.
+   * @param data Bytes escritos; sólo valen mientras dura la llamada.
+   * @param len Número de bytes.
+   */
+  using ReceptorEscritura = void ( void * contexto, uint16_t conn_handle, const uint8_t * data, uint16_t len );
+
+  /// Características que pueden tener un ReceptorEscritura a la vez.
+  static const uint8_t MAX_RECEPTORES_ESCRITURA = 4;
   
 
 
@@ -100,15 +161,6 @@ public:
 
   private:
 
-	uint8_t uuidCaracteristica[16] = { 
-	  '0', '1', '2', '3', 
-	  '4', '5', '6', '7', 
-	  '8', '9', 'A', 'B', 
-	  'C', 'D', 'E', 'F'
-	};
-
-	 
-	
 	BLECharacteristic laCaracteristica; ///< Característica BLE asociada.
 
   public:
@@ -116,43 +168,71 @@ public:
   /**
   * @brief Constructor de la clase Caracteristica.
   * 
-  * Inicializa la característica con un nombre UUID.
+  * Inicializa la característica con su UUID.
   * 
-  * @param nombreCaracteristica_ Nombre de la característica en formato string.
+  * @param uuidCaracteristica_ UUID de la característica (constante con duración estática,
+  * p. ej. `constexpr UUID128 UUID_CAR = UUID128::deNombre( "Caracteristica1" );`).
   */
   
-	Caracteristica( const char * nombreCaracteristica_ )
+	Caracteristica( const UUID128 & uuidCaracteristica_ )
 	  :
-	  laCaracteristica( stringAUint8AlReves( nombreCaracteristica_, &uuidCaracteristica[0], 16 ) )
+	  laCaracteristica( uuidCaracteristica_.bytes )
 	{
 	  
 	}
 
+	/// Un UUID temporal dejaría a la característica apuntando a memoria liberada.
+	Caracteristica( const UUID128 && uuidCaracteristica_ ) = delete;
+
 
   /**
      * @brief Constructor avanzado de la clase Caracteristica.
      * 
      * Inicializa la característica con propiedades, permisos y tamaño de datos.
      * 
-     * @param nombreCaracteristica_ Nombre de la característica en formato string.
+     * @param uuidCaracteristica_ UUID de la característica.
      * @param props Propiedades de la característica (lectura, escritura, etc.).
      * @param permisoRead Permiso de lectura.
      * @param permisoWrite Permiso de escritura.
      * @param tam Tamaño máximo de los datos de la característica.
      */
 
-	Caracteristica( const char * nombreCaracteristica_ ,
+	Caracteristica( const UUID128 & uuidCaracteristica_ ,
 					uint8_t props,
 					SecureMode_t permisoRead,
 					SecureMode_t permisoWrite, 
 					uint8_t tam ) 
 	  :
-	  Caracteristica( nombreCaracteristica_ )
+	  Caracteristica( uuidCaracteristica_ )
 	{
 	  (*this).asignarPropiedadesPermisosYTamanyoDatos( props, permisoRead, permisoWrite, tam );
 	}
 
   private:
+
+	/// Qué receptor (y con qué contexto) tiene cada característica: la biblioteca sólo da el puntero a la BLECharacteristic.
+	struct Receptor {
+	  const BLECharacteristic * caracteristica;
+	  ReceptorEscritura * receptor;
+	  void * contexto;
+	};
+
+	static Receptor * receptores() {
+	  static Receptor losReceptores[MAX_RECEPTORES_ESCRITURA];
+	  return losReceptores;
+	}
+
+	/// Callback que se instala en la biblioteca: busca el receptor de `chr` y le pasa la escritura.
+	static void alEscribir( uint16_t conn_handle, BLECharacteristic * chr, uint8_t * data, uint16_t len ) {
+	  Receptor * r = receptores();
+	  for( uint8_t i = 0; i < MAX_RECEPTORES_ESCRITURA && r[i].caracteristica != nullptr; i++ ) {
+		if( r[i].caracteristica == chr ) {
+		  r[i].receptor( r[i].contexto, conn_handle, data, len );
+		  return;
+		}
+	  }
+	}
+
 	void asignarPropiedades ( uint8_t props ) {
 	  (*this).laCaracteristica.setProperties( props );
 	} 
@@ -215,6 +295,30 @@ public:
 	} 
 
 
+  /**
+     * @brief Notifica bytes a los clientes BLE conectados.
+     * 
+     * La biblioteca trocea lo que no quepa en una notificación (MTU - 3 bytes) y, si la
+     * SoftDevice no tiene sitio en su cola, se bloquea hasta 100 ms esperándolo. Para no
+     * bloquear, ver ColaNotificaciones.
+     * 
+     * @param datos Bytes a notificar.
+     * @param tam Número de bytes.
+     * @return true si se han notificado todos.
+     */
+	bool notificarDatos( const uint8_t * datos, uint16_t tam ) {
+	  return laCaracteristica.notify( datos, tam );
+	}
+
+
+  /**
+     * @brief Tamaño máximo de los datos de la característica.
+     */
+	uint16_t tamanyoMaximoDatos() {
+	  return laCaracteristica.getMaxLen();
+	}
+
+
     /**
      * @brief Instala un callback para manejar escritura de datos en la característica.
      * 
@@ -225,6 +329,35 @@ public:
 	}
 
 
+    /**
+     * @brief Instala un receptor con contexto para las escrituras en la característica.
+     *
+     * A diferencia de instalarCallbackCaracteristicaEscrita(), el receptor recibe un puntero a su
+     * objeto, así que no hace falta una función suelta por característica. Se llama en el
+     * contexto de la pila BLE, como el callback.
+     *
+     * @param receptor Función a la que se pasan las escrituras.
+     * @param contexto Primer argumento de `receptor`.
+     * @return false si ya hay MAX_RECEPTORES_ESCRITURA características con receptor.
+     */
+	bool instalarReceptorEscritura( ReceptorEscritura * receptor, void * contexto ) {
+	  Receptor * r = receptores();
+	  uint8_t i = 0;
+	  while( i < MAX_RECEPTORES_ESCRITURA && r[i].caracteristica != nullptr
+			 && r[i].caracteristica != &(*this).laCaracteristica ) {
+		i++;
+	  }
+	  if( i == MAX_RECEPTORES_ESCRITURA ) {
+		return false;
+	  }
+	  r[i].receptor = receptor;
+	  r[i].contexto = contexto;
+	  r[i].caracteristica = &(*this).laCaracteristica;
+	  (*this).laCaracteristica.setWriteCallback( alEscribir );
+	  return true;
+	}
+
+
     /**
      * @brief Activa la característica en el servicio BLE.
      * 
@@ -233,25 +366,23 @@ public:
 
 	void activar() {
 	  err_t error = (*this).laCaracteristica.begin();
-	  Globales::elPuerto.escribir(  " (*this).laCaracteristica.begin(); error = " );
-	  Globales::elPuerto.escribir(  error );
+	  Globales::elPuerto.trazar< Trazas::Id::CARACTERISTICA_BEGIN >( error );
 	} 
 
-  }; 
-  
 
-private:
-  
-  uint8_t uuidServicio[16] = { 
-	'0', '1', '2', '3', 
-	'4', '5', '6', '7', 
-	'8', '9', 'A', 'B', 
-	'C', 'D', 'E', 'F'
-  };
+  /**
+   * @brief Sobrecarga del operador para devolver la característica BLE.
+   *
+   * @return Referencia a la característica BLE.
+   */
+	operator BLECharacteristic&() {
+	  return laCaracteristica;
+	}
 
+  }; 
   
-  BLEService elServicio; ///< Servicio BLE asociado.
 
+private:
   
   std::vector< Caracteristica * > lasCaracteristicas; ///< Lista de características asociadas al servicio.
 
@@ -260,29 +391,21 @@ public:
   /**
    * @brief Constructor de la clase ServicioEnEmisora.
    * 
-   * Inicializa el servicio BLE con un nombre UUID.
+   * Inicializa el servicio BLE con su UUID.
    * 
-   * @param nombreServicio_ Nombre del servicio en formato string.
+   * @param uuidServicio_ UUID del servicio (constante con duración estática,
+   * p. ej. `constexpr UUID128 UUID_SERVICIO = UUID128::deNombre( "EPSG-GTI-PROY-3A" );`).
    */
   
-  ServicioEnEmisora( const char * nombreServicio_ )
+  ServicioEnEmisora( const UUID128 & uuidServicio_ )
 	:
-	elServicio( stringAUint8AlReves( nombreServicio_, &uuidServicio[0], 16 ) )
+	BaseServicioEnEmisora( uuidServicio_ )
   {
 	
   } 
-  
-  /**
-   * @brief Escribe el UUID del servicio en el puerto serie.
-   */
 
-  void escribeUUID() {
-	Serial.println ( "**********" );
-	for (int i=0; i<= 15; i++) {
-	  Serial.print( (char) uuidServicio[i] );
-	}
-	Serial.println ( "\n**********" );
-  } 
+  /// Un UUID temporal dejaría al servicio apuntando a memoria liberada.
+  ServicioEnEmisora( const UUID128 && uuidServicio_ ) = delete;
 
 
   /**
@@ -303,27 +426,94 @@ public:
    * Llama a `begin` para iniciar el servicio y activar sus características.
    */
   void activarServicio( ) {
+	(*this).activarConCaracteristicas( (*this).lasCaracteristicas.begin(), (*this).lasCaracteristicas.end() );
+  } 
+	
+}; 
 
-	err_t error = (*this).elServicio.begin();
-	Serial.print( " (*this).elServicio.begin(); error = " );
-	Serial.println( error );
+/**
+ * @class ServicioEnEmisoraFijo
+ * @brief Variante de ServicioEnEmisora sin memoria dinámica.
+ *
+ * Guarda las características en un array de tamaño fijo en vez de en un std::vector, así que no
+ * usa el montón ni arrastra el código de std::vector a la imagen: la tabla GATT entera queda en
+ * memoria estática. EmisoraBLE::anyadirServicioConSusCaracteristicas() comprueba al compilar
+ * que las características que se le pasan caben.
+ *
+ * @tparam MAX_CARACTERISTICAS Número máximo de características del servicio.
+ */
+template< uint8_t MAX_CARACTERISTICAS >
+class ServicioEnEmisoraFijo : public BaseServicioEnEmisora {
 
-	for( auto pCar : (*this).lasCaracteristicas ) {
-	  (*pCar).activar();
-	} 
+public:
 
-  } 
+  /// Las características son las mismas que las de ServicioEnEmisora.
+  using Caracteristica = ServicioEnEmisora::Caracteristica;
+
+  static const uint8_t CAPACIDAD = MAX_CARACTERISTICAS;
+
+private:
+
+  Caracteristica * lasCaracteristicas[MAX_CARACTERISTICAS]; ///< Características asociadas al servicio.
+  uint8_t numeroCaracteristicas = 0;
 
+public:
 
   /**
-   * @brief Sobrecarga del operador para devolver el servicio BLE.
-   * 
-   * @return Referencia al servicio BLE.
+   * @brief Constructor de la clase ServicioEnEmisoraFijo.
+   *
+   * @param uuidServicio_ UUID del servicio (constante con duración estática).
    */
-  operator BLEService&() {
-	return elServicio;
-  } 
-	
-}; 
+  ServicioEnEmisoraFijo( const UUID128 & uuidServicio_ )
+	:
+	BaseServicioEnEmisora( uuidServicio_ )
+  {
+  }
+
+  /// Un UUID temporal dejaría al servicio apuntando a memoria liberada.
+  ServicioEnEmisoraFijo( const UUID128 && uuidServicio_ ) = delete;
+
+  /**
+   * @brief Añade una característica al servicio.
+   *
+   * @param car Referencia a la característica que se añadirá al servicio.
+   * @return false si el servicio ya tiene MAX_CARACTERISTICAS características.
+   */
+  bool anyadirCaracteristica( Caracteristica & car ) {
+	if( numeroCaracteristicas >= MAX_CARACTERISTICAS ) {
+	  return false;
+	}
+	(*this).lasCaracteristicas[ numeroCaracteristicas++ ] = & car;
+	return true;
+  }
+
+  /**
+   * @brief Añade varias características al servicio.
+   *
+   * @return false si alguna no cabe.
+   */
+  bool anyadirCaracteristicas( ) {
+	return true;
+  }
+
+  template< typename... T >
+  bool anyadirCaracteristicas( Caracteristica & car, T&... resto ) {
+	bool r = anyadirCaracteristica( car );
+	return anyadirCaracteristicas( resto... ) && r;
+  }
+
+  /// Número de características añadidas.
+  uint8_t numeroDeCaracteristicas() const { return numeroCaracteristicas; }
+
+  /**
+   * @brief Activa el servicio BLE y sus características.
+   *
+   * Llama a `begin` para iniciar el servicio y activar sus características.
+   */
+  void activarServicio( ) {
+	(*this).activarConCaracteristicas( (*this).lasCaracteristicas, (*this).lasCaracteristicas + numeroCaracteristicas );
+  }
+
+};
 
 #endif
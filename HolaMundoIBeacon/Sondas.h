@@ -0,0 +1,126 @@
+
+/**
+ * @file Sondas.h
+ * @brief Sondas de tiempo por etapas del camino medir → codificar → anunciar.
+ *
+ * Una sonda es un objeto Sondas::Ambito: cuenta los ciclos de CPU desde que se crea hasta que
+ * sale de su bloque y los añade a la Estadistica de su etapa (mínimo, máximo, media e
+ * histograma en potencias de dos). Los ciclos salen del contador DWT->CYCCNT del Cortex-M4, que
+ * se lee en un ciclo; en el ordenador el simulador lo imita con el reloj real.
+ *
+ * Todo ocupa memoria fija. Con SONDAS_ACTIVAS a 0 las sondas no generan código.
+ */
+
+#ifndef SONDAS_H_INCLUIDO
+#define SONDAS_H_INCLUIDO
+
+#ifndef SONDAS_ACTIVAS
+#define SONDAS_ACTIVAS 1
+#endif
+
+/// @namespace Sondas
+/// Contador de ciclos y estadísticas de tiempo por etapa.
+namespace Sondas {
+
+  /// Etapas medidas (su número es el que sale en el informe).
+  enum Etapa : uint8_t {
+	MEDIR = 0,       ///< Medidor::medir<S>(): lectura y filtrado.
+	CODIFICAR = 1,   ///< Publicador: montar el major o la trama y parchear el anuncio.
+	ANUNCIAR = 2,    ///< EmisoraBLE: entregar el anuncio a la SoftDevice (o arrancarlo).
+	NUMERO_DE_ETAPAS
+  };
+
+  /// Cubetas del histograma: la k cuenta las duraciones de [2^k, 2^(k+1)) ciclos; la última, el resto.
+  const uint8_t CUBETAS = 20;
+
+  /// Ciclos de CPU por microsegundo.
+  const uint32_t CICLOS_POR_US = F_CPU / 1000000;
+
+  /**
+   * @brief Estadística de duraciones, en ciclos de CPU.
+   */
+  struct Estadistica {
+	uint32_t veces = 0;
+	uint32_t minimo = UINT32_MAX;
+	uint32_t maximo = 0;
+	uint64_t suma = 0;
+	uint16_t histograma[CUBETAS] = { 0 };  ///< Satura en 65535.
+
+	void anyadir( uint32_t ciclos ) {
+	  veces++;
+	  suma += ciclos;
+	  minimo = ciclos < minimo ? ciclos : minimo;
+	  maximo = ciclos > maximo ? ciclos : maximo;
+	  uint8_t k = (uint8_t) ( 31 - __builtin_clz( ciclos | 1 ) );
+	  k = k < CUBETAS ? k : CUBETAS - 1;
+	  if( histograma[k] < UINT16_MAX ) {
+		histograma[k]++;
+	  }
+	}
+
+	uint32_t media() const {
+	  return veces > 0 ? (uint32_t) ( suma / veces ) : 0;
+	}
+  };
+
+  /// Estadística de una etapa.
+  inline Estadistica & estadistica( Etapa etapa ) {
+	static Estadistica todas[NUMERO_DE_ETAPAS];
+	return todas[etapa];
+  }
+
+  /// Pone a cero todas las estadísticas.
+  inline void reiniciar() {
+	for( uint8_t e = 0; e < NUMERO_DE_ETAPAS; e++ ) {
+	  estadistica( (Etapa) e ) = Estadistica();
+	}
+  }
+
+  /**
+   * @brief Enciende el contador de ciclos (una vez, en setup()).
+   */
+  inline void activar() {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }
+
+#if SONDAS_ACTIVAS
+
+  /**
+   * @class Ambito
+   * @brief Sonda de un bloque: mide desde su construcción hasta su destrucción.
+   *
+   * Uso: `Sondas::Ambito sonda( Sondas::MEDIR );` al principio del bloque.
+   */
+  class Ambito {
+  private:
+	Estadistica & laEstadistica;
+	uint32_t inicio;
+
+  public:
+	explicit Ambito( Etapa etapa )
+	  : laEstadistica( estadistica( etapa ) ), inicio( DWT->CYCCNT ) {
+	}
+
+	~Ambito() {
+	  laEstadistica.anyadir( (uint32_t) DWT->CYCCNT - inicio );
+	}
+
+	Ambito( const Ambito & ) = delete;
+	Ambito & operator=( const Ambito & ) = delete;
+  };
+
+#else
+
+  class Ambito {
+  public:
+	explicit Ambito( Etapa ) {
+	}
+  };
+
+#endif
+
+} // namespace Sondas
+
+#endif
@@ -0,0 +1,32 @@
+/**
+ * @file TablaTrazas.h
+ * @brief Tabla de los mensajes de traza del firmware (ver Trazas.h).
+ *
+ * Cada línea es `TRAZA( nivel, IDENTIFICADOR, "formato" )`. El número de cada traza es su
+ * posición en la tabla y viaja en las trazas binarias, así que las trazas nuevas se añaden al
+ * final y las que sobren no se borran (el decodificador del ordenador usa esta misma tabla).
+ *
+ * En el formato, %d es un entero con signo, %u uno sin signo, %x uno en hexadecimal y %c un
+ * carácter; %% escribe un %.
+ *
+ * Este archivo se incluye varias veces a propósito, con distintas definiciones de TRAZA: no
+ * lleva guardas de inclusión.
+ */
+
+TRAZA( INFO,       SETUP_FIN,               "---- setup(): fin ---- \n " )
+TRAZA( INFO,       CICLO_EMPIEZA,           "\n---- ciclo: empieza %u\n" )
+TRAZA( INFO,       CICLO_ACABA,             "---- ciclo: acaba **** %u\n" )
+TRAZA( DEPURACION, ANUNCIO_LIBRE_START,     "emitiriBeacon libre Bluefruit.Advertising.start(0);\n" )
+TRAZA( DEPURACION, ANYADIR_SERVICIO,        " Bluefruit.Advertising.addService( servicio ); \n" )
+TRAZA( ERROR,      SERVICIO_NO_ANYADIDO,    " SERVICIO NO AÑADIDO \n" )
+TRAZA( DEPURACION, CARACTERISTICA_BEGIN,    " (*this).laCaracteristica.begin(); error = %u\n" )
+TRAZA( DEPURACION, SERVICIO_BEGIN,          " (*this).elServicio.begin(); error = %u\n" )
+TRAZA( INFO,       SONDA_RESUMEN,           "sonda %u: %u veces, min %u, media %u, max %u ciclos\n" )
+TRAZA( INFO,       SONDA_CUBETA,            "  [%u, %u): %u\n" )
+TRAZA( INFO,       DIARIO_ABIERTO,          "diario: arranque %u, segmento %u, %u bytes cortados\n" )
+TRAZA( ERROR,      DIARIO_SIN_FLASH,        "DIARIO: no se puede abrir la flash\n" )
+TRAZA( INFO,       DIARIO_FIN_EXPORTAR,     "diario: fin (%u entradas, %u muestras guardadas desde el arranque)\n" )
+TRAZA( INFO,       CONEXION_NEGOCIADA,      "conexion: phy %u, mtu %u, datos %u, intervalo %u, latencia %u (%u ms, %u rechazados)\n" )
+TRAZA( INFO,       LOTES_EXTENDIDOS,        "lotes: anuncios extendidos %u (phy %u / %u)\n" )
+TRAZA( INFO,       RESIDENCIA,              "reposo: activo %u ms, reposo %u ms, radio %u ms, %u despertares (%u por eventos)\n" )
+TRAZA( ERROR,      REPOSO_SIN_RADIO,        "REPOSO: sin notificaciones de radio, no se cuenta el tiempo de radio\n" )
@@ -0,0 +1,221 @@
+
+/**
+ * @file TramaMediciones.h
+ * @brief Declaración de la clase TramaMediciones.
+ *
+ * Formato binario versionado que empaqueta varias mediciones en los 21 bytes de carga de
+ * emitirAnuncioIBeaconLibre(), para publicar todas las mediciones de un ciclo en un solo anuncio.
+ *
+ * Disposición de la versión 1 (valores de 16 bits en big-endian, como major/minor de iBeacon):
+ *
+ *  byte    0       1          2 .. 19                      20
+ *       +-------+---------+---------------------------+--------+
+ *       | V | N | secuen. | N x ( id | valor_hi | lo ) |  CRC-8 |
+ *       +-------+---------+---------------------------+--------+
+ *
+ *  V: versión (4 bits altos), N: número de mediciones (4 bits bajos, hasta 6).
+ *  Los huecos de mediciones no usadas van a 0. CRC-8 (polinomio 0x07) de los bytes 0..19.
+ *
+ * Con V = 2 la trama lleva en los bytes 1..19 un bloque de muestras comprimidas de
+ * BufferMediciones (ver CodecMuestras) y N vale 0.
+ *
+ * Con V = 3 (anuncios extendidos, ver AnuncioExtendido) la trama es de longitud variable: la
+ * cabecera, un bloque de muestras de cualquier tamaño y el CRC-8 de todo lo anterior en el último
+ * byte. La longitud la da el anuncio.
+ */
+
+#ifndef TRAMA_MEDICIONES_H_INCLUIDO
+#define TRAMA_MEDICIONES_H_INCLUIDO
+
+/**
+ * @class TramaMediciones
+ * @brief Codificador y decodificador de la trama de mediciones.
+ */
+class TramaMediciones {
+
+public:
+
+  // ------------------------------------------------------------
+  // disposición de la trama, fijada en tiempo de compilación
+  // ------------------------------------------------------------
+  static constexpr uint8_t VERSION = 1;            ///< Versión del formato.
+  static constexpr uint8_t TAMANYO = 21;           ///< Bytes de la trama (la carga libre).
+  static constexpr uint8_t POS_CABECERA = 0;       ///< Versión y número de mediciones.
+  static constexpr uint8_t POS_SECUENCIA = 1;      ///< Número de secuencia.
+  static constexpr uint8_t POS_MEDICIONES = 2;     ///< Primera medición.
+  static constexpr uint8_t TAMANYO_MEDICION = 3;   ///< id + valor de 16 bits.
+  static constexpr uint8_t POS_CRC = TAMANYO - 1;  ///< Último byte.
+  static constexpr uint8_t MAX_MEDICIONES = ( POS_CRC - POS_MEDICIONES ) / TAMANYO_MEDICION;
+
+  static constexpr uint8_t VERSION_BLOQUE = 2;     ///< Versión de las tramas con un bloque comprimido.
+  static constexpr uint8_t POS_BLOQUE = 1;         ///< Primer byte del bloque comprimido.
+  static constexpr uint8_t CAPACIDAD_BLOQUE = POS_CRC - POS_BLOQUE;
+
+  static constexpr uint8_t VERSION_BLOQUE_LARGO = 3;  ///< Versión de las tramas de longitud variable con un bloque.
+  static constexpr uint8_t TAMANYO_MINIMO_LARGA = POS_BLOQUE + 1;
+
+  /// Bloque que cabe en una trama larga de `tamanyo` bytes.
+  static constexpr uint8_t capacidadBloqueLargo( uint8_t tamanyo ) {
+	return tamanyo - POS_BLOQUE - 1;
+  }
+
+  static_assert( MAX_MEDICIONES <= 0x0f, "el número de mediciones tiene que caber en 4 bits" );
+  static_assert( POS_MEDICIONES + MAX_MEDICIONES * TAMANYO_MEDICION <= POS_CRC, "las mediciones pisan el CRC" );
+
+  /// Posición de la medición i-ésima.
+  static constexpr uint8_t posicionMedicion( uint8_t i ) {
+	return POS_MEDICIONES + i * TAMANYO_MEDICION;
+  }
+
+  /**
+   * @struct Medicion
+   * @brief Una medición de la trama.
+   */
+  struct Medicion {
+	uint8_t id;      ///< Tipo de medición (ver Publicador::MedicionesID).
+	int16_t valor;   ///< Valor medido.
+  };
+
+private:
+
+  uint8_t bytes[TAMANYO];
+  uint8_t cuantas = 0;
+
+public:
+
+  /**
+   * @brief CRC-8 (polinomio 0x07, valor inicial 0) de un bloque de bytes.
+   */
+  static uint8_t crc8( const uint8_t * p, uint8_t n ) {
+	uint8_t crc = 0;
+	for( uint8_t i = 0; i < n; i++ ) {
+	  crc ^= p[i];
+	  for( uint8_t b = 0; b < 8; b++ ) {
+		crc = ( crc & 0x80 ) ? (uint8_t) ( ( crc << 1 ) ^ 0x07 ) : (uint8_t) ( crc << 1 );
+	  }
+	}
+	return crc;
+  }
+
+  /**
+   * @brief Constructor: empieza una trama vacía.
+   *
+   * @param secuencia Número de secuencia de la trama.
+   */
+  TramaMediciones( uint8_t secuencia ) {
+	memset( bytes, 0, TAMANYO );
+	bytes[POS_SECUENCIA] = secuencia;
+  }
+
+  /**
+   * @brief Añade una medición a la trama.
+   *
+   * @param id Tipo de medición.
+   * @param valor Valor medido.
+   * @return false si la trama ya está llena.
+   */
+  bool anyadir( uint8_t id, int16_t valor ) {
+	if( cuantas >= MAX_MEDICIONES ) {
+	  return false;
+	}
+	uint8_t * p = &bytes[ posicionMedicion( cuantas ) ];
+	p[0] = id;
+	p[1] = (uint8_t) ( (uint16_t) valor >> 8 );
+	p[2] = (uint8_t) ( valor & 0xff );
+	cuantas++;
+	return true;
+  }
+
+  /**
+   * @brief Completa la cabecera y el CRC.
+   *
+   * @return Los TAMANYO bytes de la trama, listos para emitir.
+   */
+  const uint8_t * cerrar() {
+	bytes[POS_CABECERA] = (uint8_t) ( ( VERSION << 4 ) | cuantas );
+	bytes[POS_CRC] = crc8( bytes, POS_CRC );
+	return bytes;
+  }
+
+  /**
+   * @brief Parte de una trama de TAMANYO bytes donde se escribe un bloque comprimido.
+   */
+  static uint8_t * bloque( uint8_t * trama ) {
+	return &trama[POS_BLOQUE];
+  }
+
+  /**
+   * @brief Completa la cabecera y el CRC de una trama con un bloque comprimido.
+   */
+  static void cerrarBloque( uint8_t * trama ) {
+	trama[POS_CABECERA] = (uint8_t) ( VERSION_BLOQUE << 4 );
+	trama[POS_CRC] = crc8( trama, POS_CRC );
+  }
+
+  /**
+   * @brief Completa la cabecera y el CRC de una trama larga con un bloque de `tamanyoBloque` bytes.
+   *
+   * @return Bytes de la trama.
+   */
+  static uint8_t cerrarBloqueLargo( uint8_t * trama, uint8_t tamanyoBloque ) {
+	uint8_t posCRC = (uint8_t) ( POS_BLOQUE + tamanyoBloque );
+	trama[POS_CABECERA] = (uint8_t) ( VERSION_BLOQUE_LARGO << 4 );
+	trama[posCRC] = crc8( trama, posCRC );
+	return (uint8_t) ( posCRC + 1 );
+  }
+
+  /**
+   * @brief Comprueba una trama larga recibida de `n` bytes.
+   *
+   * @return Bytes de su bloque, o -1 si no es una trama larga o el CRC no cuadra.
+   */
+  static int bloqueLargo( const uint8_t * p, uint8_t n ) {
+	if( n < TAMANYO_MINIMO_LARGA || ( p[POS_CABECERA] >> 4 ) != VERSION_BLOQUE_LARGO
+		|| crc8( p, (uint8_t) ( n - 1 ) ) != p[n - 1] ) {
+	  return -1;
+	}
+	return n - POS_BLOQUE - 1;
+  }
+
+  /**
+   * @brief Versión de una trama recibida (4 bits altos de la cabecera), o -1 si el CRC no cuadra.
+   */
+  static int version( const uint8_t * p, uint8_t n ) {
+	if( n < TAMANYO || crc8( p, POS_CRC ) != p[POS_CRC] ) {
+	  return -1;
+	}
+	return p[POS_CABECERA] >> 4;
+  }
+
+  /// Número de mediciones añadidas.
+  uint8_t numeroMediciones() const { return cuantas; }
+
+  /**
+   * @brief Decodifica una trama (lo usa el receptor).
+   *
+   * @param p Bytes recibidos.
+   * @param n Número de bytes recibidos.
+   * @param secuencia Número de secuencia leído.
+   * @param mediciones Array de al menos MAX_MEDICIONES posiciones donde dejar las mediciones.
+   * @return Número de mediciones, o -1 si la trama no es válida (tamaño, versión o CRC).
+   */
+  static int decodificar( const uint8_t * p, uint8_t n, uint8_t & secuencia, Medicion * mediciones ) {
+	if( n < TAMANYO || ( p[POS_CABECERA] >> 4 ) != VERSION || crc8( p, POS_CRC ) != p[POS_CRC] ) {
+	  return -1;
+	}
+	uint8_t cuantas = p[POS_CABECERA] & 0x0f;
+	if( cuantas > MAX_MEDICIONES ) {
+	  return -1;
+	}
+	secuencia = p[POS_SECUENCIA];
+	for( uint8_t i = 0; i < cuantas; i++ ) {
+	  const uint8_t * m = &p[ posicionMedicion( i ) ];
+	  mediciones[i].id = m[0];
+	  mediciones[i].valor = (int16_t) ( ( m[1] << 8 ) | m[2] );
+	}
+	return cuantas;
+  }
+
+};
+
+#endif
@@ -0,0 +1,156 @@
+
+/**
+ * @file Trazas.h
+ * @brief Trazas con identificador: la tabla de mensajes (TablaTrazas.h) y su formato binario.
+ *
+ * Cada mensaje de diagnóstico del firmware está en TablaTrazas.h con un nivel, un identificador
+ * y un formato. Se escriben con PuertoSerie::trazar<Trazas::Id::...>( valores... ) y salen de dos
+ * maneras, según TRAZAS_BINARIAS:
+ *  - 0 (por defecto): como texto, con el formato expandido en la placa;
+ *  - 1: como un registro binario con el número de la traza y los valores sin formatear; el
+ *    texto no llega a la placa y lo reconstruye host/decodificar_trazas con la misma tabla.
+ *
+ * Registro binario: MARCA, número de traza (1 byte) y cada valor en zigzag + varint (de 1 a 5
+ * bytes). MARCA no aparece en el texto normal, así que los registros pueden ir mezclados con lo
+ * que se escriba con PuertoSerie::escribir().
+ */
+
+#ifndef TRAZAS_H_INCLUIDO
+#define TRAZAS_H_INCLUIDO
+
+#ifndef TRAZAS_BINARIAS
+#define TRAZAS_BINARIAS 0
+#endif
+
+/// @namespace Trazas
+/// Identificadores, formatos y codificación de las trazas.
+namespace Trazas {
+
+  /// Identificadores de las trazas, en el orden de TablaTrazas.h.
+  enum class Id : uint8_t {
+#define TRAZA( nivel, identificador, texto ) identificador,
+#include "TablaTrazas.h"
+#undef TRAZA
+	NUMERO_DE_TRAZAS
+  };
+
+  /// Primer byte de un registro binario (ASCII RS, separador de registros).
+  const uint8_t MARCA = 0x1e;
+
+  /// Bytes máximos de un valor codificado.
+  const uint8_t MAXIMO_BYTES_VALOR = 5;
+
+  /// Nivel y formato de cada traza.
+  template< Id ID >
+  struct Info;
+
+#define TRAZA( nivel, identificador, texto )                          \
+  template<>                                                          \
+  struct Info< Id::identificador > {                                  \
+	static const uint8_t NIVEL = NIVEL_REGISTRO_##nivel;              \
+	static constexpr const char * formato() { return texto; }         \
+  };
+#include "TablaTrazas.h"
+#undef TRAZA
+
+  /**
+   * @brief Número de valores que pide un formato (los % que no son %%).
+   */
+  constexpr uint8_t contarValores( const char * f ) {
+	return *f == '\0' ? 0
+	  : f[0] == '%' && f[1] == '%' ? contarValores( f + 2 )
+	  : ( f[0] == '%' ? 1 : 0 ) + contarValores( f + 1 );
+  }
+
+  /**
+   * @brief Escribe un valor en zigzag + varint.
+   *
+   * @return Bytes escritos (de 1 a MAXIMO_BYTES_VALOR).
+   */
+  inline uint8_t codificarValor( int32_t v, uint8_t * destino ) {
+	uint32_t z = ( (uint32_t) v << 1 ) ^ (uint32_t) ( v >> 31 );
+	uint8_t n = 0;
+	while( z >= 0x80 ) {
+	  destino[n++] = (uint8_t) ( z | 0x80 );
+	  z >>= 7;
+	}
+	destino[n++] = (uint8_t) z;
+	return n;
+  }
+
+  /**
+   * @brief Lee un valor escrito con codificarValor().
+   *
+   * @return Bytes leídos, o 0 si no hay un valor completo en los `tam` bytes.
+   */
+  inline uint8_t decodificarValor( const uint8_t * origen, size_t tam, int32_t & v ) {
+	uint32_t z = 0;
+	for( uint8_t i = 0; i < MAXIMO_BYTES_VALOR && i < tam; i++ ) {
+	  z |= (uint32_t) ( origen[i] & 0x7f ) << ( 7 * i );
+	  if( ( origen[i] & 0x80 ) == 0 ) {
+		v = (int32_t) ( ( z >> 1 ) ^ ( 0U - ( z & 1 ) ) );
+		return i + 1;
+	  }
+	}
+	return 0;
+  }
+
+  /**
+   * @brief Expande un formato con sus valores (lo mismo en la placa que en el decodificador).
+   *
+   * @param formato Formato de TablaTrazas.h.
+   * @param valores Tantos valores como pida el formato.
+   * @param poner Recibe los trozos de texto: poner( const char *, size_t ).
+   */
+  template< typename Poner >
+  void expandir( const char * formato, const int32_t * valores, Poner poner ) {
+	const char * tramo = formato;
+	for( const char * p = formato; *p != '\0'; p++ ) {
+	  if( *p != '%' || p[1] == '\0' ) {
+		continue;
+	  }
+	  poner( tramo, p - tramo );
+	  p++;
+	  char buf[12];
+	  char * fin = &buf[sizeof( buf )];
+	  char * q = fin;
+	  uint32_t u = (uint32_t) *valores;
+	  switch( *p ) {
+	  case '%':
+		*--q = '%';
+		break;
+	  case 'c':
+		*--q = (char) *valores++;
+		break;
+	  case 'x':
+		do {
+		  *--q = "0123456789abcdef"[u & 0xf];
+		  u >>= 4;
+		} while( u > 0 );
+		valores++;
+		break;
+	  case 'd':
+		if( *valores < 0 ) {
+		  u = 0U - u;
+		}
+		// fall through
+	  default:
+		do {
+		  *--q = (char) ( '0' + u % 10 );
+		  u /= 10;
+		} while( u > 0 );
+		if( *p == 'd' && *valores < 0 ) {
+		  *--q = '-';
+		}
+		valores++;
+		break;
+	  }
+	  poner( q, fin - q );
+	  tramo = p + 1;
+	}
+	poner( tramo, strlen( tramo ) );
+  }
+
+} // namespace Trazas
+
+#endif
@@ -0,0 +1,143 @@
+
+/**
+ * @file UUID.h
+ * @brief Declaración de la estructura UUID128.
+ *
+ * Los UUID de 128 bits de los servicios, características y beacons se calculan al compilar a
+ * partir de su texto, y quedan en flash ya con el orden de bytes que necesita cada uso: sin
+ * copias en RAM ni trabajo al arrancar. Un UUID mal escrito no compila.
+ */
+
+#ifndef UUID_H_INCLUIDO
+#define UUID_H_INCLUIDO
+
+/**
+ * @struct UUID128
+ * @brief UUID de 128 bits (16 bytes) calculado en tiempo de compilación.
+ *
+ * Hay que guardarlo en una constante `constexpr` con duración estática (de espacio de nombres o
+ * `static` local), porque BLEService y BLECharacteristic se quedan con un puntero a sus bytes:
+ *
+ * @code
+ *   constexpr UUID128 UUID_SERVICIO = UUID128::deNombre( "EPSG-GTI-PROY-3A" );
+ *   constexpr UUID128 UUID_NUS = UUID128::deTexto( "6E400001-B5A3-F393-E0A9-E50E24DCCA9E" );
+ * @endcode
+ *
+ * deNombre() y deTexto() dan el orden de GATT (little-endian, el último byte del texto primero),
+ * el mismo que daba stringAUint8AlReves(). iBeaconDeNombre() e iBeaconDeTexto() dan el orden en
+ * que el UUID va en un anuncio iBeacon (big-endian, el orden del texto).
+ */
+struct UUID128 {
+
+  uint8_t bytes[16]; ///< Bytes del UUID, en el orden en que se usan.
+
+private:
+
+  template< unsigned... I >
+  struct Indices { };
+
+  template< unsigned N, unsigned... I >
+  struct GenerarIndices : GenerarIndices< N - 1, N - 1, I... > { };
+
+  template< unsigned... I >
+  struct GenerarIndices< 0, I... > {
+	using Tipo = Indices< I... >;
+  };
+
+  using Indices16 = GenerarIndices< 16 >::Tipo;
+
+  /// No es constexpr: si se llega a evaluar al compilar, el UUID no compila.
+  static uint8_t uuidMalFormado() {
+	return 0;
+  }
+
+  static constexpr int valorHex( char c ) {
+	return c >= '0' && c <= '9' ? c - '0'
+	  : c >= 'a' && c <= 'f' ? c - 'a' + 10
+	  : c >= 'A' && c <= 'F' ? c - 'A' + 10
+	  : -1;
+  }
+
+  static constexpr uint8_t digitoHex( char c ) {
+	return valorHex( c ) >= 0 ? (uint8_t) valorHex( c ) : uuidMalFormado();
+  }
+
+  /// Posición en el texto "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx" del byte k (big-endian).
+  static constexpr unsigned posicionHex( unsigned k ) {
+	return 2 * k + ( k >= 4 ) + ( k >= 6 ) + ( k >= 8 ) + ( k >= 10 );
+  }
+
+  static constexpr bool guionesEnSuSitio( const char * texto ) {
+	return texto[8] == '-' && texto[13] == '-' && texto[18] == '-' && texto[23] == '-';
+  }
+
+  /// Byte k (big-endian) de un UUID en texto.
+  static constexpr uint8_t byteTexto( const char * texto, unsigned k ) {
+	return guionesEnSuSitio( texto )
+	  ? (uint8_t) ( ( digitoHex( texto[ posicionHex( k ) ] ) << 4 ) | digitoHex( texto[ posicionHex( k ) + 1 ] ) )
+	  : uuidMalFormado();
+  }
+
+  /// Byte k (big-endian) de un UUID con nombre; si el nombre es corto se rellena como antes.
+  static constexpr uint8_t byteNombre( const char * nombre, unsigned longitud, unsigned k ) {
+	return k < longitud ? (uint8_t) nombre[k] : (uint8_t) "FEDCBA9876543210"[k];
+  }
+
+  template< unsigned... I >
+  static constexpr UUID128 construirDeTexto( const char * texto, bool invertir, Indices< I... > ) {
+	return UUID128 { { byteTexto( texto, invertir ? 15 - I : I )... } };
+  }
+
+  template< unsigned... I >
+  static constexpr UUID128 construirDeNombre( const char * nombre, unsigned longitud, bool invertir, Indices< I... > ) {
+	return UUID128 { { byteNombre( nombre, longitud, invertir ? 15 - I : I )... } };
+  }
+
+public:
+
+  /**
+   * @brief UUID de GATT a partir de un nombre ASCII de hasta 16 caracteres.
+   *
+   * Equivale a stringAUint8AlReves( nombre, ... ): el primer carácter va al último byte.
+   */
+  template< unsigned N >
+  static constexpr UUID128 deNombre( const char ( & nombre )[N] ) {
+	static_assert( N - 1 <= 16, "el nombre de un UUID tiene como mucho 16 caracteres" );
+	return construirDeNombre( nombre, N - 1, true, Indices16() );
+  }
+
+  /**
+   * @brief UUID de GATT a partir del texto estándar "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx".
+   */
+  template< unsigned N >
+  static constexpr UUID128 deTexto( const char ( & texto )[N] ) {
+	static_assert( N - 1 == 36, "un UUID en texto tiene 36 caracteres: xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx" );
+	return construirDeTexto( texto, true, Indices16() );
+  }
+
+  /**
+   * @brief UUID de iBeacon a partir de un nombre ASCII de 16 caracteres (sin invertir).
+   */
+  template< unsigned N >
+  static constexpr UUID128 iBeaconDeNombre( const char ( & nombre )[N] ) {
+	static_assert( N - 1 == 16, "el nombre de un UUID de iBeacon tiene 16 caracteres" );
+	return construirDeNombre( nombre, N - 1, false, Indices16() );
+  }
+
+  /**
+   * @brief UUID de iBeacon a partir del texto estándar (sin invertir).
+   */
+  template< unsigned N >
+  static constexpr UUID128 iBeaconDeTexto( const char ( & texto )[N] ) {
+	static_assert( N - 1 == 36, "un UUID en texto tiene 36 caracteres: xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx" );
+	return construirDeTexto( texto, false, Indices16() );
+  }
+
+  /// Para pasarlo directamente a BLEUuid, BLEBeacon o AnuncioPrecalculado.
+  constexpr operator const uint8_t * () const {
+	return bytes;
+  }
+
+};
+
+#endif
@@ -0,0 +1,209 @@
+
+/**
+ * @file bench_agregador.cpp
+ * @brief Mediciones por segundo de Pasarela::Agregador y comprobación de las pérdidas que cuenta.
+ *
+ * Se generan EMISORES placas durante CICLOS ciclos de 1 s (el contador de 8 bits da la vuelta
+ * varias veces). En cada ciclo cada placa anuncia CO2 y temperatura en dos iBeacon con el mismo
+ * contador (una de cada 10, en una TramaMediciones con las dos). Cada anuncio llega entre 1 y 5
+ * veces, o ninguna (pérdida, PROBABILIDAD_PERDIDA), y alguna copia llega con 1,5 s de retraso
+ * (desordenada). Se comparan las pérdidas que cuenta el Agregador con las generadas y se mide
+ * cuántas mediciones por segundo atiende con 1, 2, 4 y 8 hilos.
+ *
+ * Con una captura H4 (p. ej. de generar_carga) la decodifica con DecodificadorAnuncios, pasa las
+ * mediciones por el Agregador y escribe sus cuentas, para compararlas con las del generador.
+ *
+ * Uso: bench_agregador [captura.h4]
+ */
+
+#include <bluefruit.h>
+
+#include "pasarela/Agregador.h"
+#include "UUID.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace {
+
+  const uint32_t EMISORES = 3000;
+  const uint32_t CICLOS = 300;
+  const uint32_t PROBABILIDAD_PERDIDA = 4;   // %
+  const uint32_t PROBABILIDAD_RETRASO = 1;   // %
+  const uint8_t CO2 = 11;
+  const uint8_t TEMPERATURA = 12;
+
+  /// Una copia recibida de un anuncio.
+  struct Llegada {
+	uint32_t instante_ms;
+	uint16_t emisor;
+	uint8_t contador;
+	uint8_t tipo;   // 0: iBeacon CO2, 1: iBeacon temperatura, 2: TramaMediciones
+  };
+
+  uint32_t semilla = 1;
+
+  uint32_t aleatorio() {
+	semilla = semilla * 1103515245 + 12345;
+	return ( semilla >> 16 ) & 0x7fff;
+  }
+
+  /// Genera las llegadas ordenadas por instante y devuelve las secuencias perdidas.
+  uint64_t generar( std::vector< Llegada > & llegadas ) {
+	uint64_t perdidas = 0;
+	for( uint32_t e = 0; e < EMISORES; e++ ) {
+	  uint32_t fase = aleatorio() % 1000;
+	  bool trama = e % 10 == 0;
+	  for( uint32_t ciclo = 0; ciclo < CICLOS; ciclo++ ) {
+		for( uint8_t tipo = trama ? 2 : 0; tipo <= ( trama ? 2 : 1 ); tipo++ ) {
+		  // el primer y el último ciclo llegan siempre: si no, esas pérdidas no se pueden ver
+		  bool extremo = ciclo == 0 || ciclo == CICLOS - 1;
+		  if( !extremo && aleatorio() % 100 < PROBABILIDAD_PERDIDA ) {
+			perdidas++;
+			continue;
+		  }
+		  uint32_t copias = 1 + aleatorio() % 5;
+		  for( uint32_t k = 0; k < copias; k++ ) {
+			uint32_t instante = ciclo * 1000 + fase + k * 100 + aleatorio() % 50;
+			if( !extremo && aleatorio() % 100 < PROBABILIDAD_RETRASO ) {
+			  instante += 1500;
+			}
+			llegadas.push_back( { instante, (uint16_t) e, (uint8_t) ciclo, tipo } );
+		  }
+		}
+	  }
+	}
+	std::stable_sort( llegadas.begin(), llegadas.end(),
+					  [] ( const Llegada & a, const Llegada & b ) { return a.instante_ms < b.instante_ms; } );
+	return perdidas;
+  }
+
+  struct Resultado {
+	double segundos;
+	uint64_t mediciones;
+	Pasarela::Agregador::Resumen resumen;
+	double intervaloMedio_ms;
+	double peorTasa;
+  };
+
+  Resultado medir( unsigned hilos, const std::vector< Llegada > & llegadas,
+				   const std::vector< uint8_t > & direcciones ) {
+	Resultado r = { 0, 0, Pasarela::Agregador::Resumen(), 0, 0 };
+	auto t0 = std::chrono::steady_clock::now();
+	Pasarela::Agregador agregador( hilos );
+	Pasarela::Medicion m;
+	m.rssi = -60;
+	m.instante_ms = 0;
+	for( const Llegada & l : llegadas ) {
+	  m.direccion = &direcciones[l.emisor * 6];
+	  m.secuencia = l.contador;
+	  uint64_t llegada_us = l.instante_ms * 1000ULL;
+	  if( l.tipo == 2 ) {
+		m.formato = Pasarela::Formato::TRAMA;
+		m.indice = 0;
+		m.id = CO2;
+		m.valor = 400;
+		agregador.recibir( m, llegada_us );
+		m.indice = 1;
+		m.id = TEMPERATURA;
+		m.valor = 21;
+		agregador.recibir( m, llegada_us );
+		r.mediciones += 2;
+	  } else {
+		m.formato = Pasarela::Formato::IBEACON;
+		m.indice = 0;
+		m.id = l.tipo == 0 ? CO2 : TEMPERATURA;
+		m.valor = l.tipo == 0 ? 400 : 21;
+		agregador.recibir( m, llegada_us );
+		r.mediciones++;
+	  }
+	}
+	agregador.terminar();
+	r.segundos = std::chrono::duration< double >( std::chrono::steady_clock::now() - t0 ).count();
+
+	r.resumen = agregador.resumen();
+	uint64_t intervalos = 0;
+	uint64_t suma_us = 0;
+	agregador.recorrer( [&] ( uint64_t, const Pasarela::Canal & c ) {
+	  intervalos += c.intervalos;
+	  suma_us += c.sumaIntervalo_us;
+	  r.peorTasa = std::max( r.peorTasa, c.tasaPerdidas() );
+	} );
+	r.intervaloMedio_ms = intervalos == 0 ? 0 : suma_us / 1000.0 / intervalos;
+	return r;
+  }
+
+  /// Decodifica y agrega una captura H4; el instante de llegada es el orden del informe (en us).
+  int agregarCaptura( const char * fichero ) {
+	FILE * f = fopen( fichero, "rb" );
+	if( f == nullptr ) {
+	  perror( fichero );
+	  return 1;
+	}
+	std::vector< uint8_t > captura;
+	uint8_t bloque[65536];
+	size_t n;
+	while( ( n = fread( bloque, 1, sizeof( bloque ), f ) ) > 0 ) {
+	  captura.insert( captura.end(), bloque, bloque + n );
+	}
+	fclose( f );
+
+	static constexpr UUID128 BEACON_UUID = UUID128::iBeaconDeNombre( "cholosimeonejefe" );
+	unsigned hilos = std::thread::hardware_concurrency();
+	auto t0 = std::chrono::steady_clock::now();
+	Pasarela::DecodificadorAnuncios decodificador( BEACON_UUID.bytes );
+	Pasarela::Agregador agregador( hilos == 0 ? 1 : hilos );
+	decodificador.decodificarHCI( captura.data(), captura.size(), [&] ( const Pasarela::Medicion & m ) {
+	  agregador.recibir( m, decodificador.contadores().anuncios );
+	} );
+	agregador.terminar();
+	double s = std::chrono::duration< double >( std::chrono::steady_clock::now() - t0 ).count();
+
+	Pasarela::Agregador::Resumen r = agregador.resumen();
+	printf( "---- agregador: %s, %zu bytes, %u hilos ----\n", fichero, captura.size(), agregador.numHilos() );
+	printf( "%.2f Mmediciones/s (con la decodificación)  emisores %llu  canales %llu  nuevas %llu  repetidas %llu"
+			"  tardías %llu  perdidas %lld  tasa %.3f %%\n",
+			r.registros / s / 1e6, (unsigned long long) r.emisores, (unsigned long long) r.canales,
+			(unsigned long long) r.nuevas, (unsigned long long) r.repetidas, (unsigned long long) r.tardias,
+			(long long) r.perdidas, 100 * r.tasaPerdidas() );
+	return 0;
+  }
+
+} // namespace
+
+int main( int argc, char * argv[] ) {
+
+  if( argc > 1 ) {
+	return agregarCaptura( argv[1] );
+  }
+
+  std::vector< uint8_t > direcciones( EMISORES * 6 );
+  for( uint32_t e = 0; e < EMISORES; e++ ) {
+	uint8_t d[6] = { (uint8_t) e, (uint8_t) ( e >> 8 ), 0x5a, 0x17, 0x3a, 0xc1 };
+	memcpy( &direcciones[e * 6], d, 6 );
+  }
+  std::vector< Llegada > llegadas;
+  llegadas.reserve( (size_t) EMISORES * CICLOS * 6 );
+  uint64_t generadas = generar( llegadas );
+
+  printf( "---- agregador: %u emisores, %u ciclos de 1 s, %zu anuncios recibidos, %u %% perdidos ----\n",
+		  EMISORES, CICLOS, llegadas.size(), PROBABILIDAD_PERDIDA );
+
+  unsigned hilosMaquina = std::thread::hardware_concurrency();
+  const unsigned HILOS[] = { 1, 2, 4, 8 };
+  for( unsigned hilos : HILOS ) {
+	Resultado r = medir( hilos, llegadas, direcciones );
+	printf( "%u hilos: %6.2f Mmediciones/s  emisores %llu  nuevas %llu  repetidas %llu  tardías %llu"
+			"  perdidas %lld (generadas %llu)  tasa %.2f %% (peor %.1f %%)  intervalo %.0f ms  esperas %llu\n",
+			hilos, r.mediciones / r.segundos / 1e6, (unsigned long long) r.resumen.emisores,
+			(unsigned long long) r.resumen.nuevas, (unsigned long long) r.resumen.repetidas,
+			(unsigned long long) r.resumen.tardias, (long long) r.resumen.perdidas,
+			(unsigned long long) generadas, 100 * r.resumen.tasaPerdidas(), 100 * r.peorTasa,
+			r.intervaloMedio_ms, (unsigned long long) r.resumen.esperas );
+  }
+  printf( "(la máquina tiene %u núcleos; un emisor con dos iBeacon por segundo y 3 copias son 6 mediciones/s)\n",
+		  hilosMaquina );
+
+  return 0;
+}
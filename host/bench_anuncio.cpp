@@ -0,0 +1,99 @@
+
+/**
+ * @file bench_anuncio.cpp
+ * @brief Micro-banco de pruebas: publicar reconfigurando el anuncio frente a parchear uno precalculado.
+ *
+ * Publica la misma secuencia de mediciones por los dos caminos de EmisoraBLE:
+ *  - emitirAnuncioIBeacon(): construye el BLEBeacon, lo configura todo, para y arranca la radio;
+ *  - actualizarAnuncio():    parchea major/minor en un AnuncioPrecalculado y cambia de búfer.
+ * Da el tiempo de CPU por publicación (medido en el ordenador sobre el Bluefruit simulado) y lo
+ * que ve la radio en cada caso: paradas, arranques y reconfiguraciones. Cada parada es un hueco
+ * sin anuncio y reinicia la temporización de los eventos de anuncio.
+ */
+
+#include <bluefruit.h>
+
+#include "PuertoSerie.h"
+
+namespace Globales {
+  PuertoSerie elPuerto ( /* velocidad = */ 115200 );
+};
+
+#include "EmisoraBLE.h"
+
+#include <chrono>
+
+namespace {
+
+  uint8_t beaconUUID[16] = {
+	'c', 'h', 'o', 'l', 'o', 's', 'i',
+	'm', 'e', 'o', 'n', 'e', 'j', 'e', 'f', 'e'
+  };
+
+  const int PUBLICACIONES = 200000;
+
+  struct Resultado {
+	double nsPorPublicacion;
+	uint64_t starts;
+	uint64_t stops;
+	uint64_t configuraciones;
+  };
+
+  Resultado contar( double ns ) {
+	Resultado r = { ns / PUBLICACIONES, 0, 0, 0 };
+	for( const sim::Evento & e : sim::Simulador::instancia().eventos() ) {
+	  if( e.tipo == sim::TipoEvento::ANUNCIO_START ) {
+		r.starts++;
+	  } else if( e.tipo == sim::TipoEvento::ANUNCIO_STOP ) {
+		r.stops++;
+	  } else if( e.tipo == sim::TipoEvento::ANUNCIO_BEACON || e.tipo == sim::TipoEvento::ANUNCIO_DATOS ) {
+		r.configuraciones++;
+	  }
+	}
+	sim::Simulador::instancia().borrarRegistro();
+	return r;
+  }
+
+  void escribir( const char * nombre, const Resultado & r ) {
+	printf( "%-26s %10.1f ns/publicación   start %7llu   stop %7llu   configuraciones %7llu\n", nombre,
+			r.nsPorPublicacion, (unsigned long long) r.starts, (unsigned long long) r.stops,
+			(unsigned long long) r.configuraciones );
+  }
+
+} // namespace
+
+int main() {
+
+  EmisoraBLE laEmisora( "GTI-3A", 0x004c, 4 );
+  laEmisora.encenderEmisora();
+
+  // camino antiguo: reconfigurar por completo en cada publicación
+  auto t0 = std::chrono::steady_clock::now();
+  for( int i = 0; i < PUBLICACIONES; i++ ) {
+	laEmisora.emitirAnuncioIBeacon( beaconUUID, ( 11 << 8 ) + ( i & 0xff ), i & 0x7fff, -53 );
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  laEmisora.detenerAnuncio();
+  Resultado antiguo = contar( std::chrono::duration<double, std::nano>( t1 - t0 ).count() );
+
+  // camino nuevo: anuncio codificado una vez y parcheado
+  AnuncioPrecalculado elAnuncio;
+  laEmisora.prepararAnuncioIBeacon( elAnuncio, beaconUUID, 0, 0, -53 );
+  t0 = std::chrono::steady_clock::now();
+  for( int i = 0; i < PUBLICACIONES; i++ ) {
+	elAnuncio.cambiarMajorMinor( ( 11 << 8 ) + ( i & 0xff ), i & 0x7fff );
+	laEmisora.actualizarAnuncio( elAnuncio );
+  }
+  t1 = std::chrono::steady_clock::now();
+  laEmisora.detenerAnuncio();
+  Resultado nuevo = contar( std::chrono::duration<double, std::nano>( t1 - t0 ).count() );
+
+  printf( "---- publicación de %d iBeacons ----\n", PUBLICACIONES );
+  escribir( "emitirAnuncioIBeacon()", antiguo );
+  escribir( "actualizarAnuncio()", nuevo );
+  printf( "%-26s %10.1fx menos CPU, %llu paradas de radio evitadas\n", "mejora",
+		  antiguo.nsPorPublicacion / nuevo.nsPorPublicacion,
+		  (unsigned long long) ( antiguo.stops - nuevo.stops ) );
+
+  return 0;
+}
@@ -0,0 +1,405 @@
+
+/**
+ * @file bench_anuncio_extendido.cpp
+ * @brief Lotes de muestras en anuncios extendidos (AnuncioExtendido, Publicador::anunciarLote()).
+ *
+ * Comprueba y mide:
+ *  - que el conjunto de anuncio 0 no exista hasta que Bluefruit lo crea, y que
+ *    configurarAnuncioExtendido() funcione justo tras encenderEmisora() sin quitárselo a Bluefruit;
+ *  - las reglas del conjunto de anuncio simulado: qué longitudes acepta la SoftDevice en un anuncio
+ *    clásico, extendido conectable y extendido no conectable, cuántos paquetes AUX_* salen, en
+ *    cuántos informes HCI llegan los datos a la pasarela y el tiempo en el aire de cada evento en
+ *    cada PHY (ver PaquetesEventoAnuncio);
+ *  - el anuncio que arma el firmware con un lote: longitudes, prefijo y trama larga con su CRC, y
+ *    que la pasarela (DecodificadorAnuncios) lo lea partido en informes HCI, con los trozos de dos
+ *    placas intercalados y con un anuncio truncado;
+ *  - el sketch entero volcando el búfer lleno, con bloques en anuncios clásicos y con lotes en
+ *    anuncios extendidos (1M + 2M y codificado): anuncios, eventos, tiempo en el aire y duración del
+ *    volcado, y que la pasarela reciba todas las muestras;
+ *  - una central que se conecta a mitad de un volcado con lotes: la SoftDevice para el anuncio
+ *    extendido (es conectable) y los lotes siguientes tienen que volver a salir al aire;
+ *  - una SoftDevice que rechaza el anuncio extendido cuando ya se había admitido: el lote que no
+ *    sale tiene que ir en bloques, sin perder muestras;
+ *  - un controlador sin BLE 5: usarAnunciosExtendidos() devuelve false y el volcado sigue con
+ *    bloques.
+ */
+
+#include <Arduino.h>
+
+#include "../HolaMundoIBeacon/HolaMundoIBeacon.ino"
+#include "pasarela/DecodificadorAnuncios.h"
+
+#include <vector>
+
+namespace {
+
+  constexpr UUID128 BEACON_UUID = UUID128::iBeaconDeNombre( "cholosimeonejefe" );
+
+  const uint8_t DIRECCION_PLACA[6] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0xc6 };
+  const uint8_t DIRECCION_OTRA[6] = { 0x99, 0x88, 0x77, 0x66, 0x55, 0xc4 };
+
+  /// Bytes de Globales::elBuffer.
+  const uint16_t TAMANYO_BUFFER = 512;
+
+  int fallos = 0;
+
+  void comprobar( bool bien, const char * que ) {
+	if( !bien ) {
+	  printf( "FALLA: %s\n", que );
+	  fallos++;
+	}
+  }
+
+  /// PHY de los informes HCI: 1 1M, 2 2M, 3 codificado.
+  uint8_t phyHCI( uint8_t phy ) {
+	return phy == BLE_GAP_PHY_CODED ? 3 : phy == BLE_GAP_PHY_2MBPS ? 2 : 1;
+  }
+
+  /**
+   * @brief Lo que manda el controlador del escáner al recibir un anuncio extendido: informes de
+   * hasta 229 bytes, los primeros con «incompleto, siguen más». Con `truncar`, el último trozo
+   * no llega y el controlador lo dice en el estado del informe.
+   */
+  void anyadirInformesExtendidos( std::vector< uint8_t > & captura, const uint8_t * direccion, uint8_t sid,
+								  const uint8_t * datos, uint16_t n, uint8_t phyPrimario, uint8_t phySecundario,
+								  bool truncar = false ) {
+	uint16_t hecho = 0;
+	do {
+	  uint8_t trozo = (uint8_t) ( n - hecho < Pasarela::DecodificadorAnuncios::MAX_DATOS_INFORME_EXTENDIDO
+								  ? n - hecho : Pasarela::DecodificadorAnuncios::MAX_DATOS_INFORME_EXTENDIDO );
+	  bool ultimo = hecho + trozo == n;
+	  uint8_t estado = ultimo ? 0 : 1;
+	  if( truncar && !ultimo ) {
+		estado = 2;
+	  }
+	  uint16_t tipo = (uint16_t) ( 0x0001 | ( estado << 5 ) );   // conectable
+	  const uint8_t cabecera[] = {
+		0x04, 0x3e, (uint8_t) ( 2 + 24 + trozo ),   // H4 evento, LE Meta, longitud
+		0x0d, 0x01,                                  // Extended Advertising Report, un informe
+		(uint8_t) tipo, (uint8_t) ( tipo >> 8 ), 0x01,
+		direccion[0], direccion[1], direccion[2], direccion[3], direccion[4], direccion[5],
+		phyHCI( phyPrimario ), phyHCI( phySecundario ), sid, 0x7f, (uint8_t) -60,
+		0x00, 0x00, 0x00, 0, 0, 0, 0, 0, 0,
+		trozo
+	  };
+	  captura.insert( captura.end(), cabecera, cabecera + sizeof( cabecera ) );
+	  captura.insert( captura.end(), datos + hecho, datos + hecho + trozo );
+	  hecho = (uint16_t) ( hecho + trozo );
+	  if( estado == 2 ) {
+		return;
+	  }
+	} while( hecho < n );
+  }
+
+  void anyadirInformeClasico( std::vector< uint8_t > & captura, const uint8_t * direccion, const uint8_t * datos,
+							  uint8_t n ) {
+	const uint8_t cabecera[] = {
+	  0x04, 0x3e, (uint8_t) ( 2 + 9 + n + 1 ), 0x02, 0x01, 0x00, 0x01,
+	  direccion[0], direccion[1], direccion[2], direccion[3], direccion[4], direccion[5], n
+	};
+	captura.insert( captura.end(), cabecera, cabecera + sizeof( cabecera ) );
+	captura.insert( captura.end(), datos, datos + n );
+	captura.push_back( (uint8_t) -60 );
+  }
+
+  /// Informes HCI en que llegan `n` bytes de un anuncio extendido.
+  uint32_t informesHCI( uint16_t n ) {
+	uint32_t m = Pasarela::DecodificadorAnuncios::MAX_DATOS_INFORME_EXTENDIDO;
+	return n == 0 ? 1 : ( n + m - 1 ) / m;
+  }
+
+  const char * nombreError( uint32_t e ) {
+	switch( e ) {
+	case NRF_SUCCESS: return "sí";
+	case NRF_ERROR_INVALID_LENGTH: return "LENGTH";
+	case NRF_ERROR_INVALID_PARAM: return "PARAM";
+	case NRF_ERROR_NOT_SUPPORTED: return "NOT_SUP";
+	}
+	return "?";
+  }
+
+  /// Configura el conjunto 0 directamente (con la radio parada) y devuelve el código de la SoftDevice.
+  uint32_t configurar( uint8_t tipo, uint16_t n, uint8_t phyPrimario, uint8_t phySecundario ) {
+	static uint8_t datos[256];
+	ble_gap_adv_data_t d;
+	memset( &d, 0, sizeof( d ) );
+	d.adv_data.p_data = datos;
+	d.adv_data.len = n;
+	ble_gap_adv_params_t p;
+	memset( &p, 0, sizeof( p ) );
+	p.properties.type = tipo;
+	p.interval = 160;
+	p.primary_phy = phyPrimario;
+	p.secondary_phy = phySecundario;
+	uint8_t manejador = 0;
+	return sd_ble_gap_adv_set_configure( &manejador, &d, &p );
+  }
+
+  void probarCreacion() {
+	printf( "---- conjunto de anuncio justo tras encender la emisora ----\n" );
+	uint8_t manejador = 0;
+	uint32_t antes = configurar( BLE_GAP_ADV_TYPE_EXTENDED_CONNECTABLE_NONSCANNABLE_UNDIRECTED, 100, BLE_GAP_PHY_1MBPS,
+								 BLE_GAP_PHY_2MBPS );
+	comprobar( antes == BLE_ERROR_INVALID_ADV_HANDLE, "el manejador 0 no vale antes de crear el conjunto" );
+	comprobar( sd_ble_gap_adv_start( manejador, CONN_CFG_PERIPHERAL ) == BLE_ERROR_INVALID_ADV_HANDLE,
+			   "ni para arrancarlo" );
+
+	EmisoraBLE & emisora = Globales::elPublicador.laEmisora;
+	emisora.encenderEmisora();
+	bool admitido = emisora.configurarAnuncioExtendido( BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS );
+	bool bluefruit = Bluefruit.Advertising.start( 0 );
+	Bluefruit.Advertising.stop();
+	printf( "configurar el manejador 0 antes de crear el conjunto: %s; configurarAnuncioExtendido() tras"
+			" encenderEmisora(): %s; Bluefruit.Advertising.start() después: %s\n",
+			antes == BLE_ERROR_INVALID_ADV_HANDLE ? "INVALID_ADV_HANDLE" : nombreError( antes ), admitido ? "sí" : "NO",
+			bluefruit ? "sí" : "NO" );
+	comprobar( admitido, "configurarAnuncioExtendido() justo tras encenderEmisora()" );
+	comprobar( bluefruit, "Bluefruit sigue pudiendo anunciar" );
+  }
+
+  void probarReglas() {
+	const uint8_t CONECTABLE = BLE_GAP_ADV_TYPE_EXTENDED_CONNECTABLE_NONSCANNABLE_UNDIRECTED;
+	const uint8_t NO_CONECTABLE = BLE_GAP_ADV_TYPE_EXTENDED_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED;
+	const uint8_t M1 = BLE_GAP_PHY_1MBPS;
+	const uint8_t M2 = BLE_GAP_PHY_2MBPS;
+	const uint8_t S8 = BLE_GAP_PHY_CODED;
+
+	printf( "---- reglas de los anuncios (SoftDevice y capa de enlace simuladas) ----\n" );
+	printf( "%6s %9s %11s %9s %11s %11s %11s %11s\n", "bytes", "clásico", "ext. conect", "ext. no c",
+			"paquetes AUX", "informes HCI", "aire 1M+1M", "1M+2M / S8" );
+	const uint16_t LONGITUDES[] = { 21, 31, 32, 100, 229, 230, 238, 239, 245, 246, 255, 256 };
+	for( uint16_t n : LONGITUDES ) {
+	  uint32_t clasico = configurar( BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED, n, M1, M1 );
+	  uint32_t conectable = configurar( CONECTABLE, n, M1, M2 );
+	  uint32_t noConectable = configurar( NO_CONECTABLE, n, M1, M2 );
+	  PaquetesEventoAnuncio a = PaquetesEventoAnuncio::extendido( n, M1, M1 );
+	  PaquetesEventoAnuncio b = PaquetesEventoAnuncio::extendido( n, M1, M2 );
+	  PaquetesEventoAnuncio c = PaquetesEventoAnuncio::extendido( n, S8, S8 );
+	  printf( "%6u %9s %11s %9s %11u %11u %8u us %5u / %5u us\n", n, nombreError( clasico ), nombreError( conectable ),
+			  nombreError( noConectable ), a.secundarios, informesHCI( n ), a.aire_us, b.aire_us, c.aire_us );
+	  comprobar( ( clasico == NRF_SUCCESS ) == ( n <= BLE_GAP_ADV_SET_DATA_SIZE_MAX ), "longitud del anuncio clásico" );
+	  comprobar( ( conectable == NRF_SUCCESS ) == ( n <= 238 ), "longitud del anuncio extendido conectable" );
+	  comprobar( ( noConectable == NRF_SUCCESS ) == ( n <= 255 ), "longitud del anuncio extendido no conectable" );
+	  comprobar( a.secundarios == ( n <= 245 ? 1 : 2 ), "un AUX_ADV_IND hasta 245 bytes" );
+	}
+	PaquetesEventoAnuncio clasico = PaquetesEventoAnuncio::clasico( 30 );
+	printf( "anuncio clásico de 30 bytes (bloque): 3 ADV_IND, %u us en el aire por evento\n", clasico.aire_us );
+
+	comprobar( configurar( CONECTABLE, 100, M2, M2 ) == NRF_ERROR_INVALID_PARAM, "2M no vale en los canales primarios" );
+	comprobar( configurar( BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED, 31, S8, S8 ) == NRF_ERROR_INVALID_PARAM,
+			   "un anuncio clásico va en 1M" );
+	ConjuntoAnuncioSimulado::instancia().simularSoloClasicos( true );
+	comprobar( configurar( CONECTABLE, 100, M1, M2 ) == NRF_ERROR_NOT_SUPPORTED, "sin BLE 5 no hay anuncios extendidos" );
+	ConjuntoAnuncioSimulado::instancia().simularSoloClasicos( false );
+	comprobar( PaquetesEventoAnuncio::extendido( 246, M1, M1 ).aire_us
+			   == 3 * 136 + ( 10 + 255 ) * 8 + ( 10 + 4 + 4 ) * 8, "aire de un AUX_ADV_IND y un AUX_CHAIN_IND" );
+  }
+
+  /// Muestras de un lote: todas las que llegan y si falta o sobra alguna.
+  struct Recepcion {
+	std::vector< uint8_t > veces;   ///< Veces que ha llegado cada secuencia desde la primera.
+	uint32_t primera = 0;
+	uint32_t mediciones = 0;
+	uint32_t lotes = 0;             ///< Mediciones de anuncios extendidos.
+
+	void anotar( const Pasarela::Medicion & m ) {
+	  mediciones++;
+	  lotes += m.formato == Pasarela::Formato::LOTE;
+	  if( m.formato != Pasarela::Formato::BLOQUE && m.formato != Pasarela::Formato::LOTE ) {
+		return;
+	  }
+	  uint32_t i = m.secuencia - primera;
+	  if( i < veces.size() ) {
+		veces[i]++;
+	  }
+	}
+
+	bool completa( uint32_t hasta ) const {
+	  for( uint32_t i = 0; i < hasta - primera && i < veces.size(); i++ ) {
+		if( veces[i] == 0 ) {
+		  return false;
+		}
+	  }
+	  return true;
+	}
+  };
+
+  void probarAnuncio() {
+	printf( "---- lote armado por el firmware ----\n" );
+	BufferMediciones< 1024 > buffer;
+	for( uint32_t k = 0; k < 200; k++ ) {
+	  buffer.anyadir( Publicador::CO2, (int16_t) ( 600 + ( ( k * 2654435761u ) >> 28 ) ), k * 2500 );
+	  buffer.anyadir( Publicador::TEMPERATURA, (int16_t) ( 21 + ( k / 50 ) % 2 ), k * 2500 );
+	}
+	AnuncioExtendido anuncio;
+	Globales::elPublicador.laEmisora.prepararAnuncioExtendido( anuncio );
+	uint32_t primera = buffer.secuenciaMasAntigua();
+	uint8_t * trama = anuncio.cargaLibre();
+	uint8_t n = buffer.extraerBloque( TramaMediciones::bloque( trama ),
+									  TramaMediciones::capacidadBloqueLargo( AnuncioExtendido::CAPACIDAD_CARGA ), 500000 );
+	anuncio.fijarCarga( TramaMediciones::cerrarBloqueLargo( trama, n ) );
+	anuncio.confirmar();
+
+	const uint8_t * d = anuncio.datosAnuncio();
+	uint8_t largo = anuncio.longitudAnuncio();
+	uint32_t muestras = buffer.secuenciaMasAntigua() - primera;
+	printf( "anuncio de %u bytes: bloque de %u bytes con %u muestras (%.1f bytes por muestra)\n", largo, n, muestras,
+			(double) n / muestras );
+	comprobar( largo <= AnuncioExtendido::TAMANYO_MAXIMO && largo >= AnuncioExtendido::TAMANYO_MAXIMO - 8,
+			   "el lote llena el anuncio" );
+	comprobar( d[0] == 2 && d[1] == BLE_GAP_AD_TYPE_FLAGS && d[3] == largo - 4 && d[4] == 0xff && d[5] == 0x4c
+			   && d[6] == 0x00 && d[7] == AnuncioExtendido::TIPO_CARGA && d[8] == largo - 9, "cabecera del anuncio" );
+	comprobar( TramaMediciones::bloqueLargo( anuncio.carga(), anuncio.longitudCarga() ) == n, "trama larga con su CRC" );
+	uint8_t roto[AnuncioExtendido::CAPACIDAD_CARGA];
+	memcpy( roto, anuncio.carga(), anuncio.longitudCarga() );
+	roto[10] ^= 0x04;
+	comprobar( TramaMediciones::bloqueLargo( roto, anuncio.longitudCarga() ) < 0, "el CRC detecta un bit cambiado" );
+
+	// la pasarela: el anuncio llega en dos informes; los de otra placa se intercalan
+	Pasarela::DecodificadorAnuncios decodificador( BEACON_UUID.bytes );
+	std::vector< uint8_t > primero;
+	std::vector< uint8_t > otro;
+	anyadirInformesExtendidos( primero, DIRECCION_PLACA, 1, d, largo, BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS );
+	anyadirInformesExtendidos( otro, DIRECCION_OTRA, 1, d, largo, BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS );
+	size_t mitadPrimero = 3 + primero[2];
+	size_t mitadOtro = 3 + otro[2];
+	std::vector< uint8_t > captura( primero.begin(), primero.begin() + mitadPrimero );
+	captura.insert( captura.end(), otro.begin(), otro.begin() + mitadOtro );
+	captura.insert( captura.end(), primero.begin() + mitadPrimero, primero.end() );
+	captura.insert( captura.end(), otro.begin() + mitadOtro, otro.end() );
+	anyadirInformesExtendidos( captura, DIRECCION_PLACA, 1, d, largo, BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS, true );
+
+	uint32_t dePlaca = 0;
+	uint32_t deOtra = 0;
+	decodificador.decodificarHCI( captura.data(), captura.size(), [&] ( const Pasarela::Medicion & m ) {
+	  ( memcmp( m.direccion, DIRECCION_PLACA, 6 ) == 0 ? dePlaca : deOtra ) += m.formato == Pasarela::Formato::LOTE;
+	} );
+	const Pasarela::DecodificadorAnuncios::Estadisticas & e = decodificador.contadores();
+	printf( "pasarela: %llu informes HCI (%llu trozos con más detrás), %u + %u muestras de dos placas intercaladas,"
+			" %llu anuncio truncado\n", (unsigned long long) e.anuncios, (unsigned long long) e.fragmentos, dePlaca,
+			deOtra, (unsigned long long) e.truncados );
+	comprobar( dePlaca == muestras && deOtra == muestras, "la pasarela junta los trozos de cada placa" );
+	comprobar( e.truncados == 1 && e.malFormados == 0, "el anuncio truncado se descarta" );
+  }
+
+  /**
+   * @brief Llena el búfer del sketch, lo vuelca y pasa lo que ha salido al aire por la pasarela.
+   *
+   * @param conectarse Una central se conecta tras el primer lote y se desconecta al acabar.
+   */
+  void volcarBuffer( const char * nombre, uint8_t phyPrimario, uint8_t phySecundario, bool conectarse = false ) {
+	sim::Simulador & s = sim::Simulador::instancia();
+	auto & buffer = Globales::elBuffer;
+	sim::correrLoop( 20000, [&] () { return buffer.estaVacio() && !s.radioEstaAnunciando(); } );
+	s.borrarRegistro();
+
+	Recepcion r;
+	r.primera = buffer.secuenciaSiguiente();
+	int16_t co2 = 620;
+	while( buffer.bytesUsados() < TAMANYO_BUFFER - 16 ) {
+	  co2 = (int16_t) ( co2 + (int) ( ( buffer.secuenciaSiguiente() * 2654435761u ) >> 29 ) - 3 );
+	  buffer.anyadir( Publicador::CO2, co2, millis() );
+	  buffer.anyadir( Publicador::TEMPERATURA, 22, millis() );
+	}
+	uint32_t llenas = buffer.numeroMuestras();
+	r.veces.assign( llenas + 64, 0 );
+
+	uint32_t t0 = millis();
+	Globales::elPlanificador.programar( Tareas::volcar, 0 );
+	if( conectarse ) {
+	  sim::correrLoop( Loop::TIEMPO_POR_BLOQUE / 2, [] () { return false; } );
+	  Bluefruit.simularConexion( 1 );
+	  comprobar( !Globales::elPublicador.laEmisora.estaAnunciandoExtendido(), "al conectarse se para el anuncio" );
+	}
+	sim::correrLoop( 60000, [&] () { return buffer.estaVacio() && !s.radioEstaAnunciando(); } );
+	uint32_t ms = millis() - t0;
+	if( conectarse ) {
+	  Bluefruit.simularDesconexion( 0x13 );
+	}
+	uint32_t hasta = buffer.secuenciaSiguiente();
+
+	// lo que ha estado en el aire: cada carga distinta le llega una vez a la pasarela
+	std::vector< uint8_t > captura;
+	uint32_t anuncios = 0;
+	uint64_t aire_us = 0;
+	uint64_t eventos = 0;
+	bool extendido = Globales::elPublicador.anunciaLotesExtendidos();
+	std::vector< uint64_t > instantes = s.instantesDeAnuncio();
+	size_t k = 0;
+	uint16_t longitud = 0;
+	const std::vector< sim::Evento > & registro = s.eventos();
+	for( size_t i = 0; i < registro.size(); i++ ) {
+	  const sim::Evento & e = registro[i];
+	  bool cambia = e.tipo == sim::TipoEvento::ANUNCIO_START
+		|| ( e.tipo == sim::TipoEvento::ANUNCIO_DATOS && e.valor == 0 );
+	  if( !cambia ) {
+		continue;
+	  }
+	  for( ; k < instantes.size() && instantes[k] < e.tiempo_us; k++ ) {
+		PaquetesEventoAnuncio p = extendido ? PaquetesEventoAnuncio::extendido( longitud, phyPrimario, phySecundario )
+		  : PaquetesEventoAnuncio::clasico( longitud );
+		aire_us += p.aire_us;
+		eventos++;
+	  }
+	  longitud = e.longitud;
+	  anuncios++;
+	  if( extendido ) {
+		anyadirInformesExtendidos( captura, DIRECCION_PLACA, 1, e.datos, e.longitud, phyPrimario, phySecundario );
+	  } else {
+		anyadirInformeClasico( captura, DIRECCION_PLACA, e.datos, e.longitud );
+	  }
+	}
+	for( ; k < instantes.size(); k++ ) {
+	  PaquetesEventoAnuncio p = extendido ? PaquetesEventoAnuncio::extendido( longitud, phyPrimario, phySecundario )
+		: PaquetesEventoAnuncio::clasico( longitud );
+	  aire_us += p.aire_us;
+	  eventos++;
+	}
+
+	Pasarela::DecodificadorAnuncios decodificador( BEACON_UUID.bytes );
+	decodificador.decodificarHCI( captura.data(), captura.size(), [&] ( const Pasarela::Medicion & m ) { r.anotar( m ); } );
+	bool completa = r.completa( hasta );
+	printf( "%-24s %4u muestras: %3u anuncios, %5llu eventos, %6.1f ms en el aire, volcado en %5.2f s, %3u informes"
+			" HCI  %s\n", nombre, hasta - r.primera, anuncios, (unsigned long long) eventos, aire_us / 1000.0,
+			ms / 1000.0, (unsigned) decodificador.contadores().anuncios, completa ? "completo" : "INCOMPLETO" );
+	comprobar( completa, nombre );
+	comprobar( extendido == ( r.lotes > 0 ), "las muestras llegan por donde toca" );
+  }
+
+} // namespace
+
+int main() {
+
+  sim::Simulador & s = sim::Simulador::instancia();
+
+  probarCreacion();
+  probarReglas();
+  probarAnuncio();
+
+  char plantilla[] = "/tmp/extendido_XXXXXX";
+  std::string directorio = mkdtemp( plantilla );
+  InternalFS.simularDirectorio( directorio.c_str() );
+  setup();
+
+  printf( "---- volcado del búfer lleno (%u bytes) del sketch, intervalo de %.1f ms ----\n", TAMANYO_BUFFER,
+		  Globales::elPublicador.laEmisora.intervaloDeAnuncio() * 0.625 );
+  volcarBuffer( "bloques (clásicos)", BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_1MBPS );
+  comprobar( Globales::elPublicador.usarAnunciosExtendidos( BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS ), "BLE 5 admitido" );
+  volcarBuffer( "lotes 1M + 2M", BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS );
+  comprobar( Globales::elPublicador.usarAnunciosExtendidos( BLE_GAP_PHY_CODED, BLE_GAP_PHY_CODED ), "PHY codificado" );
+  volcarBuffer( "lotes codificados (S8)", BLE_GAP_PHY_CODED, BLE_GAP_PHY_CODED );
+  comprobar( Globales::elPublicador.usarAnunciosExtendidos( BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS ), "1M + 2M otra vez" );
+  volcarBuffer( "lotes con una conexión", BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS, true );
+
+  comprobar( Globales::elPublicador.usarAnunciosExtendidos( BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS ), "1M + 2M otra vez" );
+  ConjuntoAnuncioSimulado::instancia().simularSoloClasicos( true );
+  volcarBuffer( "lote rechazado: bloques", BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_1MBPS );
+  bool admitidos = Globales::elPublicador.usarAnunciosExtendidos( BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS );
+  comprobar( !admitidos, "sin BLE 5 se sigue con bloques" );
+  volcarBuffer( "sin BLE 5: bloques", BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_1MBPS );
+
+  InternalFS.format();
+  rmdir( directorio.c_str() );
+  (void) s;
+  return fallos == 0 ? 0 : 1;
+}
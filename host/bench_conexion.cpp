@@ -0,0 +1,282 @@
+
+/**
+ * @file bench_conexion.cpp
+ * @brief Negociación de la conexión (NegociacionConexion) con varias centrales simuladas.
+ *
+ * Se llena el historial del sketch con una hora de mediciones, se arranca el sketch y se conectan
+ * centrales que aceptan cosas distintas (CentralSimulada):
+ *  - una que no acepta ningún cambio: la conexión se queda con los parámetros de la pila
+ *    (1M, paquetes de 27 bytes, 30 ms);
+ *  - una como iOS (intervalo mínimo de 15 ms, MTU 185);
+ *  - una como un Android reciente (acepta todo lo de PerfilesConexion::RAPIDO);
+ *  - la misma, pero ocupada con un cambio de PHY propio cuando el sketch empieza a negociar.
+ * En cada una se escribe lo negociado y cuánto ha tardado, y se descarga el historial entero.
+ * Después se deja la conexión sin hacer nada, se mide la radio en PerfilesConexion::AHORRO frente
+ * a la conexión por defecto y se pide otra descarga, que tiene que volver a RAPIDO.
+ *
+ * Lo negociado con cada central, la descarga entera y el paso a AHORRO y de vuelta a RAPIDO se
+ * comprueban: si algo no es lo esperado, el programa termina con error.
+ *
+ * Por último, una central como iOS que rechaza los 7,5 ms de RAPIDO sin que llegue ningún evento
+ * (CentralSimulada::rechazaParametros): la negociación tiene que acabar igual, con ese paso
+ * rechazado, y la conexión tiene que pasar después a AHORRO.
+ *
+ * Y una central que se va con un paso pedido: la negociación tiene que darse por acabada y la
+ * siguiente conexión tiene que llegar a RAPIDO entera (con el MTU otra vez).
+ */
+
+#include <Arduino.h>
+
+#include "../HolaMundoIBeacon/HolaMundoIBeacon.ino"
+
+namespace {
+
+  const uint32_t MUESTRAS_HORA = 3600000 / Loop::PERIODO_MUESTREO;
+  const uint8_t MAX_MUESTRAS_BLOQUE = 128;
+
+  /// Consumo de la radio (nRF52840 con el DC/DC, 0 dBm) y carga fija de cada evento de conexión
+  /// (arranque del cristal de 32 MHz y de la radio, y la CPU atendiendo a la SoftDevice).
+  const double MA_RADIO = 5.0;
+  const double UC_POR_EVENTO = 1.5;
+
+  using Descarga = DescargaHistorial< Globales::Historial >;
+
+  uint32_t muestrasRecibidas = 0;
+  bool fin = false;
+  uint32_t instanteFin = 0;
+  uint32_t instantePrimera = 0;
+
+  void recibir( const uint8_t * p, uint16_t n, uint64_t instante_us ) {
+	CodecMuestras::Muestra m[MAX_MUESTRAS_BLOQUE];
+	uint32_t instante = (uint32_t) ( instante_us / 1000 );
+	int cuantas = CodecMuestras::decodificarBloque( p, (uint8_t) n, m, MAX_MUESTRAS_BLOQUE, instante );
+	if( cuantas == 0 ) {
+	  fin = true;
+	  instanteFin = instante;
+	} else if( cuantas > 0 ) {
+	  if( muestrasRecibidas == 0 ) {
+		instantePrimera = instante;
+	  }
+	  muestrasRecibidas += (uint32_t) cuantas;
+	}
+  }
+
+  const char * nombrePhy( uint8_t phy ) {
+	return phy == BLE_GAP_PHY_2MBPS ? "2M" : "1M";
+  }
+
+  void escribirParametros( const ParametrosConexion & p ) {
+	printf( "%s, MTU %3u, paquetes de %3u bytes, %6.2f ms, latencia %u", nombrePhy( p.phy ), p.mtu, p.longitudDatos,
+			p.intervalo * 1.25, p.latencia );
+  }
+
+  /// Lo que se espera que acepte una central (el intervalo en unidades de 1,25 ms).
+  struct Esperado {
+	uint8_t phy;
+	uint16_t mtu;
+	uint16_t longitudDatos;
+	uint16_t intervalo;
+	uint16_t latencia;
+  };
+
+  bool comoSeEspera( const ParametrosConexion & p, const Esperado & e ) {
+	return p.phy == e.phy && p.mtu == e.mtu && p.longitudDatos == e.longitudDatos && p.intervalo == e.intervalo
+	  && p.latencia == e.latencia;
+  }
+
+  /// Descarga el historial entero y devuelve los ms desde la orden hasta el bloque de fin.
+  uint32_t descargar() {
+	muestrasRecibidas = 0;
+	fin = false;
+	uint32_t t0 = millis();
+	uint8_t orden[5] = { Descarga::DESCARGAR, 0, 0, 0, 0 };
+	BLECharacteristic & ordenes = Globales::lasOrdenesHistorial;
+	ordenes.simularEscritura( Bluefruit.connHandle(), orden, sizeof( orden ) );
+	sim::correrLoop( 600000, [] () { return fin; } );
+	return instanteFin - t0;
+  }
+
+  /// Radio en una conexión sin tráfico durante `ms`: carga media en microamperios.
+  double medirOciosa( uint32_t ms, uint64_t & eventos ) {
+	BLEConnection * c = Bluefruit.Connection( Bluefruit.connHandle() );
+	uint64_t atendidos = c->eventosAtendidos;
+	uint64_t radio = c->tiempoRadio_us;
+	sim::correrLoop( ms, [] () { return false; } );
+	eventos = c->eventosAtendidos - atendidos;
+	double uc = ( c->tiempoRadio_us - radio ) * MA_RADIO / 1000.0 + eventos * UC_POR_EVENTO;
+	return uc / ( ms / 1000.0 );
+  }
+
+  bool probarCentral( const char * nombre, const CentralSimulada & central, bool centralOcupada, const Esperado & esperado ) {
+	Bluefruit.simularCentral( central );
+	Bluefruit.simularConexion( 1, central.mtu, 24, recibir );
+	if( centralOcupada ) {
+	  // la central cambia el PHY por su cuenta justo al conectarse: el primer paso del sketch choca
+	  Bluefruit.Connection( 1 )->requestPHY( BLE_GAP_PHY_1MBPS );
+	}
+	uint32_t t0 = millis();
+	sim::correrLoop( 10000, [] () { return !NegociacionConexion::negociando(); } );
+	uint32_t negociacion = millis() - t0;
+	ParametrosConexion p = Globales::elPublicador.laEmisora.parametrosConexion( 1 );
+
+	uint32_t ms = descargar();
+	BLEConnection * c = Bluefruit.Connection( 1 );
+	printf( "%-22s ", nombre );
+	escribirParametros( p );
+	bool negociado = comoSeEspera( p, esperado );
+	bool completa = muestrasRecibidas >= MUESTRAS_HORA * 2;
+	printf( "  negociado en %4u ms (%u rechazados)  descarga %6.2f s  %7.0f bytes/s  %u muestras%s%s\n", negociacion,
+			NegociacionConexion::rechazados(), ms / 1000.0, c->bytesEntregados * 1000.0 / ms, muestrasRecibidas,
+			completa ? "" : " INCOMPLETA", negociado ? "" : "  NO ES LO ESPERADO" );
+	Bluefruit.simularDesconexion( 0x13 );
+	return negociado && completa;
+  }
+
+  bool probarAhorro() {
+	// conexión que se queda con los parámetros de la pila
+	CentralSimulada fija;
+	fija.phys = BLE_GAP_PHY_1MBPS;
+	fija.longitudDatos = BLE_GAP_DATA_LENGTH_DEFAULT;
+	fija.intervaloMinimo = fija.intervaloMaximo = 24;
+	fija.latenciaMaxima = 0;
+	Bluefruit.simularCentral( fija );
+	Bluefruit.simularConexion( 1, BLE_GATT_ATT_MTU_DEFAULT, 24, recibir );
+	uint64_t eventosDefecto;
+	double uaDefecto = medirOciosa( 60000, eventosDefecto );
+	Bluefruit.simularDesconexion( 0x13 );
+
+	// central que acepta todo: RAPIDO al conectarse y AHORRO tras MS_HASTA_AHORRO sin descargas
+	Bluefruit.simularCentral( CentralSimulada() );
+	Bluefruit.simularConexion( 1, BLEGATT_ATT_MTU_MAX, 24, recibir );
+	sim::correrLoop( Loop::MS_HASTA_AHORRO + 10000, [] () {
+	  return Globales::elPublicador.laEmisora.parametrosConexion( 1 ).latencia != 0 && !NegociacionConexion::negociando();
+	} );
+	ParametrosConexion p = Globales::elPublicador.laEmisora.parametrosConexion( 1 );
+	uint64_t eventosAhorro;
+	double uaAhorro = medirOciosa( 60000, eventosAhorro );
+	bool ahorro = comoSeEspera( p, { BLE_GAP_PHY_2MBPS, BLEGATT_ATT_MTU_MAX, BLE_GAP_DATA_LENGTH_MAX,
+									 PerfilesConexion::AHORRO.intervalo, PerfilesConexion::AHORRO.latencia } )
+	  && uaAhorro < uaDefecto;
+	printf( "ociosa un minuto:  pila %5llu eventos %7.1f uA   AHORRO (", (unsigned long long) eventosDefecto,
+			uaDefecto );
+	escribirParametros( p );
+	printf( ") %5llu eventos %7.1f uA  (%.0fx menos)%s\n", (unsigned long long) eventosAhorro, uaAhorro,
+			uaDefecto / uaAhorro, ahorro ? "" : "  MAL" );
+
+	// descarga pedida en AHORRO: vuelve a RAPIDO
+	uint32_t ms = descargar();
+	p = Globales::elPublicador.laEmisora.parametrosConexion( 1 );
+	bool rapido = comoSeEspera( p, { BLE_GAP_PHY_2MBPS, BLEGATT_ATT_MTU_MAX, BLE_GAP_DATA_LENGTH_MAX,
+									 PerfilesConexion::RAPIDO.intervalo, 0 } )
+	  && muestrasRecibidas >= MUESTRAS_HORA * 2;
+	printf( "descarga desde AHORRO: primera muestra a los %u ms, entera en %.2f s, ya en ",
+			instantePrimera - ( instanteFin - ms ), ms / 1000.0 );
+	escribirParametros( p );
+	printf( "%s\n", rapido ? "" : "  MAL" );
+	Bluefruit.simularDesconexion( 0x13 );
+	return ahorro && rapido;
+  }
+
+  /// Central que rechaza el intervalo de RAPIDO sin contestar: la negociación no se puede quedar esperando.
+  bool probarRechazo() {
+	CentralSimulada ios;
+	ios.mtu = 185;
+	ios.intervaloMinimo = 12;
+	ios.rechazaParametros = true;
+	Bluefruit.simularCentral( ios );
+	Bluefruit.simularConexion( 1, ios.mtu, 24, recibir );
+	uint32_t t0 = millis();
+	sim::correrLoop( 10000, [] () { return !NegociacionConexion::negociando(); } );
+	uint32_t negociacion = millis() - t0;
+	bool terminada = !NegociacionConexion::negociando();
+	uint8_t rechazados = NegociacionConexion::rechazados();
+	ParametrosConexion rapido = Globales::elPublicador.laEmisora.parametrosConexion( 1 );
+
+	sim::correrLoop( Loop::MS_HASTA_AHORRO + 10000, [] () {
+	  return Globales::elPublicador.laEmisora.parametrosConexion( 1 ).latencia != 0 && !NegociacionConexion::negociando();
+	} );
+	ParametrosConexion ahorro = Globales::elPublicador.laEmisora.parametrosConexion( 1 );
+	Bluefruit.simularDesconexion( 0x13 );
+
+	bool bien = terminada && rechazados == 1 && rapido.phy == BLE_GAP_PHY_2MBPS && rapido.intervalo == 24
+	  && ahorro.intervalo == PerfilesConexion::AHORRO.intervalo && ahorro.latencia == PerfilesConexion::AHORRO.latencia;
+	printf( "iOS que rechaza 7,5 ms: %s en %4u ms (%u rechazados), ", terminada ? "negociado" : "SIN NEGOCIAR",
+			negociacion, rechazados );
+	escribirParametros( rapido );
+	printf( "; después AHORRO " );
+	escribirParametros( ahorro );
+	printf( "  %s\n", bien ? "bien" : "MAL" );
+	return bien;
+  }
+
+  /// La central se va con un paso pedido: la negociación se olvida y la siguiente conexión empieza de cero.
+  bool probarDesconexion() {
+	Bluefruit.simularCentral( CentralSimulada() );
+	Bluefruit.simularConexion( 1, BLEGATT_ATT_MTU_MAX, 24, recibir );
+	sim::correrLoop( 10000, [] () { return NegociacionConexion::msHastaPlazo( millis() ) > 0; } );
+	bool pedido = NegociacionConexion::msHastaPlazo( millis() ) > 0;
+	Bluefruit.simularDesconexion( 0x08 );
+	bool olvidada = !NegociacionConexion::negociando() && NegociacionConexion::hayTrabajo();
+	sim::correrLoop( 100, [] () { return false; } );
+	olvidada = olvidada && !NegociacionConexion::hayTrabajo();
+
+	Bluefruit.simularConexion( 1, BLEGATT_ATT_MTU_MAX, 24, recibir );
+	sim::correrLoop( 10000, [] () { return !NegociacionConexion::negociando(); } );
+	ParametrosConexion p = Globales::elPublicador.laEmisora.parametrosConexion( 1 );
+	Bluefruit.simularDesconexion( 0x13 );
+
+	bool bien = pedido && olvidada
+	  && comoSeEspera( p, { BLE_GAP_PHY_2MBPS, BLEGATT_ATT_MTU_MAX, BLE_GAP_DATA_LENGTH_MAX,
+							PerfilesConexion::RAPIDO.intervalo, 0 } );
+	printf( "desconexión con un paso pedido: %s; al volver ", olvidada ? "olvidada" : "SIGUE NEGOCIANDO" );
+	escribirParametros( p );
+	printf( "  %s\n", bien ? "bien" : "MAL" );
+	return bien;
+  }
+
+} // namespace
+
+int main() {
+
+  sim::Simulador & s = sim::Simulador::instancia();
+  s.activarRegistro( false );
+
+  int16_t co2 = 600;
+  for( uint32_t k = 0; k < MUESTRAS_HORA; k++ ) {
+	co2 = (int16_t) ( co2 + (int) ( ( k * 2654435761u ) >> 29 ) - 3 );
+	Globales::elHistorial.anyadir( Publicador::CO2, co2, millis() );
+	Globales::elHistorial.anyadir( Publicador::TEMPERATURA, (int16_t) ( 21 + ( k / 200 ) % 3 ), millis() );
+	delay( Loop::PERIODO_MUESTREO );
+  }
+
+  setup();
+
+  printf( "---- descarga de %u muestras según lo que acepta la central ----\n",
+		  Globales::elHistorial.numeroMuestras() );
+
+  CentralSimulada fija;
+  fija.mtu = BLE_GATT_ATT_MTU_DEFAULT;
+  fija.phys = BLE_GAP_PHY_1MBPS;
+  fija.longitudDatos = BLE_GAP_DATA_LENGTH_DEFAULT;
+  fija.intervaloMinimo = fija.intervaloMaximo = 24;
+  uint8_t fallos = 0;
+  fallos += !probarCentral( "sin cambios (pila)", fija, false,
+							{ BLE_GAP_PHY_1MBPS, BLE_GATT_ATT_MTU_DEFAULT, BLE_GAP_DATA_LENGTH_DEFAULT, 24, 0 } );
+
+  CentralSimulada ios;
+  ios.mtu = 185;
+  ios.intervaloMinimo = 12;
+  fallos += !probarCentral( "como iOS", ios, false, { BLE_GAP_PHY_2MBPS, 185, BLE_GAP_DATA_LENGTH_MAX, 12, 0 } );
+
+  const Esperado RAPIDO = { BLE_GAP_PHY_2MBPS, BLEGATT_ATT_MTU_MAX, BLE_GAP_DATA_LENGTH_MAX,
+							PerfilesConexion::RAPIDO.intervalo, 0 };
+  fallos += !probarCentral( "como Android", CentralSimulada(), false, RAPIDO );
+  fallos += !probarCentral( "Android, PHY ocupado", CentralSimulada(), true, RAPIDO );
+
+  fallos += !probarAhorro();
+  fallos += !probarRechazo();
+  fallos += !probarDesconexion();
+
+  printf( "%u fallos\n", fallos );
+  return fallos == 0 ? 0 : 1;
+}
@@ -0,0 +1,213 @@
+
+/**
+ * @file bench_decodificador.cpp
+ * @brief Tramas por segundo de Pasarela::DecodificadorAnuncios sobre una captura HCI.
+ *
+ * Sin argumentos genera una captura H4 de 200000 informes «LE Advertising Report»: por cada 8,
+ * 2 iBeacon de la placa, 2 TramaMediciones, 1 bloque de BufferMediciones y 3 anuncios de otros
+ * dispositivos (otro iBeacon, otros datos de fabricante, sólo nombre). Los anuncios de la placa
+ * salen de AnuncioPrecalculado, igual que en el firmware. Se mide:
+ *  - decodificarHCI(): recorrido de los eventos HCI;
+ *  - escanear(): búsqueda del prefijo en los bytes sin mirar el formato;
+ *  - memcmp: búsqueda byte a byte, como referencia de lo que cuesta sólo buscar.
+ *
+ * Uso: bench_decodificador [--grabar fichero.h4] [captura.h4]
+ */
+
+#include <bluefruit.h>
+
+#include "AnuncioPrecalculado.h"
+#include "UUID.h"
+#include "pasarela/DecodificadorAnuncios.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace {
+
+  const size_t INFORMES = 200000;
+  const int REPETICIONES = 5;
+
+  constexpr UUID128 BEACON_UUID = UUID128::iBeaconDeNombre( "cholosimeonejefe" );
+  constexpr UUID128 OTRO_UUID = UUID128::iBeaconDeNombre( "otroBeaconCualqu" );
+
+  void anyadirInforme( std::vector< uint8_t > & captura, uint32_t i, const uint8_t * datos, uint8_t n ) {
+	const uint8_t cabecera[] = {
+	  0x04, 0x3e, (uint8_t) ( 2 + 9 + n + 1 ),   // H4 evento, LE Meta, longitud
+	  0x02, 0x01,                                 // Advertising Report, un informe
+	  0x00, 0x01,                                 // ADV_IND, dirección aleatoria
+	  (uint8_t) i, (uint8_t) ( i >> 8 ), 0x33, 0x44, 0x55, (uint8_t) ( 0xc0 | ( i % 7 ) ),
+	  n
+	};
+	captura.insert( captura.end(), cabecera, cabecera + sizeof( cabecera ) );
+	captura.insert( captura.end(), datos, datos + n );
+	captura.push_back( (uint8_t) ( -40 - (int) ( i % 50 ) ) );
+  }
+
+  std::vector< uint8_t > generarCaptura() {
+	std::vector< uint8_t > captura;
+	captura.reserve( INFORMES * 48 );
+
+	AnuncioPrecalculado nuestro;
+	nuestro.prepararIBeacon( 0x004c, BEACON_UUID, 0, 0, -53, "GTI-3A" );
+	AnuncioPrecalculado otro;
+	otro.prepararIBeacon( 0x004c, OTRO_UUID, 0x0102, 0x0304, -59, "otro" );
+	AnuncioPrecalculado libre;
+	libre.prepararLibre( nullptr, 0, "GTI-3A" );
+
+	// bloque comprimido real
+	BufferMediciones< 256 > elBuffer;
+	for( uint32_t k = 0; k < 12; k++ ) {
+	  elBuffer.anyadir( 11, (int16_t) ( 400 + k * 3 ), k * 2500 );
+	  elBuffer.anyadir( 12, (int16_t) ( 21 + ( k & 1 ) ), k * 2500 );
+	}
+	uint8_t bloque[TramaMediciones::TAMANYO] = { 0 };
+	elBuffer.extraerBloque( TramaMediciones::bloque( bloque ), TramaMediciones::CAPACIDAD_BLOQUE, 30000 );
+	TramaMediciones::cerrarBloque( bloque );
+
+	const uint8_t fabricante[] = { 2, 0x01, 0x06, 11, 0xff, 0x59, 0x00, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+	const uint8_t nombre[] = { 2, 0x01, 0x06, 9, 0x09, 's', 'e', 'n', 's', 'o', 'r', '-', '7' };
+
+	for( uint32_t i = 0; i < INFORMES; i++ ) {
+	  switch( i % 8 ) {
+	  case 0:
+	  case 4:
+		nuestro.cambiarMajorMinor( ( 11 << 8 ) + ( i & 0xff ), (uint16_t) ( 400 + i % 100 ) );
+		nuestro.confirmar();
+		anyadirInforme( captura, i, nuestro.datosAnuncio(), nuestro.longitudAnuncio() );
+		break;
+	  case 1:
+	  case 5: {
+		TramaMediciones trama( (uint8_t) i );
+		trama.anyadir( 11, (int16_t) ( 400 + i % 100 ) );
+		trama.anyadir( 12, (int16_t) ( 20 + i % 5 ) );
+		libre.cambiarCarga( 0, trama.cerrar(), TramaMediciones::TAMANYO );
+		libre.confirmar();
+		anyadirInforme( captura, i, libre.datosAnuncio(), libre.longitudAnuncio() );
+		break;
+	  }
+	  case 2:
+		libre.cambiarCarga( 0, bloque, TramaMediciones::TAMANYO );
+		libre.confirmar();
+		anyadirInforme( captura, i, libre.datosAnuncio(), libre.longitudAnuncio() );
+		break;
+	  case 3:
+		anyadirInforme( captura, i, otro.datosAnuncio(), otro.longitudAnuncio() );
+		break;
+	  case 6:
+		anyadirInforme( captura, i, fabricante, sizeof( fabricante ) );
+		break;
+	  default:
+		anyadirInforme( captura, i, nombre, sizeof( nombre ) );
+		break;
+	  }
+	}
+	return captura;
+  }
+
+  /// Mejor tiempo de REPETICIONES ejecuciones, en segundos.
+  template< typename F >
+  double cronometrar( F f ) {
+	double mejor = 1e30;
+	for( int r = 0; r < REPETICIONES; r++ ) {
+	  auto t0 = std::chrono::steady_clock::now();
+	  f();
+	  double s = std::chrono::duration< double >( std::chrono::steady_clock::now() - t0 ).count();
+	  mejor = s < mejor ? s : mejor;
+	}
+	return mejor;
+  }
+
+  void escribir( const char * nombre, uint64_t tramas, uint64_t mediciones, size_t bytes, double s ) {
+	printf( "%-16s %8llu tramas  %8llu mediciones  %10.2f Mtramas/s  %8.1f MB/s\n", nombre,
+			(unsigned long long) tramas, (unsigned long long) mediciones, tramas / s / 1e6, bytes / s / 1e6 );
+  }
+
+} // namespace
+
+int main( int argc, char * argv[] ) {
+
+  const char * grabar = nullptr;
+  const char * leer = nullptr;
+  for( int i = 1; i < argc; i++ ) {
+	std::string a = argv[i];
+	if( a == "--grabar" && i + 1 < argc ) {
+	  grabar = argv[++i];
+	} else if( a[0] != '-' && leer == nullptr ) {
+	  leer = argv[i];
+	} else {
+	  fprintf( stderr, "uso: %s [--grabar fichero.h4] [captura.h4]\n", argv[0] );
+	  return 2;
+	}
+  }
+
+  std::vector< uint8_t > captura;
+  if( leer != nullptr ) {
+	FILE * f = fopen( leer, "rb" );
+	if( f == nullptr ) {
+	  perror( leer );
+	  return 1;
+	}
+	uint8_t bloque[65536];
+	size_t n;
+	while( ( n = fread( bloque, 1, sizeof( bloque ), f ) ) > 0 ) {
+	  captura.insert( captura.end(), bloque, bloque + n );
+	}
+	fclose( f );
+  } else {
+	captura = generarCaptura();
+  }
+  if( grabar != nullptr ) {
+	FILE * f = fopen( grabar, "wb" );
+	if( f == nullptr ) {
+	  perror( grabar );
+	  return 1;
+	}
+	fwrite( captura.data(), 1, captura.size(), f );
+	fclose( f );
+  }
+
+  printf( "---- decodificador de anuncios: %s, %zu bytes ----\n", leer != nullptr ? leer : "captura generada",
+		  captura.size() );
+
+  // se acumula algo de cada medición para que el compilador no se salte el trabajo
+  uint64_t suma = 0;
+  auto consumir = [&] ( const Pasarela::Medicion & m ) { suma += (uint16_t) m.valor + m.id; };
+
+  Pasarela::DecodificadorAnuncios::Estadisticas hci;
+  double sHci = cronometrar( [&] () {
+	Pasarela::DecodificadorAnuncios d( BEACON_UUID );
+	d.decodificarHCI( captura.data(), captura.size(), consumir );
+	hci = d.contadores();
+  } );
+
+  Pasarela::DecodificadorAnuncios::Estadisticas escaneo;
+  double sEscaneo = cronometrar( [&] () {
+	Pasarela::DecodificadorAnuncios d( BEACON_UUID );
+	d.escanear( captura.data(), captura.size(), consumir );
+	escaneo = d.contadores();
+  } );
+
+  uint64_t prefijosMemcmp = 0;
+  double sMemcmp = cronometrar( [&] () {
+	static const uint8_t PREFIJO[4] = { 0x4c, 0x00, 0x02, 0x15 };
+	prefijosMemcmp = 0;
+	for( size_t i = 0; i + 4 <= captura.size(); i++ ) {
+	  if( memcmp( &captura[i], PREFIJO, 4 ) == 0 ) {
+		prefijosMemcmp++;
+		suma += captura[i + 4];
+	  }
+	}
+  } );
+
+  escribir( "decodificarHCI", hci.tramas, hci.mediciones, captura.size(), sHci );
+  escribir( "escanear", escaneo.tramas, escaneo.mediciones, captura.size(), sEscaneo );
+  printf( "%-16s %8llu prefijos (sólo la búsqueda)                        %8.1f MB/s\n", "memcmp",
+		  (unsigned long long) prefijosMemcmp, captura.size() / sMemcmp / 1e6 );
+  printf( "informes HCI %llu, cargas ajenas %llu, mal formados %llu  (control %llu)\n",
+		  (unsigned long long) hci.anuncios, (unsigned long long) hci.desconocidas,
+		  (unsigned long long) hci.malFormados, (unsigned long long) ( suma & 0xff ) );
+
+  return 0;
+}
@@ -0,0 +1,226 @@
+
+/**
+ * @file bench_diario.cpp
+ * @brief Diario de mediciones en la flash (DiarioMediciones) con el sketch entero.
+ *
+ * La flash simulada es un directorio temporal. Se ejecuta el sketch unas horas de tiempo virtual
+ * (mide cada 2,5 s y guarda el diario cada Loop::PERIODO_DIARIO) y se mide:
+ *  - lo que ocupa y lo que se escribe en la flash, y el desgaste que supone al día;
+ *  - la lectura en el ordenador con LectorDiario (mmap), con y sin el coste de proyectar los
+ *    ficheros, frente a recorrer el diario con la API de ficheros, comprobando que las muestras sean seguidas y acaben en la última del historial;
+ *  - la exportación por el puerto serie (orden `d`), que debe dar las mismas muestras;
+ *  - un reinicio a mitad de una escritura: se deja media entrada al final del segmento, se abre el
+ *    diario como al arrancar y se comprueba que se corta y que el número de arranque sube.
+ * Si hay saltos, muestras perdidas o escrituras fallidas, si la exportación no da las mismas muestras
+ * o si el reinicio no corta la media entrada, el programa termina con error.
+ */
+
+#include <Arduino.h>
+
+#include "../HolaMundoIBeacon/HolaMundoIBeacon.ino"
+#include "pasarela/LectorDiario.h"
+
+#include <chrono>
+
+namespace {
+
+  const uint32_t HORAS = 6;
+
+  /// Resumen de un recorrido: cuántas muestras, si son seguidas y una suma de control.
+  struct Resumen {
+	uint64_t muestras = 0;
+	uint32_t primera = 0;
+	uint32_t ultima = 0;
+	uint32_t saltos = 0;
+	uint32_t suma = 0;
+
+	void anyadir( uint32_t secuencia, int16_t valor ) {
+	  if( muestras == 0 ) {
+		primera = secuencia;
+	  } else if( secuencia != ultima + 1 ) {
+		saltos++;
+	  }
+	  ultima = secuencia;
+	  suma = suma * 31 + secuencia + (uint16_t) valor;
+	  muestras++;
+	}
+
+	bool operator==( const Resumen & o ) const {
+	  return muestras == o.muestras && primera == o.primera && ultima == o.ultima && suma == o.suma;
+	}
+  };
+
+  Resumen leerProyectado( const std::string & directorio ) {
+	Pasarela::LectorDiario lector;
+	lector.proyectarDirectorio( directorio.c_str() );
+	Resumen r;
+	lector.recorrer( [&] ( const Pasarela::LectorDiario::Muestra & m ) { r.anyadir( m.secuencia, m.valor ); } );
+	return r;
+  }
+
+  void medirLectura( const std::string & directorio ) {
+	const int REPETICIONES = 200;
+	uint32_t control = 0;
+	auto alLeer = [&] ( const Pasarela::LectorDiario::Muestra & m ) { control += m.valor; };
+
+	// abriendo y proyectando los ficheros cada vez, como al leer el diario de una placa
+	auto t0 = std::chrono::steady_clock::now();
+	for( int r = 0; r < REPETICIONES; r++ ) {
+	  Pasarela::LectorDiario lector;
+	  lector.proyectarDirectorio( directorio.c_str() );
+	  lector.recorrer( alLeer );
+	}
+	double sProyectar = std::chrono::duration< double >( std::chrono::steady_clock::now() - t0 ).count();
+
+	// sólo el recorrido de lo ya proyectado: comprobar los CRC y decodificar
+	Pasarela::LectorDiario lector;
+	lector.proyectarDirectorio( directorio.c_str() );
+	t0 = std::chrono::steady_clock::now();
+	uint64_t muestras = 0;
+	for( int r = 0; r < REPETICIONES; r++ ) {
+	  muestras += lector.recorrer( alLeer );
+	}
+	double sRecorrer = std::chrono::duration< double >( std::chrono::steady_clock::now() - t0 ).count();
+	uint64_t bytes = lector.contadores().bytes * REPETICIONES;
+
+	// el mismo recorrido leyendo entrada a entrada con la API de ficheros de la placa
+	t0 = std::chrono::steady_clock::now();
+	for( int r = 0; r < REPETICIONES; r++ ) {
+	  Globales::elDiario.recorrer( [&] ( const FormatoDiario::Entrada & e ) {
+		CodecMuestras::Muestra m[FormatoDiario::MAX_BLOQUE];
+		int cuantas = CodecMuestras::decodificarBloque( e.bloque, e.tamanyoBloque, m, FormatoDiario::MAX_BLOQUE,
+														e.instante );
+		for( int k = 0; k < cuantas; k++ ) {
+		  control += m[k].valor;
+		}
+	  } );
+	}
+	double sFicheros = std::chrono::duration< double >( std::chrono::steady_clock::now() - t0 ).count();
+
+	printf( "lectura de %llu bytes: LectorDiario (mmap) %6.1f us con la proyección, %6.1f us sin ella"
+			" (%.0f MB/s, %.1f M muestras/s); API de ficheros %6.1f us\n",
+			(unsigned long long) lector.contadores().bytes, sProyectar * 1e6 / REPETICIONES,
+			sRecorrer * 1e6 / REPETICIONES, bytes / sRecorrer / 1e6, muestras / sRecorrer / 1e6,
+			sFicheros * 1e6 / REPETICIONES );
+	printf( "(control %u)\n", control & 0xff );
+  }
+
+  bool exportar( const std::string & directorio ) {
+	sim::Simulador & s = sim::Simulador::instancia();
+	std::string salida;
+	s.serie.capturar( &salida );
+	uint32_t t0 = millis();
+	s.serie.recibir( "d" );
+	sim::correrLoop( 600000, [&] () { return salida.find( "diario: fin" ) != std::string::npos; } );
+	uint32_t ms = millis() - t0;
+	s.serie.capturar( nullptr );
+	Resumen enFlash = leerProyectado( directorio );   // `d` guarda antes de exportar
+
+	FILE * f = fmemopen( (void *) salida.data(), salida.size(), "r" );
+	Pasarela::LectorDiario lector;
+	uint32_t segmentos = lector.leerVolcado( f );
+	fclose( f );
+	Resumen r;
+	lector.recorrer( [&] ( const Pasarela::LectorDiario::Muestra & m ) { r.anyadir( m.secuencia, m.valor ); } );
+	printf( "exportación por el puerto serie: %u segmentos, %zu bytes de texto en %.2f s;"
+			" %llu muestras, %s que en la flash\n",
+			segmentos, salida.size(), ms / 1000.0, (unsigned long long) r.muestras,
+			r == enFlash ? "las mismas" : "DISTINTAS" );
+	return r == enFlash && r.muestras > 0;
+  }
+
+  bool reiniciarEscribiendo( const std::string & directorio ) {
+	Adafruit_LittleFS & flash = InternalFS;
+
+	// media entrada al final del segmento actual, como si se hubiera ido la corriente escribiendo
+	char nombre[32];
+	snprintf( nombre, sizeof( nombre ), "/diario%u.bin",
+			  (unsigned) ( Globales::elDiario.segmentoActual() % Globales::Diario::NUMERO_DE_SEGMENTOS ) );
+	uint32_t antes;
+	{
+	  auto f = flash.open( nombre, Adafruit_LittleFS_Namespace::FILE_O_WRITE );
+	  antes = f.size();
+	  const uint8_t MEDIA_ENTRADA[7] = { 200, 1, 0, 0x10, 0x20, 0x30, 0x40 };
+	  f.write( MEDIA_ENTRADA, sizeof( MEDIA_ENTRADA ) );
+	}
+	Resumen antesDelReinicio = leerProyectado( directorio );
+
+	// tras el reinicio el historial de la RAM está vacío y millis() vuelve a empezar
+	static Globales::Historial historialNuevo;
+	Globales::Diario diario( historialNuevo, flash );
+	bool abierto = diario.abrir();
+	for( uint32_t k = 0; k < 200; k++ ) {
+	  historialNuevo.anyadir( Publicador::CO2, (int16_t) ( 700 + k % 7 ), k * Loop::PERIODO_MUESTREO );
+	}
+	diario.guardar( 200 * Loop::PERIODO_MUESTREO );
+
+	Pasarela::LectorDiario lector;
+	lector.proyectarDirectorio( directorio.c_str() );
+	uint32_t delReinicio = 0;
+	lector.recorrer( [&] ( const Pasarela::LectorDiario::Muestra & m ) {
+	  delReinicio += m.arranque == diario.numeroArranque();
+	} );
+	// la entrada nueva va tras la cortada o, si ya no cabe, al principio del segmento siguiente
+	bool escrita = flash.open( nombre ).size() > antes || diario.segmentoActual() != Globales::elDiario.segmentoActual();
+	bool ok = abierto && diario.bytesCortadosAlAbrir() == 7 && escrita
+			  && lector.contadores().bytesMalos == 0 && delReinicio == 200
+			  && diario.numeroArranque() == Globales::elDiario.numeroArranque() + 1;
+	printf( "reinicio escribiendo: %u bytes cortados al abrir, arranque %u -> %u, %u muestras nuevas,"
+			" %u bytes malos, %llu muestras antes  %s\n",
+			diario.bytesCortadosAlAbrir(), Globales::elDiario.numeroArranque(), diario.numeroArranque(), delReinicio,
+			lector.contadores().bytesMalos, (unsigned long long) antesDelReinicio.muestras, ok ? "bien" : "MAL" );
+	return ok;
+  }
+
+} // namespace
+
+int main() {
+
+  sim::Simulador & s = sim::Simulador::instancia();
+  s.activarRegistro( false );
+
+  char plantilla[] = "/tmp/diario_XXXXXX";
+  std::string directorio = mkdtemp( plantilla );
+  InternalFS.simularDirectorio( directorio.c_str() );
+
+  setup();
+  sim::correrLoop( HORAS * 3600000, [] () { return false; } );
+  Globales::elDiario.guardar( millis() );
+
+  const Globales::Diario & d = Globales::elDiario;
+  Resumen enFlash = leerProyectado( directorio );
+  uint32_t minutosEnFlash = (uint32_t) ( enFlash.muestras * Loop::PERIODO_MUESTREO / 60000 );
+  printf( "---- %u h de sketch: %u muestras en el historial (RAM, %u bytes), %llu en la flash"
+		  " (%u min), %u perdidas ----\n",
+		  HORAS, Globales::elHistorial.numeroMuestras(), Globales::elHistorial.bytesUsados(),
+		  (unsigned long long) enFlash.muestras, minutosEnFlash, d.muestrasPerdidas() );
+  printf( "diario: segmento %u, %u entradas, %u bytes (%.2f bytes por muestra), %u muestras guardadas,"
+		  " %u escrituras fallidas\n",
+		  d.segmentoActual(), d.entradasEscritas(), d.bytesEnFlash(), (double) d.bytesEnFlash() / d.muestrasEnFlash(),
+		  d.muestrasEnFlash(), d.escriturasFallidas() );
+  bool seguidas = enFlash.muestras > 0 && enFlash.saltos == 0
+				  && enFlash.ultima + 1 == Globales::elHistorial.secuenciaSiguiente()
+				  && d.muestrasPerdidas() == 0 && d.escriturasFallidas() == 0;
+  printf( "muestras del diario: %u .. %u, %u saltos; la última del historial es %u  %s\n",
+		  enFlash.primera, enFlash.ultima, enFlash.saltos, Globales::elHistorial.secuenciaSiguiente() - 1,
+		  seguidas ? "bien" : "MAL" );
+  int fallos = !seguidas;
+
+  // el desgaste se reparte entre todos los bloques de la partición
+  double bytesDia = InternalFS.bytesEscritos * 24.0 / HORAS;
+  double ciclosDia = InternalFS.bloquesBorrados * 24.0 / HORAS / InternalFS.bloquesTotales();
+  printf( "flash: %u de %u bloques, %llu escrituras, %llu bytes, %llu bloques borrados, %llu ficheros borrados;"
+		  " al día %.0f KB y %.1f borrados por bloque: 10000 ciclos son %.1f años\n",
+		  InternalFS.bloquesOcupados(), InternalFS.bloquesTotales(), (unsigned long long) InternalFS.escrituras,
+		  (unsigned long long) InternalFS.bytesEscritos, (unsigned long long) InternalFS.bloquesBorrados,
+		  (unsigned long long) InternalFS.borrados, bytesDia / 1024, ciclosDia, 10000 / ciclosDia / 365 );
+
+  medirLectura( directorio );
+  fallos += !exportar( directorio );
+  fallos += !reiniciarEscribiendo( directorio );
+
+  InternalFS.format();
+  rmdir( directorio.c_str() );
+  printf( "%d fallos\n", fallos );
+  return fallos == 0 ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+
+/**
+ * @file bench_filtros.cpp
+ * @brief Banco de pruebas de los filtros del Medidor (Filtros.h).
+ *
+ * Genera una señal de CO2 con ruido y picos sueltos, la pasa por la cadena de filtros del
+ * Medidor y cuenta:
+ *  - muestras por segundo que procesa cada etapa en el ordenador;
+ *  - cuánto ruido queda (desviación respecto a la señal limpia);
+ *  - cuántas lecturas seguidas cambian de valor, que es lo que provoca publicaciones
+ *    redundantes.
+ */
+
+#include <Arduino.h>
+
+#include "Medidor.h"
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+  const uint32_t LECTURAS = 1 << 20;
+  const uint16_t SOBREMUESTREO = Medidor::CadenaFiltros::SOBREMUESTREO;
+
+  uint32_t semilla = 12345;
+
+  /// Generador congruencial: mismo ruido en cada ejecución.
+  int16_t aleatorio( int16_t amplitud ) {
+	semilla = semilla * 1664525u + 1013904223u;
+	return (int16_t) ( (int32_t) ( semilla >> 16 ) % ( 2 * amplitud + 1 ) - amplitud );
+  }
+
+  /// Señal limpia: CO2 que sube y baja despacio.
+  int16_t limpia( uint32_t lectura ) {
+	return (int16_t) ( 600 + ( ( lectura / 64 ) % 200 ) );
+  }
+
+  template< typename F >
+  double nsPor( uint64_t cuantas, F f ) {
+	auto t0 = std::chrono::steady_clock::now();
+	f();
+	auto t1 = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>( t1 - t0 ).count() / cuantas;
+  }
+
+  struct Calidad {
+	double error;        ///< Raíz del error cuadrático medio respecto a la señal limpia.
+	uint32_t cambios;    ///< Lecturas distintas de la anterior.
+  };
+
+  Calidad calidad( const std::vector<int16_t> & lecturas ) {
+	Calidad c = { 0, 0 };
+	for( uint32_t i = 0; i < lecturas.size(); i++ ) {
+	  double e = lecturas[i] - limpia( i );
+	  c.error += e * e;
+	  c.cambios += i > 0 && lecturas[i] != lecturas[i - 1];
+	}
+	c.error = std::sqrt( c.error / lecturas.size() );
+	return c;
+  }
+
+  volatile int32_t sumidero;
+
+} // namespace
+
+int main() {
+
+  // muestras del sensor: ruido de ±20 ppm y un pico de +800 ppm de vez en cuando
+  std::vector<int16_t> muestras( (size_t) LECTURAS * SOBREMUESTREO );
+  for( size_t i = 0; i < muestras.size(); i++ ) {
+	muestras[i] = limpia( i / SOBREMUESTREO ) + aleatorio( 20 );
+	if( aleatorio( 500 ) == 0 ) {
+	  muestras[i] += 800;
+	}
+  }
+
+  std::vector<int16_t> sinFiltrar( LECTURAS );
+  std::vector<int16_t> diezmadas( LECTURAS );
+  std::vector<int16_t> filtradas( LECTURAS );
+
+  for( uint32_t i = 0; i < LECTURAS; i++ ) {
+	sinFiltrar[i] = muestras[(size_t) i * SOBREMUESTREO];
+  }
+
+  const uint16_t BLOQUE = 0xffff;
+  const size_t BLOQUES = muestras.size() / BLOQUE;
+  double nsSuma = nsPor( BLOQUES * BLOQUE, [&] {
+	int32_t suma = 0;
+	for( size_t b = 0; b < BLOQUES; b++ ) {
+	  suma += Filtros::sumar( &muestras[b * BLOQUE], BLOQUE );
+	}
+	sumidero = suma;
+  } );
+
+  double nsDiezmado = nsPor( muestras.size(), [&] {
+	for( size_t i = 0; i < muestras.size(); i += (size_t) 64 * SOBREMUESTREO ) {
+	  Filtros::diezmar< 3 >( &muestras[i], 64 * SOBREMUESTREO, &diezmadas[i / SOBREMUESTREO] );
+	}
+  } );
+
+  Medidor::CadenaFiltros laCadena;
+  double nsCadena = nsPor( muestras.size(), [&] {
+	for( uint32_t i = 0; i < LECTURAS; i++ ) {
+	  filtradas[i] = laCadena.filtrar( &muestras[(size_t) i * SOBREMUESTREO] );
+	}
+  } );
+
+  Calidad crudo = calidad( sinFiltrar );
+  Calidad diezmado = calidad( diezmadas );
+  Calidad filtrado = calidad( filtradas );
+
+  printf( "---- Filtros del Medidor: %u lecturas de %u muestras ----\n", LECTURAS, SOBREMUESTREO );
+  printf( "%-28s %8.2f Mmuestras/s\n", "sumar()", 1e3 / nsSuma );
+  printf( "%-28s %8.2f Mmuestras/s\n", "diezmar< 3 >()", 1e3 / nsDiezmado );
+  printf( "%-28s %8.2f Mmuestras/s\n", "Cadena::filtrar()", 1e3 / nsCadena );
+  printf( "%-28s %8s %12s\n", "", "error", "cambios" );
+  printf( "%-28s %8.2f %12u\n", "una muestra por lectura", crudo.error, crudo.cambios );
+  printf( "%-28s %8.2f %12u\n", "media de 8", diezmado.error, diezmado.cambios );
+  printf( "%-28s %8.2f %12u\n", "media + mediana + EMA", filtrado.error, filtrado.cambios );
+
+  // con el sensor simulado (valor fijo) la cadena no altera la medida
+  Medidor elMedidor;
+  elMedidor.iniciarMedidor();
+  if( elMedidor.medir< Sensores::CO2 >() != Sensores::CO2::leer()
+	  || elMedidor.medir< Sensores::Temperatura >() != Sensores::Temperatura::leer()
+	  || elMedidor.medir< Sensores::Ruido >() != Sensores::Ruido::leer() ) {
+	printf( "el Medidor altera una señal constante\n" );
+	return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,240 @@
+
+/**
+ * @file bench_historial.cpp
+ * @brief Descarga por GATT de una hora de historial (DescargaHistorial) frente a los anuncios.
+ *
+ * Se llena Globales::elHistorial del sketch con una hora de mediciones (CO2 y temperatura cada
+ * 2,5 s), se arranca el sketch (setup() y loop() sobre el Bluefruit simulado) y una central
+ * simulada escribe DESCARGAR 0 en la característica de órdenes. La central decodifica cada
+ * notificación que le llega con CodecMuestras::decodificarBloque() y se comprueba que estén
+ * todas las muestras. Se mide:
+ *  - el tiempo (virtual) de la descarga con MTU 23 a 30 ms de intervalo y MTU 247 a 7,5 ms,
+ *    frente a lo que tardan las mismas muestras en bloques de anuncio (19 bytes cada
+ *    Loop::TIEMPO_POR_BLOQUE);
+ *  - una descarga cortada a la mitad: desconexión, reconexión y REANUDAR;
+ *  - el tiempo real de CPU de recorrer el historial con un cursor frente a buscar la secuencia
+ *    desde la muestra más antigua en cada bloque (lo que hacía copiarBloque()).
+ * Si falta alguna muestra, si la reanudación repite más de lo que no estaba confirmado o si los
+ * dos recorridos no sacan los mismos bloques, el programa termina con error.
+ * La central no acepta nada de lo que pide NegociacionConexion (PHY 1M y paquetes de enlace de
+ * 27 bytes): lo que se gana con eso lo mide bench_conexion.
+ */
+
+#include <Arduino.h>
+
+#include "../HolaMundoIBeacon/HolaMundoIBeacon.ino"
+
+#include <chrono>
+#include <vector>
+
+namespace {
+
+  const uint32_t MUESTRAS_HORA = 3600000 / Loop::PERIODO_MUESTREO;
+  const uint8_t MAX_MUESTRAS_BLOQUE = 128;
+
+  using Descarga = DescargaHistorial< Globales::Historial >;
+
+  /// Lo que lleva la central.
+  struct Central {
+	std::vector< uint16_t > veces;   ///< Veces que ha llegado cada secuencia.
+	uint32_t notificaciones = 0;
+	uint32_t bytes = 0;
+	uint32_t malFormados = 0;
+	bool fin = false;
+	uint32_t secuenciaFin = 0;
+	uint32_t instanteFin = 0;     ///< ms (reloj virtual) al llegar el bloque de fin.
+  };
+
+  Central laCentral;
+
+  void recibir( const uint8_t * p, uint16_t n, uint64_t instante_us ) {
+	CodecMuestras::Muestra m[MAX_MUESTRAS_BLOQUE];
+	uint32_t instante = (uint32_t) ( instante_us / 1000 );
+	int cuantas = CodecMuestras::decodificarBloque( p, (uint8_t) n, m, MAX_MUESTRAS_BLOQUE, instante );
+	laCentral.notificaciones++;
+	laCentral.bytes += n;
+	if( cuantas < 0 ) {
+	  laCentral.malFormados++;
+	  return;
+	}
+	if( cuantas == 0 ) {
+	  laCentral.fin = true;
+	  laCentral.instanteFin = instante;
+	  laCentral.secuenciaFin = ( (uint32_t) p[0] << 8 ) | p[1];
+	  return;
+	}
+	for( int k = 0; k < cuantas; k++ ) {
+	  // en una hora no se pasa de 65535 muestras: la secuencia de 16 bits es la entera
+	  if( m[k].secuencia >= laCentral.veces.size() ) {
+		laCentral.veces.resize( m[k].secuencia + 1, 0 );
+	  }
+	  laCentral.veces[m[k].secuencia]++;
+	}
+  }
+
+  void escribirOrden( uint8_t codigo, uint32_t desde = 0 ) {
+	uint8_t orden[5] = { codigo, (uint8_t) desde, (uint8_t) ( desde >> 8 ), (uint8_t) ( desde >> 16 ),
+						 (uint8_t) ( desde >> 24 ) };
+	BLECharacteristic & ordenes = Globales::lasOrdenesHistorial;
+	ordenes.simularEscritura( Bluefruit.connHandle(), orden, codigo == Descarga::DESCARGAR ? 5 : 1 );
+  }
+
+  /// Comprueba que hayan llegado todas las secuencias hasta el fin; devuelve las repetidas.
+  bool completa( uint32_t desde, uint32_t & faltan, uint32_t & repetidas ) {
+	faltan = 0;
+	repetidas = 0;
+	for( uint32_t s = desde; s < laCentral.secuenciaFin; s++ ) {
+	  uint16_t v = s < laCentral.veces.size() ? laCentral.veces[s] : 0;
+	  faltan += v == 0;
+	  repetidas += v > 1 ? v - 1 : 0;
+	}
+	return laCentral.fin && faltan == 0 && laCentral.malFormados == 0;
+  }
+
+  /// Central que se queda con `mtu`, `intervalo`, 1M y paquetes de 27 bytes, pida lo que pida el sketch.
+  void simularCentralFija( uint16_t mtu, uint16_t intervalo ) {
+	CentralSimulada fija;
+	fija.mtu = mtu;
+	fija.phys = BLE_GAP_PHY_1MBPS;
+	fija.longitudDatos = BLE_GAP_DATA_LENGTH_DEFAULT;
+	fija.intervaloMinimo = fija.intervaloMaximo = intervalo;
+	fija.latenciaMaxima = 0;
+	Bluefruit.simularCentral( fija );
+  }
+
+  bool descargar( const char * nombre, uint16_t mtu, uint16_t intervalo, uint32_t muestrasAnuncio ) {
+	laCentral = Central();
+	simularCentralFija( mtu, intervalo );
+	Bluefruit.simularConexion( 1, mtu, intervalo, recibir );
+	uint32_t t0 = millis();
+	escribirOrden( Descarga::DESCARGAR, 0 );
+	sim::correrLoop( 600000, [] () { return laCentral.fin; } );
+	uint32_t ms = laCentral.instanteFin - t0;
+	Bluefruit.simularDesconexion( 0x13 );
+
+	uint32_t faltan, repetidas;
+	bool ok = completa( 0, faltan, repetidas );
+	printf( "%-18s MTU %3u  %5.1f ms  %7.2f s  %7.0f bytes/s  %5u notif.  %5u muestras  faltan %u  %s"
+			"  (%4.0fx más rápido que los anuncios)\n",
+			nombre, mtu, intervalo * 1.25, ms / 1000.0, laCentral.bytes * 1000.0 / ms, laCentral.notificaciones,
+			laCentral.secuenciaFin, faltan, ok ? "completa" : "INCOMPLETA",
+			(double) muestrasAnuncio * Loop::TIEMPO_POR_BLOQUE / ms );
+	return ok;
+  }
+
+  bool cortarYReanudar() {
+	laCentral = Central();
+	simularCentralFija( BLEGATT_ATT_MTU_MAX, 6 );
+	Bluefruit.simularConexion( 1, BLEGATT_ATT_MTU_MAX, 6, recibir );
+	uint32_t t0 = millis();
+	escribirOrden( Descarga::DESCARGAR, 0 );
+	sim::correrLoop( 600000, [] () { return laCentral.veces.size() >= MUESTRAS_HORA / 2; } );
+	Bluefruit.simularDesconexion( 0x08 );   // supervisión: la central se ha alejado
+	uint32_t recibidasAntes = (uint32_t) laCentral.veces.size();
+	uint32_t confirmada = Globales::laDescarga.secuenciaConfirmada();
+	uint32_t enviada = Globales::laDescarga.secuenciaSiguiente();
+
+	sim::correrLoop( 2000, [] () { return false; } );
+
+	Bluefruit.simularConexion( 2, BLEGATT_ATT_MTU_MAX, 6, recibir );
+	escribirOrden( Descarga::REANUDAR );
+	sim::correrLoop( 600000, [] () { return laCentral.fin; } );
+	uint32_t ms = laCentral.instanteFin - t0;
+	Bluefruit.simularDesconexion( 0x13 );
+
+	uint32_t faltan, repetidas;
+	// sólo se vuelve a mandar lo que la central no había confirmado
+	bool ok = completa( 0, faltan, repetidas ) && recibidasAntes < laCentral.secuenciaFin
+	  && repetidas <= enviada - confirmada;
+	printf( "%-18s corte tras %u muestras recibidas (enviadas %u, confirmadas %u), REANUDAR: %u muestras"
+			"  faltan %u  repetidas %u  %s  (%.2f s con la pausa)\n",
+			"cortada", recibidasAntes, enviada, confirmada, laCentral.secuenciaFin, faltan, repetidas,
+			ok ? "completa" : "MAL", ms / 1000.0 );
+	return ok;
+  }
+
+  /// Bloques que hacen falta para sacar todo el historial en bloques de `max` bytes.
+  uint32_t bloques( uint8_t max ) {
+	Globales::Historial::Cursor c;
+	Globales::elHistorial.situar( c, 0 );
+	uint8_t bloque[BLEGATT_ATT_MTU_MAX];
+	uint32_t n = 0;
+	while( Globales::elHistorial.copiarBloque( c, bloque, max, millis() ) > 0 ) {
+	  n++;
+	}
+	return n;
+  }
+
+  /// Los dos recorridos tienen que sacar los mismos bloques.
+  bool compararCursor() {
+	const int REPETICIONES = 20;
+	uint8_t bloque[BLEGATT_ATT_MTU_MAX];
+	uint32_t control = 0;
+	bool iguales = true;
+	const uint8_t TAMANYOS[2] = { TramaMediciones::CAPACIDAD_BLOQUE, BLEGATT_ATT_MTU_MAX - 3 };
+	for( uint8_t max : TAMANYOS ) {
+	  uint32_t controlCursor = 0;
+	  uint32_t controlBuscar = 0;
+	  auto t0 = std::chrono::steady_clock::now();
+	  for( int r = 0; r < REPETICIONES; r++ ) {
+		Globales::Historial::Cursor c;
+		Globales::elHistorial.situar( c, 0 );
+		while( uint8_t n = Globales::elHistorial.copiarBloque( c, bloque, max, millis() ) ) {
+		  controlCursor = controlCursor * 31 + n + bloque[n - 1];
+		}
+	  }
+	  double sCursor = std::chrono::duration< double >( std::chrono::steady_clock::now() - t0 ).count();
+
+	  t0 = std::chrono::steady_clock::now();
+	  for( int r = 0; r < REPETICIONES; r++ ) {
+		uint32_t desde = 0;
+		while( uint8_t n = Globales::elHistorial.copiarBloque( desde, bloque, max, millis(), desde ) ) {
+		  controlBuscar = controlBuscar * 31 + n + bloque[n - 1];
+		}
+	  }
+	  double sBuscar = std::chrono::duration< double >( std::chrono::steady_clock::now() - t0 ).count();
+	  iguales = iguales && controlCursor == controlBuscar;
+	  control += controlCursor;
+
+	  printf( "recorrido en bloques de %3u bytes: cursor %8.1f us  buscando la secuencia %8.1f us  (%.0fx)\n",
+			  max, sCursor * 1e6 / REPETICIONES, sBuscar * 1e6 / REPETICIONES, sBuscar / sCursor );
+	}
+	printf( "(control %u, %s)\n", control & 0xff, iguales ? "los mismos bloques" : "BLOQUES DISTINTOS" );
+	return iguales;
+  }
+
+} // namespace
+
+int main() {
+
+  sim::Simulador & s = sim::Simulador::instancia();
+  s.activarRegistro( false );
+
+  // una hora de mediciones antes de arrancar el sketch
+  int16_t co2 = 600;
+  for( uint32_t k = 0; k < MUESTRAS_HORA; k++ ) {
+	co2 = (int16_t) ( co2 + (int) ( ( k * 2654435761u ) >> 29 ) - 3 );
+	Globales::elHistorial.anyadir( Publicador::CO2, co2, millis() );
+	Globales::elHistorial.anyadir( Publicador::TEMPERATURA, (int16_t) ( 21 + ( k / 200 ) % 3 ), millis() );
+	delay( Loop::PERIODO_MUESTREO );
+  }
+
+  setup();
+
+  uint32_t muestras = Globales::elHistorial.numeroMuestras();
+  uint32_t enAnuncios = bloques( TramaMediciones::CAPACIDAD_BLOQUE );
+  printf( "---- historial: %u muestras (%u descartadas) en %u bytes; por anuncios son %u bloques de %u bytes,"
+		  " %.0f s ----\n",
+		  muestras, Globales::elHistorial.descartadas(), Globales::elHistorial.bytesUsados(), enAnuncios,
+		  TramaMediciones::CAPACIDAD_BLOQUE, enAnuncios * Loop::TIEMPO_POR_BLOQUE / 1000.0 );
+
+  int fallos = 0;
+  fallos += !descargar( "descarga", BLE_GATT_ATT_MTU_DEFAULT, 24, enAnuncios );
+  fallos += !descargar( "descarga", BLEGATT_ATT_MTU_MAX, 24, enAnuncios );
+  fallos += !descargar( "descarga", BLEGATT_ATT_MTU_MAX, 6, enAnuncios );
+  fallos += !cortarYReanudar();
+  fallos += !compararCursor();
+
+  printf( "%d fallos\n", fallos );
+  return fallos == 0 ? 0 : 1;
+}
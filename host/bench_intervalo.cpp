@@ -0,0 +1,149 @@
+
+/**
+ * @file bench_intervalo.cpp
+ * @brief Intervalo de anuncio fijo frente a IntervaloAdaptativo: eventos de radio y retraso.
+ *
+ * Durante 30 min virtuales se mide el CO2 cada ~1 s; la lectura da un salto de vez en cuando
+ * (de media cada 30 s) y se mantiene estable entre saltos. Cada valor nuevo se anuncia en una
+ * TramaMediciones con Publicador::anunciarMediciones(). Se compara:
+ *  - fijo:        el anuncio siempre en marcha a 62,5 ms (el intervalo de EmisoraBLE);
+ *  - adaptativo:  Publicador::acelerarAnuncio() tras cada valor nuevo y retrocesos programados
+ *                 con el Planificador, con dos intervalos máximos.
+ * Se escribe cuántos eventos de anuncio emite la radio (proporcional a su ciclo de trabajo) y el
+ * retraso desde el cambio hasta el primer y el tercer evento con el valor nuevo (un escáner no
+ * oye todos los eventos: el tercero es una cota más realista de cuándo lo ve).
+ */
+
+#include <bluefruit.h>
+
+#include "LED.h"
+#include "PuertoSerie.h"
+
+namespace Globales {
+  PuertoSerie elPuerto ( /* velocidad = */ 115200 );
+};
+
+#include "EmisoraBLE.h"
+#include "TramaMediciones.h"
+#include "IntervaloAdaptativo.h"
+#include "PoliticaPublicacion.h"
+#include "Sensores.h"
+#include "Publicador.h"
+#include "Planificador.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+  const uint32_t DURACION_MS = 30 * 60 * 1000;
+  const uint32_t PERIODO_MEDIDA_MS = 997;  // no múltiplo del intervalo, para no medir siempre en la misma fase
+
+  Publicador * elPublicador = nullptr;
+  Planificador< 4 > elPlanificador;
+  bool adaptativo = false;
+
+  uint32_t semilla = 1;
+  int16_t valor = 400;
+  uint8_t secuencia = 0;
+  std::vector< uint64_t > cambios;
+
+  uint32_t aleatorio() {
+	semilla = semilla * 1103515245 + 12345;
+	return ( semilla >> 16 ) & 0x7fff;
+  }
+
+  void retroceder() {
+	uint32_t ms = elPublicador->retrocederAnuncio();
+	if( ms > 0 ) {
+	  elPlanificador.programar( retroceder, ms );
+	}
+  }
+
+  void medir() {
+	if( aleatorio() % 30 != 0 && !cambios.empty() ) {
+	  return; // lectura estable: no hay nada nuevo que anunciar
+	}
+	valor += (int16_t) ( aleatorio() % 101 ) - 50;
+	TramaMediciones trama( secuencia++ );
+	trama.anyadir( Publicador::CO2, valor );
+	elPublicador->anunciarMediciones( trama );
+	cambios.push_back( sim::Simulador::instancia().ahoraMicros() );
+	if( adaptativo ) {
+	  elPlanificador.programar( retroceder, elPublicador->acelerarAnuncio() );
+	}
+  }
+
+  struct Resultado {
+	double eventosPorSegundo;
+	double primero_ms;
+	double primeroMaximo_ms;
+	double tercero_ms;
+	double terceroMaximo_ms;
+  };
+
+  Resultado medirModo( bool adaptativo_, const IntervaloAdaptativo & intervalo ) {
+	sim::Simulador & s = sim::Simulador::instancia();
+	s.borrarRegistro();
+	cambios.clear();
+	semilla = 1;
+	adaptativo = adaptativo_;
+
+	Publicador publicador;
+	publicador.elIntervalo = intervalo;
+	elPublicador = &publicador;
+	publicador.encenderEmisora();
+
+	uint64_t inicio = s.ahoraMicros();
+	elPlanificador.programarPeriodica( medir, PERIODO_MEDIDA_MS, 0 );
+	while( s.ahoraMicros() - inicio < DURACION_MS * 1000ULL ) {
+	  uint32_t espera = elPlanificador.ejecutarPendientes();
+	  uint64_t queda = ( inicio + DURACION_MS * 1000ULL - s.ahoraMicros() ) / 1000;
+	  delay( espera < queda ? espera : queda + 1 );
+	}
+	elPlanificador.cancelar( medir );
+	elPlanificador.cancelar( retroceder );
+
+	std::vector< uint64_t > eventos = s.instantesDeAnuncio();
+	publicador.laEmisora.detenerAnuncio();
+
+	Resultado r = { 0, 0, 0, 0, 0 };
+	r.eventosPorSegundo = eventos.size() / ( DURACION_MS / 1000.0 );
+	for( uint64_t c : cambios ) {
+	  auto p = std::lower_bound( eventos.begin(), eventos.end(), c );
+	  double primero = p == eventos.end() ? 0 : ( *p - c ) / 1000.0;
+	  double tercero = eventos.end() - p < 3 ? 0 : ( *( p + 2 ) - c ) / 1000.0;
+	  r.primero_ms += primero;
+	  r.tercero_ms += tercero;
+	  r.primeroMaximo_ms = std::max( r.primeroMaximo_ms, primero );
+	  r.terceroMaximo_ms = std::max( r.terceroMaximo_ms, tercero );
+	}
+	r.primero_ms /= cambios.size();
+	r.tercero_ms /= cambios.size();
+	return r;
+  }
+
+  void escribir( const char * nombre, const Resultado & r, const Resultado & fijo ) {
+	printf( "%-24s %7.2f eventos/s (%5.1f %%)   1er evento media %7.2f ms máx %7.2f   3er evento media %7.2f ms máx %7.2f\n",
+			nombre, r.eventosPorSegundo, 100.0 * r.eventosPorSegundo / fijo.eventosPorSegundo,
+			r.primero_ms, r.primeroMaximo_ms, r.tercero_ms, r.terceroMaximo_ms );
+  }
+
+} // namespace
+
+int main() {
+
+  printf( "---- intervalo de anuncio: %u min, una medida cada ~1 s, un cambio cada ~30 s ----\n",
+		  DURACION_MS / 60000 );
+
+  Resultado fijo = medirModo( false, IntervaloAdaptativo() );
+  Resultado a2000 = medirModo( true, IntervaloAdaptativo( 20, 2000, 300, 2, 3 ) );
+  Resultado a10240 = medirModo( true, IntervaloAdaptativo( 20, 10240, 300, 2, 3 ) );
+
+  printf( "cambios anunciados: %zu\n", cambios.size() );
+  escribir( "fijo 62,5 ms", fijo, fijo );
+  escribir( "adaptativo 20..2000 ms", a2000, fijo );
+  escribir( "adaptativo 20..10240 ms", a10240, fijo );
+
+  return 0;
+}
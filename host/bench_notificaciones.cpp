@@ -0,0 +1,156 @@
+
+/**
+ * @file bench_notificaciones.cpp
+ * @brief Caudal de notificaciones: notificarDatos() registro a registro frente a ColaNotificaciones.
+ *
+ * Un productor genera un registro de 8 bytes cada milisegundo (8000 bytes/s ofrecidos) durante
+ * 20 s virtuales, con una central conectada a 30 ms de intervalo y 3 notificaciones en la cola
+ * de la SoftDevice. Se compara:
+ *  - directo: notificarDatos() con cada registro; cuando no hay crédito, notify() bloquea;
+ *  - cola:    ColaNotificaciones::encolar() + enviar(), que junta registros hasta MTU - 3 y no
+ *             bloquea nunca (si la cola se llena, el registro se rechaza y se cuenta).
+ * con el MTU mínimo (23) y con el que suelen pedir los móviles (247).
+ *
+ * Al acabar se deja un segundo para que salga lo pendiente y se comprueba que han llegado a la
+ * central todos los registros aceptados, que la cola no ha bloqueado y que da más caudal que el
+ * envío directo; si no, el programa termina con error.
+ */
+
+#include <bluefruit.h>
+
+#include "PuertoSerie.h"
+
+namespace Globales {
+  PuertoSerie elPuerto ( /* velocidad = */ 115200 );
+};
+
+#include "EmisoraBLE.h"
+
+namespace {
+
+  const uint32_t DURACION_MS = 20000;
+  const uint8_t TAMANYO_REGISTRO = 8;
+  const uint8_t COLA_SOFTDEVICE = 3;
+
+  constexpr UUID128 UUID_SERVICIO = UUID128::deNombre( "EPSG-GTI-PROY-3A" );
+  constexpr UUID128 UUID_MEDICIONES = UUID128::deNombre( "Mediciones" );
+
+  ServicioEnEmisoraFijo< 1 > elServicio( UUID_SERVICIO );
+  ServicioEnEmisora::Caracteristica lasMediciones( UUID_MEDICIONES, CHR_PROPS_NOTIFY,
+												   SECMODE_OPEN, SECMODE_NO_ACCESS, BLEGATT_ATT_MTU_MAX - 3 );
+
+  struct Resultado {
+	uint32_t producidos;       ///< Registros que el productor llegó a generar.
+	uint32_t rechazados;       ///< Registros rechazados por la cola (contrapresión).
+	uint64_t entregados;       ///< Bytes que llegaron a la central en DURACION_MS.
+	uint64_t entregadosEnTotal; ///< Bytes que llegaron a la central, también mientras se vaciaba.
+	uint64_t notificaciones;
+	uint64_t bloqueado_us;     ///< Tiempo del productor bloqueado dentro de notify().
+  };
+
+  void registro( uint32_t i, uint8_t * r ) {
+	memcpy( r, &i, 4 );
+	r[4] = 11;
+	r[5] = (uint8_t) i;
+	r[6] = 0;
+	r[7] = 0;
+  }
+
+  /// Lo que se deja al acabar para que salga lo que quede en la cola y en la SoftDevice.
+  const uint32_t MS_VACIADO = 1000;
+
+  template< typename F, typename G >
+  Resultado medir( uint16_t mtu, F producir, G vaciar ) {
+	Bluefruit.simularConexion( 1, mtu );
+	BLEConnection & c = *Bluefruit.Connection( 1 );
+	Resultado r = { 0, 0, 0, 0, 0, 0 };
+	uint32_t inicio = millis();
+	uint32_t siguiente = inicio;
+	while( millis() - inicio < DURACION_MS ) {
+	  if( (int32_t) ( millis() - siguiente ) >= 0 ) {
+		uint8_t reg[TAMANYO_REGISTRO];
+		registro( r.producidos, reg );
+		if( !producir( reg ) ) {
+		  r.rechazados++;
+		}
+		r.producidos++;
+		siguiente += 1;
+	  } else {
+		delay( 1 );
+	  }
+	}
+	r.entregados = c.bytesEntregados;
+	r.notificaciones = c.notificacionesEntregadas;
+	r.bloqueado_us = c.tiempoBloqueado_us;
+	while( millis() - inicio < DURACION_MS + MS_VACIADO ) {
+	  vaciar();
+	  delay( 1 );
+	}
+	r.entregadosEnTotal = c.bytesEntregados;
+	Bluefruit.simularDesconexion( 0x13 );
+	return r;
+  }
+
+  int fallos = 0;
+
+  void comprobar( bool bien, const char * que, uint16_t mtu ) {
+	if( !bien ) {
+	  printf( "FALLA: %s (MTU %u)\n", que, mtu );
+	  fallos++;
+	}
+  }
+
+  /// Todos los registros aceptados han llegado a la central, y ninguno más.
+  bool completo( const Resultado & r ) {
+	return r.entregadosEnTotal == (uint64_t) ( r.producidos - r.rechazados ) * TAMANYO_REGISTRO;
+  }
+
+  void escribir( const char * nombre, uint16_t mtu, const Resultado & r ) {
+	double segundos = DURACION_MS / 1000.0;
+	printf( "%-8s MTU %3u  %8.0f bytes/s  %6llu notif.  %6u/%u registros  bloqueado %5.1f %%  rechazados %u\n",
+			nombre, mtu, r.entregados / segundos, (unsigned long long) r.notificaciones,
+			r.producidos, DURACION_MS, 100.0 * r.bloqueado_us / ( DURACION_MS * 1000.0 ), r.rechazados );
+  }
+
+} // namespace
+
+int main() {
+
+  sim::Simulador::instancia().activarRegistro( false );
+
+  EmisoraBLE laEmisora( "GTI-3A", 0x004c, 4 );
+  laEmisora.configurarNotificaciones( COLA_SOFTDEVICE );
+  laEmisora.encenderEmisora();
+  laEmisora.anyadirServicioConSusCaracteristicasYActivar( elServicio, lasMediciones );
+
+  printf( "---- notificaciones: registro de %u bytes cada ms, %u s, intervalo 30 ms, cola %u ----\n",
+		  TAMANYO_REGISTRO, DURACION_MS / 1000, COLA_SOFTDEVICE );
+
+  const uint16_t MTUS[2] = { BLE_GATT_ATT_MTU_DEFAULT, BLEGATT_ATT_MTU_MAX };
+  for( uint16_t mtu : MTUS ) {
+	Resultado directo = medir( mtu, [] ( const uint8_t * reg ) {
+	  return lasMediciones.notificarDatos( reg, TAMANYO_REGISTRO );
+	}, [] () {} );
+
+	ColaNotificaciones< 512 > laCola( lasMediciones );
+	Resultado cola = medir( mtu, [&] ( const uint8_t * reg ) {
+	  bool cabe = laCola.encolar( reg, TAMANYO_REGISTRO );
+	  laCola.enviar();
+	  return cabe;
+	}, [&] () {
+	  laCola.enviar();
+	} );
+
+	escribir( "directo", mtu, directo );
+	escribir( "cola", mtu, cola );
+	printf( "%-8s MTU %3u  %8.1fx caudal\n", "mejora", mtu, (double) cola.entregados / directo.entregados );
+
+	comprobar( completo( directo ), "directo: no han llegado todos los registros aceptados", mtu );
+	comprobar( completo( cola ), "cola: no han llegado todos los registros aceptados", mtu );
+	comprobar( cola.bloqueado_us == 0, "la cola ha bloqueado", mtu );
+	comprobar( cola.entregados > directo.entregados, "la cola no da más caudal que el envío directo", mtu );
+  }
+
+  printf( "%d fallos\n", fallos );
+  return fallos == 0 ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+
+/**
+ * @file bench_ordenes.cpp
+ * @brief Órdenes BLE por DespachadorOrdenes con el sketch entero.
+ *
+ * Se arranca el sketch con una central conectada y se escriben órdenes en la característica de
+ * órdenes del historial. Se mide:
+ *  - el tiempo de CPU de cada escritura en el callback: el despachador (buscar el código,
+ *    comprobar la longitud y leer la orden en el sitio) frente a la orden leída a mano, como hacía
+ *    DescargaHistorial::ordenRecibida(), y lo que cuesta dejar una orden DIFERIDA en la cola
+ *    frente a ejecutarla (guardar el diario en la flash, que es lo que ya no se hace en el callback);
+ *  - qué escrituras se rechazan (código desconocido, longitud que no toca);
+ *  - una ráfaga de órdenes diferidas antes de que loop() las atienda: caben las de la cola y las
+ *    demás se cuentan como perdidas;
+ *  - una descarga pedida por la característica, de principio a fin.
+ * Si se rechaza o se acepta una escritura que no toca, si la ráfaga no llena la cola justo, si
+ * algún GUARDAR_DIARIO falla o si la descarga no llega entera, el programa termina con error.
+ */
+
+#include <Arduino.h>
+
+#include "../HolaMundoIBeacon/HolaMundoIBeacon.ino"
+
+#include <chrono>
+
+namespace {
+
+  using Descarga = DescargaHistorial< Globales::Historial >;
+
+  const uint32_t REPETICIONES = 2000000;
+
+  bool fin = false;
+  uint32_t muestrasRecibidas = 0;
+
+  void recibir( const uint8_t * p, uint16_t n, uint64_t instante_us ) {
+	CodecMuestras::Muestra m[128];
+	int cuantas = CodecMuestras::decodificarBloque( p, (uint8_t) n, m, 128, (uint32_t) ( instante_us / 1000 ) );
+	if( cuantas == 0 ) {
+	  fin = true;
+	} else if( cuantas > 0 ) {
+	  muestrasRecibidas += (uint32_t) cuantas;
+	}
+  }
+
+  /// La orden leída a mano en el callback, como antes del despachador.
+  volatile uint8_t ordenAMano = 0;
+  volatile uint32_t desdeAMano = 0;
+
+  bool leerAMano( const uint8_t * datos, uint16_t tam ) {
+	if( tam == 0 ) {
+	  return false;
+	}
+	if( datos[0] == Descarga::DESCARGAR && tam >= 5 ) {
+	  desdeAMano = (uint32_t) datos[1] | ( (uint32_t) datos[2] << 8 ) | ( (uint32_t) datos[3] << 16 )
+		| ( (uint32_t) datos[4] << 24 );
+	} else if( datos[0] != Descarga::REANUDAR && datos[0] != Descarga::DETENER ) {
+	  return false;
+	}
+	ordenAMano = datos[0];
+	return true;
+  }
+
+  bool nada( void * contexto, const OrdenEscrita & orden ) {
+	return true;
+  }
+
+  template< typename F >
+  double nsPorLlamada( F f ) {
+	auto t0 = std::chrono::steady_clock::now();
+	for( uint32_t k = 0; k < REPETICIONES; k++ ) {
+	  f( k );
+	}
+	return std::chrono::duration< double, std::nano >( std::chrono::steady_clock::now() - t0 ).count() / REPETICIONES;
+  }
+
+  void medirCallback() {
+	Globales::Despachador & d = Globales::elDespachador;
+	uint8_t orden[5] = { Descarga::DETENER, 0, 0, 0, 0 };
+	uint32_t aceptadas = 0;
+
+	// DETENER y no DESCARGAR: sólo se anota, y la última que queda pendiente no empieza nada
+	double nsAMano = nsPorLlamada( [&] ( uint32_t k ) {
+	  orden[1] = (uint8_t) k;
+	  aceptadas += leerAMano( orden, 1 );
+	} );
+	orden[0] = Descarga::DESCARGAR;
+	double nsAMano5 = nsPorLlamada( [&] ( uint32_t k ) {
+	  orden[1] = (uint8_t) k;
+	  aceptadas += leerAMano( orden, 5 );
+	} );
+	orden[0] = Descarga::DETENER;
+	double nsDespachador = nsPorLlamada( [&] ( uint32_t k ) {
+	  orden[1] = (uint8_t) k;
+	  aceptadas += d.recibir( 1, orden, 1 );
+	} );
+	orden[0] = Descarga::DESCARGAR;
+	double nsDespachador5 = nsPorLlamada( [&] ( uint32_t k ) {
+	  orden[1] = (uint8_t) k;
+	  aceptadas += d.recibir( 1, orden, 5 );
+	} );
+	// la descarga anotada con DESCARGAR no se atiende: se anula antes de volver a loop()
+	uint8_t detener = Descarga::DETENER;
+	d.recibir( 1, &detener, 1 );
+
+	// una orden diferida: meterla en la cola y sacarla, con un manejador que no hace nada
+	DespachadorOrdenes< 1 > vacio;
+	vacio.anyadir( Loop::ORDEN_GUARDAR_DIARIO, 1, 1, DespachadorOrdenes< 1 >::DIFERIDA, nada, nullptr );
+	uint8_t guardar = Loop::ORDEN_GUARDAR_DIARIO;
+	uint32_t encoladas = 0;
+	double nsEncolar = nsPorLlamada( [&] ( uint32_t k ) {
+	  encoladas += vacio.recibir( 1, &guardar, 1 );
+	  if( !( k & 3 ) ) {
+		vacio.ejecutarDiferidas();
+	  }
+	} );
+
+	// lo que tarda la orden en sí, que sin la cola estaría en el callback
+	const uint32_t VECES_GUARDAR = 200;
+	auto t0 = std::chrono::steady_clock::now();
+	for( uint32_t k = 0; k < VECES_GUARDAR; k++ ) {
+	  Globales::elHistorial.anyadir( Publicador::CO2, (int16_t) ( 600 + k % 9 ), millis() );
+	  ordenGuardarDiario( nullptr, OrdenEscrita( 1, &guardar, 1 ) );
+	}
+	double usGuardar = std::chrono::duration< double, std::micro >( std::chrono::steady_clock::now() - t0 ).count()
+	  / VECES_GUARDAR;
+
+	printf( "en el callback, DETENER (1 byte):    a mano %6.1f ns   despachador %6.1f ns\n", nsAMano, nsDespachador );
+	printf( "en el callback, DESCARGAR (5 bytes): a mano %6.1f ns   despachador %6.1f ns\n", nsAMano5, nsDespachador5 );
+	printf( "orden DIFERIDA: %6.1f ns por orden encolada y sacada de la cola (%u de %u); GUARDAR_DIARIO en el"
+			" callback serían %6.1f us más la espera a la flash de verdad\n",
+			nsEncolar, encoladas, REPETICIONES, usGuardar );
+	printf( "(control %u)\n", ( aceptadas + ordenAMano + desdeAMano ) & 0xff );
+  }
+
+  bool probarRechazos() {
+	struct Prueba {
+	  const char * nombre;
+	  uint8_t bytes[6];
+	  uint8_t tam;
+	  bool rechazada;
+	};
+	const Prueba PRUEBAS[] = {
+	  { "vacía", { 0 }, 0, true },
+	  { "código desconocido", { 0x7f }, 1, true },
+	  { "DESCARGAR corta", { Descarga::DESCARGAR, 1, 2 }, 3, true },
+	  { "DESCARGAR larga", { Descarga::DESCARGAR, 1, 2, 3, 4, 5 }, 6, true },
+	  { "REANUDAR con argumentos", { Descarga::REANUDAR, 1 }, 2, true },
+	  { "DETENER", { Descarga::DETENER }, 1, false },
+	};
+	Globales::Despachador & d = Globales::elDespachador;
+	bool ok = true;
+	printf( "órdenes dadas de alta: %u;", d.numeroDeOrdenes() );
+	for( const Prueba & p : PRUEBAS ) {
+	  uint32_t antes = d.ordenesRechazadas();
+	  d.recibir( 1, p.bytes, p.tam );
+	  bool rechazada = d.ordenesRechazadas() != antes;
+	  ok = ok && rechazada == p.rechazada;
+	  printf( "  %s: %s%s", p.nombre, rechazada ? "rechazada" : "aceptada", rechazada == p.rechazada ? "" : " (MAL)" );
+	}
+	printf( "\n" );
+	return ok;
+  }
+
+  bool probarRafaga() {
+	Globales::Despachador & d = Globales::elDespachador;
+	sim::correrLoop( 100, [] () { return false; } );
+	for( uint32_t k = 0; k < 20; k++ ) {
+	  Globales::elHistorial.anyadir( Publicador::TEMPERATURA, 22, millis() );
+	}
+	uint32_t perdidasAntes = d.ordenesPerdidas();
+	uint32_t ejecutadasAntes = d.ordenesEjecutadasDiferidas();
+	uint32_t rechazadasAntes = d.ordenesRechazadas();
+	BLECharacteristic & ordenes = Globales::lasOrdenesHistorial;
+	const uint8_t RAFAGA = 10;
+	for( uint8_t k = 0; k < RAFAGA; k++ ) {
+	  uint8_t guardar = Loop::ORDEN_GUARDAR_DIARIO;
+	  ordenes.simularEscritura( Bluefruit.connHandle(), &guardar, 1 );
+	}
+	uint32_t entradasAntes = Globales::elDiario.entradasEscritas();
+	sim::correrLoop( 100, [] () { return false; } );
+	uint32_t ejecutadas = d.ordenesEjecutadasDiferidas() - ejecutadasAntes;
+	uint32_t perdidas = d.ordenesPerdidas() - perdidasAntes;
+	uint32_t fallidas = d.ordenesRechazadas() - rechazadasAntes;
+	uint32_t entradas = Globales::elDiario.entradasEscritas() - entradasAntes;
+	bool ok = ejecutadas == Globales::Despachador::CAPACIDAD_COLA
+			  && perdidas == RAFAGA - Globales::Despachador::CAPACIDAD_COLA && fallidas == 0 && entradas > 0;
+	printf( "ráfaga de %u GUARDAR_DIARIO en un evento: %u ejecutadas en loop(), %u perdidas (cola de %u), %u fallidas;"
+			" %u entradas nuevas en el diario, %u muestras perdidas  %s\n",
+			RAFAGA, ejecutadas, perdidas, Globales::Despachador::CAPACIDAD_COLA, fallidas, entradas,
+			Globales::elDiario.muestrasPerdidas(), ok ? "bien" : "MAL" );
+	return ok;
+  }
+
+  bool probarDescarga() {
+	fin = false;
+	muestrasRecibidas = 0;
+	uint8_t orden[5] = { Descarga::DESCARGAR, 0, 0, 0, 0 };
+	BLECharacteristic & ordenes = Globales::lasOrdenesHistorial;
+	uint32_t t0 = millis();
+	ordenes.simularEscritura( Bluefruit.connHandle(), orden, sizeof( orden ) );
+	sim::correrLoop( 60000, [] () { return fin; } );
+	bool completa = fin && muestrasRecibidas >= Globales::elHistorial.numeroMuestras();
+	printf( "DESCARGAR por la característica: %u muestras en %.2f s  %s\n", muestrasRecibidas,
+			( millis() - t0 ) / 1000.0, completa ? "completa" : "INCOMPLETA" );
+	return completa;
+  }
+
+} // namespace
+
+int main() {
+
+  sim::Simulador & s = sim::Simulador::instancia();
+  s.activarRegistro( false );
+
+  char plantilla[] = "/tmp/ordenes_XXXXXX";
+  std::string directorio = mkdtemp( plantilla );
+  InternalFS.simularDirectorio( directorio.c_str() );
+
+  setup();
+  sim::correrLoop( 60000, [] () { return false; } );
+  Bluefruit.simularConexion( 1, BLEGATT_ATT_MTU_MAX, 6, recibir );
+  sim::correrLoop( 1000, [] () { return !NegociacionConexion::negociando(); } );
+
+  printf( "---- órdenes BLE: %u escrituras por medida ----\n", REPETICIONES );
+  medirCallback();
+  int fallos = 0;
+  fallos += !probarRechazos();
+  fallos += !probarRafaga();
+  fallos += !probarDescarga();
+  Bluefruit.simularDesconexion( 0x13 );
+
+  InternalFS.format();
+  rmdir( directorio.c_str() );
+  printf( "%d fallos\n", fallos );
+  return fallos == 0 ? 0 : 1;
+}
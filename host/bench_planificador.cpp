@@ -0,0 +1,85 @@
+
+/**
+ * @file bench_planificador.cpp
+ * @brief Banco de pruebas del Planificador sobre el reloj virtual.
+ *
+ * Programa varias tareas periódicas con periodos distintos (como las del sketch: medición,
+ * pasos de LED, paradas de anuncio) y hace girar el bucle igual que loop(): ejecutar lo
+ * vencido y esperar hasta el siguiente plazo. Comprueba que cada tarea se ejecuta en su
+ * plazo, sin retraso y sin deriva, y mide en el ordenador el coste de cada despacho.
+ */
+
+#include <Arduino.h>
+
+#include "Planificador.h"
+
+#include <chrono>
+
+namespace {
+
+  const uint8_t NUM_TAREAS = 8;
+  const uint32_t PERIODOS[NUM_TAREAS] = { 7500, 1000, 400, 100, 2000, 3, 17, 250 };
+
+  uint32_t ejecuciones[NUM_TAREAS];
+  uint32_t ultimaEjecucion[NUM_TAREAS];
+  uint32_t errores = 0;
+
+  template< uint8_t I >
+  void tarea() {
+	uint32_t ahora = millis();
+	if( ejecuciones[I] > 0 && ahora - ultimaEjecucion[I] != PERIODOS[I] ) {
+	  errores++;
+	}
+	ultimaEjecucion[I] = ahora;
+	ejecuciones[I]++;
+  }
+
+  Planificador< NUM_TAREAS >::Tarea * const TAREAS[NUM_TAREAS] = {
+	tarea<0>, tarea<1>, tarea<2>, tarea<3>, tarea<4>, tarea<5>, tarea<6>, tarea<7>
+  };
+
+} // namespace
+
+int main() {
+
+  sim::Simulador::instancia().activarRegistro( false );
+
+  Planificador< NUM_TAREAS > elPlanificador;
+
+  for( uint8_t i = 0; i < NUM_TAREAS; i++ ) {
+	elPlanificador.programarPeriodica( TAREAS[i], PERIODOS[i] );
+  }
+
+  const uint32_t DURACION_MS = 3600UL * 1000UL;
+
+  std::chrono::steady_clock::duration cpu {};
+  uint64_t despertares = 0;
+
+  while( millis() < DURACION_MS ) {
+	auto t0 = std::chrono::steady_clock::now();
+	uint32_t espera = elPlanificador.ejecutarPendientes();
+	cpu += std::chrono::steady_clock::now() - t0;
+	despertares++;
+	delay( espera );
+  }
+
+  uint64_t total = 0;
+  for( uint8_t i = 0; i < NUM_TAREAS; i++ ) {
+	total += ejecuciones[i];
+	uint32_t esperadas = ( DURACION_MS + PERIODOS[i] - 1 ) / PERIODOS[i];
+	if( ejecuciones[i] != esperadas ) {
+	  errores++;
+	}
+  }
+
+  double ns = std::chrono::duration<double, std::nano>( cpu ).count();
+
+  printf( "---- Planificador: %u tareas, %.0f s virtuales ----\n", NUM_TAREAS, DURACION_MS / 1000.0 );
+  printf( "%-34s %10llu\n", "tareas ejecutadas", (unsigned long long) total );
+  printf( "%-34s %10llu\n", "despertares del bucle", (unsigned long long) despertares );
+  printf( "%-34s %10u ms\n", "retraso máximo sobre el plazo", elPlanificador.retrasoMaximo() );
+  printf( "%-34s %10.1f ns\n", "coste por tarea despachada", ns / total );
+  printf( "%-34s %10u\n", "plazos incumplidos", errores );
+
+  return errores == 0 ? 0 : 1;
+}
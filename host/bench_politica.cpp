@@ -0,0 +1,147 @@
+/**
+ * @file bench_politica.cpp
+ * @brief Reglas de PoliticaPublicacion: banda muerta, latido y tipos sin regla.
+ *
+ * Comprueba, con valores justo a cada lado de los límites:
+ *  - la banda absoluta y la relativa (vale la mayor), y que un cambio igual a la banda no se publique;
+ *  - con banda 0, que sólo se suprima el mismo valor;
+ *  - valores negativos (la banda relativa va con el valor absoluto) y saltos de un extremo a otro;
+ *  - el latido: nada antes de silencioMaximo_ms y una publicación justo al cumplirse, también
+ *    cuando millis() da la vuelta entre medias;
+ *  - los tipos sin regla, que siempre se publican y no cuentan como suprimidos, y que no quepan
+ *    más de MAX_IDS reglas.
+ * También mide el tiempo de CPU de hayQuePublicar() con todas las reglas configuradas.
+ * Si falla alguna comprobación, el programa termina con error.
+ */
+
+#include <Arduino.h>
+
+#include "PoliticaPublicacion.h"
+
+#include <chrono>
+
+namespace {
+
+  const uint8_t CO2 = 1;
+  const uint8_t TEMPERATURA = 2;
+  const uint8_t RUIDO = 3;
+  const uint8_t PRESION = 4;
+  const uint8_t SIN_REGLA = 9;
+
+  int fallos = 0;
+
+  void comprobar( bool bien, const char * que ) {
+	if( !bien ) {
+	  printf( "FALLA: %s\n", que );
+	  fallos++;
+	}
+  }
+
+  void probarBandas() {
+	PoliticaPublicacion< 4 > p;
+	// 10 unidades o el 2 % del último valor publicado, sin latido
+	p.configurar( CO2, 10, 20, 0 );
+	comprobar( p.hayQuePublicar( CO2, 1000, 0 ), "la primera lectura se publica" );
+	comprobar( !p.hayQuePublicar( CO2, 1020, 1 ), "relativa: un cambio igual a la banda no se publica" );
+	comprobar( p.hayQuePublicar( CO2, 1021, 2 ), "relativa: un cambio mayor que la banda se publica" );
+	comprobar( !p.hayQuePublicar( CO2, 1001, 3 ), "la banda va desde el último valor publicado" );
+	comprobar( p.hayQuePublicar( CO2, 100, 4 ), "bajada grande" );
+	comprobar( !p.hayQuePublicar( CO2, 110, 5 ), "absoluta: con valores pequeños vale la absoluta" );
+	comprobar( p.hayQuePublicar( CO2, 111, 6 ), "absoluta: un cambio mayor que la banda se publica" );
+	comprobar( p.suprimidas( CO2 ) == 3, "suprimidas de una regla" );
+
+	p.configurar( TEMPERATURA, 0, 0, 0 );
+	comprobar( p.hayQuePublicar( TEMPERATURA, 22, 0 ), "banda 0: la primera" );
+	comprobar( !p.hayQuePublicar( TEMPERATURA, 22, 1 ), "banda 0: el mismo valor no se publica" );
+	comprobar( p.hayQuePublicar( TEMPERATURA, 23, 2 ), "banda 0: cualquier cambio se publica" );
+	comprobar( p.suprimidasEnTotal() == 4, "suprimidas en total" );
+	printf( "bandas: %u suprimidas de CO2 y %u de temperatura\n", p.suprimidas( CO2 ), p.suprimidas( TEMPERATURA ) );
+  }
+
+  void probarNegativos() {
+	PoliticaPublicacion< 4 > p;
+	p.configurar( TEMPERATURA, 10, 20, 0 );
+	comprobar( p.hayQuePublicar( TEMPERATURA, -1000, 0 ), "negativos: la primera" );
+	comprobar( !p.hayQuePublicar( TEMPERATURA, -1020, 1 ), "negativos: la banda relativa va con el valor absoluto" );
+	comprobar( p.hayQuePublicar( TEMPERATURA, -1021, 2 ), "negativos: fuera de la banda relativa" );
+	comprobar( p.hayQuePublicar( TEMPERATURA, -5, 3 ), "negativos: subida" );
+	comprobar( !p.hayQuePublicar( TEMPERATURA, 5, 4 ), "negativos: cruzar el 0 dentro de la banda" );
+	comprobar( p.hayQuePublicar( TEMPERATURA, 6, 5 ), "negativos: cruzar el 0 fuera de la banda" );
+	comprobar( p.hayQuePublicar( TEMPERATURA, -32768, 6 ), "del máximo al mínimo" );
+	comprobar( p.hayQuePublicar( TEMPERATURA, 32767, 7 ), "del mínimo al máximo" );
+	comprobar( !p.hayQuePublicar( TEMPERATURA, 32767 - 655, 8 ), "la banda relativa del máximo" );
+	printf( "negativos: %u suprimidas\n", p.suprimidas( TEMPERATURA ) );
+  }
+
+  void probarLatido() {
+	const uint32_t LATIDO = 60000;
+	PoliticaPublicacion< 4 > p;
+	p.configurar( RUIDO, 3, 0, LATIDO );
+	comprobar( p.hayQuePublicar( RUIDO, 40, 1000 ), "latido: la primera" );
+	comprobar( !p.hayQuePublicar( RUIDO, 40, 1000 + LATIDO - 1 ), "latido: nada antes de silencioMaximo_ms" );
+	comprobar( p.hayQuePublicar( RUIDO, 40, 1000 + LATIDO ), "latido: justo a los silencioMaximo_ms" );
+	comprobar( !p.hayQuePublicar( RUIDO, 40, 1000 + LATIDO + 1 ), "latido: vuelve a contar desde el último" );
+
+	// millis() da la vuelta a los 49,7 días
+	const uint32_t ANTES = 0xffffffffu - 4095;
+	comprobar( p.hayQuePublicar( RUIDO, 50, ANTES ), "vuelta: publicada antes de la vuelta" );
+	comprobar( !p.hayQuePublicar( RUIDO, 50, ANTES + LATIDO / 2 ), "vuelta: nada a la mitad" );
+	comprobar( !p.hayQuePublicar( RUIDO, 50, ANTES + LATIDO - 1 ), "vuelta: nada antes del latido" );
+	comprobar( p.hayQuePublicar( RUIDO, 50, ANTES + LATIDO ), "vuelta: latido tras la vuelta" );
+
+	PoliticaPublicacion< 4 > sinLatido;
+	sinLatido.configurar( RUIDO, 3, 0, 0 );
+	sinLatido.hayQuePublicar( RUIDO, 40, 0 );
+	comprobar( !sinLatido.hayQuePublicar( RUIDO, 40, 0x7fffffff ), "sin latido no se publica nunca lo mismo" );
+	printf( "latido: %u suprimidas\n", p.suprimidas( RUIDO ) );
+  }
+
+  void probarSinRegla() {
+	PoliticaPublicacion< 2 > p;
+	comprobar( p.configurar( CO2, 10, 0, 0 ), "primera regla" );
+	comprobar( p.configurar( TEMPERATURA, 0, 0, 0 ), "segunda regla" );
+	comprobar( !p.configurar( RUIDO, 0, 0, 0 ), "no caben más de MAX_IDS reglas" );
+	comprobar( p.configurar( CO2, 20, 0, 0 ), "cambiar una regla que ya está" );
+	for( uint32_t k = 0; k < 3; k++ ) {
+	  comprobar( p.hayQuePublicar( SIN_REGLA, 7, k ), "sin regla se publica siempre" );
+	  comprobar( p.hayQuePublicar( RUIDO, 7, k ), "la regla que no cupo se publica siempre" );
+	}
+	comprobar( p.suprimidas( SIN_REGLA ) == 0 && p.suprimidasEnTotal() == 0, "sin regla no hay suprimidas" );
+
+	p.hayQuePublicar( CO2, 500, 0 );
+	comprobar( !p.hayQuePublicar( CO2, 520, 1 ), "la regla cambiada usa la banda nueva" );
+	printf( "sin regla: %u suprimidas en total\n", p.suprimidasEnTotal() );
+  }
+
+  void medir() {
+	const uint32_t REPETICIONES = 10000000;
+	PoliticaPublicacion< 4 > p;
+	p.configurar( CO2, 10, 20, 300000 );
+	p.configurar( TEMPERATURA, 0, 0, 300000 );
+	p.configurar( RUIDO, 3, 0, 300000 );
+	p.configurar( PRESION, 1, 0, 300000 );
+	uint32_t publicadas = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	for( uint32_t k = 0; k < REPETICIONES; k++ ) {
+	  // la última regla: la que más cuesta encontrar
+	  publicadas += p.hayQuePublicar( PRESION, (int16_t) ( 1013 + ( ( k * 2654435761u ) >> 30 ) ), k );
+	}
+	double ns = std::chrono::duration< double, std::nano >( std::chrono::steady_clock::now() - t0 ).count()
+	  / REPETICIONES;
+	printf( "hayQuePublicar() con 4 reglas: %.1f ns por lectura, %u de %u publicadas\n", ns, publicadas, REPETICIONES );
+  }
+
+} // namespace
+
+int main() {
+
+  printf( "---- PoliticaPublicacion ----\n" );
+  probarBandas();
+  probarNegativos();
+  probarLatido();
+  probarSinRegla();
+  medir();
+
+  printf( "%d fallos\n", fallos );
+  return fallos == 0 ? 0 : 1;
+}
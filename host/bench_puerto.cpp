@@ -0,0 +1,102 @@
+
+/**
+ * @file bench_puerto.cpp
+ * @brief Latencia de publicación con el registro por el puerto serie: Serial.print directo frente
+ * a la cola de PuertoSerie.
+ *
+ * Cada 20 ms virtuales se escriben unas 80 letras de registro (lo que escribía el sketch por ciclo
+ * con los mensajes de depuración) y se publica una medición con actualizarAnuncio(). Se mide
+ * cuánto se retrasa la publicación respecto a su plazo:
+ *  - directo: Serial.print() espera cuando el FIFO de la UART se llena;
+ *  - cola:    PuertoSerie::escribir() deja el texto en la cola, que se vacía en el tiempo libre.
+ * a 115200 y a 9600 baudios.
+ */
+
+#include <bluefruit.h>
+
+#include "PuertoSerie.h"
+
+namespace Globales {
+  PuertoSerie elPuerto ( /* velocidad = */ 115200 );
+};
+
+#include "EmisoraBLE.h"
+
+namespace {
+
+  const uint32_t PUBLICACIONES = 2000;
+  const uint32_t PERIODO_MS = 20;
+
+  constexpr UUID128 BEACON_UUID = UUID128::iBeaconDeNombre( "cholosimeonejefe" );
+
+  struct Resultado {
+	uint64_t retrasoMaximo_us = 0;
+	uint64_t retrasoTotal_us = 0;
+	uint32_t perdidos = 0;
+  };
+
+  template< typename Escribir, typename Vaciar >
+  Resultado medir( long baudios, EmisoraBLE & laEmisora, AnuncioPrecalculado & elAnuncio,
+				   Escribir escribir, Vaciar vaciar ) {
+	Serial.begin( baudios );
+	Resultado r;
+	uint64_t plazo_us = micros() + PERIODO_MS * 1000;
+	for( uint32_t i = 0; i < PUBLICACIONES; i++ ) {
+	  // tiempo libre hasta el plazo
+	  while( micros() < plazo_us ) {
+		vaciar();
+		uint64_t falta = plazo_us - micros();
+		delayMicroseconds( falta < 5000 ? (unsigned) falta : 5000 );
+	  }
+	  escribir( "\n---- ciclo: empieza ", i );
+	  escribir( "emitiriBeacon libre Bluefruit.Advertising.start(0);\n", i );
+	  escribir( "---- ciclo: acaba **** ", i );
+	  elAnuncio.cambiarMajorMinor( ( 11 << 8 ) + ( i & 0xff ), i & 0x7fff );
+	  laEmisora.actualizarAnuncio( elAnuncio );
+	  uint64_t retraso = micros() - plazo_us;
+	  r.retrasoTotal_us += retraso;
+	  if( retraso > r.retrasoMaximo_us ) {
+		r.retrasoMaximo_us = retraso;
+	  }
+	  plazo_us += PERIODO_MS * 1000;
+	}
+	return r;
+  }
+
+  void escribir( const char * nombre, long baudios, const Resultado & r ) {
+	printf( "%-8s %6ld baudios   retraso medio %8.3f ms   máximo %8.3f ms   bytes perdidos %6u\n",
+			nombre, baudios, r.retrasoTotal_us / 1000.0 / PUBLICACIONES, r.retrasoMaximo_us / 1000.0, r.perdidos );
+  }
+
+} // namespace
+
+int main() {
+
+  sim::Simulador::instancia().activarRegistro( false );
+
+  EmisoraBLE laEmisora( "GTI-3A", 0x004c, 4 );
+  laEmisora.encenderEmisora();
+  AnuncioPrecalculado elAnuncio;
+  laEmisora.prepararAnuncioIBeacon( elAnuncio, BEACON_UUID, 0, 0, -53 );
+
+  printf( "---- publicación cada %u ms con ~80 bytes de registro ----\n", PERIODO_MS );
+
+  const long BAUDIOS[2] = { 115200, 9600 };
+  for( long baudios : BAUDIOS ) {
+	Resultado directo = medir( baudios, laEmisora, elAnuncio,
+							   [] ( const char * texto, uint32_t n ) { Serial.print( texto ); Serial.print( n ); },
+							   [] () { } );
+
+	uint32_t perdidosAntes = Globales::elPuerto.bytesPerdidos();
+	Resultado cola = medir( baudios, laEmisora, elAnuncio,
+							[] ( const char * texto, uint32_t n ) { Globales::elPuerto.info( texto, n ); },
+							[] () { Globales::elPuerto.vaciar(); } );
+	cola.perdidos = Globales::elPuerto.bytesPerdidos() - perdidosAntes;
+	Globales::elPuerto.vaciarDelTodo();
+
+	escribir( "directo", baudios, directo );
+	escribir( "cola", baudios, cola );
+  }
+
+  return 0;
+}
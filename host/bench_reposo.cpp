@@ -0,0 +1,223 @@
+
+/**
+ * @file bench_reposo.cpp
+ * @brief Despertares y residencia de loop() con Reposo: holgura del Planificador y despertar por eventos.
+ *
+ * Sin conexión, durante una hora virtual, un bucle como loop() con las tareas del sketch (medir
+ * cada 2,5 s; cada 7,5 s un ciclo de publicación que anuncia unos bloques cada 500 ms y hace
+ * parpadear el LED) duerme con Reposo::dormir() hasta el siguiente plazo, con varias holguras
+ * (Planificador::ejecutarPendientes()). Cada tarea gasta algo de CPU (avanza el reloj sin
+ * dormir), así que las que se reprograman desde sí mismas se van separando de las periódicas. Se escribe cuántas veces despierta, el mayor retraso de
+ * una tarea, el tiempo en cada estado de Reposo y la corriente media que sale con un modelo
+ * sencillo del nRF52840.
+ *
+ * Después, con una central conectada, se negocia PerfilesConexion::RAPIDO mirando cada 5 ms si
+ * la central ha contestado (como hacía loop() antes de Reposo) y durmiendo hasta que un evento de
+ * la SoftDevice despierta a loop().
+ */
+
+#include <bluefruit.h>
+
+#include "LED.h"
+#include "PuertoSerie.h"
+
+namespace Globales {
+  PuertoSerie elPuerto ( /* velocidad = */ 115200 );
+};
+
+#include "EmisoraBLE.h"
+#include "Planificador.h"
+#include "Reposo.h"
+
+namespace {
+
+  const uint32_t DURACION_MS = 3600UL * 1000UL;
+
+  /// Modelo de consumo (nRF52840 con el DC/DC): System ON con el RTC, la CPU a 64 MHz, la radio a
+  /// 0 dBm y la carga de cada despertar (arrancar la CPU, el tick de FreeRTOS y volver a dormir).
+  const double UA_REPOSO = 3.0;
+  const double MA_CPU = 3.3;
+  const double MA_RADIO = 5.0;
+  const double UC_POR_DESPERTAR = 0.1;
+
+  // las tareas del sketch, sin medir ni publicar nada de verdad
+  const uint32_t PERIODO_MUESTREO = 2500;
+  const uint32_t PERIODO_CICLO = 7500;
+  const uint32_t TIEMPO_POR_BLOQUE = 500;
+  const uint8_t BLOQUES_POR_CICLO = 3;
+  const uint16_t PASOS_LUCECITAS[] = { 100, 400, 100, 400, 100, 400, 1000, 1000 };
+  const uint8_t NUM_PASOS = sizeof( PASOS_LUCECITAS ) / sizeof( PASOS_LUCECITAS[0] );
+
+  /// Microsegundos de CPU de cada tarea: medir tres sensores sobremuestreados, escribir la traza
+  /// del ciclo por el puerto serie, preparar un bloque y dárselo a la SoftDevice, encender el LED.
+  const uint32_t US_MEDIR = 2600;
+  const uint32_t US_PUBLICAR = 1800;
+  const uint32_t US_VOLCAR = 700;
+  const uint32_t US_LUCECITAS = 30;
+
+  void trabajar( uint32_t us ) {
+	sim::Simulador::instancia().avanzarMicros( us );
+  }
+
+  Planificador< 8 > elPlanificador;
+  uint8_t bloque = 0;
+  uint8_t pasoLucecitas = 0;
+  uint32_t ejecuciones = 0;
+
+  // anuncio de 30 bytes, como el iBeacon
+  const uint8_t ANUNCIO[30] = { 0x02, 0x01, 0x06, 0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15 };
+
+  void medir() {
+	ejecuciones++;
+	trabajar( US_MEDIR );
+  }
+
+  void volcar() {
+	ejecuciones++;
+	trabajar( US_VOLCAR );
+	if( bloque == 0 ) {
+	  Bluefruit.Advertising.clearData();
+	  Bluefruit.Advertising.addData( BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA, ANUNCIO, sizeof( ANUNCIO ) - 2 );
+	  Bluefruit.Advertising.start( 0 );
+	}
+	if( ++bloque < BLOQUES_POR_CICLO ) {
+	  elPlanificador.programar( volcar, TIEMPO_POR_BLOQUE );
+	  return;
+	}
+	Bluefruit.Advertising.stop();
+	bloque = 0;
+  }
+
+  void lucecitas() {
+	ejecuciones++;
+	trabajar( US_LUCECITAS );
+	uint16_t duracion = PASOS_LUCECITAS[pasoLucecitas];
+	if( ++pasoLucecitas < NUM_PASOS ) {
+	  elPlanificador.programar( lucecitas, duracion );
+	}
+  }
+
+  void publicar() {
+	ejecuciones++;
+	trabajar( US_PUBLICAR );
+	elPlanificador.programar( volcar, 0 );
+	pasoLucecitas = 0;
+	elPlanificador.programar( lucecitas, 0 );
+  }
+
+  struct Resultado {
+	uint32_t despertares;
+	uint32_t retrasoMaximo;
+	uint32_t ms[Reposo::NUMERO_DE_ESTADOS];
+	double uA;
+  };
+
+  double corrienteMedia( const uint32_t ms[], uint32_t despertares, uint32_t total_ms ) {
+	double uC = ms[Reposo::REPOSO] * UA_REPOSO / 1000.0 + ms[Reposo::ACTIVO] * MA_CPU
+	  + ms[Reposo::RADIO] * MA_RADIO + despertares * UC_POR_DESPERTAR;
+	return uC * 1000.0 / total_ms;
+  }
+
+  Resultado medirHolgura( uint32_t holgura ) {
+	elPlanificador = Planificador< 8 >();
+	Bluefruit.Advertising.stop();
+	bloque = 0;
+	ejecuciones = 0;
+	elPlanificador.programarPeriodica( medir, PERIODO_MUESTREO, 0 );
+	elPlanificador.programarPeriodica( publicar, PERIODO_CICLO, 1000 );
+	Reposo::reiniciar();
+
+	uint32_t inicio = millis();
+	while( millis() - inicio < DURACION_MS ) {
+	  Reposo::dormir( elPlanificador.ejecutarPendientes( holgura ) );
+	}
+
+	Resultado r;
+	r.despertares = Reposo::despertares();
+	r.retrasoMaximo = elPlanificador.retrasoMaximo();
+	uint32_t total = 0;
+	for( uint8_t e = 0; e < Reposo::NUMERO_DE_ESTADOS; e++ ) {
+	  r.ms[e] = Reposo::residenciaMs( (Reposo::Estado) e );
+	  total += r.ms[e];
+	}
+	r.uA = corrienteMedia( r.ms, r.despertares, total );
+	return r;
+  }
+
+  void escribir( uint32_t holgura, const Resultado & r, const Resultado & sinHolgura ) {
+	double total = r.ms[Reposo::ACTIVO] + r.ms[Reposo::REPOSO] + r.ms[Reposo::RADIO];
+	printf( "holgura %3u ms: %6u despertares (%5.1f %%)  retraso máx %3u ms   activo %6.3f %%  reposo %7.3f %%"
+			"  radio %6.3f %%  %6.2f uA\n", holgura, r.despertares, 100.0 * r.despertares / sinHolgura.despertares,
+			r.retrasoMaximo, 100.0 * r.ms[Reposo::ACTIVO] / total, 100.0 * r.ms[Reposo::REPOSO] / total,
+			100.0 * r.ms[Reposo::RADIO] / total, r.uA );
+  }
+
+  /**
+   * @brief Negocia RAPIDO con una central como Android y escribe cuánto tarda y cuántas vueltas da
+   * el bucle; con `sondeo_ms` > 0 mira cada tanto (con delay()) en lugar de dormir hasta un evento.
+   */
+  bool negociar( EmisoraBLE & emisora, const char * nombre, uint32_t sondeo_ms ) {
+	Bluefruit.simularCentral( CentralSimulada() );
+	Bluefruit.simularConexion( 1, BLEGATT_ATT_MTU_MAX, 24 );
+	emisora.negociarConexion( 1, PerfilesConexion::RAPIDO );
+	Reposo::reiniciar();
+
+	uint32_t inicio = millis();
+	uint32_t vueltas = 0;
+	bool terminada = false;
+	while( !terminada && millis() - inicio < 10000 ) {
+	  vueltas++;
+	  uint32_t espera = 1000;
+	  if( NegociacionConexion::hayTrabajo() ) {
+		NegociacionConexion::Resultado r = NegociacionConexion::atender( millis() );
+		terminada = r == NegociacionConexion::TERMINADA;
+		espera = r == NegociacionConexion::REINTENTAR ? 50 : espera;
+	  }
+	  if( terminada ) {
+		break;
+	  }
+	  if( sondeo_ms > 0 ) {
+		delay( espera < sondeo_ms ? espera : sondeo_ms );
+	  } else {
+		Reposo::dormir( espera );
+	  }
+	}
+	uint32_t ms = millis() - inicio;
+	Bluefruit.simularDesconexion( 0x13 );
+
+	printf( "%-24s %s en %4u ms, %4u vueltas del bucle\n", nombre, terminada ? "negociado" : "SIN NEGOCIAR", ms,
+			vueltas );
+	return terminada;
+  }
+
+} // namespace
+
+int main() {
+
+  sim::Simulador::instancia().activarRegistro( false );
+
+  static EmisoraBLE laEmisora( "GTI-3A", 0x004c, -12 );
+  laEmisora.configurarNotificaciones( 8, 6 );
+  laEmisora.encenderEmisora();
+  bool radio = Reposo::iniciar();
+
+  printf( "---- reposo sin conexión: %u min, tareas del sketch, notificaciones de radio %s ----\n",
+		  DURACION_MS / 60000, radio ? "sí" : "NO" );
+  const uint32_t HOLGURAS[] = { 0, 5, 20, 50, 100 };
+  Resultado sinHolgura = medirHolgura( 0 );
+  uint32_t ejecucionesSinHolgura = ejecuciones;
+  bool mismasTareas = true;
+  for( uint32_t h : HOLGURAS ) {
+	Resultado r = h == 0 ? sinHolgura : medirHolgura( h );
+	mismasTareas = mismasTareas && ejecuciones + 2 >= ejecucionesSinHolgura && ejecuciones <= ejecucionesSinHolgura + 2;
+	escribir( h, r, sinHolgura );
+  }
+  printf( "tareas ejecutadas: %u por hora con todas las holguras %s\n", ejecucionesSinHolgura,
+		  mismasTareas ? "(las mismas)" : "(DISTINTAS)" );
+
+  printf( "---- negociación de PerfilesConexion::RAPIDO con una central como Android ----\n" );
+  bool sondeo = negociar( laEmisora, "mirando cada 5 ms", 5 );
+  bool eventos = negociar( laEmisora, "despertando por eventos", 0 );
+
+  return radio && mismasTareas && sondeo && eventos ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+
+/**
+ * @file bench_sensores.cpp
+ * @brief Medir y publicar con el registro de sensores (Sensores::Todos) y escrito a mano.
+ *
+ * Se compila dos veces (ver el Makefile): sin definir nada, el ciclo de medida recorre
+ * Sensores::Todos con Medidor::medir<S>() y Publicador::anunciar<S>(), como Tareas::medir(); con
+ * -DSENSORES_A_MANO lo hace como antes del registro, con un filtro, una función de lectura y un
+ * bloque copiado por sensor. Las dos versiones miden los mismos tres sensores, guardan en un
+ * historial, consultan la banda muerta y anuncian lo que toca publicar.
+ *
+ * Cada versión escribe el tiempo por ciclo y una suma de control de lo guardado y anunciado, que
+ * tiene que coincidir entre las dos; `make bench` compara además el código con `size`.
+ */
+
+#include <bluefruit.h>
+
+#include "LED.h"
+#include "PuertoSerie.h"
+
+namespace Globales {
+  PuertoSerie elPuerto ( /* velocidad = */ 115200 );
+};
+
+#include "EmisoraBLE.h"
+#include "TramaMediciones.h"
+#include "BufferMediciones.h"
+#include "IntervaloAdaptativo.h"
+#include "PoliticaPublicacion.h"
+#include "Sensores.h"
+#include "Publicador.h"
+#include "Medidor.h"
+
+#include <chrono>
+
+namespace {
+
+  const uint32_t CICLOS = 200000;
+  const uint32_t PERIODO_MS = 2500;
+
+  Publicador * elPublicador = nullptr;
+  BufferMediciones< 2048 > elHistorial;
+  BufferMediciones< 512 > elBuffer;
+  uint32_t anunciados = 0;
+  uint32_t sumaAnunciada = 0;
+
+  void anotarAnuncio( uint8_t id, int16_t valor ) {
+	anunciados++;
+	sumaAnunciada = sumaAnunciada * 31 + id + (uint16_t) valor;
+  }
+
+#ifdef SENSORES_A_MANO
+
+  const char * const NOMBRE = "a mano";
+
+  /// El Medidor de antes del registro: un filtro y un método por sensor.
+  class MedidorAMano {
+
+	Medidor::CadenaFiltros filtroCO2;
+	Medidor::CadenaFiltros filtroTemperatura;
+	Medidor::CadenaFiltros filtroRuido;
+
+	static int16_t leerCO2() { return 235; }
+	static int16_t leerTemperatura() { return 12; }
+	static int16_t leerRuido() { return 48; }
+
+  public:
+
+	void iniciarMedidor() {
+	  filtroCO2.reiniciar();
+	  filtroTemperatura.reiniciar();
+	  filtroRuido.reiniciar();
+	}
+
+	int medirCO2() {
+	  Sondas::Ambito sonda( Sondas::MEDIR );
+	  return filtroCO2.medir( leerCO2 );
+	}
+
+	int medirTemperatura() {
+	  Sondas::Ambito sonda( Sondas::MEDIR );
+	  return filtroTemperatura.medir( leerTemperatura );
+	}
+
+	int medirRuido() {
+	  Sondas::Ambito sonda( Sondas::MEDIR );
+	  return filtroRuido.medir( leerRuido );
+	}
+  };
+
+  MedidorAMano elMedidor;
+
+  void configurarPolitica() {
+	elPublicador->laPolitica.configurar( Publicador::CO2, 10, 20, 60000 );
+	elPublicador->laPolitica.configurar( Publicador::TEMPERATURA, 0, 0, 60000 );
+	elPublicador->laPolitica.configurar( Publicador::RUIDO, 3, 0, 60000 );
+  }
+
+  __attribute__(( noinline )) void ciclo( uint32_t ahora, uint8_t contador ) {
+	int16_t co2 = elMedidor.medirCO2();
+	int16_t temperatura = elMedidor.medirTemperatura();
+	int16_t ruido = elMedidor.medirRuido();
+
+	elHistorial.anyadir( Publicador::CO2, co2, ahora );
+	elHistorial.anyadir( Publicador::TEMPERATURA, temperatura, ahora );
+	elHistorial.anyadir( Publicador::RUIDO, ruido, ahora );
+
+	if( elPublicador->laPolitica.hayQuePublicar( Publicador::CO2, co2, ahora ) ) {
+	  elBuffer.anyadir( Publicador::CO2, co2, ahora );
+	  elPublicador->anunciar< Sensores::CO2 >( co2, contador );
+	  anotarAnuncio( Publicador::CO2, co2 );
+	}
+	if( elPublicador->laPolitica.hayQuePublicar( Publicador::TEMPERATURA, temperatura, ahora ) ) {
+	  elBuffer.anyadir( Publicador::TEMPERATURA, temperatura, ahora );
+	  elPublicador->anunciar< Sensores::Temperatura >( temperatura, contador );
+	  anotarAnuncio( Publicador::TEMPERATURA, temperatura );
+	}
+	if( elPublicador->laPolitica.hayQuePublicar( Publicador::RUIDO, ruido, ahora ) ) {
+	  elBuffer.anyadir( Publicador::RUIDO, ruido, ahora );
+	  elPublicador->anunciar< Sensores::Ruido >( ruido, contador );
+	  anotarAnuncio( Publicador::RUIDO, ruido );
+	}
+  }
+
+#else
+
+  const char * const NOMBRE = "registro";
+
+  Medidor elMedidor;
+
+  void configurarPolitica() {
+	elPublicador->configurarPolitica();
+  }
+
+  struct MedirSensor {
+	uint32_t ahora;
+	uint8_t contador;
+
+	template< typename S >
+	void visitar() {
+	  int16_t valor = elMedidor.medir< S >();
+	  elHistorial.anyadir( S::ID, valor, ahora );
+	  if( elPublicador->laPolitica.hayQuePublicar( S::ID, valor, ahora ) ) {
+		elBuffer.anyadir( S::ID, valor, ahora );
+		elPublicador->anunciar< S >( valor, contador );
+		anotarAnuncio( S::ID, valor );
+	  }
+	}
+  };
+
+  __attribute__(( noinline )) void ciclo( uint32_t ahora, uint8_t contador ) {
+	MedirSensor medirSensor = { ahora, contador };
+	Sensores::Todos::paraCada( medirSensor );
+  }
+
+#endif
+
+} // namespace
+
+int main() {
+
+  sim::Simulador::instancia().activarRegistro( false );
+
+  static Publicador elPublicadorDelBench;
+  elPublicador = &elPublicadorDelBench;
+  elPublicador->encenderEmisora();
+  elMedidor.iniciarMedidor();
+  configurarPolitica();
+
+  uint32_t sumaBuffer = 0;
+  CodecMuestras::Muestra m;
+  auto t0 = std::chrono::steady_clock::now();
+  for( uint32_t k = 0; k < CICLOS; k++ ) {
+	ciclo( k * PERIODO_MS, (uint8_t) k );
+	while( elBuffer.extraer( m ) ) {
+	  sumaBuffer = sumaBuffer * 31 + m.id + (uint16_t) m.valor + m.instante;
+	}
+  }
+  double ns = std::chrono::duration< double, std::nano >( std::chrono::steady_clock::now() - t0 ).count() / CICLOS;
+
+  printf( "%-9s %u sensores: %7.1f ns por ciclo; %u anunciados, %u en el historial, %u suprimidas"
+		  " (control %08x %08x)\n", NOMBRE, Sensores::Todos::NUMERO, ns, anunciados, elHistorial.secuenciaSiguiente(),
+		  elPublicador->laPolitica.suprimidasEnTotal(), sumaAnunciada, sumaBuffer );
+  return 0;
+}
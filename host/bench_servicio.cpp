@@ -0,0 +1,94 @@
+
+/**
+ * @file bench_servicio.cpp
+ * @brief Memoria de un servicio GATT con ServicioEnEmisora (std::vector) y con ServicioEnEmisoraFijo.
+ *
+ * Se compila dos veces (ver el Makefile): sin definir nada usa ServicioEnEmisora y con
+ * -DSERVICIO_FIJO usa ServicioEnEmisoraFijo. Cada versión monta el mismo servicio con tres
+ * características, lo registra en la emisora y escribe la RAM que ocupa: el objeto más lo que
+ * pide al montón. `make bench` compara además el código de las dos imágenes con `size`.
+ *
+ * En el ordenador libstdc++ está enlazada dinámicamente; en la placa usar el montón añade también
+ * malloc/free de newlib y el código de std::vector, así que el ahorro real de flash es mayor.
+ */
+
+#include <bluefruit.h>
+
+#include "PuertoSerie.h"
+
+namespace Globales {
+  PuertoSerie elPuerto ( /* velocidad = */ 115200 );
+};
+
+#include "EmisoraBLE.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+  size_t bytesMonton = 0;
+  size_t reservas = 0;
+
+  constexpr UUID128 UUID_SERVICIO = UUID128::deNombre( "EPSG-GTI-PROY-3A" );
+  constexpr UUID128 UUID_CO2 = UUID128::deNombre( "CO2" );
+  constexpr UUID128 UUID_TEMPERATURA = UUID128::deNombre( "Temperatura" );
+  constexpr UUID128 UUID_ORDENES = UUID128::deNombre( "Ordenes" );
+
+#ifdef SERVICIO_FIJO
+  using Servicio = ServicioEnEmisoraFijo< 3 >;
+  const char * const NOMBRE = "ServicioEnEmisoraFijo< 3 >";
+#else
+  using Servicio = ServicioEnEmisora;
+  const char * const NOMBRE = "ServicioEnEmisora";
+#endif
+
+} // namespace
+
+void * operator new( size_t n ) {
+  bytesMonton += n;
+  reservas++;
+  void * p = malloc( n );
+  if( p == nullptr ) {
+	throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete( void * p ) noexcept {
+  free( p );
+}
+
+void operator delete( void * p, size_t ) noexcept {
+  free( p );
+}
+
+int main() {
+
+  sim::Simulador::instancia().activarRegistro( false );
+
+  EmisoraBLE laEmisora( "GTI-3A", 0x004c, 4 );
+  laEmisora.encenderEmisora();
+
+  size_t montonAntes = bytesMonton;
+  size_t reservasAntes = reservas;
+
+  static Servicio elServicio( UUID_SERVICIO );
+  static ServicioEnEmisora::Caracteristica laCO2( UUID_CO2, CHR_PROPS_READ | CHR_PROPS_NOTIFY,
+												  SECMODE_OPEN, SECMODE_NO_ACCESS, 20 );
+  static ServicioEnEmisora::Caracteristica laTemperatura( UUID_TEMPERATURA, CHR_PROPS_READ | CHR_PROPS_NOTIFY,
+														  SECMODE_OPEN, SECMODE_NO_ACCESS, 20 );
+  static ServicioEnEmisora::Caracteristica lasOrdenes( UUID_ORDENES, CHR_PROPS_WRITE,
+													   SECMODE_NO_ACCESS, SECMODE_OPEN, 20 );
+
+  bool ok = laEmisora.anyadirServicioConSusCaracteristicasYActivar( elServicio, laCO2, laTemperatura, lasOrdenes );
+
+  size_t monton = bytesMonton - montonAntes;
+
+  printf( "---- servicio con 3 características: %s ----\n", NOMBRE );
+  printf( "%-30s %6zu bytes\n", "objeto del servicio", sizeof( Servicio ) );
+  printf( "%-30s %6zu bytes en %zu reservas\n", "montón", monton, reservas - reservasAntes );
+  printf( "%-30s %6zu bytes\n", "RAM total del servicio", sizeof( Servicio ) + monton );
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+
+/**
+ * @file decodificar_trama.cpp
+ * @brief Decodificador en el ordenador de las TramaMediciones emitidas por la placa.
+ *
+ * Lee líneas con datos de anuncio en hexadecimal, bien una traza CSV de simular_sketch
+ * (el último campo de cada línea), bien un volcado con un anuncio por línea. En cada una busca
+ * el prefijo 4c 00 02 15 de la carga libre e intenta decodificar los 21 bytes siguientes como
+ * TramaMediciones; las tramas válidas se escriben con su secuencia y sus mediciones. Las tramas
+ * con un bloque comprimido de BufferMediciones se expanden muestra a muestra, con el instante
+ * calculado a partir de la hora de la traza.
+ *
+ * Uso: decodificar_trama [fichero]   (sin fichero lee la entrada estándar)
+ */
+
+#include <Arduino.h>
+
+#include "TramaMediciones.h"
+#include "BufferMediciones.h"
+
+#include <string>
+
+namespace {
+
+  const char * nombreMedicion( uint8_t id ) {
+	switch( id ) {
+	case 11: return "CO2";
+	case 12: return "TEMPERATURA";
+	case 13: return "RUIDO";
+	}
+	return "?";
+  }
+
+  int valorHex( char c ) {
+	if( c >= '0' && c <= '9' ) return c - '0';
+	if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+	if( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+	return -1;
+  }
+
+} // namespace
+
+int main( int argc, char * argv[] ) {
+
+  FILE * f = stdin;
+  if( argc > 1 ) {
+	f = fopen( argv[1], "r" );
+	if( f == nullptr ) {
+	  perror( argv[1] );
+	  return 1;
+	}
+  }
+
+  static const uint8_t PREFIJO[4] = { 0x4c, 0x00, 0x02, 0x15 };
+
+  char linea[1024];
+  unsigned long tramas = 0;
+  unsigned long erroneas = 0;
+
+  while( fgets( linea, sizeof( linea ), f ) != nullptr ) {
+	std::string l = linea;
+	while( !l.empty() && ( l.back() == '\n' || l.back() == '\r' ) ) {
+	  l.pop_back();
+	}
+	size_t coma = l.rfind( ',' );
+	std::string instante = coma == std::string::npos ? "" : l.substr( 0, l.find( ',' ) );
+	std::string hex = coma == std::string::npos ? l : l.substr( coma + 1 );
+
+	uint8_t bytes[256];
+	size_t n = 0;
+	bool esHex = hex.size() % 2 == 0;
+	for( size_t i = 0; esHex && i + 1 < hex.size() && n < sizeof( bytes ); i += 2 ) {
+	  int a = valorHex( hex[i] );
+	  int b = valorHex( hex[i + 1] );
+	  esHex = a >= 0 && b >= 0;
+	  bytes[n++] = (uint8_t) ( a * 16 + b );
+	}
+	if( !esHex ) {
+	  continue;
+	}
+
+	for( size_t i = 0; i + 4 + TramaMediciones::TAMANYO <= n; i++ ) {
+	  if( memcmp( &bytes[i], PREFIJO, 4 ) != 0 ) {
+		continue;
+	  }
+	  const uint8_t * trama = &bytes[i + 4];
+	  int version = TramaMediciones::version( trama, TramaMediciones::TAMANYO );
+
+	  if( version == TramaMediciones::VERSION_BLOQUE ) {
+		CodecMuestras::Muestra m[TramaMediciones::CAPACIDAD_BLOQUE];
+		uint32_t recepcion = (uint32_t) ( strtoull( instante.c_str(), nullptr, 10 ) / 1000 );
+		int cuantas = CodecMuestras::decodificarBloque( TramaMediciones::bloque( (uint8_t *) trama ),
+														TramaMediciones::CAPACIDAD_BLOQUE, m,
+														TramaMediciones::CAPACIDAD_BLOQUE, recepcion );
+		if( cuantas < 0 ) {
+		  erroneas++;
+		  break;
+		}
+		tramas++;
+		for( int k = 0; k < cuantas; k++ ) {
+		  printf( "%s%smuestra %5u  t=%u ms  %s(%u)=%d\n", instante.c_str(), instante.empty() ? "" : " us  ",
+				  m[k].secuencia, m[k].instante, nombreMedicion( m[k].id ), m[k].id, m[k].valor );
+		}
+		break;
+	  }
+
+	  uint8_t secuencia;
+	  TramaMediciones::Medicion m[TramaMediciones::MAX_MEDICIONES];
+	  int cuantas = TramaMediciones::decodificar( trama, TramaMediciones::TAMANYO, secuencia, m );
+	  if( cuantas < 0 ) {
+		// puede ser un iBeacon normal o una carga libre de otro tipo
+		erroneas++;
+		break;
+	  }
+	  tramas++;
+	  printf( "%s%ssecuencia %3u", instante.c_str(), instante.empty() ? "" : " us  ", secuencia );
+	  for( int k = 0; k < cuantas; k++ ) {
+		printf( "  %s(%u)=%d", nombreMedicion( m[k].id ), m[k].id, m[k].valor );
+	  }
+	  printf( "\n" );
+	  break;
+	}
+  }
+
+  fprintf( stderr, "%lu tramas decodificadas, %lu anuncios con el prefijo que no eran tramas válidas\n",
+		   tramas, erroneas );
+
+  if( f != stdin ) {
+	fclose( f );
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+
+/**
+ * @file decodificar_trazas.cpp
+ * @brief Decodificador en el ordenador de las trazas binarias de PuertoSerie (TRAZAS_BINARIAS = 1).
+ *
+ * Lee lo que sale por el puerto serie de la placa y escribe el texto de cada registro de traza
+ * con la tabla de HolaMundoIBeacon/TablaTrazas.h, la misma con la que se compiló el firmware.
+ * Lo que no es un registro (lo escrito con PuertoSerie::escribir()) pasa tal cual. Al final
+ * escribe en stderr los bytes recibidos frente a los que habría ocupado el texto.
+ *
+ * Uso: decodificar_trazas [--nombres] [fichero]   (sin fichero lee la entrada estándar)
+ *   --nombres  antepone a cada traza su identificador, p. ej. [CICLO_EMPIEZA]
+ *
+ * Ejemplo: build/simular_sketch_trazas --eco | build/decodificar_trazas
+ */
+
+#include <Arduino.h>
+
+#include "PuertoSerie.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+  struct Entrada {
+	uint8_t nivel;
+	const char * nombre;
+	const char * formato;
+  };
+
+  const Entrada TABLA[] = {
+#define TRAZA( nivel, identificador, texto ) { NIVEL_REGISTRO_##nivel, #identificador, texto },
+#include "TablaTrazas.h"
+#undef TRAZA
+  };
+
+  const size_t NUMERO_DE_TRAZAS = sizeof( TABLA ) / sizeof( TABLA[0] );
+
+  static_assert( NUMERO_DE_TRAZAS == (size_t) Trazas::Id::NUMERO_DE_TRAZAS, "tabla de trazas distinta" );
+
+  void poner( const char * p, size_t n ) {
+	fwrite( p, 1, n, stdout );
+  }
+
+} // namespace
+
+int main( int argc, char * argv[] ) {
+
+  bool nombres = false;
+  FILE * f = stdin;
+  for( int i = 1; i < argc; i++ ) {
+	std::string a = argv[i];
+	if( a == "--nombres" ) {
+	  nombres = true;
+	} else if( f == stdin && a[0] != '-' ) {
+	  f = fopen( argv[i], "rb" );
+	  if( f == nullptr ) {
+		perror( argv[i] );
+		return 1;
+	  }
+	} else {
+	  fprintf( stderr, "uso: %s [--nombres] [fichero]\n", argv[0] );
+	  return 2;
+	}
+  }
+
+  std::vector< uint8_t > bytes;
+  uint8_t bloque[4096];
+  size_t leidos;
+  while( ( leidos = fread( bloque, 1, sizeof( bloque ), f ) ) > 0 ) {
+	bytes.insert( bytes.end(), bloque, bloque + leidos );
+  }
+
+  unsigned long registros = 0;
+  unsigned long erroneos = 0;
+  unsigned long bytesRegistros = 0;
+  unsigned long bytesTexto = 0;
+
+  size_t i = 0;
+  while( i < bytes.size() ) {
+	// texto normal hasta la siguiente marca
+	size_t marca = i;
+	while( marca < bytes.size() && bytes[marca] != Trazas::MARCA ) {
+	  marca++;
+	}
+	poner( (const char *) &bytes[i], marca - i );
+	i = marca;
+	if( i == bytes.size() ) {
+	  break;
+	}
+
+	// registro: marca, número de traza y sus valores
+	size_t j = i + 1;
+	bool valido = j < bytes.size() && bytes[j] < NUMERO_DE_TRAZAS;
+	const Entrada * e = valido ? &TABLA[bytes[j++]] : nullptr;
+	int32_t valores[256];
+	uint8_t n = valido ? Trazas::contarValores( e->formato ) : 0;
+	for( uint8_t k = 0; valido && k < n; k++ ) {
+	  uint8_t usados = Trazas::decodificarValor( &bytes[j], bytes.size() - j, valores[k] );
+	  valido = usados > 0;
+	  j += usados;
+	}
+	if( !valido ) {
+	  // no es un registro: la marca sale como un byte más
+	  erroneos++;
+	  poner( (const char *) &bytes[i], 1 );
+	  i++;
+	  continue;
+	}
+
+	if( nombres ) {
+	  printf( "[%s] ", e->nombre );
+	}
+	Trazas::expandir( e->formato, valores, [&] ( const char * p, size_t m ) {
+	  poner( p, m );
+	  bytesTexto += m;
+	} );
+	registros++;
+	bytesRegistros += j - i;
+	i = j;
+  }
+
+  fflush( stdout );
+  fprintf( stderr, "---- %lu trazas en %lu bytes (%lu bytes como texto, %.1fx); %lu marcas sueltas ----\n",
+		   registros, bytesRegistros, bytesTexto,
+		   bytesRegistros > 0 ? (double) bytesTexto / bytesRegistros : 0.0, erroneos );
+
+  return 0;
+}
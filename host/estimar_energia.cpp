@@ -0,0 +1,419 @@
+
+/**
+ * @file estimar_energia.cpp
+ * @brief Tiempo en el aire, eventos de anuncio y carga del ciclo de publicación del sketch.
+ *
+ * Recorre los tramos de anuncio (de un ANUNCIO_START al siguiente START o STOP) de una ejecución
+ * del sketch sobre el simulador o de una traza CSV de simular_sketch. De cada tramo toma el
+ * intervalo, la longitud de los datos y la potencia de Bluefruit.setTxPower(), y calcula los
+ * eventos de anuncio y sus paquetes con el modelo de la capa de enlace del simulador
+ * (PaquetesEventoAnuncio: clásico hasta 31 bytes, extendido en 1M por encima). La carga de cada
+ * evento sale de un modelo sencillo del nRF52840 con el DC/DC:
+ *  - cada paquete: el arranque de la radio y su tiempo en el aire, con la corriente de emisión de
+ *    la potencia del tramo (interpolada en la tabla de la hoja de datos);
+ *  - el anuncio es conectable: tras cada ADV_IND (o tras el AUX_ADV_IND) la radio escucha;
+ *  - por evento, la CPU de la SoftDevice y el arranque del HFXO;
+ *  - el resto del tiempo, el reposo con el RTC.
+ *
+ * El informe es una línea `clave valor unidad` por cifra, con los decimales fijos: al ser un reloj
+ * virtual sale igual en cada ejecución y se puede comparar con `diff` entre versiones del
+ * firmware. Con `--comparar` se lee un informe anterior y se termina con error si alguna carga
+ * (por ciclo, por medición, por llamada a loop()...) sube más que la tolerancia.
+ *
+ * Las cifras de las conexiones no están: las da bench_conexion.
+ *
+ * Uso: estimar_energia [--segundos S] [--dbm P] [--mah C] [--traza salida.csv]
+ *                      [--comparar informe.txt] [--tolerancia %] [traza.csv]
+ *   sin traza.csv ejecuta el sketch S segundos virtuales desde el arranque (900 por omisión) y
+ *   añade las cifras por llamada a loop() y por medición tomada, que no están en una traza;
+ *   con traza.csv, S es la duración (si no, la hora del último evento; una traza de simular_sketch
+ *   sigue hasta --segundos más lo que tarda setup());
+ *   --dbm  potencia en lugar de la del firmware o la de la traza.
+ */
+
+#include <Arduino.h>
+
+#include "../HolaMundoIBeacon/HolaMundoIBeacon.ino"
+#include "pasarela/DecodificadorAnuncios.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+  constexpr UUID128 BEACON_UUID = UUID128::iBeaconDeNombre( "cholosimeonejefe" );
+
+  /// Modelo de consumo (nRF52840 con el DC/DC a 3 V), como en bench_conexion y bench_reposo.
+  const double UA_REPOSO = 3.0;
+  const double MA_RECEPCION = 4.6;
+  const double UC_POR_EVENTO = 1.5;
+  const double UC_POR_DESPERTAR = 0.1;
+  const uint32_t US_ARRANQUE_RADIO = 140;   ///< De TXEN a READY, por paquete.
+  const uint32_t US_ESCUCHA = 190;          ///< T_IFS y una dirección de acceso, esperando un SCAN_REQ o un CONNECT_IND.
+
+  /// Corriente de emisión (mA) por potencia (dBm), aproximada, de la hoja de datos.
+  struct PuntoEmision {
+	int8_t dbm;
+	double mA;
+  };
+  const PuntoEmision EMISION[] = {
+	{ -40, 2.3 }, { -20, 2.7 }, { -16, 2.9 }, { -12, 3.1 }, { -8, 3.3 }, { -4, 3.8 }, { 0, 4.8 }, { 4, 9.6 }, { 8, 14.8 }
+  };
+  const uint8_t NUM_PUNTOS = sizeof( EMISION ) / sizeof( EMISION[0] );
+
+  double corrienteEmision( int8_t dbm ) {
+	if( dbm <= EMISION[0].dbm ) {
+	  return EMISION[0].mA;
+	}
+	for( uint8_t k = 1; k < NUM_PUNTOS; k++ ) {
+	  if( dbm <= EMISION[k].dbm ) {
+		const PuntoEmision & a = EMISION[k - 1];
+		const PuntoEmision & b = EMISION[k];
+		return a.mA + ( b.mA - a.mA ) * ( dbm - a.dbm ) / ( b.dbm - a.dbm );
+	  }
+	}
+	return EMISION[NUM_PUNTOS - 1].mA;
+  }
+
+  /// Hueco sin radio a partir del cual un START empieza otro ciclo de publicación (como simular_sketch).
+  const uint64_t US_ENTRE_CICLOS = 50000;
+
+  /// Lo que suman los tramos de anuncio.
+  struct Anuncios {
+	uint64_t tramos = 0;
+	uint64_t ciclos = 0;
+	uint64_t eventos = 0;
+	uint64_t paquetes = 0;
+	uint64_t extendidos = 0;      ///< Eventos con anuncio extendido.
+	uint64_t intervalo_us = 0;    ///< Suma de intervalo x eventos, para la media.
+	uint64_t bytes = 0;           ///< Suma de longitud x eventos.
+	uint64_t anunciando_us = 0;
+	uint64_t aire_us = 0;
+	uint64_t radio_us = 0;        ///< Aire, arranques y escuchas.
+	uint64_t mediciones = 0;      ///< Mediciones en los anuncios (cada carga distinta una vez).
+	double uC = 0;
+	int8_t dbm = 0;               ///< La última potencia.
+  };
+
+  /**
+   * @brief Recorre los eventos del registro (o de una traza) y suma los tramos hasta `fin_us`.
+   *
+   * @param dbmFijo Potencia para todos los tramos; INT8_MIN para usar la de los eventos POTENCIA.
+   */
+  Anuncios recorrerAnuncios( const std::vector< sim::Evento > & eventos, uint64_t fin_us, int dbmFijo ) {
+	Pasarela::DecodificadorAnuncios decodificador( BEACON_UUID.bytes );
+	Anuncios r;
+	r.dbm = dbmFijo != INT8_MIN ? (int8_t) dbmFijo : 0;
+	bool enAire = false;
+	uint64_t inicio = 0;
+	uint64_t ultimoStop = 0;
+	uint32_t intervalo = 1;
+	uint8_t longitud = 0;
+	std::vector< uint8_t > ultimaCarga;
+
+	auto cerrar = [&] ( uint64_t fin ) {
+	  if( !enAire ) {
+		return;
+	  }
+	  uint64_t n = 1 + ( fin > inicio ? ( fin - inicio - 1 ) / intervalo : 0 );
+	  PaquetesEventoAnuncio p = longitud <= BLE_GAP_ADV_SET_DATA_SIZE_MAX
+		? PaquetesEventoAnuncio::clasico( longitud )
+		: PaquetesEventoAnuncio::extendido( longitud, BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_1MBPS );
+	  uint8_t paquetes = (uint8_t) ( p.primarios + p.secundarios );
+	  uint8_t escuchas = p.secundarios > 0 ? 1 : p.primarios;
+	  uint32_t emitiendo_us = p.aire_us + paquetes * US_ARRANQUE_RADIO;
+	  double uC = emitiendo_us * corrienteEmision( r.dbm ) / 1000.0 + escuchas * US_ESCUCHA * MA_RECEPCION / 1000.0
+		+ UC_POR_EVENTO;
+
+	  r.tramos++;
+	  r.eventos += n;
+	  r.paquetes += n * paquetes;
+	  r.extendidos += p.secundarios > 0 ? n : 0;
+	  r.intervalo_us += n * intervalo;
+	  r.bytes += n * longitud;
+	  r.anunciando_us += fin - inicio;
+	  r.aire_us += n * p.aire_us;
+	  r.radio_us += n * ( emitiendo_us + escuchas * US_ESCUCHA );
+	  r.uC += n * uC;
+	};
+
+	for( const sim::Evento & e : eventos ) {
+	  if( e.tiempo_us > fin_us ) {
+		break;
+	  }
+	  switch( e.tipo ) {
+	  case sim::TipoEvento::POTENCIA:
+		if( dbmFijo == INT8_MIN ) {
+		  r.dbm = (int8_t) e.valor;
+		}
+		break;
+	  case sim::TipoEvento::ANUNCIO_START:
+		cerrar( e.tiempo_us );
+		if( !enAire && ( r.ciclos == 0 || e.tiempo_us - ultimoStop >= US_ENTRE_CICLOS ) ) {
+		  r.ciclos++;
+		}
+		enAire = true;
+		inicio = e.tiempo_us;
+		intervalo = e.valor > 0 ? e.valor : 1;
+		longitud = e.longitud;
+		if( ultimaCarga.size() != e.longitud || memcmp( ultimaCarga.data(), e.datos, e.longitud ) != 0 ) {
+		  ultimaCarga.assign( e.datos, e.datos + e.longitud );
+		  r.mediciones += decodificador.decodificarDatos( e.datos, e.longitud, nullptr, 127,
+														  [] ( const Pasarela::Medicion & ) {} );
+		}
+		break;
+	  case sim::TipoEvento::ANUNCIO_STOP:
+		cerrar( e.tiempo_us );
+		enAire = false;
+		ultimoStop = e.tiempo_us;
+		break;
+	  default:
+		break;
+	  }
+	}
+	cerrar( fin_us );
+	return r;
+  }
+
+  /// Una línea del informe.
+  struct Linea {
+	std::string clave;
+	double valor;
+  };
+
+  std::vector< Linea > lineas;
+
+  void escribir( const char * clave, double valor, const char * unidad, int decimales = 3 ) {
+	printf( "%-28s %16.*f%s%s\n", clave, decimales, valor, unidad[0] != 0 ? " " : "", unidad );
+	lineas.push_back( { clave, valor } );
+  }
+
+  /// Las cifras que no pueden subir sin avisar: las cargas y la corriente media.
+  bool vigilada( const std::string & clave ) {
+	const std::string CARGA = ".carga";
+	return clave == "total.corriente_media"
+	  || ( clave.size() > CARGA.size() && clave.compare( clave.size() - CARGA.size(), CARGA.size(), CARGA ) == 0 );
+  }
+
+  /**
+   * @brief Compara las cifras vigiladas con las de un informe anterior (por stderr).
+   *
+   * @return false si alguna sube más de `tolerancia` por ciento, o si no se puede leer el informe.
+   */
+  bool comparar( const char * fichero, double tolerancia ) {
+	FILE * f = fopen( fichero, "r" );
+	if( f == nullptr ) {
+	  perror( fichero );
+	  return false;
+	}
+	bool bien = true;
+	char linea[256];
+	char clave[64];
+	double antes;
+	while( fgets( linea, sizeof( linea ), f ) != nullptr ) {
+	  if( linea[0] == '#' || sscanf( linea, "%63s %lf", clave, &antes ) != 2 || !vigilada( clave ) ) {
+		continue;
+	  }
+	  for( const Linea & l : lineas ) {
+		if( l.clave != clave ) {
+		  continue;
+		}
+		double cambio = antes > 0 ? 100.0 * ( l.valor - antes ) / antes : 0;
+		bool sube = cambio > tolerancia;
+		bien = bien && !sube;
+		fprintf( stderr, "%-28s %16.3f -> %16.3f  %+7.1f %%%s\n", clave, antes, l.valor, cambio,
+				 sube ? "  SUBE" : "" );
+	  }
+	}
+	fclose( f );
+	fprintf( stderr, "comparado con %s (tolerancia %.1f %%): %s\n", fichero, tolerancia, bien ? "bien" : "MAL" );
+	return bien;
+  }
+
+  int valorHex( char c ) {
+	if( c >= '0' && c <= '9' ) return c - '0';
+	if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+	if( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+	return -1;
+  }
+
+  /**
+   * @brief Lee una traza CSV de simular_sketch (tiempo_us,evento,valor,datos).
+   */
+  bool leerTraza( const char * fichero, std::vector< sim::Evento > & eventos ) {
+	FILE * f = fopen( fichero, "r" );
+	if( f == nullptr ) {
+	  perror( fichero );
+	  return false;
+	}
+	char linea[1024];
+	char nombre[32];
+	unsigned long long tiempo;
+	unsigned long valor;
+	int leidos;
+	while( fgets( linea, sizeof( linea ), f ) != nullptr ) {
+	  if( sscanf( linea, "%llu,%31[^,],%lu,%n", &tiempo, nombre, &valor, &leidos ) != 3 ) {
+		continue;  // la cabecera
+	  }
+	  sim::Evento e;
+	  e.tiempo_us = tiempo;
+	  e.valor = (uint32_t) valor;
+	  e.longitud = 0;
+	  bool conocido = false;
+	  for( uint8_t t = 0; t <= (uint8_t) sim::TipoEvento::POTENCIA && !conocido; t++ ) {
+		e.tipo = (sim::TipoEvento) t;
+		conocido = strcmp( nombre, sim::nombreEvento( e.tipo ) ) == 0;
+	  }
+	  if( !conocido ) {
+		continue;
+	  }
+	  for( const char * p = linea + leidos; e.longitud < sizeof( e.datos ); p += 2 ) {
+		int alto = valorHex( p[0] );
+		int bajo = alto < 0 ? -1 : valorHex( p[1] );
+		if( bajo < 0 ) {
+		  break;
+		}
+		e.datos[e.longitud++] = (uint8_t) ( alto * 16 + bajo );
+	  }
+	  eventos.push_back( e );
+	}
+	fclose( f );
+	return true;
+  }
+
+} // namespace
+
+int main( int argc, char * argv[] ) {
+
+  double segundos = -1;
+  int dbm = INT8_MIN;
+  double mah = 1000;
+  double tolerancia = 10;
+  const char * ficheroTraza = nullptr;
+  const char * salidaTraza = nullptr;
+  const char * referencia = nullptr;
+
+  for( int i = 1; i < argc; i++ ) {
+	std::string a = argv[i];
+	if( a == "--segundos" && i + 1 < argc ) {
+	  segundos = atof( argv[++i] );
+	} else if( a == "--dbm" && i + 1 < argc ) {
+	  dbm = atoi( argv[++i] );
+	} else if( a == "--mah" && i + 1 < argc ) {
+	  mah = atof( argv[++i] );
+	} else if( a == "--traza" && i + 1 < argc ) {
+	  salidaTraza = argv[++i];
+	} else if( a == "--comparar" && i + 1 < argc ) {
+	  referencia = argv[++i];
+	} else if( a == "--tolerancia" && i + 1 < argc ) {
+	  tolerancia = atof( argv[++i] );
+	} else if( a[0] != '-' && ficheroTraza == nullptr ) {
+	  ficheroTraza = argv[i];
+	} else {
+	  fprintf( stderr, "uso: %s [--segundos S] [--dbm P] [--mah C] [--traza salida.csv] [--comparar informe.txt]"
+			   " [--tolerancia %%] [traza.csv]\n", argv[0] );
+	  return 2;
+	}
+  }
+
+  sim::Simulador & s = sim::Simulador::instancia();
+  std::vector< sim::Evento > deLaTraza;
+  uint64_t fin = segundos > 0 ? (uint64_t) ( segundos * 1e6 ) : 0;
+  uint64_t loops = 0;
+
+  if( ficheroTraza != nullptr ) {
+	if( !leerTraza( ficheroTraza, deLaTraza ) ) {
+	  return 1;
+	}
+	if( segundos <= 0 && !deLaTraza.empty() ) {
+	  fin = deLaTraza.back().tiempo_us;
+	}
+  } else {
+	// una placa recién estrenada: sin el diario de otras ejecuciones en build/flash
+	char plantilla[] = "/tmp/energia_XXXXXX";
+	std::string directorio = mkdtemp( plantilla );
+	InternalFS.simularDirectorio( directorio.c_str() );
+
+	fin = segundos > 0 ? fin : 900000000ULL;
+	setup();
+	while( s.ahoraMicros() < fin ) {
+	  uint64_t antes = s.ahoraMicros();
+	  loop();
+	  loops++;
+	  if( s.ahoraMicros() == antes ) {
+		s.avanzarMicros( 1000 );
+	  }
+	}
+	if( s.radioEstaAnunciando() ) {
+	  Bluefruit.Advertising.stop();
+	}
+	InternalFS.format();
+	rmdir( directorio.c_str() );
+	if( salidaTraza != nullptr ) {
+	  FILE * f = fopen( salidaTraza, "w" );
+	  if( f == nullptr ) {
+		perror( salidaTraza );
+		return 1;
+	  }
+	  s.volcarTraza( f );
+	  fclose( f );
+	}
+  }
+
+  const std::vector< sim::Evento > & eventos = ficheroTraza != nullptr ? deLaTraza : s.eventos();
+  Anuncios a = recorrerAnuncios( eventos, fin, dbm );
+
+  double segundosTotales = fin / 1e6;
+  double uCReposo = ( fin - ( a.radio_us < fin ? a.radio_us : fin ) ) * UA_REPOSO / 1e6;
+  double uCTotal = a.uC + uCReposo;
+  double uA = uCTotal / segundosTotales;
+  double ciclos = a.ciclos > 0 ? a.ciclos : 1;
+  double numEventos = a.eventos > 0 ? a.eventos : 1;
+
+  printf( "# estimar_energia: %.3f s, %+d dBm, modelo nRF52840 con DC/DC\n", segundosTotales, a.dbm );
+  escribir( "duracion", segundosTotales, "s" );
+  escribir( "potencia", a.dbm, "dBm", 0 );
+  escribir( "potencia.corriente", corrienteEmision( a.dbm ), "mA" );
+  escribir( "anuncio.tramos", a.tramos, "", 0 );
+  escribir( "anuncio.eventos", a.eventos, "", 0 );
+  escribir( "anuncio.extendidos", a.extendidos, "", 0 );
+  escribir( "anuncio.paquetes", a.paquetes, "", 0 );
+  escribir( "anuncio.intervalo_medio", a.intervalo_us / numEventos / 1000.0, "ms" );
+  escribir( "anuncio.bytes_medios", (double) a.bytes / numEventos, "B", 1 );
+  escribir( "anuncio.anunciando", a.anunciando_us / 1000.0, "ms" );
+  escribir( "anuncio.aire", a.aire_us / 1000.0, "ms" );
+  escribir( "anuncio.radio", a.radio_us / 1000.0, "ms" );
+  escribir( "evento.aire", a.aire_us / numEventos, "us" );
+  escribir( "evento.carga", a.uC / numEventos, "uC" );
+  escribir( "ciclos", a.ciclos, "", 0 );
+  escribir( "ciclo.eventos", a.eventos / ciclos, "" );
+  escribir( "ciclo.aire", a.aire_us / ciclos / 1000.0, "ms" );
+  escribir( "ciclo.carga", a.uC / ciclos, "uC" );
+  escribir( "mediciones_anunciadas", a.mediciones, "", 0 );
+  escribir( "medicion_anunciada.carga", a.mediciones > 0 ? a.uC / a.mediciones : 0, "uC" );
+  escribir( "anuncio.carga", a.uC, "uC" );
+  escribir( "reposo.carga", uCReposo, "uC" );
+  escribir( "total.carga", uCTotal, "uC" );
+  escribir( "total.corriente_media", uA, "uA" );
+  escribir( "hora.carga", uA * 3600.0 / 1000.0, "mC" );
+  escribir( "bateria.capacidad", mah, "mAh", 0 );
+  escribir( "bateria.duracion", mah * 1000.0 / uA / 24.0, "dias", 1 );
+
+  if( ficheroTraza == nullptr ) {
+	// con el sketch en marcha se sabe además cuántas veces ha girado loop() y cuánto ha medido
+	double uCDespertares = Reposo::despertares() * UC_POR_DESPERTAR;
+	double tomadas = Globales::elHistorial.secuenciaSiguiente();
+	escribir( "loop.llamadas", loops, "", 0 );
+	escribir( "loop.despertares", Reposo::despertares(), "", 0 );
+	escribir( "loop.despertares.carga", uCDespertares, "uC" );
+	escribir( "loop.carga", loops > 0 ? ( uCTotal + uCDespertares ) / loops : 0, "uC" );
+	escribir( "loop.mediciones_tomadas", tomadas, "", 0 );
+	escribir( "loop.medicion_tomada.carga", tomadas > 0 ? ( uCTotal + uCDespertares ) / tomadas : 0, "uC" );
+  }
+
+  if( referencia != nullptr && !comparar( referencia, tolerancia ) ) {
+	return 1;
+  }
+  return 0;
+}
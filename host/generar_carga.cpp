@@ -0,0 +1,452 @@
+
+/**
+ * @file generar_carga.cpp
+ * @brief Generador de carga para pasarelas: miles de Publicador virtuales anunciando a la vez.
+ *
+ * Cada placa virtual es un Publicador de verdad (con su EmisoraBLE y sus AnuncioPrecalculado)
+ * sobre el Bluefruit simulado; los bytes de cada anuncio son los que le llegan a la radio
+ * simulada. Cada placa repite su ciclo de publicación cada PERIODO (con una deriva de reloj de
+ * hasta ±0,5 %): las de iBeacon anuncian el CO2 la primera mitad y la temperatura la segunda,
+ * con el mismo contador, como loop(); las de trama anuncian las dos en una TramaMediciones.
+ * Mientras un valor está en el aire hay un evento de anuncio por intervalo de EmisoraBLE más el
+ * retraso aleatorio de 0 a 10 ms que añade BLE a cada evento.
+ *
+ * Las placas se reparten en grupos de --por-escaner, cada uno al alcance de un escáner que
+ * escucha en un canal (miles de placas no caben en el aire de un solo escáner: con el intervalo
+ * de 62,5 ms, 20 placas ya lo ocupan un 11 %). Cada escáner pierde:
+ *  - los paquetes de su grupo que se solapan en el aire (colisiones), si no se pone --sin-colisiones;
+ *  - un porcentaje al azar (--perdidas), por alcance o por interferencias.
+ * Todos entregan a la misma pasarela, que ve un único flujo de eventos HCI «LE Advertising
+ * Report» (ordenado por tiempo en cada escáner), con un ruido de ±--jitter ms en la marca de tiempo. Al final se escriben las secuencias que no ha
+ * recibido ninguna vez, la referencia con la que comparar un receptor (p. ej. Pasarela::Agregador).
+ *
+ * Salidas (se pueden combinar):
+ *   --h4 fichero         flujo H4 sin tiempos (lo que leen DecodificadorAnuncios y bench_decodificador)
+ *   --btsnoop fichero    btsnoop con marca de tiempo (Wireshark), tiempo simulado desde 1970
+ *   --udp puerto         un datagrama por evento HCI a 127.0.0.1:puerto (--tiempo-real: a su ritmo)
+ *
+ * Uso: generar_carga [--emisores N] [--por-escaner N] [--segundos S] [--periodo ms] [--tramas %]
+ *                    [--perdidas %] [--jitter ms] [--sin-colisiones] [--semilla N] [salidas...]
+ */
+
+#include <bluefruit.h>
+
+#include "LED.h"
+#include "PuertoSerie.h"
+
+namespace Globales {
+  PuertoSerie elPuerto ( /* velocidad = */ 115200 );
+};
+
+#include "EmisoraBLE.h"
+#include "TramaMediciones.h"
+#include "IntervaloAdaptativo.h"
+#include "PoliticaPublicacion.h"
+#include "Sensores.h"
+#include "Publicador.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+  struct Opciones {
+	uint32_t emisores = 1000;
+	uint32_t porEscaner = 20;
+	double segundos = 60;
+	uint32_t periodo_ms = 1000;
+	uint32_t tramas = 10;        // % de placas que anuncian con TramaMediciones
+	double perdidas = 2;         // %
+	double jitter_ms = 0;
+	bool colisiones = true;
+	uint32_t semilla = 1;
+	const char * ficheroH4 = nullptr;
+	const char * ficheroBtsnoop = nullptr;
+	int puertoUdp = 0;
+	bool tiempoReal = false;
+  };
+
+  uint32_t semilla = 1;
+
+  /// 30 bits pseudoaleatorios (dos pasos del generador congruencial de los bancos de pruebas).
+  uint32_t aleatorio() {
+	semilla = semilla * 1103515245 + 12345;
+	uint32_t alto = ( semilla >> 16 ) & 0x7fff;
+	semilla = semilla * 1103515245 + 12345;
+	return ( alto << 15 ) | ( ( semilla >> 16 ) & 0x7fff );
+  }
+
+  /// Número al azar en [0, 1).
+  double uniforme() { return aleatorio() / (double) ( 1u << 30 ); }
+
+  /// Una placa virtual.
+  struct Emisor {
+	std::unique_ptr< Publicador > publicador;
+	uint8_t direccion[6];
+	bool trama;
+	uint64_t periodo_us;
+	uint64_t siguientePublicacion_us;
+	uint32_t publicaciones = 0;   ///< Llevadas a cabo (en iBeacon, dos por ciclo).
+	int16_t co2;
+	int16_t temperatura;
+	uint8_t anuncio[31];          ///< Lo que tiene la radio.
+	uint8_t longitud = 0;
+	uint64_t intervalo_us = 0;
+	uint32_t canal = 0;           ///< Canal del valor en el aire: índice en recibidas.
+	uint32_t ciclo = 0;           ///< Ciclo del valor en el aire.
+  };
+
+  /// Un paquete en el aire.
+  struct Paquete {
+	uint64_t inicio_us;
+	uint64_t fin_us;
+	uint32_t emisor;
+	uint32_t canal;
+	uint32_t ciclo;
+	uint8_t anuncio[31];
+	uint8_t longitud;
+	bool colisiona;
+  };
+
+  // secuencias de cada canal (placa y tipo de medición) recibidas alguna vez, por publicación
+  std::vector< std::vector< bool > > recibidas;
+
+  /// Copia lo que la radio simulada tiene en el aire tras la última llamada al Publicador.
+  uint8_t leerRadio( uint8_t * destino ) {
+	sim::Simulador & s = sim::Simulador::instancia();
+	uint8_t n = 0;
+	for( const sim::Evento & e : s.eventos() ) {
+	  if( e.tipo == sim::TipoEvento::ANUNCIO_START || e.tipo == sim::TipoEvento::ANUNCIO_DATOS ) {
+		memcpy( destino, e.datos, e.longitud );
+		n = e.longitud;
+	  }
+	}
+	s.borrarRegistro();
+	return n;
+  }
+
+  /// Pone en el aire el siguiente valor de la placa.
+  void publicar( Emisor & e, uint32_t indice ) {
+	uint32_t ciclo = e.trama ? e.publicaciones : e.publicaciones / 2;
+	bool esCO2 = e.trama || e.publicaciones % 2 == 0;
+	if( esCO2 ) {
+	  e.co2 += (int16_t) ( aleatorio() % 21 ) - 10;
+	  e.temperatura += (int16_t) ( aleatorio() % 3 ) - 1;
+	}
+	if( e.trama ) {
+	  TramaMediciones trama( (uint8_t) ciclo );
+	  trama.anyadir( Publicador::CO2, e.co2 );
+	  trama.anyadir( Publicador::TEMPERATURA, e.temperatura );
+	  e.publicador->anunciarMediciones( trama );
+	  e.canal = indice * 2;
+	} else if( esCO2 ) {
+	  e.publicador->anunciar< Sensores::CO2 >( e.co2, (uint8_t) ciclo );
+	  e.canal = indice * 2;
+	} else {
+	  e.publicador->anunciar< Sensores::Temperatura >( e.temperatura, (uint8_t) ciclo );
+	  e.canal = indice * 2 + 1;
+	}
+	if( recibidas[e.canal].size() <= ciclo ) {
+	  recibidas[e.canal].resize( ciclo + 1, false );
+	}
+	e.ciclo = ciclo;
+	e.longitud = leerRadio( e.anuncio );
+	e.intervalo_us = e.publicador->laEmisora.intervaloDeAnuncio() * 625ULL;
+	e.publicaciones++;
+	e.siguientePublicacion_us += e.trama ? e.periodo_us : e.periodo_us / 2;
+  }
+
+  /// Salidas de los informes recibidos.
+  class Salidas {
+  private:
+	FILE * h4 = nullptr;
+	FILE * btsnoop = nullptr;
+	int socketUdp = -1;
+	sockaddr_in destino;
+	bool tiempoReal = false;
+	std::chrono::steady_clock::time_point arranque;
+
+	static void escribirBE32( FILE * f, uint32_t v ) {
+	  uint8_t b[4] = { (uint8_t) ( v >> 24 ), (uint8_t) ( v >> 16 ), (uint8_t) ( v >> 8 ), (uint8_t) v };
+	  fwrite( b, 1, 4, f );
+	}
+
+  public:
+	uint64_t informes = 0;
+	uint64_t bytes = 0;
+
+	bool abrir( const Opciones & o ) {
+	  if( o.ficheroH4 != nullptr && ( h4 = fopen( o.ficheroH4, "wb" ) ) == nullptr ) {
+		perror( o.ficheroH4 );
+		return false;
+	  }
+	  if( o.ficheroBtsnoop != nullptr ) {
+		if( ( btsnoop = fopen( o.ficheroBtsnoop, "wb" ) ) == nullptr ) {
+		  perror( o.ficheroBtsnoop );
+		  return false;
+		}
+		fwrite( "btsnoop\0", 1, 8, btsnoop );
+		escribirBE32( btsnoop, 1 );      // versión
+		escribirBE32( btsnoop, 1002 );   // enlace: HCI UART (H4)
+	  }
+	  if( o.puertoUdp > 0 ) {
+		socketUdp = socket( AF_INET, SOCK_DGRAM, 0 );
+		if( socketUdp < 0 ) {
+		  perror( "socket" );
+		  return false;
+		}
+		memset( &destino, 0, sizeof( destino ) );
+		destino.sin_family = AF_INET;
+		destino.sin_port = htons( (uint16_t) o.puertoUdp );
+		destino.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	  }
+	  tiempoReal = o.tiempoReal;
+	  arranque = std::chrono::steady_clock::now();
+	  return true;
+	}
+
+	void escribir( const Paquete & p, const uint8_t * direccion, uint64_t recepcion_us, int8_t rssi ) {
+	  uint8_t evento[3 + 12 + 31 + 1] = {
+		0x04, 0x3e, (uint8_t) ( 2 + 9 + p.longitud + 1 ),   // H4 evento, LE Meta, longitud
+		0x02, 0x01,                                          // Advertising Report, un informe
+		0x00, 0x01,                                          // ADV_IND, dirección aleatoria
+		0, 0, 0, 0, 0, 0,                                    // dirección
+		p.longitud
+	  };
+	  memcpy( &evento[7], direccion, 6 );
+	  size_t n = 14;
+	  memcpy( &evento[n], p.anuncio, p.longitud );
+	  n += p.longitud;
+	  evento[n++] = (uint8_t) rssi;
+	  informes++;
+	  bytes += n;
+
+	  if( h4 != nullptr ) {
+		fwrite( evento, 1, n, h4 );
+	  }
+	  if( btsnoop != nullptr ) {
+		const uint64_t DESDE_EL_ANYO_0_A_1970_US = 0x00dcddb30f2f8000ULL;
+		uint64_t t = DESDE_EL_ANYO_0_A_1970_US + recepcion_us;
+		escribirBE32( btsnoop, (uint32_t) n );
+		escribirBE32( btsnoop, (uint32_t) n );
+		escribirBE32( btsnoop, 3 );   // recibido, evento
+		escribirBE32( btsnoop, 0 );
+		escribirBE32( btsnoop, (uint32_t) ( t >> 32 ) );
+		escribirBE32( btsnoop, (uint32_t) t );
+		fwrite( evento, 1, n, btsnoop );
+	  }
+	  if( socketUdp >= 0 ) {
+		if( tiempoReal ) {
+		  std::this_thread::sleep_until( arranque + std::chrono::microseconds( recepcion_us ) );
+		}
+		sendto( socketUdp, evento, n, 0, (const sockaddr *) &destino, sizeof( destino ) );
+	  }
+	}
+
+	void cerrar() {
+	  if( h4 != nullptr ) {
+		fclose( h4 );
+	  }
+	  if( btsnoop != nullptr ) {
+		fclose( btsnoop );
+	  }
+	  if( socketUdp >= 0 ) {
+		close( socketUdp );
+	  }
+	}
+  };
+
+} // namespace
+
+int main( int argc, char * argv[] ) {
+
+  Opciones o;
+  for( int i = 1; i < argc; i++ ) {
+	std::string a = argv[i];
+	if( a == "--emisores" && i + 1 < argc ) {
+	  o.emisores = (uint32_t) atoi( argv[++i] );
+	} else if( a == "--por-escaner" && i + 1 < argc ) {
+	  o.porEscaner = (uint32_t) atoi( argv[++i] );
+	} else if( a == "--segundos" && i + 1 < argc ) {
+	  o.segundos = atof( argv[++i] );
+	} else if( a == "--periodo" && i + 1 < argc ) {
+	  o.periodo_ms = (uint32_t) atoi( argv[++i] );
+	} else if( a == "--tramas" && i + 1 < argc ) {
+	  o.tramas = (uint32_t) atoi( argv[++i] );
+	} else if( a == "--perdidas" && i + 1 < argc ) {
+	  o.perdidas = atof( argv[++i] );
+	} else if( a == "--jitter" && i + 1 < argc ) {
+	  o.jitter_ms = atof( argv[++i] );
+	} else if( a == "--sin-colisiones" ) {
+	  o.colisiones = false;
+	} else if( a == "--semilla" && i + 1 < argc ) {
+	  o.semilla = (uint32_t) atoi( argv[++i] );
+	} else if( a == "--h4" && i + 1 < argc ) {
+	  o.ficheroH4 = argv[++i];
+	} else if( a == "--btsnoop" && i + 1 < argc ) {
+	  o.ficheroBtsnoop = argv[++i];
+	} else if( a == "--udp" && i + 1 < argc ) {
+	  o.puertoUdp = atoi( argv[++i] );
+	} else if( a == "--tiempo-real" ) {
+	  o.tiempoReal = true;
+	} else {
+	  fprintf( stderr, "uso: %s [--emisores N] [--por-escaner N] [--segundos S] [--periodo ms] [--tramas %%]\n"
+			   "          [--perdidas %%] [--jitter ms] [--sin-colisiones] [--semilla N] [--h4 fichero] [--btsnoop fichero]\n"
+			   "          [--udp puerto [--tiempo-real]]\n", argv[0] );
+	  return 2;
+	}
+  }
+  if( o.emisores == 0 || o.emisores > 65535 || o.porEscaner == 0 || o.periodo_ms < 2 ) {
+	fprintf( stderr, "emisores de 1 a 65535, por escáner 1 o más y periodo de 2 ms o más\n" );
+	return 2;
+  }
+  semilla = o.semilla;
+
+  Salidas salidas;
+  if( !salidas.abrir( o ) ) {
+	return 1;
+  }
+
+  // las placas virtuales
+  std::vector< Emisor > emisores( o.emisores );
+  recibidas.assign( o.emisores * 2, std::vector< bool >() );
+  for( uint32_t k = 0; k < o.emisores; k++ ) {
+	Emisor & e = emisores[k];
+	e.publicador.reset( new Publicador() );
+	e.publicador->encenderEmisora();
+	uint8_t d[6] = { (uint8_t) k, (uint8_t) ( k >> 8 ), (uint8_t) aleatorio(), (uint8_t) aleatorio(),
+					 (uint8_t) aleatorio(), (uint8_t) ( 0xc0 | aleatorio() ) };
+	memcpy( e.direccion, d, 6 );
+	e.trama = aleatorio() % 100 < o.tramas;
+	double deriva = 1 + ( uniforme() - 0.5 ) * 0.01;
+	e.periodo_us = (uint64_t) ( o.periodo_ms * 1000.0 * deriva );
+	e.siguientePublicacion_us = (uint64_t) ( uniforme() * o.periodo_ms * 1000 );
+	e.co2 = (int16_t) ( 400 + aleatorio() % 200 );
+	e.temperatura = (int16_t) ( 18 + aleatorio() % 8 );
+  }
+
+  // eventos de anuncio de todas las placas, por orden de tiempo
+  typedef std::pair< uint64_t, uint32_t > Siguiente;   // instante, placa
+  std::priority_queue< Siguiente, std::vector< Siguiente >, std::greater< Siguiente > > cola;
+  for( uint32_t k = 0; k < o.emisores; k++ ) {
+	cola.push( Siguiente( emisores[k].siguientePublicacion_us, k ) );
+  }
+
+  const uint64_t FIN_US = (uint64_t) ( o.segundos * 1e6 );
+  uint64_t eventos = 0;
+  uint64_t colisionados = 0;
+  uint64_t perdidosAlAzar = 0;
+
+  // por escáner: fin del paquete en el aire que acaba más tarde y el último, que todavía puede
+  // chocar con el siguiente
+  struct Escaner {
+	uint64_t finOcupado_us = 0;
+	bool hayPendiente = false;
+	Paquete pendiente;
+  };
+  std::vector< Escaner > escaneres( ( o.emisores + o.porEscaner - 1 ) / o.porEscaner );
+
+  auto entregar = [&] ( const Paquete & p ) {
+	if( p.colisiona ) {
+	  colisionados++;
+	  return;
+	}
+	if( uniforme() * 100 < o.perdidas ) {
+	  perdidosAlAzar++;
+	  return;
+	}
+	recibidas[p.canal][p.ciclo] = true;
+	double ruido_us = ( uniforme() * 2 - 1 ) * o.jitter_ms * 1000;
+	uint64_t recepcion_us = (uint64_t) ( (double) p.fin_us + ruido_us > 0 ? (double) p.fin_us + ruido_us : 0 );
+	salidas.escribir( p, emisores[p.emisor].direccion, recepcion_us, (int8_t) ( -40 - (int) ( aleatorio() % 56 ) ) );
+  };
+
+  while( !cola.empty() && cola.top().first < FIN_US ) {
+	Siguiente s = cola.top();
+	cola.pop();
+	Emisor & e = emisores[s.second];
+	uint64_t t = s.first;
+
+	if( t >= e.siguientePublicacion_us ) {
+	  // nuevo valor: el primer evento sale al ponerlo en el aire
+	  publicar( e, s.second );
+	}
+
+	Paquete p;
+	p.inicio_us = t;
+	// 1 Mbit/s: preámbulo, dirección de acceso, cabecera, AdvA, datos y CRC
+	p.fin_us = t + ( 1 + 4 + 2 + 6 + e.longitud + 3 ) * 8;
+	p.emisor = s.second;
+	p.canal = e.canal;
+	p.ciclo = e.ciclo;
+	memcpy( p.anuncio, e.anuncio, e.longitud );
+	p.longitud = e.longitud;
+	p.colisiona = false;
+	eventos++;
+
+	Escaner & r = escaneres[s.second / o.porEscaner];
+	if( o.colisiones && p.inicio_us < r.finOcupado_us ) {
+	  p.colisiona = true;
+	  if( r.hayPendiente && p.inicio_us < r.pendiente.fin_us ) {
+		r.pendiente.colisiona = true;
+	  }
+	}
+	r.finOcupado_us = p.fin_us > r.finOcupado_us ? p.fin_us : r.finOcupado_us;
+	if( r.hayPendiente ) {
+	  entregar( r.pendiente );
+	}
+	r.pendiente = p;
+	r.hayPendiente = true;
+
+	// siguiente evento: intervalo + retraso aleatorio de 0 a 10 ms, o el siguiente valor
+	uint64_t siguiente = t + e.intervalo_us + aleatorio() % 10001;
+	cola.push( Siguiente( siguiente < e.siguientePublicacion_us ? siguiente : e.siguientePublicacion_us, s.second ) );
+  }
+  for( Escaner & r : escaneres ) {
+	if( r.hayPendiente ) {
+	  entregar( r.pendiente );
+	}
+  }
+  salidas.cerrar();
+
+  // referencia: secuencias que no han llegado nunca entre la primera y la última recibida
+  uint64_t emitidas = 0;
+  uint64_t recibidasUnaVez = 0;
+  uint64_t perdidasVisibles = 0;
+  for( const std::vector< bool > & r : recibidas ) {
+	emitidas += r.size();
+	size_t primera = r.size();
+	size_t ultima = 0;
+	for( size_t k = 0; k < r.size(); k++ ) {
+	  if( r[k] ) {
+		recibidasUnaVez++;
+		primera = k < primera ? k : primera;
+		ultima = k;
+	  }
+	}
+	for( size_t k = primera; k < ultima; k++ ) {
+	  perdidasVisibles += r[k] ? 0 : 1;
+	}
+  }
+
+  printf( "---- carga: %u placas (%u %% con trama) en %zu escáneres, %.0f s, periodo %u ms ----\n",
+		  o.emisores, o.tramas, escaneres.size(), o.segundos, o.periodo_ms );
+  printf( "eventos en el aire %llu (%.0f/s)  colisionados %llu (%.2f %%)  perdidos al azar %llu\n",
+		  (unsigned long long) eventos, eventos / o.segundos, (unsigned long long) colisionados,
+		  eventos == 0 ? 0.0 : 100.0 * colisionados / eventos, (unsigned long long) perdidosAlAzar );
+  printf( "informes HCI %llu (%.1f MB)  secuencias emitidas %llu  recibidas %llu  perdidas entre la primera y la última %llu\n",
+		  (unsigned long long) salidas.informes, salidas.bytes / 1e6, (unsigned long long) emitidas,
+		  (unsigned long long) recibidasUnaVez, (unsigned long long) perdidasVisibles );
+
+  return 0;
+}
@@ -0,0 +1,62 @@
+
+/**
+ * @file leer_diario.cpp
+ * @brief Escribe las muestras del diario de mediciones de la placa (ver DiarioMediciones.h).
+ *
+ * El diario puede ser el directorio con los ficheros de los segmentos (p. ej. el de la flash
+ * simulada, build/flash) o el volcado de la orden `d` por el puerto serie. Escribe una muestra
+ * por línea (arranque, secuencia, millis() de ese arranque, medición y valor) y, por la salida
+ * de errores, el resumen de lo leído.
+ *
+ * Uso: leer_diario [directorio | volcado.txt]   (sin nada lee el volcado de la entrada estándar)
+ */
+
+#include <Arduino.h>
+
+#include "pasarela/LectorDiario.h"
+
+namespace {
+
+  const char * nombreMedicion( uint8_t id ) {
+	switch( id ) {
+	case 11: return "CO2";
+	case 12: return "TEMPERATURA";
+	case 13: return "RUIDO";
+	}
+	return "?";
+  }
+
+} // namespace
+
+int main( int argc, char * argv[] ) {
+
+  Pasarela::LectorDiario lector;
+  struct stat st;
+  if( argc > 1 && stat( argv[1], &st ) == 0 && S_ISDIR( st.st_mode ) ) {
+	lector.proyectarDirectorio( argv[1] );
+  } else {
+	FILE * f = stdin;
+	if( argc > 1 ) {
+	  f = fopen( argv[1], "r" );
+	  if( f == nullptr ) {
+		perror( argv[1] );
+		return 1;
+	  }
+	}
+	lector.leerVolcado( f );
+	if( f != stdin ) {
+	  fclose( f );
+	}
+  }
+
+  lector.recorrer( [] ( const Pasarela::LectorDiario::Muestra & m ) {
+	printf( "arranque %u  muestra %8u  t=%10u ms  %s(%u)=%d\n", m.arranque, m.secuencia, m.instante,
+			nombreMedicion( m.id ), m.id, m.valor );
+  } );
+
+  const Pasarela::LectorDiario::Estadisticas & e = lector.contadores();
+  fprintf( stderr, "%u segmentos, %llu bytes, %u entradas, %llu muestras, %u bytes malos, %u bloques mal formados\n",
+		   e.segmentos, (unsigned long long) e.bytes, e.entradas, (unsigned long long) e.muestras, e.bytesMalos,
+		   e.bloquesMalFormados );
+  return e.segmentos == 0 ? 1 : 0;
+}
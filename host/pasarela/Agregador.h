@@ -0,0 +1,407 @@
+
+/**
+ * @file Agregador.h
+ * @brief Agregador de la pasarela: seguimiento de secuencias por emisor, repartido entre hilos.
+ *
+ * Cada anuncio de la placa se repite muchas veces mientras dura su tiempoEspera, y lo único que
+ * permite saber si se ha perdido uno o si es una repetición es su número de secuencia: el
+ * contador de 8 bits del major en los iBeacon, la secuencia de 8 bits de TramaMediciones o la de
+ * 16 bits de las muestras de un bloque. El Agregador recibe las Medicion que entrega
+ * DecodificadorAnuncios y, por cada emisor (dirección) y canal (formato y, en iBeacon, tipo de
+ * medición):
+ *  - descarta las repeticiones;
+ *  - cuenta las secuencias que faltan, teniendo en cuenta que el contador da la vuelta;
+ *  - reconoce las que llegan tarde (desordenadas) y las descuenta de las perdidas;
+ *  - mide el intervalo entre valores nuevos y, en los bloques, la edad de cada muestra al llegar.
+ *
+ * Reparto: el hilo que llama a recibir() (el que decodifica) reparte por dirección entre los
+ * hilos trabajadores, cada uno con su cola de un productor y un consumidor sin cerrojos; cada
+ * emisor lo atiende siempre el mismo hilo, dueño de su estado, así que no hay nada compartido.
+ */
+
+#ifndef AGREGADOR_H_INCLUIDO
+#define AGREGADOR_H_INCLUIDO
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "DecodificadorAnuncios.h"
+
+namespace Pasarela {
+
+  /**
+   * @class SeguimientoSecuencia
+   * @brief Números de secuencia de un canal: repetidos, nuevos, perdidos y tardíos.
+   *
+   * Recuerda qué secuencias ha visto en una ventana de 128 por detrás de la mayor. Una secuencia
+   * se toma como posterior a la mayor si está a menos de media vuelta del contador por delante.
+   */
+  class SeguimientoSecuencia {
+
+  public:
+
+	enum Resultado : uint8_t {
+	  NUEVA,      ///< Posterior a todas las vistas.
+	  REPETIDA,   ///< Ya vista (o demasiado antigua para saberlo).
+	  TARDIA      ///< Anterior a la mayor, no vista: se había contado como perdida.
+	};
+
+	static const uint32_t VENTANA = 128;
+
+  private:
+
+	uint32_t mascara;   ///< 0xff o 0xffff: tamaño del contador.
+	uint32_t mayor = 0;
+	uint64_t vistas[2] = { 0, 0 };  ///< Bit k: se ha visto la secuencia mayor - k.
+	uint32_t recorridas = 0;        ///< Secuencias de la ventana desde la primera vista.
+
+	bool vista( uint32_t atras ) const { return ( vistas[atras >> 6] >> ( atras & 63 ) ) & 1; }
+	void marcar( uint32_t atras ) { vistas[atras >> 6] |= (uint64_t) 1 << ( atras & 63 ); }
+
+	void desplazar( uint32_t n ) {
+	  if( n >= VENTANA ) {
+		vistas[0] = vistas[1] = 0;
+	  } else if( n >= 64 ) {
+		vistas[1] = vistas[0] << ( n - 64 );
+		vistas[0] = 0;
+	  } else if( n > 0 ) {
+		vistas[1] = ( vistas[1] << n ) | ( vistas[0] >> ( 64 - n ) );
+		vistas[0] <<= n;
+	  }
+	}
+
+  public:
+
+	/// @param bits Tamaño del contador: 8 o 16.
+	explicit SeguimientoSecuencia( uint8_t bits = 8 ) : mascara( ( 1u << bits ) - 1 ) { }
+
+	/**
+	 * @brief Anota una secuencia recibida.
+	 *
+	 * @param secuencia Número de secuencia (sólo cuentan los bits del contador).
+	 * @param perdidas Suma las que faltan entre la mayor y ésta; resta 1 si es TARDIA.
+	 */
+	Resultado anotar( uint32_t secuencia, int64_t & perdidas ) {
+	  secuencia &= mascara;
+	  if( recorridas == 0 ) {
+		recorridas = 1;
+		mayor = secuencia;
+		marcar( 0 );
+		return NUEVA;
+	  }
+	  uint32_t delante = ( secuencia - mayor ) & mascara;
+	  if( delante == 0 ) {
+		return REPETIDA;
+	  }
+	  if( delante <= mascara / 2 ) {
+		perdidas += delante - 1;
+		desplazar( delante );
+		recorridas = recorridas + delante > VENTANA ? VENTANA : recorridas + delante;
+		mayor = secuencia;
+		marcar( 0 );
+		return NUEVA;
+	  }
+	  uint32_t atras = ( mayor - secuencia ) & mascara;
+	  if( atras >= recorridas || vista( atras ) ) {
+		// ya vista, o anterior a la primera vista o a la ventana: no se puede saber
+		return REPETIDA;
+	  }
+	  marcar( atras );
+	  perdidas -= 1;
+	  return TARDIA;
+	}
+
+  };
+
+  /**
+   * @struct Canal
+   * @brief Estado y cifras de un emisor en un canal (formato y tipo de medición).
+   */
+  struct Canal {
+	SeguimientoSecuencia secuencias;
+	uint64_t nuevas = 0;
+	uint64_t repetidas = 0;
+	uint64_t tardias = 0;
+	int64_t perdidas = 0;
+	uint64_t ultimaLlegada_us = 0;
+	uint64_t intervalos = 0;       ///< Intervalos medidos entre valores nuevos.
+	uint64_t sumaIntervalo_us = 0;
+	uint64_t maximoIntervalo_us = 0;
+	uint64_t sumaEdad_ms = 0;      ///< BLOQUE: edad de cada muestra nueva al llegar.
+	uint32_t maximaEdad_ms = 0;
+	int16_t ultimoValor = 0;
+
+	explicit Canal( uint8_t bits ) : secuencias( bits ) { }
+
+	/// Pérdidas sobre secuencias esperadas (0 a 1).
+	double tasaPerdidas() const {
+	  uint64_t esperadas = nuevas + tardias + ( perdidas > 0 ? perdidas : 0 );
+	  return esperadas == 0 ? 0 : ( perdidas > 0 ? perdidas : 0 ) / (double) esperadas;
+	}
+  };
+
+  /**
+   * @class Agregador
+   * @brief Reparte las mediciones recibidas entre hilos y lleva el Canal de cada emisor.
+   *
+   * Uso: recibir() desde un único hilo (el del decodificador); terminar() espera a que se vacíen
+   * las colas y para los hilos; después recorrer() y resumen() dan las cifras.
+   */
+  class Agregador {
+
+  public:
+
+	/// Totales de todos los canales.
+	struct Resumen {
+	  uint64_t registros = 0;   ///< Mediciones recibidas.
+	  uint64_t canales = 0;
+	  uint64_t emisores = 0;
+	  uint64_t nuevas = 0;
+	  uint64_t repetidas = 0;
+	  uint64_t tardias = 0;
+	  int64_t perdidas = 0;
+	  uint64_t esperas = 0;     ///< Veces que recibir() encontró la cola de un hilo llena.
+
+	  double tasaPerdidas() const {
+		uint64_t esperadas = nuevas + tardias + ( perdidas > 0 ? perdidas : 0 );
+		return esperadas == 0 ? 0 : ( perdidas > 0 ? perdidas : 0 ) / (double) esperadas;
+	  }
+	};
+
+	/// Clave de un canal: dirección (48 bits), formato y tipo de medición.
+	static uint64_t clave( const Medicion & m ) {
+	  uint64_t direccion = 0;
+	  if( m.direccion != nullptr ) {
+		for( int k = 5; k >= 0; k-- ) {
+		  direccion = ( direccion << 8 ) | m.direccion[k];
+		}
+	  }
+	  // en TRAMA y BLOQUE la secuencia es del anuncio o de la serie, no del tipo de medición
+	  uint8_t id = m.formato == Formato::IBEACON ? m.id : 0;
+	  // los lotes de los anuncios extendidos son la misma serie de muestras que los bloques
+	  Formato formato = m.formato == Formato::LOTE ? Formato::BLOQUE : m.formato;
+	  return ( direccion << 16 ) | ( (uint64_t) formato << 8 ) | id;
+	}
+
+	static uint64_t direccionDeClave( uint64_t c ) { return c >> 16; }
+	static Formato formatoDeClave( uint64_t c ) { return (Formato) ( ( c >> 8 ) & 0xff ); }
+
+  private:
+
+	/// Lo que viaja por la cola: la Medicion sin punteros al búfer del decodificador.
+	struct Registro {
+	  uint64_t clave;
+	  uint64_t llegada_us;
+	  uint32_t secuencia;
+	  int32_t instante_ms;
+	  int16_t valor;
+	  uint8_t indice;
+	};
+
+	/// Un hilo trabajador con su cola (un productor, un consumidor) y sus canales.
+	struct Hilo {
+	  std::vector< Registro > cola;
+	  size_t mascaraCola;
+	  // escritos (del productor) y leidos (del hilo) en líneas de caché distintas
+	  std::atomic< size_t > escritos { 0 };
+	  char separacion1[64];
+	  std::atomic< size_t > leidos { 0 };
+	  char separacion2[64];
+	  size_t leidosVistos = 0;   ///< Copia de leidos en el productor.
+	  std::atomic< bool > parar { false };
+	  std::unordered_map< uint64_t, Canal > canales;
+	  std::thread hilo;
+
+	  explicit Hilo( size_t capacidad ) : cola( capacidad ), mascaraCola( capacidad - 1 ) { }
+	};
+
+	std::vector< std::unique_ptr< Hilo > > hilos;
+	uint64_t registros = 0;
+	uint64_t esperas = 0;
+	bool terminado = false;
+
+	static void procesar( Hilo & h, const Registro & r ) {
+	  Formato formato = formatoDeClave( r.clave );
+	  auto it = h.canales.find( r.clave );
+	  if( it == h.canales.end() ) {
+		it = h.canales.emplace( r.clave, Canal( formato == Formato::BLOQUE ? 16 : 8 ) ).first;
+	  }
+	  Canal & c = it->second;
+
+	  // las demás mediciones de una TramaMediciones llevan la misma secuencia que la primera
+	  if( formato == Formato::TRAMA && r.indice > 0 ) {
+		return;
+	  }
+
+	  SeguimientoSecuencia::Resultado resultado = c.secuencias.anotar( r.secuencia, c.perdidas );
+	  if( resultado == SeguimientoSecuencia::REPETIDA ) {
+		c.repetidas++;
+		return;
+	  }
+	  if( resultado == SeguimientoSecuencia::TARDIA ) {
+		c.tardias++;
+	  } else {
+		c.nuevas++;
+		c.ultimoValor = r.valor;
+		if( c.ultimaLlegada_us != 0 ) {
+		  uint64_t intervalo = r.llegada_us - c.ultimaLlegada_us;
+		  c.intervalos++;
+		  c.sumaIntervalo_us += intervalo;
+		  c.maximoIntervalo_us = intervalo > c.maximoIntervalo_us ? intervalo : c.maximoIntervalo_us;
+		}
+		c.ultimaLlegada_us = r.llegada_us;
+	  }
+	  if( formato == Formato::BLOQUE ) {
+		uint32_t edad = (uint32_t) -r.instante_ms;
+		c.sumaEdad_ms += edad;
+		c.maximaEdad_ms = edad > c.maximaEdad_ms ? edad : c.maximaEdad_ms;
+	  }
+	}
+
+	static void trabajar( Hilo * h ) {
+	  size_t leidos = h->leidos.load( std::memory_order_relaxed );
+	  for( ;; ) {
+		size_t escritos = h->escritos.load( std::memory_order_acquire );
+		if( escritos == leidos ) {
+		  if( h->parar.load( std::memory_order_acquire ) && h->escritos.load( std::memory_order_acquire ) == leidos ) {
+			return;
+		  }
+		  std::this_thread::yield();
+		  continue;
+		}
+		for( ; leidos != escritos; leidos++ ) {
+		  procesar( *h, h->cola[leidos & h->mascaraCola] );
+		}
+		h->leidos.store( leidos, std::memory_order_release );
+	  }
+	}
+
+  public:
+
+	/**
+	 * @brief Constructor de la clase Agregador. Arranca los hilos.
+	 *
+	 * @param numHilos Hilos trabajadores (1 o más).
+	 * @param capacidadCola Registros en la cola de cada hilo (se redondea a potencia de 2).
+	 */
+	explicit Agregador( unsigned numHilos, size_t capacidadCola = 1 << 14 ) {
+	  size_t capacidad = 2;
+	  while( capacidad < capacidadCola ) {
+		capacidad <<= 1;
+	  }
+	  for( unsigned k = 0; k < ( numHilos == 0 ? 1 : numHilos ); k++ ) {
+		hilos.emplace_back( new Hilo( capacidad ) );
+	  }
+	  for( auto & h : hilos ) {
+		h->hilo = std::thread( trabajar, h.get() );
+	  }
+	}
+
+	~Agregador() {
+	  terminar();
+	}
+
+	Agregador( const Agregador & ) = delete;
+	Agregador & operator=( const Agregador & ) = delete;
+
+	/**
+	 * @brief Entrega una medición al hilo de su emisor. Sólo desde un hilo.
+	 *
+	 * Si la cola de ese hilo está llena, espera a que haga sitio.
+	 *
+	 * @param m Medición (se copia lo necesario; el búfer de m puede reutilizarse a la vuelta).
+	 * @param llegada_us Instante de recepción.
+	 */
+	void recibir( const Medicion & m, uint64_t llegada_us ) {
+	  Registro r;
+	  r.clave = clave( m );
+	  r.llegada_us = llegada_us;
+	  r.secuencia = m.secuencia;
+	  r.instante_ms = m.instante_ms;
+	  r.valor = m.valor;
+	  r.indice = m.indice;
+
+	  // reparto por dirección: un emisor siempre va al mismo hilo
+	  uint64_t mezcla = direccionDeClave( r.clave ) * 0x9e3779b97f4a7c15ULL;
+	  Hilo & h = *hilos[( mezcla >> 32 ) % hilos.size()];
+
+	  size_t escritos = h.escritos.load( std::memory_order_relaxed );
+	  if( escritos - h.leidosVistos > h.mascaraCola ) {
+		h.leidosVistos = h.leidos.load( std::memory_order_acquire );
+		if( escritos - h.leidosVistos > h.mascaraCola ) {
+		  esperas++;
+		  do {
+			std::this_thread::yield();
+			h.leidosVistos = h.leidos.load( std::memory_order_acquire );
+		  } while( escritos - h.leidosVistos > h.mascaraCola );
+		}
+	  }
+	  h.cola[escritos & h.mascaraCola] = r;
+	  h.escritos.store( escritos + 1, std::memory_order_release );
+	  registros++;
+	}
+
+	/// Espera a que los hilos vacíen sus colas y los para. Después no se puede recibir().
+	void terminar() {
+	  if( terminado ) {
+		return;
+	  }
+	  for( auto & h : hilos ) {
+		h->parar.store( true, std::memory_order_release );
+	  }
+	  for( auto & h : hilos ) {
+		h->hilo.join();
+	  }
+	  terminado = true;
+	}
+
+	unsigned numHilos() const { return (unsigned) hilos.size(); }
+
+	/**
+	 * @brief Recorre los canales de todos los emisores. Sólo tras terminar().
+	 *
+	 * @param f Se llama con f( uint64_t clave, const Canal & ).
+	 */
+	template< typename F >
+	void recorrer( F && f ) const {
+	  for( auto & h : hilos ) {
+		for( auto & par : h->canales ) {
+		  f( par.first, par.second );
+		}
+	  }
+	}
+
+	/// Totales. Sólo tras terminar().
+	Resumen resumen() const {
+	  Resumen r;
+	  r.registros = registros;
+	  r.esperas = esperas;
+	  for( auto & h : hilos ) {
+		std::vector< uint64_t > direcciones;
+		for( auto & par : h->canales ) {
+		  const Canal & c = par.second;
+		  r.canales++;
+		  r.nuevas += c.nuevas;
+		  r.repetidas += c.repetidas;
+		  r.tardias += c.tardias;
+		  r.perdidas += c.perdidas;
+		  direcciones.push_back( direccionDeClave( par.first ) );
+		}
+		// cada dirección está en un solo hilo: basta con contar las distintas de cada uno
+		std::sort( direcciones.begin(), direcciones.end() );
+		r.emisores += std::unique( direcciones.begin(), direcciones.end() ) - direcciones.begin();
+	  }
+	  return r;
+	}
+
+  };
+
+} // namespace Pasarela
+
+#endif
@@ -0,0 +1,441 @@
+
+/**
+ * @file DecodificadorAnuncios.h
+ * @brief Decodificador para la pasarela de los anuncios de la placa (biblioteca de sólo cabecera).
+ *
+ * Reconoce los formatos que emite el firmware, con el prefijo 4c 00 02 15 en los datos de
+ * fabricante (tipo AD 0xff) seguido de 21 bytes:
+ *  - iBeacon con el UUID de Publicador: major = (MedicionesID << 8) + contador, minor = valor;
+ *  - carga libre (emitirAnuncioIBeaconLibre()) con una TramaMediciones: mediciones sueltas
+ *    (versión 1) o un bloque comprimido de BufferMediciones (versión 2);
+ * y, en los anuncios extendidos (AnuncioExtendido), con el prefijo 4c 00 03 N seguido de N bytes:
+ *  - un lote de Publicador::anunciarLote(): una TramaMediciones larga (versión 3);
+ * y entrega cada medición como un registro Medicion.
+ *
+ * Nada se copia: los registros apuntan a la dirección del emisor dentro del búfer de entrada,
+ * que tiene que seguir vivo mientras se usan. Hay dos maneras de recorrer una captura:
+ *  - decodificarHCI(): eventos HCI «LE Advertising Report» y «LE Extended Advertising Report» en
+ *    formato H4 (0x04 0x3e ...), con dirección y RSSI de cada anuncio. Un evento HCI lleva como
+ *    mucho 229 bytes de datos de un anuncio extendido, así que el controlador parte los más largos
+ *    en varios informes («incompleto, siguen más»); esos trozos (y sólo esos) se copian hasta
+ *    tener el anuncio entero;
+ *  - escanear(): cualquier volcado de bytes (btsnoop, registros de otra herramienta...); busca el
+ *    prefijo directamente, sin dirección ni RSSI.
+ *
+ * Necesita TramaMediciones.h y BufferMediciones.h del firmware (-I../HolaMundoIBeacon).
+ */
+
+#ifndef DECODIFICADOR_ANUNCIOS_H_INCLUIDO
+#define DECODIFICADOR_ANUNCIOS_H_INCLUIDO
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "TramaMediciones.h"
+#include "BufferMediciones.h"
+
+/// @namespace Pasarela
+/// Código del lado de la pasarela (recepción de los anuncios).
+namespace Pasarela {
+
+  /// Formato del anuncio del que sale una medición.
+  enum class Formato : uint8_t {
+	IBEACON,   ///< iBeacon con major/minor.
+	TRAMA,     ///< TramaMediciones versión 1.
+	BLOQUE,    ///< TramaMediciones con un bloque de BufferMediciones.
+	LOTE       ///< TramaMediciones larga de un anuncio extendido.
+  };
+
+  /**
+   * @struct Medicion
+   * @brief Una medición recibida.
+   */
+  struct Medicion {
+	const uint8_t * direccion;  ///< 6 bytes en el orden de HCI (el menos significativo primero); nullptr con escanear().
+	int8_t rssi;                ///< dBm (127 si no se sabe).
+	Formato formato;
+	uint8_t id;                 ///< Tipo de medición (Publicador::MedicionesID).
+	int16_t valor;
+	uint32_t secuencia;         ///< IBEACON: contador de 8 bits; TRAMA: secuencia de la trama; BLOQUE: de la muestra.
+	int32_t instante_ms;        ///< BLOQUE: ms respecto a la recepción (<= 0); 0 en los demás.
+	uint8_t indice;             ///< Posición dentro del anuncio: 0 la primera medición de cada anuncio.
+  };
+
+  /**
+   * @class DecodificadorAnuncios
+   * @brief Busca y decodifica los anuncios de la placa en búferes de HCI o en bytes sueltos.
+   */
+  class DecodificadorAnuncios {
+
+  public:
+
+	/// Prefijo de los datos de fabricante: Apple (4c 00), tipo iBeacon (02), 21 bytes (15).
+	static constexpr uint32_t PREFIJO = 0x1502004c;  ///< 4c 00 02 15 leído en little-endian.
+	static const uint8_t TAMANYO_PREFIJO = 4;
+	static const uint8_t TAMANYO_CARGA = 21;
+
+	/// Prefijo de los lotes (AnuncioExtendido): Apple (4c 00), tipo 03; le sigue la longitud.
+	static constexpr uint32_t PREFIJO_LOTE = 0x03004c;  ///< 4c 00 03 leído en little-endian (3 bytes).
+	static const uint8_t TAMANYO_PREFIJO_LOTE = 4;
+
+	/// Datos de anuncio que caben en un informe HCI extendido (255 - 2 del subevento - 24 de cabecera).
+	static const uint8_t MAX_DATOS_INFORME_EXTENDIDO = 229;
+
+	/// Anuncios extendidos partidos en varios informes que se pueden estar juntando a la vez.
+	static const uint8_t MAX_FRAGMENTADOS = 4;
+
+	/// Contadores desde que se creó el decodificador.
+	struct Estadisticas {
+	  uint64_t anuncios = 0;      ///< Anuncios (informes HCI) recorridos.
+	  uint64_t tramas = 0;        ///< Cargas con el prefijo que se han reconocido.
+	  uint64_t mediciones = 0;
+	  uint64_t desconocidas = 0;  ///< Cargas con el prefijo que no son de la placa (otro UUID, CRC...).
+	  uint64_t malFormados = 0;   ///< Paquetes HCI cortados o con longitudes imposibles.
+	  uint64_t fragmentos = 0;    ///< Informes extendidos con un trozo de anuncio que siguen en otro.
+	  uint64_t truncados = 0;     ///< Anuncios extendidos que el controlador no ha recibido enteros.
+	};
+
+  private:
+
+	uint8_t uuidBeacon[16];
+	Estadisticas estadisticas;
+
+	/// Anuncio extendido que llega en varios informes: se juntan sus trozos.
+	struct Fragmentado {
+	  bool enUso = false;
+	  uint8_t direccion[6];
+	  uint8_t sid;
+	  uint16_t n;
+	  uint8_t datos[255];
+	};
+	Fragmentado fragmentados[MAX_FRAGMENTADOS];
+	uint8_t siguienteFragmentado = 0;
+
+	Fragmentado * buscarFragmentado( const uint8_t * direccion, uint8_t sid ) {
+	  for( Fragmentado & f : fragmentados ) {
+		if( f.enUso && f.sid == sid && memcmp( f.direccion, direccion, 6 ) == 0 ) {
+		  return &f;
+		}
+	  }
+	  return nullptr;
+	}
+
+	/**
+	 * @brief Un informe extendido: lo decodifica si el anuncio está entero o junta su trozo.
+	 *
+	 * @param estado Bits 5 y 6 del tipo de evento: 0 completo, 1 incompleto (siguen más), 2 truncado.
+	 */
+	template< typename F >
+	void informeExtendido( uint8_t estado, const uint8_t * direccion, uint8_t sid, int8_t rssi,
+						   const uint8_t * datos, uint8_t n, F && alRecibir ) {
+	  Fragmentado * f = buscarFragmentado( direccion, sid );
+	  if( estado == 0 && f == nullptr ) {
+		decodificarDatos( datos, n, direccion, rssi, alRecibir );
+		return;
+	  }
+	  if( estado > 1 ) {
+		estadisticas.truncados++;
+		if( f != nullptr ) {
+		  f->enUso = false;
+		}
+		return;
+	  }
+	  if( f == nullptr ) {
+		// el más antiguo deja sitio, y si no estaba entero se pierde
+		f = &fragmentados[siguienteFragmentado];
+		siguienteFragmentado = (uint8_t) ( ( siguienteFragmentado + 1 ) % MAX_FRAGMENTADOS );
+		if( f->enUso ) {
+		  estadisticas.truncados++;
+		}
+		f->enUso = true;
+		memcpy( f->direccion, direccion, 6 );
+		f->sid = sid;
+		f->n = 0;
+	  }
+	  if( f->n + n > sizeof( f->datos ) ) {
+		estadisticas.malFormados++;
+		f->enUso = false;
+		return;
+	  }
+	  memcpy( &f->datos[f->n], datos, n );
+	  f->n = (uint16_t) ( f->n + n );
+	  if( estado == 1 ) {
+		estadisticas.fragmentos++;
+		return;
+	  }
+	  f->enUso = false;
+	  decodificarDatos( f->datos, (uint8_t) f->n, direccion, rssi, alRecibir );
+	}
+
+	static uint32_t leer32( const uint8_t * p ) {
+	  uint32_t v;
+	  memcpy( &v, p, 4 );
+	  return v;
+	}
+
+  public:
+
+	/**
+	 * @brief Constructor de la clase DecodificadorAnuncios.
+	 *
+	 * @param uuid UUID de los iBeacon de la placa, en el orden en que va en el anuncio.
+	 */
+	explicit DecodificadorAnuncios( const uint8_t * uuid ) {
+	  memcpy( uuidBeacon, uuid, 16 );
+	}
+
+	const Estadisticas & contadores() const { return estadisticas; }
+
+	/**
+	 * @brief Busca el prefijo 4c 00 02 15 en [p, fin).
+	 *
+	 * Salta con memchr() al siguiente 0x4c (la biblioteca de C lo hace con instrucciones
+	 * vectoriales, muchos bytes por ciclo) y sólo ahí compara los 4 bytes de una vez. Es unas
+	 * 10 veces más rápido que comparar byte a byte con memcmp().
+	 *
+	 * @return Puntero al prefijo, o nullptr si no está.
+	 */
+	static const uint8_t * buscarPrefijo( const uint8_t * p, const uint8_t * fin ) {
+	  while( fin - p >= TAMANYO_PREFIJO ) {
+		p = (const uint8_t *) memchr( p, 0x4c, (size_t) ( fin - p - TAMANYO_PREFIJO + 1 ) );
+		if( p == nullptr ) {
+		  return nullptr;
+		}
+		if( leer32( p ) == PREFIJO ) {
+		  return p;
+		}
+		p++;
+	  }
+	  return nullptr;
+	}
+
+	/**
+	 * @brief Decodifica los 21 bytes que siguen al prefijo.
+	 *
+	 * @param carga Los 21 bytes.
+	 * @param direccion Dirección del emisor (o nullptr).
+	 * @param rssi RSSI del anuncio.
+	 * @param alRecibir Se llama con cada Medicion: alRecibir( const Medicion & ).
+	 * @return Mediciones entregadas (0 si la carga no es de la placa).
+	 */
+	template< typename F >
+	size_t decodificarCarga( const uint8_t * carga, const uint8_t * direccion, int8_t rssi, F && alRecibir ) {
+	  Medicion m;
+	  m.direccion = direccion;
+	  m.rssi = rssi;
+	  m.instante_ms = 0;
+	  m.indice = 0;
+
+	  if( memcmp( carga, uuidBeacon, 16 ) == 0 ) {
+		m.formato = Formato::IBEACON;
+		m.id = carga[16];
+		m.secuencia = carga[17];
+		m.valor = (int16_t) ( ( carga[18] << 8 ) | carga[19] );
+		estadisticas.tramas++;
+		estadisticas.mediciones++;
+		alRecibir( m );
+		return 1;
+	  }
+
+	  int version = TramaMediciones::version( carga, TAMANYO_CARGA );
+	  if( version == TramaMediciones::VERSION ) {
+		uint8_t secuencia;
+		TramaMediciones::Medicion t[TramaMediciones::MAX_MEDICIONES];
+		int cuantas = TramaMediciones::decodificar( carga, TAMANYO_CARGA, secuencia, t );
+		if( cuantas >= 0 ) {
+		  m.formato = Formato::TRAMA;
+		  m.secuencia = secuencia;
+		  for( int k = 0; k < cuantas; k++ ) {
+			m.id = t[k].id;
+			m.valor = t[k].valor;
+			m.indice = (uint8_t) k;
+			alRecibir( m );
+		  }
+		  estadisticas.tramas++;
+		  estadisticas.mediciones += cuantas;
+		  return cuantas;
+		}
+	  } else if( version == TramaMediciones::VERSION_BLOQUE ) {
+		CodecMuestras::Muestra b[TramaMediciones::CAPACIDAD_BLOQUE];
+		int cuantas = CodecMuestras::decodificarBloque( TramaMediciones::bloque( (uint8_t *) carga ),
+														TramaMediciones::CAPACIDAD_BLOQUE, b,
+														TramaMediciones::CAPACIDAD_BLOQUE, 0 );
+		if( cuantas >= 0 ) {
+		  m.formato = Formato::BLOQUE;
+		  for( int k = 0; k < cuantas; k++ ) {
+			m.id = b[k].id;
+			m.valor = b[k].valor;
+			m.secuencia = b[k].secuencia;
+			m.instante_ms = (int32_t) b[k].instante;
+			m.indice = (uint8_t) k;
+			alRecibir( m );
+		  }
+		  estadisticas.tramas++;
+		  estadisticas.mediciones += cuantas;
+		  return cuantas;
+		}
+	  }
+
+	  estadisticas.desconocidas++;
+	  return 0;
+	}
+
+	/**
+	 * @brief Decodifica la carga de un lote (la que sigue al prefijo 4c 00 03 N).
+	 *
+	 * @param carga Los N bytes.
+	 * @param n N.
+	 * @return Mediciones entregadas (0 si la carga no es de la placa).
+	 */
+	template< typename F >
+	size_t decodificarLote( const uint8_t * carga, uint8_t n, const uint8_t * direccion, int8_t rssi, F && alRecibir ) {
+	  int tamanyoBloque = TramaMediciones::bloqueLargo( carga, n );
+	  CodecMuestras::Muestra b[255];
+	  int cuantas = tamanyoBloque < 0 ? -1
+		: CodecMuestras::decodificarBloque( TramaMediciones::bloque( (uint8_t *) carga ), (uint8_t) tamanyoBloque,
+											b, 255, 0 );
+	  if( cuantas < 0 ) {
+		estadisticas.desconocidas++;
+		return 0;
+	  }
+	  Medicion m;
+	  m.direccion = direccion;
+	  m.rssi = rssi;
+	  m.formato = Formato::LOTE;
+	  for( int k = 0; k < cuantas; k++ ) {
+		m.id = b[k].id;
+		m.valor = b[k].valor;
+		m.secuencia = b[k].secuencia;
+		m.instante_ms = (int32_t) b[k].instante;
+		m.indice = (uint8_t) k;
+		alRecibir( m );
+	  }
+	  estadisticas.tramas++;
+	  estadisticas.mediciones += cuantas;
+	  return cuantas;
+	}
+
+	/**
+	 * @brief Decodifica los datos de un anuncio (estructuras AD: longitud, tipo, datos).
+	 *
+	 * @return Mediciones entregadas.
+	 */
+	template< typename F >
+	size_t decodificarDatos( const uint8_t * datos, uint8_t n, const uint8_t * direccion, int8_t rssi, F && alRecibir ) {
+	  size_t total = 0;
+	  uint8_t i = 0;
+	  while( i + 1 < n ) {
+		uint8_t longitud = datos[i];
+		if( longitud == 0 || i + 1 + longitud > n ) {
+		  break;
+		}
+		if( datos[i + 1] == 0xff && longitud == 1 + TAMANYO_PREFIJO + TAMANYO_CARGA
+			&& leer32( &datos[i + 2] ) == PREFIJO ) {
+		  total += decodificarCarga( &datos[i + 2 + TAMANYO_PREFIJO], direccion, rssi, alRecibir );
+		} else if( datos[i + 1] == 0xff && longitud > 1 + TAMANYO_PREFIJO_LOTE
+				   && ( leer32( &datos[i + 2] ) & 0xffffff ) == PREFIJO_LOTE
+				   && datos[i + 5] == longitud - 1 - TAMANYO_PREFIJO_LOTE ) {
+		  total += decodificarLote( &datos[i + 2 + TAMANYO_PREFIJO_LOTE], datos[i + 5], direccion, rssi, alRecibir );
+		}
+		i += 1 + longitud;
+	  }
+	  return total;
+	}
+
+	/**
+	 * @brief Recorre un flujo H4 de eventos HCI y decodifica los LE Advertising Report y los LE
+	 * Extended Advertising Report.
+	 *
+	 * Los demás paquetes se saltan. Un paquete cortado al final del búfer se deja sin leer.
+	 *
+	 * @param p Bytes del flujo.
+	 * @param n Número de bytes.
+	 * @param alRecibir Se llama con cada Medicion.
+	 * @return Bytes consumidos (los que falten hasta n son el principio de un paquete incompleto).
+	 */
+	template< typename F >
+	size_t decodificarHCI( const uint8_t * p, size_t n, F && alRecibir ) {
+	  const uint8_t TIPO_EVENTO = 0x04;
+	  const uint8_t EVENTO_LE_META = 0x3e;
+	  const uint8_t SUBEVENTO_INFORME_ANUNCIOS = 0x02;
+	  const uint8_t SUBEVENTO_INFORME_EXTENDIDO = 0x0d;
+	  const uint8_t CABECERA_INFORME_EXTENDIDO = 24;
+
+	  size_t i = 0;
+	  while( i + 3 <= n ) {
+		if( p[i] != TIPO_EVENTO ) {
+		  // no es un evento (o el flujo está desalineado): se busca el siguiente
+		  estadisticas.malFormados++;
+		  i++;
+		  continue;
+		}
+		size_t longitud = p[i + 2];
+		if( i + 3 + longitud > n ) {
+		  break;
+		}
+		const uint8_t * e = &p[i + 3];
+		if( p[i + 1] == EVENTO_LE_META && longitud >= 2 && e[0] == SUBEVENTO_INFORME_ANUNCIOS ) {
+		  // informes uno detrás de otro: tipo, tipo de dirección, dirección, longitud, datos, rssi
+		  uint8_t informes = e[1];
+		  size_t j = 2;
+		  for( uint8_t k = 0; k < informes; k++ ) {
+			if( j + 9 > longitud || j + 9 + e[j + 8] + 1 > longitud ) {
+			  estadisticas.malFormados++;
+			  break;
+			}
+			uint8_t nDatos = e[j + 8];
+			estadisticas.anuncios++;
+			decodificarDatos( &e[j + 9], nDatos, &e[j + 2], (int8_t) e[j + 9 + nDatos], alRecibir );
+			j += 9 + nDatos + 1;
+		  }
+		} else if( p[i + 1] == EVENTO_LE_META && longitud >= 2 && e[0] == SUBEVENTO_INFORME_EXTENDIDO ) {
+		  // tipo (2), tipo de dirección, dirección, PHY primario y secundario, SID, potencia, RSSI,
+		  // intervalo periódico (2), dirección directa (1 + 6), longitud, datos
+		  uint8_t informes = e[1];
+		  size_t j = 2;
+		  for( uint8_t k = 0; k < informes; k++ ) {
+			if( j + CABECERA_INFORME_EXTENDIDO > longitud
+				|| j + CABECERA_INFORME_EXTENDIDO + e[j + 23] > longitud ) {
+			  estadisticas.malFormados++;
+			  break;
+			}
+			const uint8_t * r = &e[j];
+			uint8_t nDatos = r[23];
+			estadisticas.anuncios++;
+			informeExtendido( (uint8_t) ( ( r[0] >> 5 ) & 0x03 ), &r[3], r[11], (int8_t) r[13], &r[24], nDatos,
+							  alRecibir );
+			j += CABECERA_INFORME_EXTENDIDO + nDatos;
+		  }
+		}
+		i += 3 + longitud;
+	  }
+	  return i;
+	}
+
+	/**
+	 * @brief Busca el prefijo en bytes sin formato conocido y decodifica lo que lo sigue.
+	 *
+	 * @return Mediciones entregadas.
+	 */
+	template< typename F >
+	size_t escanear( const uint8_t * p, size_t n, F && alRecibir ) {
+	  size_t total = 0;
+	  const uint8_t * fin = p + n;
+	  const uint8_t * q = p;
+	  while( ( q = buscarPrefijo( q, fin ) ) != nullptr ) {
+		if( fin - q < TAMANYO_PREFIJO + TAMANYO_CARGA ) {
+		  break;
+		}
+		size_t m = decodificarCarga( q + TAMANYO_PREFIJO, nullptr, 127, alRecibir );
+		total += m;
+		q += m > 0 ? TAMANYO_PREFIJO + TAMANYO_CARGA : 1;
+	  }
+	  return total;
+	}
+
+  };
+
+} // namespace Pasarela
+
+#endif
@@ -0,0 +1,250 @@
+
+/**
+ * @file LectorDiario.h
+ * @brief Lectura en el ordenador del diario de mediciones de la placa (ver DiarioMediciones.h).
+ *
+ * El diario llega de dos maneras:
+ *  - los ficheros de los segmentos (/diario0.bin...), p. ej. el directorio de la flash simulada o
+ *    una copia de la partición: se proyectan en memoria con mmap() y se recorren sin copiarlos;
+ *  - el volcado por el puerto serie de la orden `d` (líneas `diario <segmento> <byte> <hex>`),
+ *    que se pasa a bytes una vez y se recorre igual.
+ *
+ * Los segmentos se ordenan por su número de cabecera (no por el nombre del fichero, que da la
+ * vuelta) y cada entrada se comprueba con su CRC; un segmento se deja de leer en la primera
+ * entrada mala, igual que hace la placa al abrir el diario.
+ */
+
+#ifndef LECTOR_DIARIO_H_INCLUIDO
+#define LECTOR_DIARIO_H_INCLUIDO
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BufferMediciones.h"
+#include "FormatoDiario.h"
+
+namespace Pasarela {
+
+  /**
+   * @class LectorDiario
+   * @brief Segmentos del diario en memoria (proyectados o leídos del volcado) y su recorrido.
+   */
+  class LectorDiario {
+
+  public:
+
+	/// Una muestra del diario, con la secuencia entera (el bloque sólo lleva 16 bits).
+	struct Muestra {
+	  uint16_t arranque;   ///< Arranque de la placa en que se tomó.
+	  uint32_t secuencia;
+	  uint32_t instante;   ///< millis() de ese arranque.
+	  uint8_t id;
+	  int16_t valor;
+	};
+
+	/// Contadores del último recorrer().
+	struct Estadisticas {
+	  uint32_t segmentos = 0;
+	  uint32_t entradas = 0;
+	  uint64_t muestras = 0;
+	  uint64_t bytes = 0;
+	  uint32_t bytesMalos = 0;         ///< Tras la última entrada buena de cada segmento.
+	  uint32_t bloquesMalFormados = 0; ///< Con el CRC bien pero que CodecMuestras no entiende.
+	};
+
+  private:
+
+	struct Segmento {
+	  const uint8_t * datos = nullptr;
+	  size_t tamanyo = 0;
+	  uint32_t numero = 0;
+	  uint16_t arranque = 0;
+	  void * mapa = nullptr;          ///< Si está proyectado con mmap().
+	  std::vector< uint8_t > propios; ///< Si viene del volcado.
+	};
+
+	std::vector< Segmento > segmentos;
+	Estadisticas estadisticas;
+
+	bool anyadir( Segmento && s ) {
+	  if( !FormatoDiario::leerCabecera( s.datos, (uint32_t) s.tamanyo, s.numero, s.arranque ) ) {
+		if( s.mapa != nullptr ) {
+		  munmap( s.mapa, s.tamanyo );
+		}
+		return false;
+	  }
+	  segmentos.push_back( std::move( s ) );
+	  // el vector puede haber movido los propios: sus datos siguen en el mismo sitio del montón
+	  std::sort( segmentos.begin(), segmentos.end(), [] ( const Segmento & a, const Segmento & b ) {
+		return (int32_t) ( a.numero - b.numero ) < 0;
+	  } );
+	  return true;
+	}
+
+	static int valorHex( char c ) {
+	  if( c >= '0' && c <= '9' ) return c - '0';
+	  if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+	  if( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+	  return -1;
+	}
+
+  public:
+
+	LectorDiario() = default;
+	LectorDiario( const LectorDiario & ) = delete;
+	LectorDiario & operator=( const LectorDiario & ) = delete;
+
+	~LectorDiario() {
+	  cerrar();
+	}
+
+	void cerrar() {
+	  for( Segmento & s : segmentos ) {
+		if( s.mapa != nullptr ) {
+		  munmap( s.mapa, s.tamanyo );
+		}
+	  }
+	  segmentos.clear();
+	}
+
+	/**
+	 * @brief Proyecta en memoria un fichero de segmento.
+	 * @return false si no se puede abrir o no empieza con una cabecera del diario.
+	 */
+	bool proyectar( const char * ruta ) {
+	  int fd = open( ruta, O_RDONLY );
+	  if( fd < 0 ) {
+		return false;
+	  }
+	  struct stat st;
+	  if( fstat( fd, &st ) != 0 || st.st_size < FormatoDiario::TAMANYO_CABECERA ) {
+		close( fd );
+		return false;
+	  }
+	  void * mapa = mmap( nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	  close( fd );
+	  if( mapa == MAP_FAILED ) {
+		return false;
+	  }
+	  Segmento s;
+	  s.mapa = mapa;
+	  s.datos = (const uint8_t *) mapa;
+	  s.tamanyo = (size_t) st.st_size;
+	  return anyadir( std::move( s ) );
+	}
+
+	/**
+	 * @brief Proyecta los segmentos /diario0.bin ... de un directorio.
+	 * @return Segmentos válidos encontrados.
+	 */
+	uint32_t proyectarDirectorio( const char * directorio ) {
+	  uint32_t n = 0;
+	  for( char k = '0'; k <= '9'; k++ ) {
+		std::string ruta = std::string( directorio ) + "/diario" + k + ".bin";
+		n += proyectar( ruta.c_str() );
+	  }
+	  return n;
+	}
+
+	/**
+	 * @brief Lee el volcado de la orden `d` por el puerto serie (las demás líneas se ignoran).
+	 * @return Segmentos válidos encontrados.
+	 */
+	uint32_t leerVolcado( FILE * f ) {
+	  std::vector< std::vector< uint8_t > > trozos;
+	  char linea[512];
+	  while( fgets( linea, sizeof( linea ), f ) != nullptr ) {
+		unsigned segmento, posicion;
+		int leidos = 0;
+		if( sscanf( linea, "diario %u %u %n", &segmento, &posicion, &leidos ) != 2 || leidos == 0
+			|| segmento > 9 ) {
+		  continue;
+		}
+		if( trozos.size() <= segmento ) {
+		  trozos.resize( segmento + 1 );
+		}
+		std::vector< uint8_t > & t = trozos[segmento];
+		if( posicion == 0 ) {
+		  t.clear();    // otro volcado del mismo segmento: vale el último
+		}
+		if( posicion != t.size() ) {
+		  continue;     // falta una línea: el resto del segmento no se puede colocar
+		}
+		for( const char * p = &linea[leidos]; valorHex( p[0] ) >= 0 && valorHex( p[1] ) >= 0; p += 2 ) {
+		  t.push_back( (uint8_t) ( valorHex( p[0] ) * 16 + valorHex( p[1] ) ) );
+		}
+	  }
+	  uint32_t n = 0;
+	  for( std::vector< uint8_t > & t : trozos ) {
+		Segmento s;
+		s.propios = std::move( t );
+		s.datos = s.propios.data();
+		s.tamanyo = s.propios.size();
+		n += s.tamanyo > 0 && anyadir( std::move( s ) );
+	  }
+	  return n;
+	}
+
+	uint32_t numeroSegmentos() const { return (uint32_t) segmentos.size(); }
+
+	const Estadisticas & contadores() const { return estadisticas; }
+
+	/**
+	 * @brief Recorre todas las muestras, del segmento más antiguo al más reciente.
+	 *
+	 * @param alLeer Se llama con cada muestra: alLeer( const Muestra & ).
+	 * @return Muestras entregadas.
+	 */
+	template< typename F >
+	uint64_t recorrer( F && alLeer ) {
+	  estadisticas = Estadisticas();
+	  CodecMuestras::Muestra m[FormatoDiario::MAX_BLOQUE];
+	  for( const Segmento & s : segmentos ) {
+		estadisticas.segmentos++;
+		estadisticas.bytes += s.tamanyo;
+		size_t i = FormatoDiario::TAMANYO_CABECERA;
+		while( i < s.tamanyo ) {
+		  FormatoDiario::Entrada e;
+		  uint16_t n = FormatoDiario::leerEntrada( &s.datos[i], (uint32_t) ( s.tamanyo - i ), e );
+		  if( n == 0 ) {
+			break;
+		  }
+		  i += n;
+		  estadisticas.entradas++;
+		  int cuantas = CodecMuestras::decodificarBloque( e.bloque, e.tamanyoBloque, m, FormatoDiario::MAX_BLOQUE,
+														  e.instante );
+		  if( cuantas < 0 ) {
+			estadisticas.bloquesMalFormados++;
+			continue;
+		  }
+		  for( int k = 0; k < cuantas; k++ ) {
+			Muestra r;
+			r.arranque = e.arranque;
+			r.secuencia = e.secuencia + (uint32_t) k;
+			r.instante = m[k].instante;
+			r.id = m[k].id;
+			r.valor = m[k].valor;
+			alLeer( r );
+		  }
+		  estadisticas.muestras += (uint64_t) cuantas;
+		}
+		estadisticas.bytesMalos += (uint32_t) ( s.tamanyo - i );
+	  }
+	  return estadisticas.muestras;
+	}
+
+  };
+
+} // namespace Pasarela
+
+#endif
@@ -0,0 +1,298 @@
+/**
+ * @file Adafruit_LittleFS.h
+ * @brief Sistema de ficheros LittleFS de Adafruit simulado con ficheros normales del ordenador.
+ *
+ * Cada fichero de la flash es un fichero dentro de un directorio del ordenador (por defecto
+ * build/flash, o el de la variable de entorno SIM_FLASH), así que lo escrito sigue ahí entre
+ * ejecuciones, como en la placa tras un reinicio. Se modela la ocupación de la flash en bloques
+ * de TAMANYO_BLOQUE bytes (cada fichero ocupa sus bloques enteros, más BLOQUES_METADATOS para los
+ * directorios): una escritura que no cabe falla, como con LFS_ERR_NOSPC.
+ *
+ * Desgaste: LittleFS no reescribe un bloque en su sitio; al cerrar un fichero en el que se ha
+ * escrito, el último bloque (a medias) se copia a un bloque recién borrado. Se cuenta un borrado
+ * por ese bloque más uno por cada bloque lleno escrito (sin contar los de metadatos).
+ */
+
+#ifndef ADAFRUIT_LITTLEFS_SIMULADO_H_INCLUIDO
+#define ADAFRUIT_LITTLEFS_SIMULADO_H_INCLUIDO
+
+#include "Arduino.h"
+
+#include <string>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class Adafruit_LittleFS;
+
+namespace Adafruit_LittleFS_Namespace {
+
+  enum {
+	FILE_O_READ = 0,
+	FILE_O_WRITE = 1   ///< Lectura y escritura; crea el fichero y se sitúa al final.
+  };
+
+  // ---------------------------------------------------------------
+  // ---------------------------------------------------------------
+  class File {
+  private:
+	Adafruit_LittleFS * fs;
+	FILE * f = nullptr;
+	std::string ruta;
+	bool escritura = false;
+	uint32_t escritos = 0;   ///< Bytes escritos desde que se abrió.
+
+  public:
+	File( Adafruit_LittleFS & fs_ ) : fs( &fs_ ) { }
+
+	File( const File & ) = delete;
+	File & operator=( const File & ) = delete;
+
+	File( File && otro )
+	  : fs( otro.fs ), f( otro.f ), ruta( otro.ruta ), escritura( otro.escritura ), escritos( otro.escritos ) {
+	  otro.f = nullptr;
+	}
+
+	File & operator=( File && otro ) {
+	  if( this != &otro ) {
+		close();
+		fs = otro.fs;
+		f = otro.f;
+		ruta = otro.ruta;
+		escritura = otro.escritura;
+		escritos = otro.escritos;
+		otro.f = nullptr;
+	  }
+	  return *this;
+	}
+
+	~File() { close(); }
+
+	bool open( char const * filename, uint8_t mode );
+
+	size_t write( uint8_t const * buf, size_t size );
+	size_t write( uint8_t ch ) { return write( &ch, 1 ); }
+
+	int read( void * buf, uint16_t nbyte ) {
+	  return f == nullptr ? -1 : (int) fread( buf, 1, nbyte, f );
+	}
+
+	int read() {
+	  uint8_t c;
+	  return read( &c, 1 ) == 1 ? c : -1;
+	}
+
+	bool seek( uint32_t pos ) { return f != nullptr && fseek( f, (long) pos, SEEK_SET ) == 0; }
+	uint32_t position() { return f == nullptr ? 0 : (uint32_t) ftell( f ); }
+
+	uint32_t size() {
+	  if( f == nullptr ) {
+		return 0;
+	  }
+	  fflush( f );
+	  struct stat st;
+	  return fstat( fileno( f ), &st ) == 0 ? (uint32_t) st.st_size : 0;
+	}
+
+	bool truncate( uint32_t pos ) {
+	  if( f == nullptr || !escritura ) {
+		return false;
+	  }
+	  fflush( f );
+	  return ftruncate( fileno( f ), pos ) == 0 && seek( pos );
+	}
+
+	void flush() {
+	  if( f != nullptr ) {
+		fflush( f );
+	  }
+	}
+
+	void close();
+
+	bool isOpen() const { return f != nullptr; }
+	operator bool() const { return f != nullptr; }
+  };
+
+} // namespace Adafruit_LittleFS_Namespace
+
+// ---------------------------------------------------------------
+// ---------------------------------------------------------------
+class Adafruit_LittleFS {
+public:
+  static const uint32_t TAMANYO_BLOQUE = 4096;
+  static const uint32_t BLOQUES_METADATOS = 2;
+
+private:
+  std::string directorio;
+  uint32_t bloques;
+  bool montado = false;
+
+public:
+  // estadísticas
+  uint64_t bytesEscritos = 0;
+  uint64_t escrituras = 0;
+  uint64_t borrados = 0;            ///< Ficheros borrados.
+  uint64_t bloquesBorrados = 0;     ///< Bloques de la flash borrados para escribir (ver arriba).
+  uint64_t escriturasSinSitio = 0;
+
+  /**
+   * @param bloques_ Bloques de la partición (InternalFS: 28 KB, 7 bloques de 4 KB).
+   */
+  Adafruit_LittleFS( uint32_t bloques_ ) : bloques( bloques_ ) {
+	const char * d = getenv( "SIM_FLASH" );
+	directorio = d != nullptr ? d : "build/flash";
+  }
+
+  /// Cambia el directorio del ordenador que hace de flash (antes de begin()).
+  void simularDirectorio( const char * d ) {
+	directorio = d;
+	montado = false;
+  }
+
+  const std::string & directorioSimulado() const { return directorio; }
+
+  bool begin() {
+	// como mkdir -p, para que sirva build/flash sin crear antes build
+	for( size_t i = 1; i <= directorio.size(); i++ ) {
+	  if( i == directorio.size() || directorio[i] == '/' ) {
+		mkdir( directorio.substr( 0, i ).c_str(), 0755 );
+	  }
+	}
+	struct stat st;
+	montado = stat( directorio.c_str(), &st ) == 0 && S_ISDIR( st.st_mode );
+	return montado;
+  }
+
+  std::string rutaReal( char const * filepath ) const {
+	std::string r = directorio;
+	if( filepath[0] != '/' ) {
+	  r += '/';
+	}
+	return r + filepath;
+  }
+
+  /// Bloques ocupados (ficheros redondeados a bloques enteros más los de metadatos).
+  uint32_t bloquesOcupados() const {
+	uint32_t n = BLOQUES_METADATOS;
+	DIR * d = opendir( directorio.c_str() );
+	if( d == nullptr ) {
+	  return n;
+	}
+	while( struct dirent * e = readdir( d ) ) {
+	  if( e->d_name[0] == '.' ) {
+		continue;
+	  }
+	  struct stat st;
+	  if( stat( ( directorio + "/" + e->d_name ).c_str(), &st ) == 0 && S_ISREG( st.st_mode ) ) {
+		n += (uint32_t) ( ( st.st_size + TAMANYO_BLOQUE - 1 ) / TAMANYO_BLOQUE );
+	  }
+	}
+	closedir( d );
+	return n;
+  }
+
+  uint32_t bloquesTotales() const { return bloques; }
+
+  Adafruit_LittleFS_Namespace::File open( char const * filepath,
+										   uint8_t mode = Adafruit_LittleFS_Namespace::FILE_O_READ ) {
+	Adafruit_LittleFS_Namespace::File f( *this );
+	if( montado ) {
+	  f.open( filepath, mode );
+	}
+	return f;
+  }
+
+  bool exists( char const * filepath ) {
+	struct stat st;
+	return montado && stat( rutaReal( filepath ).c_str(), &st ) == 0;
+  }
+
+  bool remove( char const * filepath ) {
+	if( !montado || ::remove( rutaReal( filepath ).c_str() ) != 0 ) {
+	  return false;
+	}
+	borrados++;
+	return true;
+  }
+
+  bool rename( char const * desde, char const * hasta ) {
+	return montado && ::rename( rutaReal( desde ).c_str(), rutaReal( hasta ).c_str() ) == 0;
+  }
+
+  /// Borra todos los ficheros.
+  bool format() {
+	if( !begin() ) {
+	  return false;
+	}
+	DIR * d = opendir( directorio.c_str() );
+	while( d != nullptr ) {
+	  struct dirent * e = readdir( d );
+	  if( e == nullptr ) {
+		break;
+	  }
+	  if( e->d_name[0] != '.' ) {
+		::remove( ( directorio + "/" + e->d_name ).c_str() );
+	  }
+	}
+	if( d != nullptr ) {
+	  closedir( d );
+	}
+	return true;
+  }
+};
+
+inline bool Adafruit_LittleFS_Namespace::File::open( char const * filename, uint8_t mode ) {
+  close();
+  ruta = fs->rutaReal( filename );
+  escritura = mode == FILE_O_WRITE;
+  escritos = 0;
+  if( escritura ) {
+	f = fopen( ruta.c_str(), "r+b" );
+	if( f == nullptr ) {
+	  f = fopen( ruta.c_str(), "w+b" );
+	}
+	if( f != nullptr ) {
+	  fseek( f, 0, SEEK_END );
+	}
+  } else {
+	f = fopen( ruta.c_str(), "rb" );
+  }
+  return f != nullptr;
+}
+
+inline size_t Adafruit_LittleFS_Namespace::File::write( uint8_t const * buf, size_t size ) {
+  if( f == nullptr || !escritura ) {
+	return 0;
+  }
+  // los bloques nuevos que haría falta reservar
+  uint32_t fin = position() + (uint32_t) size;
+  uint32_t actual = this->size();
+  if( fin > actual ) {
+	uint32_t antes = ( actual + Adafruit_LittleFS::TAMANYO_BLOQUE - 1 ) / Adafruit_LittleFS::TAMANYO_BLOQUE;
+	uint32_t despues = ( fin + Adafruit_LittleFS::TAMANYO_BLOQUE - 1 ) / Adafruit_LittleFS::TAMANYO_BLOQUE;
+	if( fs->bloquesOcupados() + ( despues - antes ) > fs->bloquesTotales() ) {
+	  fs->escriturasSinSitio++;
+	  return 0;
+	}
+  }
+  size_t n = fwrite( buf, 1, size, f );
+  fs->bytesEscritos += n;
+  fs->escrituras++;
+  escritos += (uint32_t) n;
+  return n;
+}
+
+inline void Adafruit_LittleFS_Namespace::File::close() {
+  if( f == nullptr ) {
+	return;
+  }
+  fclose( f );
+  f = nullptr;
+  if( escritos > 0 ) {
+	fs->bloquesBorrados += 1 + escritos / Adafruit_LittleFS::TAMANYO_BLOQUE;
+	escritos = 0;
+  }
+}
+
+#endif
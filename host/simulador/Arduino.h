@@ -0,0 +1,269 @@
+
+/**
+ * @file Arduino.h
+ * @brief Núcleo Arduino simulado para compilar el sketch en el ordenador.
+ *
+ * Implementa lo que usa el firmware (pines, `delay()`, `millis()`, `Serial`) sobre el
+ * reloj virtual de sim::Simulador. Nada de esto duerme de verdad: `delay()` sólo hace
+ * avanzar el reloj, así que una simulación de horas tarda milisegundos.
+ */
+
+#ifndef ARDUINO_SIMULADO_H_INCLUIDO
+#define ARDUINO_SIMULADO_H_INCLUIDO
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+#include "Simulador.h"
+
+#include <chrono>
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define DEC 10
+#define HEX 16
+
+/// Reloj de la CPU del nRF52840.
+#ifndef F_CPU
+#define F_CPU 64000000UL
+#endif
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+inline void pinMode( uint32_t pin, uint32_t modo ) {
+  (void) pin;
+  (void) modo;
+}
+
+inline void digitalWrite( uint32_t pin, uint32_t valor ) {
+  sim::Simulador::instancia().anotar( sim::TipoEvento::PIN, pin * 2 + ( valor ? 1 : 0 ) );
+}
+
+inline unsigned long micros() {
+  return (unsigned long) sim::Simulador::instancia().ahoraMicros();
+}
+
+inline unsigned long millis() {
+  return (unsigned long) ( sim::Simulador::instancia().ahoraMicros() / 1000 );
+}
+
+inline void delay( unsigned long ms ) {
+  sim::Simulador::instancia().anotar( sim::TipoEvento::ESPERA, (uint32_t) ms );
+  sim::Simulador::instancia().esperarMicros( (uint64_t) ms * 1000 );
+}
+
+inline void delayMicroseconds( unsigned int us ) {
+  sim::Simulador::instancia().esperarMicros( us );
+}
+
+/**
+ * @brief Registros de depuración del Cortex-M4 (CMSIS) que usa el firmware para contar ciclos.
+ *
+ * DWT->CYCCNT cuenta ciclos de F_CPU a partir del reloj real del ordenador (no del virtual), así
+ * que mide lo que tarda de verdad el código del firmware al ejecutarse aquí.
+ */
+namespace sim {
+
+  struct ContadorCiclos {
+	operator uint32_t() const {
+	  auto ns = std::chrono::duration_cast< std::chrono::nanoseconds >(
+		std::chrono::steady_clock::now().time_since_epoch() ).count();
+	  return (uint32_t) ( (uint64_t) ns * ( F_CPU / 1000000 ) / 1000 ) - base;
+	}
+	ContadorCiclos & operator=( uint32_t v ) {
+	  base = 0;
+	  base = (uint32_t) *this - v;
+	  return *this;
+	}
+	uint32_t base = 0;
+  };
+
+  struct RegistrosDWT {
+	uint32_t CTRL = 0;
+	ContadorCiclos CYCCNT;
+  };
+
+  struct RegistrosCoreDebug {
+	uint32_t DEMCR = 0;
+  };
+
+  inline RegistrosDWT * dwt() {
+	static RegistrosDWT r;
+	return &r;
+  }
+
+  inline RegistrosCoreDebug * coreDebug() {
+	static RegistrosCoreDebug r;
+	return &r;
+  }
+
+} // namespace sim
+
+#define DWT ( sim::dwt() )
+#define CoreDebug ( sim::coreDebug() )
+#define DWT_CTRL_CYCCNTENA_Msk ( 1UL << 0 )
+#define CoreDebug_DEMCR_TRCENA_Msk ( 1UL << 24 )
+
+/**
+ * @brief RTC1, el reloj de 32768 Hz con el que FreeRTOS lleva su tick en el núcleo de Adafruit.
+ *
+ * NRF_RTC1->COUNTER (24 bits) sigue el reloj virtual.
+ */
+namespace sim {
+
+  struct ContadorRTC {
+	operator uint32_t() const {
+	  return (uint32_t) ( Simulador::instancia().ahoraMicros() * 32768 / 1000000 ) & 0xFFFFFF;
+	}
+  };
+
+  struct RegistrosRTC {
+	ContadorRTC COUNTER;
+  };
+
+  inline RegistrosRTC * rtc1() {
+	static RegistrosRTC r;
+	return &r;
+  }
+
+} // namespace sim
+
+#define NRF_RTC1 ( sim::rtc1() )
+
+/**
+ * @brief Lo poco de FreeRTOS que usa el firmware (el núcleo de Adafruit lo trae con Arduino.h).
+ *
+ * Aquí un tick es un milisegundo (en la placa, configTICK_RATE_HZ es 1024). Un semáforo binario
+ * es una bandera: xSemaphoreTake() avanza el reloj virtual hasta que alguien lo da o se acaba el
+ * plazo. Lo puede dar la pila BLE simulada mientras pasa el tiempo, así que con un observador del
+ * reloj (una conexión) se avanza de milisegundo en milisegundo; si no, de una vez.
+ */
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+
+#define pdFALSE ( (BaseType_t) 0 )
+#define pdTRUE ( (BaseType_t) 1 )
+#define ms2tick( ms ) ( (TickType_t) ( ms ) )
+
+namespace sim {
+
+  struct SemaforoSimulado {
+	bool dado = false;
+  };
+
+} // namespace sim
+
+typedef sim::SemaforoSimulado * SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return new sim::SemaforoSimulado();
+}
+
+inline BaseType_t xSemaphoreGive( SemaphoreHandle_t semaforo ) {
+  if( semaforo->dado ) {
+	return pdFALSE;
+  }
+  semaforo->dado = true;
+  return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGiveFromISR( SemaphoreHandle_t semaforo, BaseType_t * hayQueCambiar ) {
+  if( hayQueCambiar != nullptr ) {
+	*hayQueCambiar = pdFALSE;
+  }
+  return xSemaphoreGive( semaforo );
+}
+
+inline BaseType_t xSemaphoreTake( SemaphoreHandle_t semaforo, TickType_t ticks ) {
+  sim::Simulador & s = sim::Simulador::instancia();
+  uint64_t fin = s.ahoraMicros() + (uint64_t) ticks * 1000;
+  while( !semaforo->dado && s.ahoraMicros() < fin ) {
+	uint64_t paso = fin - s.ahoraMicros();
+	s.esperarMicros( s.hayObservador() && paso > 1000 ? 1000 : paso );
+  }
+  if( !semaforo->dado ) {
+	return pdFALSE;
+  }
+  semaforo->dado = false;
+  return pdTRUE;
+}
+
+/**
+ * @class Print
+ * @brief Equivalente simulado de `Serial`: formatea como el núcleo Arduino y lo pasa a SerieSimulada.
+ */
+class Print {
+private:
+  size_t enviar( const char * p, size_t n ) {
+	sim::Simulador & s = sim::Simulador::instancia();
+	s.anotar( sim::TipoEvento::SERIE, (uint32_t) n );
+	uint64_t bloqueado = s.serie.escribir( (const uint8_t *) p, n, s.ahoraMicros() );
+	s.bloqueadoEnSerie( bloqueado );
+	s.esperarMicros( bloqueado );
+	return n;
+  }
+
+  size_t entero( unsigned long long v, bool negativo, int base ) {
+	char buf[24];
+	char * p = &buf[sizeof( buf )];
+	do {
+	  unsigned d = (unsigned) ( v % base );
+	  *--p = (char) ( d < 10 ? '0' + d : 'A' + d - 10 );
+	  v /= base;
+	} while( v > 0 );
+	if( negativo ) {
+	  *--p = '-';
+	}
+	return enviar( p, &buf[sizeof( buf )] - p );
+  }
+
+public:
+  void begin( long baudios ) { sim::Simulador::instancia().serie.begin( baudios ); }
+  void end() { }
+  void flush() { }
+  operator bool() const { return true; }
+
+  /// Bytes recibidos pendientes de leer (los que se dan con SerieSimulada::recibir()).
+  int available() { return (int) sim::Simulador::instancia().serie.pendientesDeLeer(); }
+
+  /// Siguiente byte recibido, o -1 si no hay.
+  int read() { return sim::Simulador::instancia().serie.leer(); }
+
+  int availableForWrite() {
+	sim::Simulador & s = sim::Simulador::instancia();
+	return (int) s.serie.libres( s.ahoraMicros() );
+  }
+
+  size_t write( uint8_t c ) { return enviar( (const char *) &c, 1 ); }
+  size_t write( const uint8_t * p, size_t n ) { return enviar( (const char *) p, n ); }
+
+  size_t print( const char * s ) { return enviar( s, strlen( s ) ); }
+  size_t print( char c ) { return enviar( &c, 1 ); }
+  size_t print( unsigned char v, int base = DEC ) { return entero( v, false, base ); }
+  size_t print( int v, int base = DEC ) { return print( (long) v, base ); }
+  size_t print( unsigned int v, int base = DEC ) { return entero( v, false, base ); }
+  size_t print( long v, int base = DEC ) {
+	return v < 0 && base == DEC ? entero( - (unsigned long long) v, true, base ) : entero( (unsigned long) v, false, base );
+  }
+  size_t print( unsigned long v, int base = DEC ) { return entero( v, false, base ); }
+  size_t print( double v, int decimales = 2 ) {
+	char buf[32];
+	int n = snprintf( buf, sizeof( buf ), "%.*f", decimales, v );
+	return enviar( buf, n );
+  }
+
+  template<typename T>
+  size_t println( T v ) { size_t n = print( v ); return n + print( "\r\n" ); }
+  size_t println() { return print( "\r\n" ); }
+};
+
+static Print Serial __attribute__(( unused ));
+
+#endif
@@ -0,0 +1,24 @@
+/**
+ * @file InternalFileSystem.h
+ * @brief Partición LittleFS de la flash interna del nRF52 (InternalFS), simulada.
+ */
+
+#ifndef INTERNAL_FILE_SYSTEM_SIMULADO_H_INCLUIDO
+#define INTERNAL_FILE_SYSTEM_SIMULADO_H_INCLUIDO
+
+#include "Adafruit_LittleFS.h"
+
+class InternalFileSystem : public Adafruit_LittleFS {
+public:
+  /// 28 KB, como la partición del cargador de Adafruit (7 bloques de 4 KB).
+  InternalFileSystem() : Adafruit_LittleFS( 7 ) { }
+
+  static InternalFileSystem & instancia() {
+	static InternalFileSystem elSistema;
+	return elSistema;
+  }
+};
+
+static InternalFileSystem & InternalFS = InternalFileSystem::instancia();
+
+#endif
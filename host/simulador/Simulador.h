@@ -0,0 +1,422 @@
+
+/**
+ * @file Simulador.h
+ * @brief Núcleo del simulador de placa para compilar el sketch en el ordenador (Linux).
+ *
+ * Contiene el reloj virtual que hacen avanzar `delay()` y el puerto serie, y el registro
+ * con marca de tiempo de todo lo que el firmware hace sobre la radio (arranque y parada de
+ * anuncios, cambios de datos de anuncio, notificaciones y escrituras GATT) y sobre los pines.
+ * A partir de ese registro se obtienen las cifras del banco de pruebas: tiempo con la radio
+ * anunciando, número de eventos de anuncio emitidos, periodo del bucle, etc.
+ */
+
+#ifndef SIMULADOR_H_INCLUIDO
+#define SIMULADOR_H_INCLUIDO
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <string>
+
+namespace sim {
+
+  /**
+   * @enum TipoEvento
+   * @brief Tipos de evento que el simulador anota en su registro.
+   */
+  enum class TipoEvento : uint8_t {
+	ANUNCIO_START,      ///< Bluefruit.Advertising.start(): la radio empieza a anunciar.
+	ANUNCIO_STOP,       ///< Bluefruit.Advertising.stop(): la radio deja de anunciar.
+	ANUNCIO_BEACON,     ///< Bluefruit.Advertising.setBeacon(): se cargan datos iBeacon.
+	ANUNCIO_DATOS,      ///< Bluefruit.Advertising.addData(): se añade una estructura AD.
+	ANUNCIO_BORRAR,     ///< Bluefruit.Advertising.clearData().
+	ANUNCIO_INTERVALO,  ///< Bluefruit.Advertising.setInterval(): valor en unidades de 0,625 ms.
+	NOTIFICACION,       ///< BLECharacteristic::notify().
+	ESCRITURA,          ///< BLECharacteristic::write().
+	PIN,                ///< digitalWrite(): valor = pin * 2 + nivel.
+	SERIE,              ///< Serial.print(): valor = bytes escritos.
+	ESPERA,             ///< delay(): valor = milisegundos.
+	POTENCIA            ///< Bluefruit.setTxPower(): valor = dBm (como int8_t).
+  };
+
+  /**
+   * @brief Devuelve el nombre legible de un tipo de evento (para las trazas CSV).
+   */
+  inline const char * nombreEvento( TipoEvento tipo ) {
+	switch( tipo ) {
+	case TipoEvento::ANUNCIO_START: return "anuncio_start";
+	case TipoEvento::ANUNCIO_STOP: return "anuncio_stop";
+	case TipoEvento::ANUNCIO_BEACON: return "anuncio_beacon";
+	case TipoEvento::ANUNCIO_DATOS: return "anuncio_datos";
+	case TipoEvento::ANUNCIO_BORRAR: return "anuncio_borrar";
+	case TipoEvento::ANUNCIO_INTERVALO: return "anuncio_intervalo";
+	case TipoEvento::NOTIFICACION: return "notificacion";
+	case TipoEvento::ESCRITURA: return "escritura";
+	case TipoEvento::PIN: return "pin";
+	case TipoEvento::SERIE: return "serie";
+	case TipoEvento::ESPERA: return "espera";
+	case TipoEvento::POTENCIA: return "potencia";
+	}
+	return "?";
+  }
+
+  /**
+   * @struct Evento
+   * @brief Entrada del registro del simulador.
+   */
+  struct Evento {
+	uint64_t tiempo_us;   ///< Instante (reloj virtual) en microsegundos.
+	TipoEvento tipo;      ///< Qué ha ocurrido.
+	uint32_t valor;       ///< Dato numérico asociado (depende del tipo).
+	uint8_t longitud;     ///< Bytes válidos en `datos`.
+	uint8_t datos[255];   ///< Copia de la carga (anuncio, notificación...), truncada a 255 bytes.
+  };
+
+  /**
+   * @class SerieSimulada
+   * @brief Modelo del puerto serie: un FIFO de transmisión que se vacía a la velocidad en baudios.
+   *
+   * Como en el puerto real, escribir sólo bloquea cuando el FIFO está lleno; en ese caso el
+   * reloj virtual avanza lo que tardaría la UART en dejar sitio (10 bits por byte).
+   */
+  class SerieSimulada {
+  private:
+	long baudios = 0;
+	uint64_t vaciadoHasta_us = 0;  ///< Instante en que el FIFO quedará vacío.
+	bool eco = false;
+	std::string * captura = nullptr;
+	std::string entrada;           ///< Bytes recibidos sin leer.
+
+  public:
+	static const size_t TAMANYO_FIFO = 64; ///< Bytes de FIFO de transmisión.
+
+	void begin( long baudios_ ) { baudios = baudios_; }
+	void activarEco( bool activar ) { eco = activar; }
+	/// Guarda en `destino` todo lo que se escriba (nullptr para dejar de hacerlo).
+	void capturar( std::string * destino ) { captura = destino; }
+	long velocidad() const { return baudios; }
+
+	/// Simula que llegan bytes por el puerto (lo que se teclearía en el monitor serie).
+	void recibir( const char * texto ) { entrada += texto; }
+	size_t pendientesDeLeer() const { return entrada.size(); }
+	int leer() {
+	  if( entrada.empty() ) {
+		return -1;
+	  }
+	  int c = (uint8_t) entrada[0];
+	  entrada.erase( 0, 1 );
+	  return c;
+	}
+
+	/// Tiempo que tarda en salir un byte por la UART, en microsegundos.
+	uint64_t microsPorByte() const {
+	  return baudios > 0 ? ( 10ULL * 1000000ULL + baudios - 1 ) / baudios : 0;
+	}
+
+	/// Bytes que se pueden escribir ahora mismo sin bloquear.
+	size_t libres( uint64_t ahora_us ) const {
+	  if( baudios <= 0 || vaciadoHasta_us <= ahora_us ) {
+		return TAMANYO_FIFO;
+	  }
+	  uint64_t pendientes = ( vaciadoHasta_us - ahora_us + microsPorByte() - 1 ) / microsPorByte();
+	  return pendientes >= TAMANYO_FIFO ? 0 : TAMANYO_FIFO - pendientes;
+	}
+
+	/**
+	 * @brief Encola bytes en el FIFO.
+	 * @return Microsegundos que el llamante queda bloqueado esperando sitio.
+	 */
+	uint64_t escribir( const uint8_t * p, size_t n, uint64_t ahora_us ) {
+	  if( eco ) {
+		fwrite( p, 1, n, stdout );
+	  }
+	  if( captura != nullptr ) {
+		captura->append( (const char *) p, n );
+	  }
+	  if( baudios <= 0 ) {
+		return 0;
+	  }
+	  uint64_t desde = vaciadoHasta_us > ahora_us ? vaciadoHasta_us : ahora_us;
+	  vaciadoHasta_us = desde + n * microsPorByte();
+	  uint64_t capacidad_us = TAMANYO_FIFO * microsPorByte();
+	  if( vaciadoHasta_us - ahora_us > capacidad_us ) {
+		return vaciadoHasta_us - ahora_us - capacidad_us;
+	  }
+	  return 0;
+	}
+  };
+
+  /**
+   * @class Simulador
+   * @brief Reloj virtual y registro de eventos compartidos por el Arduino y el Bluefruit simulados.
+   */
+  class Simulador {
+  private:
+	uint64_t ahora_us = 0;
+	std::vector<Evento> registro;
+	bool registrando = true;
+
+	// estado de la radio
+	bool anunciando = false;
+	uint64_t inicioAnuncio_us = 0;
+	uint32_t intervaloAnuncio_us = 100 * 625;
+	size_t longitudAnuncio = 0;
+	uint64_t tiempoAnunciando_us = 0;
+	uint64_t eventosAnuncio = 0;
+
+	// tiempo pasado dentro de delay()
+	uint64_t tiempoEsperando_us = 0;
+
+	// tiempo bloqueado escribiendo en Serial con el FIFO lleno
+	uint64_t tiempoBloqueadoSerie_us = 0;
+
+	// quien quiere enterarse de que el reloj avanza (la conexión BLE simulada)
+	void ( * observador )( uint64_t ahora_us ) = nullptr;
+	bool avisando = false;
+
+	// notificaciones de radio: a quién se avisa al encenderse y al apagarse la radio y quién
+	// sabe cuándo la va a usar (ver notificarRadio())
+	void ( * avisoRadio )() = nullptr;
+	bool ( * usoRadio )( uint64_t desde_us, uint64_t & inicio_us, uint32_t & duracion_us ) = nullptr;
+	bool radioEncendida = false;
+	uint64_t finUsoRadio_us = 0;
+
+	void avisarObservador() {
+	  if( observador != nullptr && !avisando ) {
+		avisando = true;
+		observador( ahora_us );
+		avisando = false;
+	  }
+	}
+
+	Simulador() { registro.reserve( 4096 ); }
+
+	void cerrarTramoAnuncio() {
+	  uint64_t duracion = ahora_us - inicioAnuncio_us;
+	  tiempoAnunciando_us += duracion;
+	  // el primer evento sale al arrancar y luego uno por intervalo
+	  eventosAnuncio += duracion == 0 ? 1 : ( duracion + intervaloAnuncio_us - 1 ) / intervaloAnuncio_us;
+	  inicioAnuncio_us = ahora_us;
+	}
+
+	/// Lleva el reloj hasta `hasta_us`, parándose en cada encendido y apagado de la radio si hay que avisar.
+	void moverReloj( uint64_t hasta_us ) {
+	  while( avisoRadio != nullptr ) {
+		uint64_t cambio_us = finUsoRadio_us;
+		if( !radioEncendida ) {
+		  uint32_t duracion_us = 0;
+		  if( !usoRadio( ahora_us, cambio_us, duracion_us ) ) {
+			break;
+		  }
+		  cambio_us = cambio_us < ahora_us ? ahora_us : cambio_us;
+		  finUsoRadio_us = cambio_us + ( duracion_us > 0 ? duracion_us : 1 );
+		}
+		if( cambio_us > hasta_us ) {
+		  break;
+		}
+		ahora_us = cambio_us;
+		avisarObservador();
+		radioEncendida = !radioEncendida;
+		avisoRadio();
+	  }
+	  ahora_us = hasta_us;
+	  avisarObservador();
+	}
+
+  public:
+	SerieSimulada serie; ///< Puerto serie simulado (`Serial`).
+
+	/// Única instancia del simulador.
+	static Simulador & instancia() {
+	  static Simulador elSimulador;
+	  return elSimulador;
+	}
+
+	uint64_t ahoraMicros() const { return ahora_us; }
+
+	/// Hace avanzar el reloj virtual.
+	void avanzarMicros( uint64_t us ) {
+	  moverReloj( ahora_us + us );
+	}
+
+	/// Hace avanzar el reloj virtual contabilizándolo como tiempo bloqueado en espera.
+	void esperarMicros( uint64_t us ) {
+	  tiempoEsperando_us += us;
+	  moverReloj( ahora_us + us );
+	}
+
+	/**
+	 * @brief Instala la función a la que se llama cada vez que avanza el reloj (nullptr: ninguna).
+	 *
+	 * Hace de «tarea de la pila BLE»: lo que en la placa pasa en segundo plano mientras el
+	 * sketch espera, aquí pasa al avanzar el reloj.
+	 */
+	void observarReloj( void ( * f )( uint64_t ahora_us ) ) { observador = f; }
+
+	/// Hay alguien que observa el reloj: algo puede pasar en segundo plano en cualquier momento.
+	bool hayObservador() const { return observador != nullptr; }
+
+	/**
+	 * @brief Activa las notificaciones de radio (nullptr: las desactiva).
+	 *
+	 * Al avanzar, el reloj se para al principio y al final de cada uso de la radio y llama a
+	 * `aviso` (la interrupción SWI1 de la placa). `uso` dice cuándo empieza el siguiente uso a
+	 * partir de un instante y cuánto dura; false si la radio no se va a usar.
+	 */
+	void notificarRadio( void ( * aviso )(), bool ( * uso )( uint64_t desde_us, uint64_t & inicio_us, uint32_t & duracion_us ) ) {
+	  avisoRadio = uso != nullptr ? aviso : nullptr;
+	  usoRadio = uso;
+	  radioEncendida = false;
+	}
+
+	/// Activa o desactiva el registro de eventos (los contadores siguen funcionando).
+	void activarRegistro( bool activar ) { registrando = activar; }
+
+	/**
+	 * @brief Anota un evento con la hora actual.
+	 */
+	void anotar( TipoEvento tipo, uint32_t valor, const void * datos = nullptr, size_t longitud = 0 ) {
+	  if( !registrando ) {
+		return;
+	  }
+	  Evento e;
+	  e.tiempo_us = ahora_us;
+	  e.tipo = tipo;
+	  e.valor = valor;
+	  e.longitud = (uint8_t) ( longitud > sizeof( e.datos ) ? sizeof( e.datos ) : longitud );
+	  if( e.longitud > 0 ) {
+		memcpy( e.datos, datos, e.longitud );
+	  }
+	  registro.push_back( e );
+	}
+
+	/// La radio empieza a anunciar con el intervalo dado (en microsegundos).
+	void radioAnunciando( uint32_t intervalo_us, const uint8_t * datos, size_t longitud ) {
+	  if( anunciando ) {
+		cerrarTramoAnuncio();
+	  }
+	  anunciando = true;
+	  inicioAnuncio_us = ahora_us;
+	  intervaloAnuncio_us = intervalo_us > 0 ? intervalo_us : 1;
+	  longitudAnuncio = longitud;
+	  anotar( TipoEvento::ANUNCIO_START, intervalo_us, datos, longitud );
+	}
+
+	/// La radio deja de anunciar.
+	void radioParada() {
+	  if( !anunciando ) {
+		return;
+	  }
+	  cerrarTramoAnuncio();
+	  anunciando = false;
+	  anotar( TipoEvento::ANUNCIO_STOP, 0 );
+	}
+
+	bool radioEstaAnunciando() const { return anunciando; }
+
+	/// Instante del primer evento del tramo de anuncio en curso y microsegundos entre eventos.
+	uint64_t inicioTramoAnuncio() const { return inicioAnuncio_us; }
+	uint32_t intervaloDeAnuncio() const { return intervaloAnuncio_us; }
+
+	/// Bytes de datos del anuncio en curso.
+	size_t longitudDeAnuncio() const { return longitudAnuncio; }
+
+	/// Tiempo total anunciando, incluido el tramo en curso.
+	uint64_t tiempoAnunciandoMicros() const {
+	  return tiempoAnunciando_us + ( anunciando ? ahora_us - inicioAnuncio_us : 0 );
+	}
+
+	/// Eventos de anuncio emitidos (tramos cerrados).
+	uint64_t eventosDeAnuncio() const { return eventosAnuncio; }
+
+	/**
+	 * @brief Instantes de los eventos de anuncio del registro, hasta ahora.
+	 *
+	 * Cada tramo (de un ANUNCIO_START al siguiente START o STOP) emite un evento al arrancar y
+	 * luego uno por intervalo, igual que cuenta eventosDeAnuncio(). Necesita el registro activado.
+	 */
+	std::vector<uint64_t> instantesDeAnuncio() const {
+	  std::vector<uint64_t> instantes;
+	  bool enAire = false;
+	  uint64_t inicio = 0;
+	  uint32_t intervalo = 1;
+	  auto cerrar = [&] ( uint64_t fin ) {
+		if( !enAire ) {
+		  return;
+		}
+		instantes.push_back( inicio );
+		for( uint64_t t = inicio + intervalo; t < fin; t += intervalo ) {
+		  instantes.push_back( t );
+		}
+	  };
+	  for( const Evento & e : registro ) {
+		if( e.tipo == TipoEvento::ANUNCIO_START ) {
+		  cerrar( e.tiempo_us );
+		  enAire = true;
+		  inicio = e.tiempo_us;
+		  intervalo = e.valor > 0 ? e.valor : 1;
+		} else if( e.tipo == TipoEvento::ANUNCIO_STOP ) {
+		  cerrar( e.tiempo_us );
+		  enAire = false;
+		}
+	  }
+	  cerrar( ahora_us );
+	  return instantes;
+	}
+
+	uint64_t tiempoEsperandoMicros() const { return tiempoEsperando_us; }
+
+	/// Cuenta tiempo bloqueado en Serial (además de sumarlo al de espera).
+	void bloqueadoEnSerie( uint64_t us ) { tiempoBloqueadoSerie_us += us; }
+
+	uint64_t tiempoBloqueadoSerieMicros() const { return tiempoBloqueadoSerie_us; }
+
+	const std::vector<Evento> & eventos() const { return registro; }
+
+	void borrarRegistro() { registro.clear(); }
+
+	/**
+	 * @brief Vuelca el registro como CSV: tiempo_us,evento,valor,datos(hex).
+	 */
+	void volcarTraza( FILE * f ) const {
+	  fprintf( f, "tiempo_us,evento,valor,datos\n" );
+	  for( const Evento & e : registro ) {
+		fprintf( f, "%llu,%s,%u,", (unsigned long long) e.tiempo_us, nombreEvento( e.tipo ), e.valor );
+		for( uint8_t i = 0; i < e.longitud; i++ ) {
+		  fprintf( f, "%02x", e.datos[i] );
+		}
+		fprintf( f, "\n" );
+	  }
+	}
+  };
+
+} // namespace sim
+
+void loop();   // la del sketch, en los programas que lo incluyen
+
+namespace sim {
+
+  /**
+   * @brief Ejecuta loop() hasta que `parar()` o hasta `limite_ms` de tiempo virtual.
+   *
+   * Una vuelta de loop() que no espera nada haría girar la simulación sin avanzar el reloj: en
+   * ese caso se avanza 1 ms.
+   */
+  template< typename F >
+  void correrLoop( uint32_t limite_ms, F parar ) {
+	Simulador & s = Simulador::instancia();
+	uint32_t inicio = (uint32_t) ( s.ahoraMicros() / 1000 );
+	while( !parar() && (uint32_t) ( s.ahoraMicros() / 1000 ) - inicio < limite_ms ) {
+	  uint64_t antes = s.ahoraMicros();
+	  loop();
+	  if( s.ahoraMicros() == antes ) {
+		s.avanzarMicros( 1000 );
+	  }
+	}
+  }
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,1413 @@
+
+/**
+ * @file bluefruit.h
+ * @brief Biblioteca Bluefruit (Adafruit nRF52) simulada para compilar el sketch en el ordenador.
+ *
+ * Reproduce la parte de la API que usan EmisoraBLE y ServicioEnEmisora con el mismo
+ * comportamiento observable (límite de 31 bytes por anuncio, formato iBeacon, valores de
+ * retorno) y anota cada operación de radio en el registro de sim::Simulador.
+ */
+
+#ifndef BLUEFRUIT_SIMULADO_H_INCLUIDO
+#define BLUEFRUIT_SIMULADO_H_INCLUIDO
+
+#include "Arduino.h"
+
+typedef uint32_t err_t;
+
+#define ERROR_NONE 0
+
+// ---------------------------------------------------------------
+// constantes de la SoftDevice
+// ---------------------------------------------------------------
+#define BLE_GAP_ADV_SET_DATA_SIZE_MAX 31
+#define BLE_GAP_ADV_SET_HANDLE_NOT_SET 0xFF
+#define BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_MAX_SUPPORTED             255
+#define BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_CONNECTABLE_MAX_SUPPORTED 238
+
+#define BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED                 0x01
+#define BLE_GAP_ADV_TYPE_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED           0x05
+#define BLE_GAP_ADV_TYPE_EXTENDED_CONNECTABLE_NONSCANNABLE_UNDIRECTED     0x06
+#define BLE_GAP_ADV_TYPE_EXTENDED_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED  0x0A
+
+#define BLE_GAP_ADV_FP_ANY                    0x00
+#define BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED 0
+
+#define CONN_CFG_PERIPHERAL 1
+
+#define BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE 0x06
+
+#define BLE_GAP_AD_TYPE_FLAGS                          0x01
+#define BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE   0x07
+#define BLE_GAP_AD_TYPE_SHORT_LOCAL_NAME               0x08
+#define BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME            0x09
+#define BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA     0xFF
+
+#define BLE_CONN_HANDLE_INVALID 0xFFFF
+
+#define BLE_GATT_ATT_MTU_DEFAULT 23
+#define BLEGATT_ATT_MTU_MAX      247
+
+#define BLE_GAP_EVENT_LENGTH_DEFAULT              3
+#define BLE_GAP_CONN_SLAVE_LATENCY                0
+#define BLE_GAP_CONN_SUPERVISION_TIMEOUT_MS       4000
+
+#define BLE_GAP_PHY_AUTO   0x00
+#define BLE_GAP_PHY_1MBPS  0x01
+#define BLE_GAP_PHY_2MBPS  0x02
+#define BLE_GAP_PHY_CODED  0x04
+
+#define BLE_GAP_DATA_LENGTH_DEFAULT 27
+#define BLE_GAP_DATA_LENGTH_MAX     251
+#define BLE_GATTS_HVN_TX_QUEUE_SIZE_DEFAULT       1
+#define BLE_GATTC_WRITE_CMD_TX_QUEUE_SIZE_DEFAULT 1
+
+// ---------------------------------------------------------------
+// eventos de la SoftDevice (sólo los campos que se simulan)
+// ---------------------------------------------------------------
+#define BLE_GAP_EVT_CONNECTED          0x10
+#define BLE_GAP_EVT_DISCONNECTED       0x11
+#define BLE_GAP_EVT_CONN_PARAM_UPDATE  0x12
+#define BLE_GAP_EVT_PHY_UPDATE         0x22
+#define BLE_GAP_EVT_DATA_LENGTH_UPDATE 0x24
+#define BLE_GAP_EVT_ADV_SET_TERMINATED 0x26
+#define BLE_GATTC_EVT_EXCHANGE_MTU_RSP 0x3A
+#define BLE_GATTS_EVT_HVN_TX_COMPLETE  0x57
+
+typedef struct {
+  uint16_t evt_id;
+  uint16_t evt_len;
+} ble_evt_hdr_t;
+
+typedef struct {
+  uint16_t min_conn_interval;
+  uint16_t max_conn_interval;
+  uint16_t slave_latency;
+  uint16_t conn_sup_timeout;
+} ble_gap_conn_params_t;
+
+typedef struct {
+  uint16_t max_tx_octets;
+  uint16_t max_rx_octets;
+  uint16_t max_tx_time_us;
+  uint16_t max_rx_time_us;
+} ble_gap_data_length_params_t;
+
+typedef struct {
+  uint16_t conn_handle;
+  union {
+	struct {
+	  ble_gap_conn_params_t conn_params;
+	} conn_param_update;
+	struct {
+	  uint8_t status;
+	  uint8_t tx_phy;
+	  uint8_t rx_phy;
+	} phy_update;
+	struct {
+	  ble_gap_data_length_params_t effective_params;
+	} data_length_update;
+  } params;
+} ble_gap_evt_t;
+
+typedef struct {
+  uint8_t count;
+} ble_gatts_evt_hvn_tx_complete_t;
+
+typedef struct {
+  uint16_t conn_handle;
+  union {
+	ble_gatts_evt_hvn_tx_complete_t hvn_tx_complete;
+  } params;
+} ble_gatts_evt_t;
+
+typedef struct {
+  uint16_t conn_handle;
+  union {
+	struct {
+	  uint16_t server_rx_mtu;
+	} exchange_mtu_rsp;
+  } params;
+} ble_gattc_evt_t;
+
+typedef struct {
+  ble_evt_hdr_t header;
+  union {
+	ble_gap_evt_t gap_evt;
+	ble_gattc_evt_t gattc_evt;
+	ble_gatts_evt_t gatts_evt;
+  } evt;
+} ble_evt_t;
+
+enum CharsProperties {
+  CHR_PROPS_BROADCAST     = 0x01,
+  CHR_PROPS_READ          = 0x02,
+  CHR_PROPS_WRITE_WO_RESP = 0x04,
+  CHR_PROPS_WRITE         = 0x08,
+  CHR_PROPS_NOTIFY        = 0x10,
+  CHR_PROPS_INDICATE      = 0x20
+};
+
+enum SecureMode_t {
+  SECMODE_NO_ACCESS      = 0x00,
+  SECMODE_OPEN           = 0x11,
+  SECMODE_ENC_NO_MITM    = 0x21,
+  SECMODE_ENC_WITH_MITM  = 0x31
+};
+
+// ---------------------------------------------------------------
+// ---------------------------------------------------------------
+class BLEUuid {
+public:
+  const uint8_t * uuid128;   ///< Como en la biblioteca real: no copia los bytes, guarda el puntero.
+
+  BLEUuid( const uint8_t uuid128_[16] ) : uuid128( uuid128_ ) { }
+};
+
+// ---------------------------------------------------------------
+// ---------------------------------------------------------------
+class BLEService {
+private:
+  BLEUuid uuid;
+  bool activo = false;
+
+public:
+  BLEService( BLEUuid uuid_ ) : uuid( uuid_ ) { }
+
+  err_t begin() {
+	activo = true;
+	return ERROR_NONE;
+  }
+
+  const BLEUuid & getUuid() const { return uuid; }
+};
+
+class BLECharacteristic;
+
+typedef void (*write_cb_t) ( uint16_t conn_hdl, BLECharacteristic * chr, uint8_t * data, uint16_t len );
+
+// ---------------------------------------------------------------
+// ---------------------------------------------------------------
+class BLECharacteristic {
+private:
+  BLEUuid uuid;
+  uint8_t propiedades = 0;
+  SecureMode_t permisoLectura = SECMODE_OPEN;
+  SecureMode_t permisoEscritura = SECMODE_NO_ACCESS;
+  uint16_t longitudMaxima = 20;
+  uint8_t valor[247];
+  uint16_t longitudValor = 0;
+  write_cb_t callbackEscritura = nullptr;
+
+public:
+  BLECharacteristic( BLEUuid uuid_ ) : uuid( uuid_ ) { }
+
+  void setProperties( uint8_t props ) { propiedades = props; }
+  void setPermission( SecureMode_t read, SecureMode_t write ) { permisoLectura = read; permisoEscritura = write; }
+  void setMaxLen( uint16_t max ) { longitudMaxima = max > sizeof( valor ) ? sizeof( valor ) : max; }
+  uint16_t getMaxLen() const { return longitudMaxima; }
+  void setWriteCallback( write_cb_t fp ) { callbackEscritura = fp; }
+
+  err_t begin() { return ERROR_NONE; }
+
+  uint16_t write( const void * data, uint16_t len ) {
+	uint16_t n = len > longitudMaxima ? longitudMaxima : len;
+	memcpy( valor, data, n );
+	longitudValor = n;
+	sim::Simulador::instancia().anotar( sim::TipoEvento::ESCRITURA, n, data, n );
+	return n;
+  }
+
+  uint16_t write( const char * str ) { return write( str, (uint16_t) strlen( str ) ); }
+
+  /**
+   * @brief Como en la biblioteca real: trocea en notificaciones de MTU - 3 bytes y cada una
+   * necesita un crédito de la conexión; si no hay, se bloquea hasta 100 ms esperándolo.
+   */
+  bool notify( const void * data, uint16_t len );
+
+  bool notify( const char * str ) { return notify( str, (uint16_t) strlen( str ) ); }
+
+  /// Simula que una central escribe en la característica.
+  void simularEscritura( uint16_t connHandle, uint8_t * data, uint16_t len ) {
+	write( data, len );
+	if( callbackEscritura != nullptr ) {
+	  callbackEscritura( connHandle, this, data, len );
+	}
+  }
+};
+
+// ---------------------------------------------------------------
+// ---------------------------------------------------------------
+class BLEAdvertisingData {
+protected:
+  uint8_t datos[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
+  uint8_t cuenta = 0;
+  bool esRespuestaEscaneo;
+
+public:
+  BLEAdvertisingData( bool esRespuestaEscaneo_ = false ) : esRespuestaEscaneo( esRespuestaEscaneo_ ) { }
+
+  bool addData( uint8_t type, const void * data, uint8_t len ) {
+	if( cuenta + len + 2 > BLE_GAP_ADV_SET_DATA_SIZE_MAX ) {
+	  return false;
+	}
+	datos[cuenta] = len + 1;
+	datos[cuenta + 1] = type;
+	memcpy( &datos[cuenta + 2], data, len );
+	cuenta += len + 2;
+	if( !esRespuestaEscaneo ) {
+	  sim::Simulador::instancia().anotar( sim::TipoEvento::ANUNCIO_DATOS, type, data, len );
+	}
+	return true;
+  }
+
+  bool addFlags( uint8_t flags ) { return addData( BLE_GAP_AD_TYPE_FLAGS, &flags, 1 ); }
+
+  bool addName();
+
+  bool addService( BLEService & servicio ) {
+	return addData( BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE, servicio.getUuid().uuid128, 16 );
+  }
+
+  bool setData( const uint8_t * data, uint8_t count ) {
+	if( count > BLE_GAP_ADV_SET_DATA_SIZE_MAX ) {
+	  return false;
+	}
+	memcpy( datos, data, count );
+	cuenta = count;
+	return true;
+  }
+
+  void clearData() {
+	cuenta = 0;
+	if( !esRespuestaEscaneo ) {
+	  sim::Simulador::instancia().anotar( sim::TipoEvento::ANUNCIO_BORRAR, 0 );
+	}
+  }
+
+  uint8_t count() const { return cuenta; }
+  uint8_t * getData() { return datos; }
+};
+
+// ---------------------------------------------------------------
+// ---------------------------------------------------------------
+class BLEAdvertising;
+
+class BLEBeacon {
+private:
+  uint16_t fabricante = 0x004C;
+  uint8_t uuid128[16];
+  uint16_t major;
+  uint16_t minor;
+  int8_t rssiA1m;
+
+public:
+  BLEBeacon( const uint8_t uuid128_[16], uint16_t major_, uint16_t minor_, int8_t rssi_ )
+	: major( major_ ), minor( minor_ ), rssiA1m( rssi_ ) {
+	memcpy( uuid128, uuid128_, 16 );
+  }
+
+  void setManufacturer( uint16_t m ) { fabricante = m; }
+  void setMajorMinor( uint16_t major_, uint16_t minor_ ) { major = major_; minor = minor_; }
+
+  bool start( BLEAdvertising & adv );
+};
+
+// ---------------------------------------------------------------
+// ---------------------------------------------------------------
+class BLEAdvertising : public BLEAdvertisingData {
+private:
+  uint16_t intervaloRapido = 32;   ///< En unidades de 0,625 ms.
+  uint16_t intervaloLento = 244;
+  uint16_t tiempoRapido_s = 30;
+  bool reiniciarAlDesconectar = true;
+  bool enMarcha = false;
+  uint8_t manejador = BLE_GAP_ADV_SET_HANDLE_NOT_SET;   ///< El del conjunto de anuncio, tras el primer start().
+  const uint8_t * datosEnUso = nullptr;      ///< Búfer del que está emitiendo la radio.
+  const uint8_t * respuestaEnUso = nullptr;
+
+public:
+  void setInterval( uint16_t rapido, uint16_t lento ) {
+	intervaloRapido = rapido;
+	intervaloLento = lento;
+	sim::Simulador::instancia().anotar( sim::TipoEvento::ANUNCIO_INTERVALO, rapido );
+  }
+
+  void setIntervalMS( uint16_t rapido_ms, uint16_t lento_ms ) {
+	setInterval( (uint16_t) ( rapido_ms * 1000UL / 625 ), (uint16_t) ( lento_ms * 1000UL / 625 ) );
+  }
+
+  void setFastTimeout( uint16_t segundos ) { tiempoRapido_s = segundos; }
+  void restartOnDisconnect( bool activar ) { reiniciarAlDesconectar = activar; }
+
+  bool setBeacon( BLEBeacon & beacon ) { return beacon.start( *this ); }
+
+  bool start( uint16_t timeout = 0 );
+
+  bool stop() {
+	enMarcha = false;
+	sim::Simulador::instancia().radioParada();
+	return true;
+  }
+
+  bool isRunning() const { return enMarcha; }
+
+  /// Cambia los búferes de la radio mientras anuncia (ver sd_ble_gap_adv_set_configure()).
+  uint32_t cambiarBuferes( const uint8_t * datos_, uint16_t n, const uint8_t * respuesta_ ) {
+	if( datos_ == datosEnUso || ( respuesta_ != nullptr && respuesta_ == respuestaEnUso ) ) {
+	  return 8; // NRF_ERROR_INVALID_STATE: hay que dar búferes nuevos
+	}
+	datosEnUso = datos_;
+	respuestaEnUso = respuesta_;
+	sim::Simulador::instancia().anotar( sim::TipoEvento::ANUNCIO_DATOS, 0, datos_, n );
+	return 0;
+  }
+
+  uint16_t intervalo() const { return intervaloRapido; }
+};
+
+inline bool BLEBeacon::start( BLEAdvertising & adv ) {
+  // formato iBeacon: fabricante (LE), 0x02 0x15, UUID, major (BE), minor (BE), RSSI a 1 m
+  uint8_t carga[25];
+  carga[0] = (uint8_t) ( fabricante & 0xff );
+  carga[1] = (uint8_t) ( fabricante >> 8 );
+  carga[2] = 0x02;
+  carga[3] = 0x15;
+  memcpy( &carga[4], uuid128, 16 );
+  carga[20] = (uint8_t) ( major >> 8 );
+  carga[21] = (uint8_t) ( major & 0xff );
+  carga[22] = (uint8_t) ( minor >> 8 );
+  carga[23] = (uint8_t) ( minor & 0xff );
+  carga[24] = (uint8_t) rssiA1m;
+
+  adv.clearData();
+  sim::Simulador::instancia().anotar( sim::TipoEvento::ANUNCIO_BEACON, major, carga, sizeof( carga ) );
+  adv.addFlags( BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE );
+  return adv.addData( BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA, carga, sizeof( carga ) );
+}
+
+// ---------------------------------------------------------------
+// ---------------------------------------------------------------
+/// Lo que recibe la central simulada: cada notificación y el instante del evento de conexión en que llega.
+typedef void (*receptor_notificaciones_t) ( const uint8_t * data, uint16_t len, uint64_t instante_us );
+
+/**
+ * @struct CentralSimulada
+ * @brief Lo que acepta la central simulada cuando el periférico pide cambiar la conexión.
+ *
+ * Por defecto, un móvil Android reciente: 2M, paquetes de 251 bytes e intervalos desde 7,5 ms.
+ */
+struct CentralSimulada {
+  uint16_t mtu = BLEGATT_ATT_MTU_MAX;
+  uint8_t phys = BLE_GAP_PHY_1MBPS | BLE_GAP_PHY_2MBPS;
+  uint16_t longitudDatos = BLE_GAP_DATA_LENGTH_MAX;
+  uint16_t intervaloMinimo = 6;      ///< Unidades de 1,25 ms (iOS: 12, 15 ms).
+  uint16_t intervaloMaximo = 3200;
+  uint16_t latenciaMaxima = 30;
+  /// Rechaza por L2CAP los parámetros de conexión fuera de su rango en lugar de ajustarlos, como
+  /// iOS: la petición sale, pero la SoftDevice no manda BLE_GAP_EVT_CONN_PARAM_UPDATE.
+  bool rechazaParametros = false;
+};
+
+/**
+ * @class BLEConnection
+ * @brief Conexión simulada: eventos de conexión, cola de notificaciones y procedimientos de enlace.
+ *
+ * Tiempo en el aire: cada paquete de enlace lleva 10 bytes de cabeceras y CRC (11 en 2M) y va
+ * seguido de 150 us, el acuse vacío de la central y otros 150 us; en un evento caben los paquetes
+ * que entran en la longitud de evento de configPrphConn(). Sin nada que enviar, el periférico
+ * puede saltarse `latencia` eventos seguidos.
+ *
+ * Los cambios de PHY, longitud de datos e intervalo son procedimientos de la capa de enlace: sólo
+ * puede haber uno en marcha (si no, la petición falla como con NRF_ERROR_BUSY) y el resultado
+ * llega como evento unos eventos de conexión después. El intercambio de MTU va aparte, en ATT.
+ */
+class BLEConnection {
+public:
+  /// Eventos de conexión que tarda cada procedimiento (el PHY y el intervalo esperan a su «instante»).
+  static const uint8_t EVENTOS_PHY = 8;
+  static const uint8_t EVENTOS_LONGITUD_DATOS = 2;
+  static const uint8_t EVENTOS_PARAMETROS = 8;
+  static const uint8_t EVENTOS_MTU = 2;
+
+  /// Bits de actualizacionesHechas().
+  enum : uint8_t { HECHO_PHY = 1, HECHO_LONGITUD_DATOS = 2, HECHO_PARAMETROS = 4, HECHO_MTU = 8 };
+
+private:
+  enum Procedimiento : uint8_t { NINGUNO, PHY, LONGITUD_DATOS, PARAMETROS };
+
+  uint16_t connHandle;
+  uint16_t mtu = BLE_GATT_ATT_MTU_DEFAULT;
+  uint16_t mtuMaximo = BLE_GATT_ATT_MTU_DEFAULT;
+  uint16_t intervalo = 24;           ///< Intervalo de conexión en unidades de 1,25 ms.
+  uint16_t latencia = 0;
+  uint16_t supervision = BLE_GAP_CONN_SUPERVISION_TIMEOUT_MS / 10;
+  uint8_t phy = BLE_GAP_PHY_1MBPS;
+  uint16_t longitudDatos = BLE_GAP_DATA_LENGTH_DEFAULT;
+  uint32_t longitudEvento_us = BLE_GAP_EVENT_LENGTH_DEFAULT * 1250;
+  uint8_t creditos = BLE_GATTS_HVN_TX_QUEUE_SIZE_DEFAULT;
+  uint64_t siguienteEvento_us = 0;
+  uint16_t eventosSinAtender = 0;
+  CentralSimulada central;
+
+  // procedimiento de enlace en marcha y su resultado
+  Procedimiento procedimiento = NINGUNO;
+  uint8_t eventosProcedimiento = 0;
+  uint16_t resultado[3] = { 0, 0, 0 };
+  uint8_t eventosMtu = 0;
+  uint16_t resultadoMtu = 0;
+  uint8_t hechos = 0;
+
+  // notificaciones en la cola de la SoftDevice, pendientes de salir
+  static const uint8_t MAX_PENDIENTES = 32;
+  uint16_t pendientes[MAX_PENDIENTES];   ///< Bytes de enlace (L2CAP + ATT + datos) que le faltan a cada una.
+  uint16_t bytesPendientes[MAX_PENDIENTES];
+  uint8_t datosPendientes[MAX_PENDIENTES][BLEGATT_ATT_MTU_MAX - 3];
+  uint8_t primeraPendiente = 0;
+  uint8_t numPendientes = 0;
+  receptor_notificaciones_t receptor = nullptr;
+
+  /// Microsegundos de un intercambio: paquete con `datos` bytes, acuse vacío y los dos IFS.
+  uint32_t tiempoIntercambio( uint16_t datos ) const {
+	uint32_t bytesCabecera = phy == BLE_GAP_PHY_2MBPS ? 11 : 10;
+	uint32_t usPorByte = phy == BLE_GAP_PHY_2MBPS ? 4 : 8;
+	return ( datos + bytesCabecera ) * usPorByte + 150 + bytesCabecera * usPorByte + 150;
+  }
+
+  /// Termina el procedimiento de enlace en marcha: aplica su resultado.
+  void terminarProcedimiento() {
+	switch( procedimiento ) {
+	case PHY:
+	  phy = (uint8_t) resultado[0];
+	  hechos |= HECHO_PHY;
+	  break;
+	case LONGITUD_DATOS:
+	  longitudDatos = resultado[0];
+	  hechos |= HECHO_LONGITUD_DATOS;
+	  break;
+	case PARAMETROS:
+	  intervalo = resultado[0];
+	  latencia = resultado[1];
+	  supervision = resultado[2];
+	  hechos |= HECHO_PARAMETROS;
+	  break;
+	case NINGUNO:
+	  break;
+	}
+	procedimiento = NINGUNO;
+  }
+
+  bool empezarProcedimiento( Procedimiento p, uint8_t eventos, uint16_t r0, uint16_t r1 = 0, uint16_t r2 = 0 ) {
+	if( procedimiento != NINGUNO ) {
+	  return false;
+	}
+	procedimiento = p;
+	eventosProcedimiento = eventos;
+	resultado[0] = r0;
+	resultado[1] = r1;
+	resultado[2] = r2;
+	return true;
+  }
+
+public:
+  // estadísticas
+  uint64_t notificacionesEntregadas = 0;
+  uint64_t bytesEntregados = 0;
+  uint64_t tiempoBloqueado_us = 0;
+  uint64_t eventosAtendidos = 0;     ///< Eventos de conexión en que el periférico ha encendido la radio.
+  uint64_t eventosSaltados = 0;      ///< Eventos que se ha saltado por la latencia.
+  uint64_t tiempoRadio_us = 0;       ///< Tiempo con la radio transmitiendo o recibiendo.
+
+  BLEConnection( uint16_t connHandle_ ) : connHandle( connHandle_ ) { }
+
+  /**
+   * @brief Conexión simulada.
+   *
+   * @param mtuMaximo_ MTU máximo del periférico (configPrphConn()); al conectarse la central
+   * pide el suyo y se queda el menor.
+   * @param intervalo_ Intervalo de conexión que fija la central (unidades de 1,25 ms).
+   * @param longitudEvento Longitud del evento de conexión (unidades de 1,25 ms, como configPrphConn()).
+   * @param creditos_ Notificaciones que la SoftDevice acepta en cola (hvn_qsize).
+   */
+  BLEConnection( uint16_t connHandle_, uint16_t mtuMaximo_, uint16_t intervalo_, uint8_t longitudEvento,
+				 uint8_t creditos_, const CentralSimulada & central_, receptor_notificaciones_t receptor_ = nullptr )
+	: connHandle( connHandle_ ), mtuMaximo( mtuMaximo_ ), intervalo( intervalo_ ),
+	  longitudEvento_us( longitudEvento * 1250UL ), creditos( creditos_ ), central( central_ ), receptor( receptor_ ) {
+	mtu = central.mtu < mtuMaximo ? central.mtu : mtuMaximo;
+	siguienteEvento_us = sim::Simulador::instancia().ahoraMicros() + intervalo * 1250UL;
+  }
+
+  uint16_t handle() const { return connHandle; }
+  uint16_t getMtu() const { return mtu; }
+  uint16_t getConnectionInterval() const { return intervalo; }
+  uint16_t getSlaveLatency() const { return latencia; }
+  uint16_t getSupervisionTimeout() const { return supervision; }
+  uint8_t getPHY() const { return phy; }
+  uint16_t getDataLength() const { return longitudDatos; }
+  bool connected() const { return true; }
+
+  /// Pide cambiar de PHY (BLE_GAP_PHY_AUTO: el mejor que tengan los dos; coded no se simula).
+  bool requestPHY( uint8_t phy_ = BLE_GAP_PHY_AUTO ) {
+	uint8_t quiere = phy_ == BLE_GAP_PHY_AUTO ? (uint8_t) ( BLE_GAP_PHY_1MBPS | BLE_GAP_PHY_2MBPS ) : phy_;
+	uint8_t r = ( quiere & central.phys & BLE_GAP_PHY_2MBPS ) ? BLE_GAP_PHY_2MBPS : BLE_GAP_PHY_1MBPS;
+	return empezarProcedimiento( PHY, EVENTOS_PHY, r );
+  }
+
+  /// Pide paquetes de enlace más largos (sin parámetros: los más largos que permite el MTU).
+  bool requestDataLengthUpdate( const ble_gap_data_length_params_t * p = nullptr ) {
+	// la SoftDevice sólo reserva búferes para MTU + 4 bytes de L2CAP
+	uint16_t maximo = mtuMaximo + 4 < BLE_GAP_DATA_LENGTH_MAX ? mtuMaximo + 4 : BLE_GAP_DATA_LENGTH_MAX;
+	uint16_t quiere = p != nullptr && p->max_tx_octets != 0 ? p->max_tx_octets : maximo;
+	if( quiere < BLE_GAP_DATA_LENGTH_DEFAULT || quiere > maximo ) {
+	  return false;
+	}
+	uint16_t r = quiere < central.longitudDatos ? quiere : central.longitudDatos;
+	return empezarProcedimiento( LONGITUD_DATOS, EVENTOS_LONGITUD_DATOS, r );
+  }
+
+  /// Pide otros parámetros de conexión; la central ajusta el intervalo y la latencia a lo que admite.
+  bool requestConnectionParameter( uint16_t intervalo_, uint16_t latencia_ = BLE_GAP_CONN_SLAVE_LATENCY,
+								   uint16_t supervision_ = BLE_GAP_CONN_SUPERVISION_TIMEOUT_MS / 10 ) {
+	// la supervisión tiene que durar más que dos vueltas de latencia
+	if( supervision_ * 10000UL <= ( 1UL + latencia_ ) * intervalo_ * 1250UL * 2 ) {
+	  return false;
+	}
+	if( central.rechazaParametros && ( intervalo_ < central.intervaloMinimo || intervalo_ > central.intervaloMaximo
+									   || latencia_ > central.latenciaMaxima ) ) {
+	  return procedimiento == NINGUNO;   // la petición sale (si no hay otro procedimiento) y no vuelve nada
+	}
+	uint16_t i = intervalo_ < central.intervaloMinimo ? central.intervaloMinimo
+				 : intervalo_ > central.intervaloMaximo ? central.intervaloMaximo : intervalo_;
+	uint16_t l = latencia_ < central.latenciaMaxima ? latencia_ : central.latenciaMaxima;
+	return empezarProcedimiento( PARAMETROS, EVENTOS_PARAMETROS, i, l, supervision_ );
+  }
+
+  /// Pide un MTU mayor (el periférico como cliente de ATT; una sola vez por conexión).
+  bool requestMtuExchange( uint16_t mtu_ ) {
+	if( eventosMtu > 0 || resultadoMtu != 0 ) {
+	  return false;
+	}
+	uint16_t r = mtu_ < mtuMaximo ? mtu_ : mtuMaximo;
+	resultadoMtu = r < central.mtu ? r : central.mtu;
+	eventosMtu = EVENTOS_MTU;
+	return true;
+  }
+
+  /// Procedimientos terminados desde la última llamada (bits HECHO_...).
+  uint8_t actualizacionesHechas() {
+	uint8_t h = hechos;
+	hechos = 0;
+	return h;
+  }
+
+  // --- parte simulada de la SoftDevice ---
+
+  uint64_t siguienteEventoMicros() const { return siguienteEvento_us; }
+
+  /// Intenta coger un crédito; si no hay, espera eventos de conexión hasta 100 ms.
+  bool cogerCredito() {
+	sim::Simulador & s = sim::Simulador::instancia();
+	uint64_t limite = s.ahoraMicros() + 100000;
+	while( creditos == 0 && s.ahoraMicros() < limite ) {
+	  uint64_t hasta = siguienteEvento_us < limite ? siguienteEvento_us : limite;
+	  if( hasta <= s.ahoraMicros() ) {
+		hasta = s.ahoraMicros() + 1;
+	  }
+	  tiempoBloqueado_us += hasta - s.ahoraMicros();
+	  s.esperarMicros( hasta - s.ahoraMicros() );
+	}
+	if( creditos == 0 ) {
+	  return false;
+	}
+	creditos--;
+	return true;
+  }
+
+  /// Pone una notificación de `len` bytes en la cola de la SoftDevice.
+  void encolarNotificacion( const void * data, uint16_t len ) {
+	uint8_t i = (uint8_t) ( ( primeraPendiente + numPendientes ) % MAX_PENDIENTES );
+	pendientes[i] = (uint16_t) ( len + 7 );   // ATT (3) + L2CAP (4)
+	bytesPendientes[i] = len;
+	memcpy( datosPendientes[i], data, len );
+	numPendientes++;
+  }
+
+  /**
+   * @brief Hace los eventos de conexión hasta `ahora_us`.
+   * @return Notificaciones que se completaron (se devuelven sus créditos).
+   */
+  uint8_t procesarHasta( uint64_t ahora_us ) {
+	uint8_t completadas = 0;
+	while( siguienteEvento_us <= ahora_us ) {
+	  bool ocupado = numPendientes > 0 || procedimiento != NINGUNO || eventosMtu > 0;
+	  if( !ocupado && eventosSinAtender < latencia ) {
+		eventosSinAtender++;
+		eventosSaltados++;
+		siguienteEvento_us += intervalo * 1250UL;
+		continue;
+	  }
+	  eventosSinAtender = 0;
+	  eventosAtendidos++;
+
+	  uint32_t limite_us = longitudEvento_us < intervalo * 1250UL ? longitudEvento_us : intervalo * 1250UL;
+	  uint32_t usado_us = 0;
+	  while( numPendientes > 0 ) {
+		uint16_t & faltan = pendientes[primeraPendiente];
+		uint16_t trozo = faltan < longitudDatos ? faltan : longitudDatos;
+		uint32_t t = tiempoIntercambio( trozo );
+		if( usado_us + t > limite_us ) {
+		  break;
+		}
+		usado_us += t;
+		faltan -= trozo;
+		if( faltan == 0 ) {
+		  notificacionesEntregadas++;
+		  bytesEntregados += bytesPendientes[primeraPendiente];
+		  if( receptor != nullptr ) {
+			receptor( datosPendientes[primeraPendiente], bytesPendientes[primeraPendiente], siguienteEvento_us );
+		  }
+		  primeraPendiente = (uint8_t) ( ( primeraPendiente + 1 ) % MAX_PENDIENTES );
+		  numPendientes--;
+		  completadas++;
+		}
+	  }
+	  // sin datos, el evento es un paquete vacío en cada sentido
+	  tiempoRadio_us += usado_us > 0 ? usado_us : tiempoIntercambio( 0 );
+
+	  if( procedimiento != NINGUNO && --eventosProcedimiento == 0 ) {
+		terminarProcedimiento();
+	  }
+	  if( eventosMtu > 0 && --eventosMtu == 0 ) {
+		mtu = resultadoMtu;
+		hechos |= HECHO_MTU;
+	  }
+	  siguienteEvento_us += intervalo * 1250UL;
+	}
+	creditos += completadas;
+	return completadas;
+  }
+
+  /**
+   * @brief El siguiente evento de conexión en que el periférico encenderá la radio, a partir de
+   * `desde_us`, y su duración con lo que hay ahora en cola (como lo hará procesarHasta()).
+   */
+  void siguienteUsoRadio( uint64_t desde_us, uint64_t & inicio_us, uint32_t & duracion_us ) const {
+	bool ocupado = numPendientes > 0 || procedimiento != NINGUNO || eventosMtu > 0;
+	uint64_t t = siguienteEvento_us;
+	uint16_t sinAtender = eventosSinAtender;
+	while( t < desde_us || ( !ocupado && sinAtender < latencia ) ) {
+	  sinAtender++;
+	  t += intervalo * 1250UL;
+	}
+	inicio_us = t;
+
+	uint32_t limite_us = longitudEvento_us < intervalo * 1250UL ? longitudEvento_us : intervalo * 1250UL;
+	uint32_t usado_us = 0;
+	uint8_t i = primeraPendiente;
+	uint8_t quedan = numPendientes;
+	uint16_t faltan = quedan > 0 ? pendientes[i] : 0;
+	while( quedan > 0 ) {
+	  uint16_t trozo = faltan < longitudDatos ? faltan : longitudDatos;
+	  uint32_t us = tiempoIntercambio( trozo );
+	  if( usado_us + us > limite_us ) {
+		break;
+	  }
+	  usado_us += us;
+	  faltan -= trozo;
+	  if( faltan == 0 ) {
+		i = (uint8_t) ( ( i + 1 ) % MAX_PENDIENTES );
+		quedan--;
+		faltan = quedan > 0 ? pendientes[i] : 0;
+	  }
+	}
+	duracion_us = usado_us > 0 ? usado_us : tiempoIntercambio( 0 );
+  }
+};
+
+typedef void (*ble_connect_callback_t) ( uint16_t conn_hdl );
+typedef void (*ble_disconnect_callback_t) ( uint16_t conn_hdl, uint8_t reason );
+
+class BLEPeriph {
+public:
+  ble_connect_callback_t callbackConexion = nullptr;
+  ble_disconnect_callback_t callbackDesconexion = nullptr;
+
+  void setConnectCallback( ble_connect_callback_t fp ) { callbackConexion = fp; }
+  void setDisconnectCallback( ble_disconnect_callback_t fp ) { callbackDesconexion = fp; }
+};
+
+// ---------------------------------------------------------------
+// ---------------------------------------------------------------
+/// Lo que hace la SoftDevice con el conjunto de anuncio al conectarse una central (ver ConjuntoAnuncioSimulado).
+inline void pararAnuncioConectable();
+
+class AdafruitBluefruit {
+private:
+  char nombre[32] = "Bluefruit52";
+  int8_t potencia = 0;
+  BLEConnection * conexion = nullptr;
+
+  // configuración de las conexiones como periférico (configPrphConn)
+  uint16_t mtuMaximo = BLE_GATT_ATT_MTU_DEFAULT;
+  uint8_t longitudEvento = BLE_GAP_EVENT_LENGTH_DEFAULT;
+  uint8_t colaNotificaciones = BLE_GATTS_HVN_TX_QUEUE_SIZE_DEFAULT;
+
+  CentralSimulada laCentral;
+
+  void ( * callbackEventos )( ble_evt_t * ) = nullptr;
+
+  void avisarEvento( uint16_t id, uint16_t connHandle, uint8_t cuenta = 0 ) {
+	if( callbackEventos == nullptr ) {
+	  return;
+	}
+	ble_evt_t evento;
+	memset( &evento, 0, sizeof( evento ) );
+	evento.header.evt_id = id;
+	evento.header.evt_len = sizeof( evento );
+	switch( id ) {
+	case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+	  evento.evt.gatts_evt.conn_handle = connHandle;
+	  evento.evt.gatts_evt.params.hvn_tx_complete.count = cuenta;
+	  break;
+	case BLE_GATTC_EVT_EXCHANGE_MTU_RSP:
+	  evento.evt.gattc_evt.conn_handle = connHandle;
+	  evento.evt.gattc_evt.params.exchange_mtu_rsp.server_rx_mtu = conexion->getMtu();
+	  break;
+	case BLE_GAP_EVT_PHY_UPDATE:
+	  evento.evt.gap_evt.conn_handle = connHandle;
+	  evento.evt.gap_evt.params.phy_update.tx_phy = conexion->getPHY();
+	  evento.evt.gap_evt.params.phy_update.rx_phy = conexion->getPHY();
+	  break;
+	case BLE_GAP_EVT_DATA_LENGTH_UPDATE:
+	  evento.evt.gap_evt.conn_handle = connHandle;
+	  evento.evt.gap_evt.params.data_length_update.effective_params.max_tx_octets = conexion->getDataLength();
+	  evento.evt.gap_evt.params.data_length_update.effective_params.max_rx_octets = conexion->getDataLength();
+	  break;
+	case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+	  evento.evt.gap_evt.conn_handle = connHandle;
+	  evento.evt.gap_evt.params.conn_param_update.conn_params.min_conn_interval = conexion->getConnectionInterval();
+	  evento.evt.gap_evt.params.conn_param_update.conn_params.max_conn_interval = conexion->getConnectionInterval();
+	  evento.evt.gap_evt.params.conn_param_update.conn_params.slave_latency = conexion->getSlaveLatency();
+	  evento.evt.gap_evt.params.conn_param_update.conn_params.conn_sup_timeout = conexion->getSupervisionTimeout();
+	  break;
+	default:
+	  evento.evt.gap_evt.conn_handle = connHandle;
+	}
+	callbackEventos( &evento );
+  }
+
+  /// Lo que hace la pila BLE mientras pasa el tiempo: eventos de conexión.
+  static void alAvanzarElReloj( uint64_t ahora_us ) {
+	AdafruitBluefruit & b = instancia();
+	if( b.conexion == nullptr ) {
+	  return;
+	}
+	uint8_t completadas = b.conexion->procesarHasta( ahora_us );
+	if( completadas > 0 ) {
+	  b.avisarEvento( BLE_GATTS_EVT_HVN_TX_COMPLETE, b.conexion->handle(), completadas );
+	}
+	uint8_t hechas = b.conexion->actualizacionesHechas();
+	const uint16_t EVENTOS[4] = { BLE_GAP_EVT_PHY_UPDATE, BLE_GAP_EVT_DATA_LENGTH_UPDATE, BLE_GAP_EVT_CONN_PARAM_UPDATE,
+								  BLE_GATTC_EVT_EXCHANGE_MTU_RSP };
+	for( uint8_t i = 0; i < 4; i++ ) {
+	  if( hechas & ( 1 << i ) ) {
+		b.avisarEvento( EVENTOS[i], b.conexion->handle() );
+	  }
+	}
+  }
+
+public:
+  BLEAdvertising Advertising;
+  BLEAdvertisingData ScanResponse { true };
+  BLEPeriph Periph;
+
+  bool begin() { return true; }
+
+  /// Configuración de las conexiones como periférico (antes de begin()).
+  void configPrphConn( uint16_t mtu_max, uint16_t event_len, uint8_t hvn_qsize, uint8_t wrcmd_qsize ) {
+	(void) wrcmd_qsize;
+	mtuMaximo = mtu_max;
+	longitudEvento = (uint8_t) event_len;
+	colaNotificaciones = hvn_qsize;
+  }
+
+  /// Callback que recibe todos los eventos de la SoftDevice.
+  void setEventCallback( void ( * fp )( ble_evt_t * ) ) { callbackEventos = fp; }
+
+  bool setTxPower( int8_t dbm ) {
+	potencia = dbm;
+	sim::Simulador::instancia().anotar( sim::TipoEvento::POTENCIA, (uint8_t) dbm );
+	return true;
+  }
+  int8_t getTxPower() const { return potencia; }
+
+  void setName( const char * n ) {
+	strncpy( nombre, n, sizeof( nombre ) - 1 );
+	nombre[sizeof( nombre ) - 1] = 0;
+  }
+  const char * getName() const { return nombre; }
+
+  BLEConnection * Connection( uint16_t connHandle ) {
+	return conexion != nullptr && conexion->handle() == connHandle ? conexion : nullptr;
+  }
+
+  bool connected() const { return conexion != nullptr; }
+
+  /// El siguiente evento de conexión con la radio encendida (ver BLEConnection::siguienteUsoRadio()).
+  bool siguienteUsoRadioConexion( uint64_t desde_us, uint64_t & inicio_us, uint32_t & duracion_us ) const {
+	if( conexion == nullptr ) {
+	  return false;
+	}
+	conexion->siguienteUsoRadio( desde_us, inicio_us, duracion_us );
+	return true;
+  }
+
+  uint16_t connHandle() const { return conexion != nullptr ? conexion->handle() : BLE_CONN_HANDLE_INVALID; }
+
+  /// Lo que aceptará la central en las próximas conexiones simuladas.
+  void simularCentral( const CentralSimulada & central ) { laCentral = central; }
+
+  /**
+   * @brief Simula que una central se conecta.
+   *
+   * @param connHandle Manejador de la conexión.
+   * @param mtuCentral MTU que pide la central (se queda en el menor de los dos).
+   * @param intervalo Intervalo de conexión que fija la central (unidades de 1,25 ms).
+   * @param receptor Si no es nulo, recibe cada notificación cuando llega a la central (las que
+   * quedan en la cola de la SoftDevice al desconectarse se pierden).
+   */
+  void simularConexion( uint16_t connHandle, uint16_t mtuCentral = BLE_GATT_ATT_MTU_DEFAULT, uint16_t intervalo = 24,
+						receptor_notificaciones_t receptor = nullptr ) {
+	static BLEConnection laConexion( 0 );
+	CentralSimulada central = laCentral;
+	central.mtu = mtuCentral;
+	laConexion = BLEConnection( connHandle, mtuMaximo, intervalo, longitudEvento, colaNotificaciones, central,
+								receptor );
+	conexion = &laConexion;
+	sim::Simulador::instancia().observarReloj( alAvanzarElReloj );
+	pararAnuncioConectable();
+	avisarEvento( BLE_GAP_EVT_CONNECTED, connHandle );
+	if( Periph.callbackConexion != nullptr ) {
+	  Periph.callbackConexion( connHandle );
+	}
+  }
+
+  /// Simula que la central se desconecta.
+  void simularDesconexion( uint8_t razon ) {
+	if( conexion == nullptr ) {
+	  return;
+	}
+	uint16_t h = conexion->handle();
+	conexion = nullptr;
+	sim::Simulador::instancia().observarReloj( nullptr );
+	avisarEvento( BLE_GAP_EVT_DISCONNECTED, h );
+	if( Periph.callbackDesconexion != nullptr ) {
+	  Periph.callbackDesconexion( h, razon );
+	}
+  }
+
+  static AdafruitBluefruit & instancia() {
+	static AdafruitBluefruit elBluefruit;
+	return elBluefruit;
+  }
+};
+
+static AdafruitBluefruit & Bluefruit = AdafruitBluefruit::instancia();
+
+inline bool BLECharacteristic::notify( const void * data, uint16_t len ) {
+  if( ( propiedades & CHR_PROPS_NOTIFY ) == 0 ) {
+	return false;
+  }
+  uint16_t n = len > longitudMaxima ? longitudMaxima : len;
+  BLEConnection * conexion = Bluefruit.Connection( Bluefruit.connHandle() );
+  if( conexion == nullptr ) {
+	// sin central conectada sólo se actualiza el valor
+	sim::Simulador::instancia().anotar( sim::TipoEvento::NOTIFICACION, n, data, n );
+	return false;
+  }
+  const uint8_t * p = (const uint8_t *) data;
+  uint16_t trozoMaximo = conexion->getMtu() - 3;
+  while( n > 0 ) {
+	uint16_t trozo = n < trozoMaximo ? n : trozoMaximo;
+	if( !conexion->cogerCredito() ) {
+	  return false;
+	}
+	conexion->encolarNotificacion( p, trozo );
+	sim::Simulador::instancia().anotar( sim::TipoEvento::NOTIFICACION, trozo, p, trozo );
+	p += trozo;
+	n -= trozo;
+  }
+  return true;
+}
+
+inline bool BLEAdvertisingData::addName() {
+  const char * n = Bluefruit.getName();
+  size_t len = strlen( n );
+  int sitio = BLE_GAP_ADV_SET_DATA_SIZE_MAX - cuenta - 2;
+  if( sitio <= 0 ) {
+	return false;
+  }
+  if( (int) len > sitio ) {
+	return addData( BLE_GAP_AD_TYPE_SHORT_LOCAL_NAME, n, (uint8_t) sitio );
+  }
+  return addData( BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME, n, (uint8_t) len );
+}
+
+// ---------------------------------------------------------------
+// llamadas directas a la SoftDevice
+// ---------------------------------------------------------------
+#define NRF_SUCCESS               0
+#define NRF_ERROR_INVALID_PARAM   7
+#define NRF_ERROR_INVALID_STATE   8
+#define NRF_ERROR_INVALID_LENGTH  9
+#define NRF_ERROR_NOT_SUPPORTED   6
+#define NRF_ERROR_NO_MEM          4
+#define BLE_ERROR_INVALID_ADV_HANDLE 0x3004
+
+typedef struct {
+  uint8_t * p_data;
+  uint16_t len;
+} ble_data_t;
+
+typedef struct {
+  ble_data_t adv_data;
+  ble_data_t scan_rsp_data;
+} ble_gap_adv_data_t;
+
+/// Propiedades de un conjunto de anuncio: tipo (BLE_GAP_ADV_TYPE_...) y opciones.
+typedef struct {
+  uint8_t type;
+  uint8_t anonymous : 1;
+  uint8_t include_tx_power : 1;
+} ble_gap_adv_properties_t;
+
+/// Parámetros de un conjunto de anuncio (los campos de la SoftDevice que el simulador mira o admite).
+typedef struct {
+  ble_gap_adv_properties_t properties;
+  const void * p_peer_addr;
+  uint32_t interval;          ///< Unidades de 0,625 ms.
+  uint16_t duration;          ///< Unidades de 10 ms (0: sin límite).
+  uint8_t max_adv_evts;
+  uint8_t channel_mask[5];
+  uint8_t filter_policy;
+  uint8_t primary_phy;        ///< BLE_GAP_PHY_1MBPS o BLE_GAP_PHY_CODED (AUTO: 1M).
+  uint8_t secondary_phy;      ///< PHY de los paquetes AUX_* de los anuncios extendidos.
+  uint8_t set_id : 4;
+  uint8_t scan_req_notification : 1;
+} ble_gap_adv_params_t;
+
+/// Tipos de anuncio extendido (los que van con ADV_EXT_IND en los canales primarios y AUX_* en los secundarios).
+inline bool esAnuncioExtendido( uint8_t tipo ) {
+  return tipo >= BLE_GAP_ADV_TYPE_EXTENDED_CONNECTABLE_NONSCANNABLE_UNDIRECTED;
+}
+
+inline bool esAnuncioConectable( uint8_t tipo ) {
+  return tipo == BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED
+	|| tipo == BLE_GAP_ADV_TYPE_EXTENDED_CONNECTABLE_NONSCANNABLE_UNDIRECTED;
+}
+
+/**
+ * @struct PaquetesEventoAnuncio
+ * @brief Lo que sale al aire en un evento de anuncio, según el modelo de la capa de enlace del simulador.
+ *
+ * Anuncio clásico: un ADV_IND (dirección y hasta 31 bytes) en cada uno de los tres canales
+ * primarios. Anuncio extendido: un ADV_EXT_IND de 7 bytes (cabecera extendida, ADI y AuxPtr) en
+ * cada canal primario, que apunta a un AUX_ADV_IND en un canal secundario con la dirección, el ADI
+ * y los primeros datos; lo que no cabe va en AUX_CHAIN_IND encadenados, cada uno con el AuxPtr del
+ * siguiente. Las PDU son de 255 bytes como mucho, así que el AUX_ADV_IND lleva 245 bytes de datos
+ * (242 si le sigue otro paquete) y cada AUX_CHAIN_IND 251 (248). Un anuncio conectable no se puede
+ * encadenar: la SoftDevice sólo admite BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_CONNECTABLE_MAX_SUPPORTED.
+ *
+ * El tiempo en el aire es el de transmitir los paquetes (preámbulo, dirección de acceso, cabecera,
+ * PDU y CRC), sin los huecos entre ellos ni el arranque de la radio:
+ *  - 1M: (10 + PDU) x 8 us;  2M: (11 + PDU) x 4 us;
+ *  - codificado S8: 80 us de preámbulo, 256 de dirección de acceso, 16 + 24 de CI y TERM1,
+ *    (5 + PDU) x 64 us y 24 de TERM2, es decir 400 + (5 + PDU) x 64 us.
+ */
+struct PaquetesEventoAnuncio {
+  uint8_t primarios = 0;     ///< ADV_IND o ADV_EXT_IND (uno por canal primario).
+  uint8_t secundarios = 0;   ///< AUX_ADV_IND más AUX_CHAIN_IND.
+  uint32_t aire_us = 0;      ///< Tiempo transmitiendo en todo el evento.
+
+  static const uint8_t CANALES_PRIMARIOS = 3;
+  static const uint8_t PDU_MAXIMA = 255;
+  static const uint8_t CABECERA_ADV_IND = 6;                  ///< AdvA.
+  static const uint8_t CABECERA_ADV_EXT_IND = 1 + 1 + 2 + 3;  ///< Longitud y modo, banderas, ADI, AuxPtr.
+  static const uint8_t CABECERA_AUX_ADV_IND = 1 + 1 + 6 + 2;  ///< Longitud y modo, banderas, AdvA, ADI.
+  static const uint8_t CABECERA_AUX_CHAIN_IND = 1 + 1 + 2;    ///< Longitud y modo, banderas, ADI.
+  static const uint8_t AUX_PTR = 3;
+
+  /// Microsegundos en el aire de una PDU de `bytes` bytes en el PHY `phy`.
+  static uint32_t tiempoPDU( uint8_t phy, uint16_t bytes ) {
+	if( phy == BLE_GAP_PHY_CODED ) {
+	  return 400 + ( 5 + bytes ) * 64UL;
+	}
+	if( phy == BLE_GAP_PHY_2MBPS ) {
+	  return ( 11 + bytes ) * 4UL;
+	}
+	return ( 10 + bytes ) * 8UL;
+  }
+
+  /// Evento de un anuncio clásico (ADV_IND) con `datos` bytes.
+  static PaquetesEventoAnuncio clasico( uint16_t datos ) {
+	PaquetesEventoAnuncio r;
+	r.primarios = CANALES_PRIMARIOS;
+	r.aire_us = CANALES_PRIMARIOS * tiempoPDU( BLE_GAP_PHY_1MBPS, CABECERA_ADV_IND + datos );
+	return r;
+  }
+
+  /// Evento de un anuncio extendido con `datos` bytes en los PHY dados (AUTO: 1M).
+  static PaquetesEventoAnuncio extendido( uint16_t datos, uint8_t phyPrimario, uint8_t phySecundario ) {
+	PaquetesEventoAnuncio r;
+	r.primarios = CANALES_PRIMARIOS;
+	r.aire_us = CANALES_PRIMARIOS * tiempoPDU( phyPrimario, CABECERA_ADV_EXT_IND );
+	uint16_t cabecera = CABECERA_AUX_ADV_IND;
+	do {
+	  uint16_t sitio = PDU_MAXIMA - cabecera;
+	  uint16_t van = datos;
+	  if( datos > sitio ) {
+		cabecera += AUX_PTR;   // le sigue otro paquete
+		van = (uint16_t) ( PDU_MAXIMA - cabecera );
+	  }
+	  r.aire_us += tiempoPDU( phySecundario, cabecera + van );
+	  r.secundarios++;
+	  datos = (uint16_t) ( datos - van );
+	  cabecera = CABECERA_AUX_CHAIN_IND;
+	} while( datos > 0 );
+	return r;
+  }
+};
+
+/**
+ * @class ConjuntoAnuncioSimulado
+ * @brief El conjunto de anuncio 0 de la SoftDevice cuando se usa directamente con
+ * sd_ble_gap_adv_set_configure() y sd_ble_gap_adv_start(), p. ej. para anuncios extendidos.
+ *
+ * Es el mismo conjunto que usa Bluefruit.Advertising (sólo hay uno): mientras uno de los dos
+ * anuncia, el otro no puede arrancar, y Bluefruit.Advertising.start() lo vuelve a configurar con
+ * sus parámetros. No existe hasta que alguien lo configura con BLE_GAP_ADV_SET_HANDLE_NOT_SET (la
+ * SoftDevice le da el 0): antes, el manejador 0 es inválido, y después no se puede crear otro.
+ * Bluefruit.Advertising.start() lo crea la primera vez y se queda con su manejador. simularSoloClasicos() hace de controlador sin BLE 5 (p. ej. la S112 antigua):
+ * los tipos extendidos y los PHY que no sean 1M se rechazan con NRF_ERROR_NOT_SUPPORTED.
+ */
+class ConjuntoAnuncioSimulado {
+private:
+  bool creado = false;
+  bool configurado = false;
+  bool enMarcha = false;
+  bool soloClasicos = false;
+  ble_gap_adv_params_t parametros;
+  const uint8_t * datosEnUso = nullptr;
+  uint16_t longitud = 0;
+
+  void ponerEnElAire() {
+	sim::Simulador::instancia().radioAnunciando( parametros.interval * 625UL, datosEnUso, longitud );
+  }
+
+public:
+  static ConjuntoAnuncioSimulado & instancia() {
+	static ConjuntoAnuncioSimulado elConjunto;
+	return elConjunto;
+  }
+
+  void simularSoloClasicos( bool activar ) { soloClasicos = activar; }
+
+  /**
+   * @brief Comprueba el manejador de una llamada a la SoftDevice; con `crear`, uno
+   * BLE_GAP_ADV_SET_HANDLE_NOT_SET crea el conjunto y pasa a ser el 0.
+   */
+  uint32_t comprobarManejador( uint8_t & manejador, bool crear ) {
+	if( crear && manejador == BLE_GAP_ADV_SET_HANDLE_NOT_SET ) {
+	  if( creado ) {
+		return NRF_ERROR_NO_MEM;   // la SoftDevice sólo tiene un conjunto
+	  }
+	  creado = true;
+	  manejador = 0;
+	  return NRF_SUCCESS;
+	}
+	return manejador == 0 && creado ? NRF_SUCCESS : BLE_ERROR_INVALID_ADV_HANDLE;
+  }
+
+  /// Bluefruit.Advertising ha configurado el conjunto con sus parámetros.
+  void olvidarConfiguracion() { configurado = false; }
+
+  bool estaEnMarcha() const { return enMarcha; }
+  const ble_gap_adv_params_t & parametrosActuales() const { return parametros; }
+  const uint8_t * datos() const { return datosEnUso; }
+  uint16_t longitudDatos() const { return longitud; }
+
+  /// Lo que sale al aire en cada evento con la configuración actual.
+  PaquetesEventoAnuncio paquetesPorEvento() const {
+	if( !esAnuncioExtendido( parametros.properties.type ) ) {
+	  return PaquetesEventoAnuncio::clasico( longitud );
+	}
+	return PaquetesEventoAnuncio::extendido( longitud, parametros.primary_phy, parametros.secondary_phy );
+  }
+
+  uint32_t configurar( ble_gap_adv_data_t const * d, ble_gap_adv_params_t const * p ) {
+	const uint8_t * nuevos = d != nullptr ? d->adv_data.p_data : nullptr;
+	uint16_t n = d != nullptr ? d->adv_data.len : 0;
+	if( p == nullptr ) {
+	  // cambio de datos: con el conjunto en marcha, sin parar la radio; parado, para el próximo
+	  // sd_ble_gap_adv_start() (y no sale nada al aire)
+	  if( !configurado ) {
+		return NRF_ERROR_INVALID_STATE;
+	  }
+	  if( ( enMarcha && nuevos == datosEnUso ) || n > maximoDatos( parametros.properties.type ) ) {
+		return n > maximoDatos( parametros.properties.type ) ? NRF_ERROR_INVALID_LENGTH : NRF_ERROR_INVALID_STATE;
+	  }
+	  datosEnUso = nuevos;
+	  longitud = n;
+	  if( enMarcha ) {
+		sim::Simulador::instancia().anotar( sim::TipoEvento::ANUNCIO_DATOS, 0, nuevos, n );
+	  }
+	  return NRF_SUCCESS;
+	}
+	if( enMarcha ) {
+	  return NRF_ERROR_INVALID_STATE;
+	}
+	bool extendido = esAnuncioExtendido( p->properties.type );
+	uint8_t primario = p->primary_phy == BLE_GAP_PHY_AUTO ? BLE_GAP_PHY_1MBPS : p->primary_phy;
+	uint8_t secundario = p->secondary_phy == BLE_GAP_PHY_AUTO ? BLE_GAP_PHY_1MBPS : p->secondary_phy;
+	if( soloClasicos && ( extendido || primario != BLE_GAP_PHY_1MBPS ) ) {
+	  return NRF_ERROR_NOT_SUPPORTED;
+	}
+	if( primario == BLE_GAP_PHY_2MBPS || ( !extendido && primario != BLE_GAP_PHY_1MBPS )
+		|| ( secundario & ~( BLE_GAP_PHY_1MBPS | BLE_GAP_PHY_2MBPS | BLE_GAP_PHY_CODED ) ) != 0 ) {
+	  return NRF_ERROR_INVALID_PARAM;
+	}
+	if( n > maximoDatos( p->properties.type ) ) {
+	  return NRF_ERROR_INVALID_LENGTH;
+	}
+	parametros = *p;
+	parametros.primary_phy = primario;
+	parametros.secondary_phy = secundario;
+	datosEnUso = nuevos;
+	longitud = n;
+	configurado = true;
+	return NRF_SUCCESS;
+  }
+
+  uint32_t arrancar() {
+	if( !configurado || enMarcha || Bluefruit.Advertising.isRunning() ) {
+	  return NRF_ERROR_INVALID_STATE;
+	}
+	enMarcha = true;
+	ponerEnElAire();
+	return NRF_SUCCESS;
+  }
+
+  uint32_t parar() {
+	if( !enMarcha ) {
+	  return NRF_ERROR_INVALID_STATE;
+	}
+	enMarcha = false;
+	sim::Simulador::instancia().radioParada();
+	return NRF_SUCCESS;
+  }
+
+  /// Se ha conectado una central: un anuncio conectable se para solo (la SoftDevice sólo avisa con BLE_GAP_EVT_CONNECTED).
+  void alConectarse() {
+	if( enMarcha && esAnuncioConectable( parametros.properties.type ) ) {
+	  parar();
+	}
+  }
+
+  /// Bytes de datos que admite la SoftDevice con un tipo de anuncio.
+  static uint16_t maximoDatos( uint8_t tipo ) {
+	if( !esAnuncioExtendido( tipo ) ) {
+	  return BLE_GAP_ADV_SET_DATA_SIZE_MAX;
+	}
+	return esAnuncioConectable( tipo ) ? BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_CONNECTABLE_MAX_SUPPORTED
+	  : BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_MAX_SUPPORTED;
+  }
+};
+
+inline void pararAnuncioConectable() {
+  ConjuntoAnuncioSimulado::instancia().alConectarse();
+}
+
+inline bool BLEAdvertising::start( uint16_t timeout ) {
+  (void) timeout;
+  ConjuntoAnuncioSimulado & conjunto = ConjuntoAnuncioSimulado::instancia();
+  if( conjunto.estaEnMarcha() ) {
+	return false;   // la SoftDevice no deja configurar el conjunto mientras anuncia
+  }
+  if( conjunto.comprobarManejador( manejador, true ) != NRF_SUCCESS ) {
+	return false;   // el conjunto lo ha creado otro: Bluefruit no puede anunciar
+  }
+  conjunto.olvidarConfiguracion();
+  enMarcha = true;
+  datosEnUso = datos;
+  respuestaEnUso = Bluefruit.ScanResponse.getData();
+  // el simulador no modela el paso del intervalo rápido al lento: se usa el rápido
+  sim::Simulador::instancia().radioAnunciando( intervaloRapido * 625UL, datos, cuenta );
+  return true;
+}
+
+/**
+ * @brief Configura el conjunto de anuncio 0.
+ *
+ * Con `p_adv_params` nulo sólo cambia los datos de un anuncio en marcha (sin parar la radio), sea
+ * el de Bluefruit.Advertising o uno arrancado con sd_ble_gap_adv_start(); si el conjunto está
+ * configurado pero parado (p. ej. al conectarse una central), la SoftDevice también lo acepta y
+ * los datos no salen hasta volver a arrancarlo. Con parámetros, el
+ * conjunto tiene que estar parado y queda listo para sd_ble_gap_adv_start(). El manejador tiene
+ * que ser el 0 de un conjunto ya creado, o BLE_GAP_ADV_SET_HANDLE_NOT_SET con parámetros para
+ * crearlo (ver ConjuntoAnuncioSimulado).
+ */
+inline uint32_t sd_ble_gap_adv_set_configure( uint8_t * p_adv_handle,
+											  ble_gap_adv_data_t const * p_adv_data,
+											  ble_gap_adv_params_t const * p_adv_params ) {
+  if( p_adv_handle == nullptr || ( p_adv_data == nullptr && p_adv_params == nullptr ) ) {
+	return NRF_ERROR_INVALID_PARAM;
+  }
+  ConjuntoAnuncioSimulado & conjunto = ConjuntoAnuncioSimulado::instancia();
+  uint32_t error = conjunto.comprobarManejador( *p_adv_handle, p_adv_params != nullptr );
+  if( error != NRF_SUCCESS ) {
+	return error;
+  }
+  if( p_adv_params != nullptr ) {
+	if( Bluefruit.Advertising.isRunning() ) {
+	  return NRF_ERROR_INVALID_STATE;
+	}
+	return conjunto.configurar( p_adv_data, p_adv_params );
+  }
+  if( !Bluefruit.Advertising.isRunning() ) {
+	return conjunto.configurar( p_adv_data, nullptr );
+  }
+  return Bluefruit.Advertising.cambiarBuferes( p_adv_data->adv_data.p_data, p_adv_data->adv_data.len,
+											   p_adv_data->scan_rsp_data.p_data );
+}
+
+/**
+ * @brief Arranca el conjunto de anuncio configurado con sd_ble_gap_adv_set_configure().
+ */
+inline uint32_t sd_ble_gap_adv_start( uint8_t adv_handle, uint8_t conn_cfg_tag ) {
+  (void) conn_cfg_tag;
+  uint32_t error = ConjuntoAnuncioSimulado::instancia().comprobarManejador( adv_handle, false );
+  if( error != NRF_SUCCESS ) {
+	return error;
+  }
+  return ConjuntoAnuncioSimulado::instancia().arrancar();
+}
+
+/**
+ * @brief Para el conjunto de anuncio arrancado con sd_ble_gap_adv_start().
+ */
+inline uint32_t sd_ble_gap_adv_stop( uint8_t adv_handle ) {
+  uint32_t error = ConjuntoAnuncioSimulado::instancia().comprobarManejador( adv_handle, false );
+  if( error != NRF_SUCCESS ) {
+	return error;
+  }
+  return ConjuntoAnuncioSimulado::instancia().parar();
+}
+
+// ---------------------------------------------------------------
+// notificaciones de radio de la SoftDevice
+// ---------------------------------------------------------------
+#define NRF_RADIO_NOTIFICATION_TYPE_NONE            0
+#define NRF_RADIO_NOTIFICATION_TYPE_INT_ON_ACTIVE   1
+#define NRF_RADIO_NOTIFICATION_TYPE_INT_ON_INACTIVE 2
+#define NRF_RADIO_NOTIFICATION_TYPE_INT_ON_BOTH     3
+
+#define NRF_RADIO_NOTIFICATION_DISTANCE_NONE        0
+
+typedef enum {
+  SWI1_EGU1_IRQn = 21   ///< La interrupción de las notificaciones de radio.
+} IRQn_Type;
+
+/// Manejador de la interrupción SWI1 (lo define la aplicación).
+extern "C" void SWI1_EGU1_IRQHandler();
+
+/**
+ * @brief Los usos de la radio del simulador, para las notificaciones de radio.
+ *
+ * Cada evento de anuncio (el tiempo en el aire de PaquetesEventoAnuncio, sin los huecos entre
+ * canales) y cada evento de conexión atendido (como BLEConnection::procesarHasta()).
+ */
+inline bool siguienteUsoRadioSimulado( uint64_t desde_us, uint64_t & inicio_us, uint32_t & duracion_us ) {
+  sim::Simulador & s = sim::Simulador::instancia();
+  bool hay = false;
+  if( s.radioEstaAnunciando() ) {
+	uint64_t inicio = s.inicioTramoAnuncio();
+	uint32_t intervalo = s.intervaloDeAnuncio();
+	uint64_t eventos = desde_us <= inicio ? 0 : ( desde_us - inicio + intervalo - 1 ) / intervalo;
+	inicio_us = inicio + eventos * intervalo;
+	ConjuntoAnuncioSimulado & conjunto = ConjuntoAnuncioSimulado::instancia();
+	duracion_us = conjunto.estaEnMarcha() ? conjunto.paquetesPorEvento().aire_us
+	  : PaquetesEventoAnuncio::clasico( (uint16_t) s.longitudDeAnuncio() ).aire_us;
+	hay = true;
+  }
+  uint64_t inicioConexion;
+  uint32_t duracionConexion;
+  if( Bluefruit.siguienteUsoRadioConexion( desde_us, inicioConexion, duracionConexion )
+	  && ( !hay || inicioConexion < inicio_us ) ) {
+	inicio_us = inicioConexion;
+	duracion_us = duracionConexion;
+	hay = true;
+  }
+  return hay;
+}
+
+namespace sim {
+
+  struct NotificacionRadio {
+	uint8_t tipo = NRF_RADIO_NOTIFICATION_TYPE_NONE;
+	bool habilitada = false;
+
+	static NotificacionRadio & instancia() {
+	  static NotificacionRadio laNotificacion;
+	  return laNotificacion;
+	}
+
+	void aplicar() {
+	  // sólo se simula INT_ON_BOTH, la que da el principio y el final de cada uso
+	  bool activa = habilitada && tipo == NRF_RADIO_NOTIFICATION_TYPE_INT_ON_BOTH;
+	  Simulador::instancia().notificarRadio( SWI1_EGU1_IRQHandler, activa ? siguienteUsoRadioSimulado : nullptr );
+	}
+  };
+
+} // namespace sim
+
+inline uint32_t sd_radio_notification_cfg_set( uint8_t type, uint8_t distance ) {
+  if( type > NRF_RADIO_NOTIFICATION_TYPE_INT_ON_BOTH || distance != NRF_RADIO_NOTIFICATION_DISTANCE_NONE ) {
+	return NRF_ERROR_INVALID_PARAM;
+  }
+  sim::NotificacionRadio::instancia().tipo = type;
+  sim::NotificacionRadio::instancia().aplicar();
+  return NRF_SUCCESS;
+}
+
+inline uint32_t sd_nvic_ClearPendingIRQ( IRQn_Type irq ) {
+  return irq == SWI1_EGU1_IRQn ? NRF_SUCCESS : NRF_ERROR_INVALID_PARAM;
+}
+
+inline uint32_t sd_nvic_SetPriority( IRQn_Type irq, uint32_t prioridad ) {
+  // la SoftDevice se queda las prioridades 0, 1, 4 y 5
+  if( irq != SWI1_EGU1_IRQn || prioridad > 7 || prioridad < 2 || prioridad == 4 || prioridad == 5 ) {
+	return NRF_ERROR_INVALID_PARAM;
+  }
+  return NRF_SUCCESS;
+}
+
+inline uint32_t sd_nvic_EnableIRQ( IRQn_Type irq ) {
+  if( irq != SWI1_EGU1_IRQn ) {
+	return NRF_ERROR_INVALID_PARAM;
+  }
+  sim::NotificacionRadio::instancia().habilitada = true;
+  sim::NotificacionRadio::instancia().aplicar();
+  return NRF_SUCCESS;
+}
+
+inline uint32_t sd_nvic_DisableIRQ( IRQn_Type irq ) {
+  if( irq != SWI1_EGU1_IRQn ) {
+	return NRF_ERROR_INVALID_PARAM;
+  }
+  sim::NotificacionRadio::instancia().habilitada = false;
+  sim::NotificacionRadio::instancia().aplicar();
+  return NRF_SUCCESS;
+}
+
+#endif
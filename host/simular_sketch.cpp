@@ -0,0 +1,203 @@
+
+/**
+ * @file simular_sketch.cpp
+ * @brief Ejecuta el sketch HolaMundoIBeacon sobre el Bluefruit simulado y mide un ciclo de publicación.
+ *
+ * Llama a setup() y después a loop() hasta cubrir el tiempo virtual pedido, y escribe un informe
+ * con el periodo de los ciclos de publicación, el tiempo que la radio pasa anunciando, los eventos
+ * de anuncio y las llamadas a loop(). Un ciclo de publicación (una ráfaga) empieza con
+ * el primer Advertising.start() tras un periodo con la radio parada. Como el reloj es virtual, el
+ * resultado es exactamente reproducible entre versiones del firmware.
+ *
+ * El informe acaba con las sondas de Sondas.h (tiempo real de CPU del ordenador por etapa), para
+ * ver si un cambio encarece el camino medir → codificar → anunciar.
+ *
+ * Uso: simular_sketch [--segundos S] [--traza fichero.csv] [--eco] [--orden texto]
+ *   --orden  al final de la simulación llega `texto` por el puerto serie y se simula un segundo
+ *            más (p. ej. `--eco --orden s` escribe el informe de las sondas del propio sketch)
+ */
+
+#include <Arduino.h>
+
+#include "../HolaMundoIBeacon/HolaMundoIBeacon.ino"
+
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+  /// Estadística mínima / media / máxima de una serie de tiempos en microsegundos.
+  struct Estadistica {
+	uint64_t minimo = UINT64_MAX;
+	uint64_t maximo = 0;
+	uint64_t suma = 0;
+	uint64_t n = 0;
+
+	void anyadir( uint64_t v ) {
+	  minimo = v < minimo ? v : minimo;
+	  maximo = v > maximo ? v : maximo;
+	  suma += v;
+	  n++;
+	}
+
+	void escribir( const char * nombre ) const {
+	  if( n == 0 ) {
+		printf( "%-34s -\n", nombre );
+		return;
+	  }
+	  printf( "%-34s media %10.3f ms   min %10.3f ms   max %10.3f ms\n", nombre,
+			  suma / 1000.0 / n, minimo / 1000.0, maximo / 1000.0 );
+	}
+  };
+
+} // namespace
+
+int main( int argc, char * argv[] ) {
+
+  double segundos = 75;
+  const char * ficheroTraza = nullptr;
+  const char * orden = nullptr;
+
+  for( int i = 1; i < argc; i++ ) {
+	std::string a = argv[i];
+	if( a == "--segundos" && i + 1 < argc ) {
+	  segundos = atof( argv[++i] );
+	} else if( a == "--traza" && i + 1 < argc ) {
+	  ficheroTraza = argv[++i];
+	} else if( a == "--eco" ) {
+	  sim::Simulador::instancia().serie.activarEco( true );
+	} else if( a == "--orden" && i + 1 < argc ) {
+	  orden = argv[++i];
+	} else {
+	  fprintf( stderr, "uso: %s [--segundos S] [--traza fichero.csv] [--eco] [--orden texto]\n", argv[0] );
+	  return 2;
+	}
+  }
+
+  sim::Simulador & s = sim::Simulador::instancia();
+
+  setup();
+
+  uint64_t inicio = s.ahoraMicros();
+  uint64_t fin = inicio + (uint64_t) ( segundos * 1e6 );
+  uint64_t loops = 0;
+
+  if( orden != nullptr ) {
+	fin += 1000000;
+  }
+  while( s.ahoraMicros() < fin ) {
+	if( orden != nullptr && s.ahoraMicros() >= fin - 1000000 ) {
+	  s.serie.recibir( orden );
+	  orden = nullptr;
+	}
+	uint64_t antes = s.ahoraMicros();
+	loop();
+	loops++;
+	if( s.ahoraMicros() == antes ) {
+	  // un loop() que no espera nada haría girar la simulación sin avanzar el reloj
+	  s.avanzarMicros( 1000 );
+	}
+  }
+  if( s.radioEstaAnunciando() ) {
+	Bluefruit.Advertising.stop();
+  }
+
+  // ráfagas de anuncios y huecos sin radio entre anuncios seguidos de una misma ráfaga
+  Estadistica periodoCiclo;
+  Estadistica anunciandoPorCiclo;
+  Estadistica huecoEntreAnuncios;
+  uint64_t starts = 0;
+  uint64_t stops = 0;
+  uint64_t configuraciones = 0;
+  uint64_t inicioRafaga = 0;
+  uint64_t anunciandoRafaga = 0;
+  uint64_t ultimoStart = 0;
+  uint64_t ultimoStop = 0;
+  bool hayRafaga = false;
+  bool enAire = false;
+
+  for( const sim::Evento & e : s.eventos() ) {
+	switch( e.tipo ) {
+	case sim::TipoEvento::ANUNCIO_START:
+	  starts++;
+	  if( enAire ) {
+		anunciandoRafaga += e.tiempo_us - ultimoStart;
+	  } else if( hayRafaga && e.tiempo_us - ultimoStop < 50000 ) {
+		huecoEntreAnuncios.anyadir( e.tiempo_us - ultimoStop );
+	  } else {
+		if( hayRafaga ) {
+		  periodoCiclo.anyadir( e.tiempo_us - inicioRafaga );
+		  anunciandoPorCiclo.anyadir( anunciandoRafaga );
+		}
+		hayRafaga = true;
+		inicioRafaga = e.tiempo_us;
+		anunciandoRafaga = 0;
+	  }
+	  ultimoStart = e.tiempo_us;
+	  enAire = true;
+	  break;
+	case sim::TipoEvento::ANUNCIO_STOP:
+	  stops++;
+	  anunciandoRafaga += e.tiempo_us - ultimoStart;
+	  ultimoStop = e.tiempo_us;
+	  enAire = false;
+	  break;
+	case sim::TipoEvento::ANUNCIO_BEACON:
+	case sim::TipoEvento::ANUNCIO_DATOS:
+	  configuraciones++;
+	  break;
+	default:
+	  break;
+	}
+  }
+  if( hayRafaga ) {
+	anunciandoPorCiclo.anyadir( anunciandoRafaga );
+  }
+
+  uint64_t total = s.ahoraMicros() - inicio;
+
+  printf( "---- simulación de HolaMundoIBeacon: %.3f s virtuales, %llu llamadas a loop() ----\n",
+		  total / 1e6, (unsigned long long) loops );
+  periodoCiclo.escribir( "periodo del ciclo de publicación" );
+  anunciandoPorCiclo.escribir( "radio anunciando por ciclo" );
+  huecoEntreAnuncios.escribir( "hueco stop -> start en un ciclo" );
+  printf( "%-34s %10.2f %%\n", "ciclo de trabajo de la radio", 100.0 * s.tiempoAnunciandoMicros() / s.ahoraMicros() );
+  printf( "%-34s %10.2f %%\n", "tiempo bloqueado en delay()", 100.0 * s.tiempoEsperandoMicros() / s.ahoraMicros() );
+  printf( "%-34s %10.3f ms\n", "bloqueado escribiendo en Serial", s.tiempoBloqueadoSerieMicros() / 1000.0 );
+  printf( "%-34s %10u (%u por eventos BLE)\n", "despertares de loop() (Reposo)", Reposo::despertares(),
+		  Reposo::anticipados() );
+  const char * const ESTADOS[Reposo::NUMERO_DE_ESTADOS] = { "CPU activa (Reposo)", "CPU en reposo (Reposo)",
+															 "radio encendida (Reposo)" };
+  uint64_t totalReposo = 0;
+  for( uint8_t e = 0; e < Reposo::NUMERO_DE_ESTADOS; e++ ) {
+	totalReposo += Reposo::residenciaMs( (Reposo::Estado) e );
+  }
+  for( uint8_t e = 0; e < Reposo::NUMERO_DE_ESTADOS; e++ ) {
+	printf( "%-34s %10.3f %%\n", ESTADOS[e], 100.0 * Reposo::residenciaMs( (Reposo::Estado) e ) / totalReposo );
+  }
+  printf( "%-34s %10llu\n", "eventos de anuncio emitidos", (unsigned long long) s.eventosDeAnuncio() );
+  printf( "%-34s %10llu\n", "Advertising.start()", (unsigned long long) starts );
+  printf( "%-34s %10llu\n", "Advertising.stop()", (unsigned long long) stops );
+  printf( "%-34s %10llu\n", "setBeacon() / addData()", (unsigned long long) configuraciones );
+  printf( "%-34s %10u\n", "lecturas suprimidas (banda muerta)", Globales::elPublicador.laPolitica.suprimidasEnTotal() );
+
+  const char * const ETAPAS[Sondas::NUMERO_DE_ETAPAS] = { "sonda medir", "sonda codificar", "sonda anunciar" };
+  for( uint8_t k = 0; k < Sondas::NUMERO_DE_ETAPAS; k++ ) {
+	const Sondas::Estadistica & e = Sondas::estadistica( (Sondas::Etapa) k );
+	printf( "%-34s media %10.3f us   min %10.3f us   max %10.3f us   (%u veces)\n", ETAPAS[k],
+			(double) e.media() / Sondas::CICLOS_POR_US, (double) ( e.veces > 0 ? e.minimo : 0 ) / Sondas::CICLOS_POR_US,
+			(double) e.maximo / Sondas::CICLOS_POR_US, e.veces );
+  }
+
+  if( ficheroTraza != nullptr ) {
+	FILE * f = fopen( ficheroTraza, "w" );
+	if( f == nullptr ) {
+	  perror( ficheroTraza );
+	  return 1;
+	}
+	s.volcarTraza( f );
+	fclose( f );
+  }
+
+  return 0;
+}